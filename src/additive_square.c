@@ -46,8 +46,9 @@ additive_square_generate_samples(additive_square_t* square,
                                  float              frequency,
                                  float*             out_buffer)
 {
-  float nyq = square->nyquist;
-  float t   = square->theta;
+  float  nyq  = square->nyquist;
+  float  t    = square->theta;
+  double step = additive_square_phase_step(square, frequency);
 
   /* Square wave is 1st,3rd,5th,... harmonics summed.
      max harmonic we can represent is determined by nyquist freq */
@@ -58,8 +59,7 @@ additive_square_generate_samples(additive_square_t* square,
       out_buffer[i] += sin(2*M_PI*harmonic*t) / (float)harmonic;
     }
 
-    t += frequency / (nyq*2.) /* sample rate */;
-    if (t >= 1.0) t -= 1.0;
+    t = additive_square_advance_phase(t, step);
 
     assert(out_buffer[i] <= 1.0);
     assert(out_buffer[i] >= -1.0);
@@ -68,3 +68,23 @@ additive_square_generate_samples(additive_square_t* square,
   square->theta = t;
   return APP_SUCCESS;
 }
+
+float
+additive_square_phase(additive_square_t const* square)
+{
+  return square->theta;
+}
+
+void
+additive_square_set_phase(additive_square_t* square,
+                          float              phase)
+{
+  square->theta = phase;
+}
+
+double
+additive_square_phase_step(additive_square_t const* square,
+                           float                    frequency)
+{
+  return frequency / (square->nyquist*2.) /* sample rate */;
+}
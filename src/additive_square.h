@@ -43,3 +43,35 @@ additive_square_generate_samples(additive_square_t* square,
                                  size_t             n_frames,
                                  float              frequency_hz,
                                  float*             out_buffer);
+
+/* Phase of the fundamental (in cycles, [0, 1)) at the next frame that will be
+   generated. The fundamental is sin(2*pi*phase). */
+
+float
+additive_square_phase(additive_square_t const* square);
+
+/* Carry on from `phase` instead, e.g. to make the same samples again from a
+   phase that was saved with additive_square_phase */
+
+void
+additive_square_set_phase(additive_square_t* square,
+                          float              phase);
+
+/* Cycles the phase advances per frame at the given frequency */
+
+double
+additive_square_phase_step(additive_square_t const* square,
+                           float                    frequency_hz);
+
+/* Advance a phase by one frame, exactly the way the generator does. Anything
+   that wants to follow the generator's phase (e.g. to demodulate against it)
+   should step with this so that it never drifts. */
+
+static inline float
+additive_square_advance_phase(float  theta,
+                              double step)
+{
+  theta += step;
+  if (theta >= 1.0) theta -= 1.0;
+  return theta;
+}
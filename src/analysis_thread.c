@@ -0,0 +1,484 @@
+#include "analysis_thread.h"
+
+#include "common.h"
+#include "disk.h"
+#include "err.h"
+#include "gcc_phat.h"
+#include "record_io.h"
+#include "strike_fit.h"
+#include "sync_avg.h"
+#include "thread_setup.h"
+#include "xspec.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/* how long to wait for room in the write ring before giving up on a result,
+   in WRITE_RETRY_US steps. A few ms at most, a result isn't worth stalling
+   the analysis of everything after it. */
+#define WRITE_RETRIES  20
+#define WRITE_RETRY_US 250
+
+struct analysis_thread {
+  /* shared between main thread and background thread */
+  pthread_t          t;
+  bool               thread_valid;
+  atomic_bool        flush;
+  int                efd;            /* eventfd the callback pokes the thread through */
+  atomic_bool        sleeping;       /* the thread is (about to be) blocked on efd */
+  atomic_uint_fast64_t dropped;      /* results we had nowhere to put */
+
+  /* stuff only accessed from the thread */
+  slot_ring_t*       read_ring;
+  slot_ring_t*       write_ring;
+  uint64_t           sample_rate_hz;
+  bool               have_strike;    /* false until the first strike shows up */
+  uint64_t           strike_frame;   /* frame of the strike currently being collected */
+  strike_fit_t*      fit;
+  sync_avg_t*        avg;
+  xspec_t*           xspec;
+  gcc_phat_t*        gcc;
+  float              latencies[LATENCY_MEDIAN_STRIKES]; /* ring of recent latencies */
+  size_t             n_latencies;
+  size_t             next_latency;
+
+  /* trailing memory holds the strike fit, the transfer function estimator, the
+     latency estimator and the synchronous average */
+};
+
+static size_t
+sync_avg_window_frames(uint64_t sample_rate_hz)
+{
+  return sample_rate_hz*SYNC_AVG_WINDOW_MS/1000;
+}
+
+static size_t
+fit_offset(void)
+{
+  return ALIGN(sizeof(analysis_thread_t), strike_fit_align());
+}
+
+static size_t
+xspec_offset(void)
+{
+  return ALIGN(fit_offset() + strike_fit_footprint(STRIKE_FIT_MAX_POINTS), xspec_align());
+}
+
+static size_t
+gcc_offset(void)
+{
+  return ALIGN(xspec_offset() + xspec_footprint(XSPEC_SEGMENT), gcc_phat_align());
+}
+
+static size_t
+avg_offset(void)
+{
+  return ALIGN(gcc_offset() + gcc_phat_footprint(LATENCY_WINDOW), sync_avg_align());
+}
+
+static void
+write_result(analysis_thread_t*  at,
+             record_hdr_t const* rec)
+{
+  /* Not a realtime thread, waiting briefly for the disk thread to catch up
+     is fine. This is the one place left that sleeps on a timer: the ring
+     only fills when the disk thread is already behind, and it has no way to
+     say when room frees up, so a short sleep is as good as a wake-up here.
+     If it is still full after that the result is dropped and counted. */
+  for (size_t i = 0; i < WRITE_RETRIES; ++i) {
+    if (APP_SUCCESS == record_write(at->write_ring, rec)) return;
+
+    /* it can't catch up on anything it can't see */
+    slot_ring_publish(at->write_ring);
+    usleep(WRITE_RETRY_US);
+  }
+
+  atomic_store_explicit(&at->dropped, atomic_load_explicit(&at->dropped, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+}
+
+/* Fit whatever has been collected since the last strike */
+
+static void
+finish_strike(analysis_thread_t* at)
+{
+  if (!at->have_strike) return;
+
+  strike_fit_result_t result[1];
+  if (APP_SUCCESS != strike_fit_solve(at->fit, result)) return; /* not enough points */
+
+  char mem[sizeof(strike_response_t)];
+  strike_response_t* r = create_strike_response(mem, at->strike_frame);
+  r->baseline          = result->baseline;
+  r->amplitude         = result->amplitude;
+  r->tau_rise_s        = result->tau_rise_s;
+  r->tau_fall_s        = result->tau_fall_s;
+  r->rms_residual      = result->rms_residual;
+  r->n_points          = result->n_points;
+  r->iterations        = result->iterations;
+  r->converged         = result->converged;
+
+  write_result(at, &r->hdr);
+}
+
+/* Write out the synchronous average, a slice at a time, and start a new one */
+
+static void
+finish_average(analysis_thread_t* at)
+{
+  size_t n_strikes = sync_avg_n_strikes(at->avg);
+  if (n_strikes == 0) return;
+
+  size_t window = sync_avg_window(at->avg);
+  for (size_t offset = 0; offset < window; offset += SYNC_AVERAGE_MAX_POINTS) {
+    size_t n = MIN(SYNC_AVERAGE_MAX_POINTS, window - offset);
+
+    char mem[sizeof(sync_average_t) + SYNC_AVERAGE_MAX_POINTS*sizeof(float)];
+    sync_average_t* a = create_sync_average(mem, sync_avg_first_strike(at->avg), n_strikes,
+                                            window, offset, n, NULL);
+    sync_avg_mean(at->avg, offset, n, sync_average_samples(a));
+    write_result(at, &a->hdr);
+  }
+
+  sync_avg_reset(at->avg);
+}
+
+/* Write out the transfer function estimate, a slice at a time, and start a new
+   one */
+
+static void
+finish_transfer(analysis_thread_t* at)
+{
+  size_t n_segments = xspec_n_segments(at->xspec);
+  if (n_segments == 0) return;
+
+  size_t n_bins = xspec_n_bins(at->xspec);
+  for (size_t first = 0; first < n_bins; first += TRANSFER_MAX_BINS) {
+    size_t n = MIN(TRANSFER_MAX_BINS, n_bins - first);
+
+    char mem[sizeof(transfer_t) + 3*TRANSFER_MAX_BINS*sizeof(float)];
+    transfer_t* t = create_transfer(mem, xspec_first_frame(at->xspec), n_segments,
+                                    xspec_segment(at->xspec), first, n, NULL);
+    xspec_estimate(at->xspec, first, n, transfer_real(t), transfer_imag(t), transfer_coherence(t));
+    write_result(at, &t->hdr);
+  }
+
+  xspec_reset(at->xspec);
+}
+
+/* Median of the last few latencies, small enough that sorting a copy is fine */
+
+static float
+median_latency(analysis_thread_t const* at)
+{
+  float  sorted[LATENCY_MEDIAN_STRIKES];
+  size_t n = at->n_latencies;
+  for (size_t i = 0; i < n; ++i) {
+    float  v = at->latencies[i];
+    size_t j = i;
+    for (; j > 0 && sorted[j-1] > v; --j) sorted[j] = sorted[j-1];
+    sorted[j] = v;
+  }
+
+  return n % 2 ? sorted[n/2] : 0.5f*(sorted[n/2-1] + sorted[n/2]);
+}
+
+static void
+finish_latency(analysis_thread_t* at,
+               uint64_t           strike_frame)
+{
+  gcc_phat_result_t result[1];
+  if (APP_SUCCESS != gcc_phat_estimate(at->gcc, result)) return;
+
+  at->latencies[at->next_latency] = result->delay;
+  at->next_latency = (at->next_latency + 1) % LATENCY_MEDIAN_STRIKES;
+  at->n_latencies  = MIN(at->n_latencies + 1, LATENCY_MEDIAN_STRIKES);
+
+  char mem[sizeof(latency_t)];
+  latency_t* l     = create_latency(mem, strike_frame);
+  l->delay_frames  = result->delay;
+  l->peak          = result->peak;
+  l->median_frames = median_latency(at);
+  l->n_median      = (uint32_t)at->n_latencies;
+
+  write_result(at, &l->hdr);
+}
+
+static void
+handle_strike(analysis_thread_t* at,
+              strike_t const*    s)
+{
+  finish_strike(at);
+  if (sync_avg_n_strikes(at->avg) == SYNC_AVG_STRIKES) finish_average(at);
+
+  strike_fit_reset(at->fit);
+  sync_avg_strike(at->avg, s->hdr.frame);
+  gcc_phat_strike(at->gcc, s->hdr.frame);
+  at->have_strike  = true;
+  at->strike_frame = s->hdr.frame;
+}
+
+static void
+handle_sample_set(analysis_thread_t* at,
+                  sample_set_t*      sset)
+{
+  sync_avg_add(at->avg, sset->hdr.frame, sample_set_lxd_in_samples(sset), sset->n_samples);
+
+#if XSPEC_INPUT_SQUARE
+  float const* input = sample_set_square_samples(sset);
+#else
+  float const* input = sample_set_pulse_samples(sset);
+#endif
+
+  xspec_add(at->xspec, sset->hdr.frame, input, sample_set_lxd_in_samples(sset), sset->n_samples);
+  if (xspec_n_segments(at->xspec) >= XSPEC_SEGMENTS) finish_transfer(at);
+
+  if (gcc_phat_add(at->gcc, sset->hdr.frame, sample_set_pulse_samples(sset),
+                   sample_set_lxd_in_samples(sset), sset->n_samples)) {
+    finish_latency(at, at->strike_frame);
+  }
+}
+
+static void
+handle_demodulated(analysis_thread_t* at,
+                   demodulated_t*     d)
+{
+  if (!at->have_strike) return;
+
+  float const* amplitude = demodulated_amplitude(d);
+  for (size_t i = 0; i < d->n_points; ++i) {
+    uint64_t frame = d->hdr.frame + i*d->decimation;
+    if (frame < at->strike_frame) continue;
+
+    float t = (float)((double)(frame - at->strike_frame)/(double)at->sample_rate_hz);
+    strike_fit_add(at->fit, t, amplitude[i]);
+  }
+}
+
+/* Block until poked, or ANALYSIS_WAKE_TIMEOUT_MS for anything published
+   without a poke. Same handshake on `sleeping` as the disk thread's. */
+
+static void
+wait_for_work(analysis_thread_t* at)
+{
+  atomic_store(&at->sleeping, true);
+  if (slot_ring_readable(at->read_ring) >= ANALYSIS_WAKE_SLOTS || atomic_load(&at->flush)) {
+    atomic_store(&at->sleeping, false);
+    return;
+  }
+
+  struct pollfd pfd[1] = { { .fd = at->efd, .events = POLLIN, .revents = 0 } };
+  poll(pfd, 1, ANALYSIS_WAKE_TIMEOUT_MS);
+
+  uint64_t count;
+  ssize_t  ret = read(at->efd, &count, sizeof(count)); /* non-blocking, just clears it */
+  (void)ret;
+
+  atomic_store(&at->sleeping, false);
+}
+
+static void*
+thread(void* arg)
+{
+  analysis_thread_t* at = (analysis_thread_t*)arg;
+  assert(at->thread_valid); /* this would be weird */
+  int ret = pthread_setname_np(pthread_self(), "profile_lxd:ana");
+  if (0 != ret) {
+    fprintf(stderr, "couldn't set thread name, why=\n");
+  }
+
+  /* failures are reported, but the thread works wherever it ends up */
+  thread_setup_denormals();
+  thread_setup_pin(ANALYSIS_CPU);
+  thread_setup_nice(ANALYSIS_NICE);
+  thread_setup_report("analysis thread");
+
+  while (true) {
+    bool   flushing = atomic_load(&at->flush);
+    size_t n        = slot_ring_readable(at->read_ring);
+    if (flushing && n == 0) break;
+
+    /* records are used where they sit in the ring */
+    for (size_t i = 0; i < n; ++i) {
+      record_hdr_t* hdr = record_at(at->read_ring, i);
+      switch (hdr->type) {
+        case RECORD_STRIKE:     handle_strike(at, (strike_t const*)hdr);     break;
+        case RECORD_LOCKIN:     handle_demodulated(at, (demodulated_t*)hdr); break;
+        case RECORD_SAMPLE_SET: handle_sample_set(at, (sample_set_t*)hdr);   break;
+        default:                                                             break;
+      }
+    }
+
+    slot_ring_release(at->read_ring, n);
+    slot_ring_publish(at->write_ring);
+    if (n == 0) wait_for_work(at);
+  }
+
+  /* last strike is probably cut short, but fit what we have */
+  finish_strike(at);
+  finish_average(at);
+  finish_transfer(at);
+  slot_ring_publish(at->write_ring);
+  return NULL;
+}
+
+size_t
+analysis_thread_footprint(uint64_t sample_rate_hz)
+{
+  return avg_offset() + sync_avg_footprint(sync_avg_window_frames(sample_rate_hz));
+}
+
+size_t
+analysis_thread_align(void)
+{
+  return MAX(MAX(_Alignof(analysis_thread_t), strike_fit_align()),
+             MAX(MAX(xspec_align(), gcc_phat_align()), sync_avg_align()));
+}
+
+analysis_thread_t*
+create_analysis_thread(void*              mem,
+                       uint64_t           sample_rate_hz,
+                       slot_ring_t*       read_ring,
+                       slot_ring_t*       write_ring,
+                       int*               opt_err)
+{
+  if (!mem || !read_ring || !write_ring) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  strike_fit_t* fit = create_strike_fit((char*)mem + fit_offset(),
+                                        STRIKE_FIT_MAX_POINTS, STRIKE_FIT_MAX_ITERATIONS,
+                                        STRIKE_FIT_MIN_TAU_S, STRIKE_FIT_MAX_TAU_S,
+                                        opt_err);
+  if (!fit) return NULL; /* opt_err already set */
+
+  sync_avg_t* avg = create_sync_avg((char*)mem + avg_offset(),
+                                    sync_avg_window_frames(sample_rate_hz), opt_err);
+  if (!avg) return NULL; /* opt_err already set */
+
+  xspec_t* xspec = create_xspec((char*)mem + xspec_offset(), XSPEC_SEGMENT, opt_err);
+  if (!xspec) return NULL; /* opt_err already set */
+
+  gcc_phat_t* gcc = create_gcc_phat((char*)mem + gcc_offset(), LATENCY_WINDOW, LATENCY_MAX_LAG,
+                                    opt_err);
+  if (!gcc) {
+    destroy_xspec(xspec);
+    return NULL; /* opt_err already set */
+  }
+
+  int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (-1 == efd) {
+    if (opt_err) *opt_err = APP_ERR_OPEN;
+    fprintf(stderr, "Failed to create eventfd with '%s'", strerror(errno));
+    destroy_gcc_phat(gcc);
+    destroy_xspec(xspec);
+    return NULL;
+  }
+
+  analysis_thread_t* at = (analysis_thread_t*)mem;
+  at->t                 = 0; /* no portable way to init */
+  at->thread_valid      = false;
+  /* flush follows */
+  at->read_ring         = read_ring;
+  at->write_ring        = write_ring;
+  at->sample_rate_hz    = sample_rate_hz;
+  at->have_strike       = false;
+  at->strike_frame      = 0;
+  at->fit               = fit;
+  at->avg               = avg;
+  at->xspec             = xspec;
+  at->gcc               = gcc;
+  at->n_latencies       = 0;
+  at->next_latency      = 0;
+  memset(at->latencies, 0, sizeof(at->latencies));
+  at->efd               = efd;
+  atomic_store(&at->flush, false);
+  atomic_store(&at->sleeping, false);
+  atomic_store(&at->dropped, 0);
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return at;
+}
+
+void*
+destroy_analysis_thread(analysis_thread_t* at)
+{
+  if (!at) return NULL;
+  assert(!at->thread_valid);
+
+  destroy_gcc_phat(at->gcc);
+  destroy_xspec(at->xspec);
+  destroy_sync_avg(at->avg);
+  destroy_strike_fit(at->fit);
+  close(at->efd);
+  return (void*)at;
+}
+
+int
+analysis_thread_start(analysis_thread_t* at)
+{
+  if (!at) return APP_ERR_INVAL;
+
+  at->thread_valid = true;
+  int ret = pthread_create(&at->t, NULL, thread, at);
+  if (0 != ret) {
+    at->thread_valid = false;
+    if (ret == EINVAL) return APP_ERR_INVAL;
+    else               return APP_ERR_ALLOC;
+  }
+
+  return APP_SUCCESS;
+}
+
+int
+analysis_thread_flush_and_stop(analysis_thread_t* at)
+{
+  if (!at)               return APP_ERR_INVAL;
+  if (!at->thread_valid) return APP_ERR_INVAL;
+
+  atomic_store(&at->flush, true);
+
+  /* don't wait out the timeout */
+  uint64_t one = 1;
+  ssize_t  n   = write(at->efd, &one, sizeof(one));
+  (void)n;
+
+  int ret = pthread_join(at->t, NULL);
+  at->thread_valid = false;
+  if (0 != ret) return APP_ERR_THREAD_JOIN;
+
+  return APP_SUCCESS;
+}
+
+void
+analysis_thread_poke(analysis_thread_t* at,
+                     size_t             pending)
+{
+  if (pending < ANALYSIS_WAKE_SLOTS) return;
+
+  /* order our publish before looking at `sleeping`, pairs with the store in
+     wait_for_work */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!atomic_load_explicit(&at->sleeping, memory_order_relaxed)) return;
+  if (!atomic_exchange(&at->sleeping, false))                     return; /* someone beat us to it */
+
+  uint64_t one = 1;
+  ssize_t  ret = write(at->efd, &one, sizeof(one));
+  (void)ret;
+}
+
+uint64_t
+analysis_thread_dropped(analysis_thread_t* at)
+{
+  return atomic_load_explicit(&at->dropped, memory_order_relaxed);
+}
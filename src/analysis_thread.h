@@ -0,0 +1,62 @@
+#pragma once
+
+#include "slot_ring.h"
+
+#include <stdint.h>
+
+/* Background thread for anything too slow (or too bursty) to do in the jack
+   callback. Reads records from `read_ring`, writes whatever it derives from
+   them to `write_ring`.
+
+   Currently:
+   - segments the lock-in output by strike and fits each strike's response (see
+     strike_fit.h), emitting one strike_response record per strike
+   - averages lxd_in synchronously with the strikes (see sync_avg.h), emitting
+     the average every SYNC_AVG_STRIKES strikes
+   - estimates the transfer function from the drive to lxd_in (see xspec.h),
+     emitting H1 and coherence every XSPEC_SEGMENTS segments
+   - estimates the latency from pulse_out to lxd_in around each strike (see
+     gcc_phat.h), emitting it with a rolling median
+
+   Between batches the thread sleeps on an eventfd, the way the disk thread
+   does: the callback calls analysis_thread_poke after publishing, and
+   anything short of ANALYSIS_WAKE_SLOTS is picked up after
+   ANALYSIS_WAKE_TIMEOUT_MS. */
+
+typedef struct analysis_thread analysis_thread_t;
+
+size_t
+analysis_thread_footprint(uint64_t sample_rate_hz);
+
+size_t
+analysis_thread_align(void);
+
+analysis_thread_t*
+create_analysis_thread(void*              mem,
+                       uint64_t           sample_rate_hz,
+                       slot_ring_t*       read_ring,
+                       slot_ring_t*       write_ring,
+                       int*               opt_err);
+
+void*
+destroy_analysis_thread(analysis_thread_t* at);
+
+int
+analysis_thread_start(analysis_thread_t* at);
+
+/* Process everything left in the read ring, then stop */
+
+int
+analysis_thread_flush_and_stop(analysis_thread_t* at);
+
+/* Wake the thread if it sleeps and `pending` slots (the read ring's fill) have
+   reached ANALYSIS_WAKE_SLOTS. Realtime safe, see disk_thread_poke. */
+
+void
+analysis_thread_poke(analysis_thread_t* at,
+                     size_t             pending);
+
+/* Results lost to a write ring that stayed full, since the start */
+
+uint64_t
+analysis_thread_dropped(analysis_thread_t* at);
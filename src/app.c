@@ -1,35 +1,100 @@
 #include "additive_square.h"
+#include "analysis_thread.h"
 #include "app.h"
 #include "common.h"
+#include "cycle_hist.h"
 #include "disk.h"
 #include "disk_thread.h"
 #include "err.h"
+#include "harmonic_tracker.h"
 #include "inc_fftw.h"
 #include "envelope.h"
+#include "lockin.h"
+#include "record_io.h"
+#include "slot_ring.h"
+#include "spectrum.h"
+#include "strike_sched.h"
 
 #include <assert.h>
-#include <jack/ringbuffer.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define NS_PER_S 1000000000ull
+
+/* Stages of app_poll that get timed */
+enum {
+  STAGE_SQUARE,
+  STAGE_ENVELOPE,    /* including the strike record */
+  STAGE_FFT,
+  STAGE_HARMONICS,   /* tracking and writing snapshots */
+  STAGE_LOCKIN,      /* demodulating and writing records */
+  STAGE_SAMPLE_SETS, /* building sample sets in their slots */
+  STAGE_PUBLISH,
+  STAGE_TOTAL,
+  STAGE_COUNT,
+};
+
+static char const* stage_names[STAGE_COUNT] = {
+  "square", "envelope", "fft", "harmonics", "lockin", "sample sets", "publish", "total",
+};
+
+/* Load shedding levels, see gap_t */
+enum {
+  SHED_NONE,
+  SHED_SQUARE,   /* no square_out */
+  SHED_DECIMATE, /* and the other two decimated by SHED_DECIMATION */
+  SHED_FEATURES, /* no samples at all, fft bins and feature records only */
+};
+
+/* Generators at the first frame of a sample set, see sample_set_t */
+typedef struct {
+  float    square_phase;
+  uint32_t envelope_position;
+} gen_state_t;
 
 struct app {
-  bool               running;                 /* store if we're running up or not */
-  uint64_t           strike_period_ns;        /* how often to strike the pulse gen */
-  uint64_t           last_strike_ns;          /* time of the last strike in nanos */
-  uint64_t           sample_rate_hz;
-  fftwf_plan         plan;                    /* precomputed fft plan (typefed ptr) */
-  size_t             fft_in_location;         /* current idx of fft_in */
-  size_t             fft_in_space;            /* total fft_in space */
-  size_t             fft_out_space;           /* number of elements in fft_out buffer */
-  jack_ringbuffer_t* rb;                      /* can't be inlined */
+  bool                running;                 /* store if we're running up or not */
+  uint64_t            sample_rate_hz;
+  uint64_t            frame;                   /* frames processed since start */
+  size_t              max_nframes;             /* largest buffer we can be polled with */
+  size_t              chunk_frames;            /* frames per sample set at the current buffer size */
+  size_t              arena_size;              /* bytes mapped for the app, this struct included */
+  bool                arena_hugetlb;           /* arena came from mmap, not posix_memalign */
+  bool                arena_locked;
+  long                minflt_at_start;         /* page faults before app_start */
+  long                majflt_at_start;
+  atomic_uint_fast64_t xruns;                  /* reported by app_note_xrun, from any thread */
+  atomic_uint_fast64_t xrun_ns;                /* when the latest one was reported */
+  uint64_t            xruns_marked;            /* xruns covered by markers written so far */
+  atomic_uint         shed_level;              /* SHED_* for this callback */
+  unsigned            shed_marked;             /* level in the latest gap marker */
+  atomic_uint_fast64_t dropped;                /* records lost to a full disk ring */
+  atomic_uint_fast64_t analysis_dropped;       /* and to a full analysis ring */
+  uint64_t            dropped_marked;          /* drops covered by gap markers so far */
+  uint64_t            wakeups_reported;        /* disk thread wakeups as of the last report */
+  uint64_t            reported_ns;             /* and when that was */
 
   /* Store a bunch of pointers into the trailing data, done for convenience */
-  additive_square_t* sq;
-  envelope_t*        cv_gen;
-  disk_thread_t*     dthread;
-  float*             fft_in;
-  fftwf_complex*     fft_out;
+  slot_ring_t*        rb;                      /* to the disk thread */
+  slot_ring_t*        analysis_rb;             /* to the analysis thread */
+  slot_ring_t*        results_rb;              /* analysis thread to the disk thread */
+  additive_square_t*  sq;
+  envelope_t*         cv_gen;
+  strike_sched_t*     strikes;
+  disk_thread_t*      dthread;
+  analysis_thread_t*  athread;
+  harmonic_tracker_t* tracker;
+  lockin_t*           lockin;
+  spectrum_t*         spectrum;                /* fft bins per sample set of the current callback */
+  cycle_hist_t*       timings;                 /* per stage of app_poll */
+  gen_state_t*        gen_state;               /* per sample set of the current callback */
 
   /* Trailing memory contains the additional components...... */
 };
@@ -45,62 +110,161 @@ app_errstr(int err)
 #undef ELT
 }
 
+/* Everything the process callback touches lives in one arena. It is zeroed
+   before anything is placed in it, so every page is faulted in now instead
+   of in the first callbacks, and locked so it stays that way. Failing to lock
+   (usually RLIMIT_MEMLOCK) isn't fatal. */
+
+static void*
+arena_alloc(size_t size,
+            bool*  hugetlb,
+            bool*  locked)
+{
+  void* mem = NULL;
+  *hugetlb  = false;
+  *locked   = false;
+
+#if ARENA_HUGEPAGES == 2
+  mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (mem != MAP_FAILED) {
+    *hugetlb = true;
+  }
+  else {
+    printf("%-30s %s\n", "no hugetlb pages for app", strerror(errno));
+    mem = NULL;
+  }
+#endif
+
+  if (!mem) {
+    /* the disk thread's buffers are page aligned */
+    size_t align = ARENA_HUGEPAGES ? HUGEPAGE_SIZE : MAX(CACHELINE, disk_thread_align());
+    if (0 != posix_memalign(&mem, align, size)) return NULL;
+  }
+
+#if ARENA_HUGEPAGES
+  /* hugetlb falls back to transparent hugepages */
+  if (!*hugetlb && 0 != madvise(mem, size, MADV_HUGEPAGE)) {
+    printf("%-30s %s\n", "no transparent hugepages", strerror(errno));
+  }
+#endif
+
+  memset(mem, 0, size);
+
+  if (0 == mlock(mem, size)) *locked = true;
+  else printf("%-30s %s\n", "failed to lock app memory", strerror(errno));
+
+  return mem;
+}
+
+static void
+arena_free(void*  mem,
+           size_t size,
+           bool   hugetlb,
+           bool   locked)
+{
+  if (locked) munlock(mem, size);
+  if (hugetlb) munmap(mem, size);
+  else         free(mem);
+}
+
 app_t*
-create_app(uint64_t sample_rate_hz,
-           uint64_t strike_period_ns,
-           int*     opt_err)
+create_app(uint64_t    sample_rate_hz,
+           uint64_t    strike_period_ns,
+           size_t      max_nframes,
+           char const* output_dir,
+           char const* output_prefix,
+           int*        opt_err)
 {
   /* FIXME fft size should be computed from the sample_rate and frequency of the
      square wave, but this seems to be doing a pretty good job.
 
      Since freq will be changing, probably need to window the fft input */
 
-  size_t fft_in_size  = 1024;
-  size_t fft_out_size = (fft_in_size/2)+1;
+  size_t fft_in_size  = 1024; /* no less than SAMPLE_SET_MAX_FRAMES, see spectrum.h */
+
+  /* sliding dft bins are HARMONIC_BIN_HZ apart */
+  size_t harmonic_window = sample_rate_hz/HARMONIC_BIN_HZ;
+  size_t harmonic_block  = MAX(1, sample_rate_hz/HARMONIC_RECORD_HZ);
+
+  size_t lockin_decimation = MAX(1, sample_rate_hz/LOCKIN_OUTPUT_HZ);
+
+  if (max_nframes == 0) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  /* The disk and analysis rings carry sample sets of up to
+     SAMPLE_SET_MAX_FRAMES, with the fft's bins on each set a transform
+     completes in. Results only ever need RING_SLOT_SIZE. */
+  size_t sample_set_frames = MIN(max_nframes, SAMPLE_SET_MAX_FRAMES);
+  size_t sample_set_slot   = MAX(RING_SLOT_SIZE, sample_set_footprint(sample_set_frames,
+                                                                      fft_in_size/2 + 1));
+  size_t slot_sizes[]      = { sample_set_slot, sample_set_slot, RING_SLOT_SIZE };
+
+  /* offsets are from the start of the arena, so padding here matches padding
+     when the components are placed */
+  size_t footprint = sizeof(app_t);
+  for (size_t i = 0; i < ARRAY_SIZE(slot_sizes); ++i) {
+    footprint = ALIGN(footprint, slot_ring_align());
+    footprint += slot_ring_footprint(RING_SLOTS, slot_sizes[i]);
+  }
 
-  size_t footprint = 0;
   footprint = ALIGN(footprint, additive_square_align());
   footprint += additive_square_footprint();
 
   footprint = ALIGN(footprint, envelope_footprint());
   footprint += envelope_footprint();
 
+  footprint = ALIGN(footprint, strike_sched_align());
+  footprint += strike_sched_footprint();
+
   footprint = ALIGN(footprint, disk_thread_align());
   footprint += disk_thread_footprint();
 
-  /* aligning fft buffers to cache size will be more than sufficient for SIMD alignment. */
+  footprint = ALIGN(footprint, analysis_thread_align());
+  footprint += analysis_thread_footprint(sample_rate_hz);
 
-  footprint += ALIGN(footprint, CACHELINE);
-  footprint += sizeof(float) * fft_in_size;
+  footprint = ALIGN(footprint, harmonic_tracker_align());
+  footprint += harmonic_tracker_footprint(HARMONIC_COUNT, harmonic_window);
 
-  footprint += ALIGN(footprint, CACHELINE);
-  footprint += sizeof(fftwf_complex) * fft_out_size;
+  footprint = ALIGN(footprint, lockin_align());
+  footprint += lockin_footprint();
 
-  size_t             tsize   = footprint + sizeof(app_t);
-  int                err     = 0;
+  size_t max_sets = (max_nframes + SAMPLE_SET_MAX_FRAMES - 1)/SAMPLE_SET_MAX_FRAMES;
+  footprint = ALIGN(footprint, spectrum_align());
+  footprint += spectrum_footprint(fft_in_size, max_sets);
 
-  /* allocations */
-  void*              mem     = NULL;
-  fftwf_plan         plan    = NULL; /* actually a secret pointer */
-  jack_ringbuffer_t* rb      = NULL;
+  footprint = ALIGN(footprint, cycle_hist_align());
+  footprint += cycle_hist_footprint();
 
-  /* trailing memory */
-  additive_square_t* sq      = NULL;
-  envelope_t*        cv_gen  = NULL;
-  disk_thread_t*     dthread = NULL;
-  float*             fft_in  = NULL;
-  fftwf_complex*     fft_out = NULL;
-
-  err = posix_memalign(&mem, CACHELINE, tsize);
-  if (err != 0) {
-    if (opt_err) *opt_err = APP_ERR_ALLOC;
-    goto exit;
-  }
+  footprint = ALIGN(footprint, _Alignof(gen_state_t));
+  footprint += max_sets*sizeof(gen_state_t);
+
+  size_t              tsize   = footprint;
+  if (ARENA_HUGEPAGES) tsize  = ALIGN(tsize, HUGEPAGE_SIZE);
+  bool                hugetlb = false;
+  bool                locked  = false;
 
-  /* Grab this first since it does another allocation */
+  /* allocations */
+  void*               mem     = NULL;
 
-  rb = jack_ringbuffer_create(RINGBUFFER_SIZE);
-  if (!rb) {
+  /* trailing memory */
+  slot_ring_t*        rb      = NULL;
+  slot_ring_t*        arb     = NULL;
+  slot_ring_t*        rrb     = NULL;
+  additive_square_t*  sq      = NULL;
+  envelope_t*         cv_gen  = NULL;
+  strike_sched_t*     strikes = NULL;
+  disk_thread_t*      dthread = NULL;
+  analysis_thread_t*  athread = NULL;
+  harmonic_tracker_t* tracker = NULL;
+  lockin_t*           lockin  = NULL;
+  spectrum_t*         spec    = NULL;
+  cycle_hist_t*       timings = NULL;
+  gen_state_t*        gens    = NULL;
+
+  mem = arena_alloc(tsize, &hugetlb, &locked);
+  if (!mem) {
     if (opt_err) *opt_err = APP_ERR_ALLOC;
     goto exit;
   }
@@ -108,6 +272,14 @@ create_app(uint64_t sample_rate_hz,
   /* initialize the trailing region */
   char* ptr = (char*)mem + sizeof(app_t);
 
+  slot_ring_t** rings[] = { &rb, &arb, &rrb };
+  for (size_t i = 0; i < ARRAY_SIZE(rings); ++i) {
+    ptr = (char*)ALIGN((size_t)ptr, slot_ring_align());
+    *rings[i] = create_slot_ring(ptr, RING_SLOTS, slot_sizes[i], opt_err);
+    if (!*rings[i]) goto exit; /* opt_err already set */
+    ptr += slot_ring_footprint(RING_SLOTS, slot_sizes[i]);
+  }
+
   ptr = (char*)ALIGN((size_t)ptr, additive_square_align());
   sq = create_additive_square(ptr, sample_rate_hz, opt_err);
   if (!sq) goto exit; /* opt_err already set */
@@ -122,61 +294,135 @@ create_app(uint64_t sample_rate_hz,
   if (!cv_gen) goto exit; /* opt_err already set */
   ptr += envelope_footprint();
 
+  ptr = (char*)ALIGN((size_t)ptr, strike_sched_align());
+  strikes = create_strike_sched(ptr, sample_rate_hz, strike_period_ns, opt_err);
+  if (!strikes) goto exit; /* opt_err already set */
+  ptr += strike_sched_footprint();
+
+  /* written into every output file, so it can be read without this code */
+  capture_meta_t meta[1];
+  memset(meta, 0, sizeof(meta));
+  meta->sample_rate_hz     = sample_rate_hz;
+  meta->strike_period_ns   = strike_period_ns;
+  meta->fft_size           = (uint32_t)fft_in_size;
+  meta->envelope_type      = (uint32_t)setting->type;
+  meta->envelope_param     = setting->u.constant->value; /* every type has the one float */
+  meta->drive_frequency_hz = DRIVE_FREQUENCY_HZ;
+  meta->harmonic_count     = HARMONIC_COUNT;
+  meta->n_channels         = 3;
+  strcpy(meta->channels[0], "square_out");
+  strcpy(meta->channels[1], "pulse_out");
+  strcpy(meta->channels[2], "lxd_in");
+
   ptr = (char*)ALIGN((size_t)ptr, disk_thread_align());
-  dthread = create_disk_thread(ptr, rb, opt_err);
-  if (!sq) goto exit; /* opt_err already set */
+  slot_ring_t* disk_rings[] = { rb, rrb };
+  dthread = create_disk_thread(ptr, disk_rings, ARRAY_SIZE(disk_rings), output_dir, output_prefix,
+                               meta, DISK_SEGMENT_BYTES, opt_err);
+  if (!dthread) goto exit; /* opt_err already set */
   ptr += disk_thread_footprint();
 
-  ptr = (char*)ALIGN((size_t)ptr, CACHELINE);
-  fft_in = (float*)ptr;
-  ptr += sizeof(float) * fft_in_size;
+  ptr = (char*)ALIGN((size_t)ptr, analysis_thread_align());
+  athread = create_analysis_thread(ptr, sample_rate_hz, arb, rrb, opt_err);
+  if (!athread) goto exit; /* opt_err already set */
+  ptr += analysis_thread_footprint(sample_rate_hz);
 
-  ptr = (char*)ALIGN((size_t)ptr, CACHELINE);
-  fft_out = (fftwf_complex*)ptr;
-  ptr += sizeof(fftwf_complex) * fft_out_size;
+  ptr = (char*)ALIGN((size_t)ptr, harmonic_tracker_align());
+  tracker = create_harmonic_tracker(ptr, sample_rate_hz, DRIVE_FREQUENCY_HZ, HARMONIC_COUNT,
+                                    harmonic_window, harmonic_block, opt_err);
+  if (!tracker) goto exit; /* opt_err already set */
+  ptr += harmonic_tracker_footprint(HARMONIC_COUNT, harmonic_window);
 
-  /* Build an fft_plan, this does some calculations to determine the fastest way. */
+  ptr = (char*)ALIGN((size_t)ptr, lockin_align());
+  lockin = create_lockin(ptr, sample_rate_hz, LOCKIN_CUTOFF_HZ, lockin_decimation, opt_err);
+  if (!lockin) goto exit; /* opt_err already set */
+  ptr += lockin_footprint();
 
-  plan = fftwf_plan_dft_r2c_1d(fft_in_size, fft_in, fft_out, FFTW_MEASURE);
-  if (!plan) {
-    if (opt_err) *opt_err = APP_ERR_ALLOC; /* FIXME? */
-    goto exit;
-  }
+  ptr = (char*)ALIGN((size_t)ptr, spectrum_align());
+  spec = create_spectrum(ptr, fft_in_size, max_sets, opt_err);
+  if (!spec) goto exit; /* opt_err already set */
+  ptr += spectrum_footprint(fft_in_size, max_sets);
+
+  ptr = (char*)ALIGN((size_t)ptr, cycle_hist_align());
+  timings = create_cycle_hist(ptr, STAGE_COUNT, opt_err);
+  if (!timings) goto exit; /* opt_err already set */
+  ptr += cycle_hist_footprint();
+
+  ptr = (char*)ALIGN((size_t)ptr, _Alignof(gen_state_t));
+  gens = (gen_state_t*)ptr;
+  ptr += max_sets*sizeof(gen_state_t);
 
   printf("%-30s %zu\n", "Created app with size", footprint);
+  printf("%-30s %s\n",  "App memory locked",     locked ? "true" : "false");
+  printf("%-30s %s\n",  "App memory pages",
+         hugetlb ? "hugetlb" : ARENA_HUGEPAGES ? "transparent huge" : "normal");
   printf("%-30s %p\n",  "Created app at",        (void*)mem);
   printf("%-30s %p\n",  "Created square gen at", (void*)sq);
   printf("%-30s %p\n",  "Created cv_gen at",     (void*)cv_gen);
+  printf("%-30s %p\n",  "Created strikes at",    (void*)strikes);
   printf("%-30s %p\n",  "Created dthread at",    (void*)dthread);
-  printf("%-30s %p\n",  "Created fft_in at",     (void*)fft_in);
-  printf("%-30s %p\n",  "Created fft_out at",    (void*)fft_out);
+  printf("%-30s %p\n",  "Created athread at",    (void*)athread);
+  printf("%-30s %p\n",  "Created tracker at",    (void*)tracker);
+  printf("%-30s %p\n",  "Created lockin at",     (void*)lockin);
+  printf("%-30s %p\n",  "Created spectrum at",   (void*)spec);
+  printf("%-30s %p\n",  "Created timings at",    (void*)timings);
+  printf("%-30s %.3f\n", "Timestamp cycles per ns", cycle_hist_cycles_per_ns(timings));
   printf("%-30s %p\n",  "Created rb at",         (void*)rb);
+  printf("%-30s %p\n",  "Created analysis rb at", (void*)arb);
+  printf("%-30s %p\n",  "Created results rb at",  (void*)rrb);
 
   /* build the returned value */
   app_t* ret = mem;
   ret->running          = false;
-  ret->strike_period_ns = strike_period_ns;
-  ret->last_strike_ns   = 0;
   ret->sample_rate_hz   = sample_rate_hz;
-  ret->plan             = plan;
-  ret->fft_in_location  = 0;
-  ret->fft_in_space     = fft_in_size;
-  ret->fft_out_space    = fft_out_size;
+  ret->frame            = 0;
+  ret->max_nframes      = max_nframes;
+  ret->chunk_frames     = 0;
+  ret->arena_size       = tsize;
+  ret->arena_hugetlb    = hugetlb;
+  ret->arena_locked     = locked;
+  ret->minflt_at_start  = 0;
+  ret->majflt_at_start  = 0;
+  ret->xruns_marked     = 0;
+  ret->shed_marked      = SHED_NONE;
+  ret->dropped_marked   = 0;
+  ret->wakeups_reported = 0;
+  ret->reported_ns      = 0;
+  atomic_init(&ret->shed_level,       SHED_NONE);
+  atomic_init(&ret->dropped,          0);
+  atomic_init(&ret->analysis_dropped, 0);
+  atomic_init(&ret->xruns,   0);
+  atomic_init(&ret->xrun_ns, 0);
   ret->rb               = rb;
+  ret->analysis_rb      = arb;
+  ret->results_rb       = rrb;
   ret->sq               = sq;
   ret->cv_gen           = cv_gen;
+  ret->strikes          = strikes;
   ret->dthread          = dthread;
-  ret->fft_in           = fft_in;
-  ret->fft_out          = fft_out;
+  ret->athread          = athread;
+  ret->tracker          = tracker;
+  ret->lockin           = lockin;
+  ret->spectrum         = spec;
+  ret->timings          = timings;
+  ret->gen_state        = gens;
+
+  app_set_buffer_size(ret, max_nframes);
   return ret;
 
 exit:
-  if (plan)    fftwf_destroy_plan(plan);
+  if (timings) destroy_cycle_hist(timings);
+  if (spec)    destroy_spectrum(spec);
+  if (lockin)  destroy_lockin(lockin);
+  if (tracker) destroy_harmonic_tracker(tracker);
+  if (strikes) destroy_strike_sched(strikes);
   if (cv_gen)  destroy_envelope(cv_gen);
+  if (athread) destroy_analysis_thread(athread);
   if (dthread) destroy_disk_thread(dthread);
   if (sq)      destroy_additive_square(sq);
-  if (rb)      jack_ringbuffer_free(rb);
-  if (mem)     free(mem);
+  if (rrb)     destroy_slot_ring(rrb);
+  if (arb)     destroy_slot_ring(arb);
+  if (rb)      destroy_slot_ring(rb);
+  if (mem)     arena_free(mem, tsize, hugetlb, locked);
 
   fftwf_cleanup();
   return NULL;
@@ -188,13 +434,20 @@ destroy_app(app_t* app)
   if (!app) return;
   assert(!app->running); /* not valid if the app is still running */
 
-  if (app->plan)    fftwf_destroy_plan(app->plan);
-  if (app->cv_gen)  destroy_envelope(app->cv_gen);
-  if (app->dthread) destroy_disk_thread(app->dthread);
-  if (app->sq)      destroy_additive_square(app->sq);
-  if (app->rb)      jack_ringbuffer_free(app->rb);
-
-  free(app);
+  if (app->timings)     destroy_cycle_hist(app->timings);
+  if (app->spectrum)    destroy_spectrum(app->spectrum);
+  if (app->lockin)      destroy_lockin(app->lockin);
+  if (app->tracker)     destroy_harmonic_tracker(app->tracker);
+  if (app->strikes)     destroy_strike_sched(app->strikes);
+  if (app->cv_gen)      destroy_envelope(app->cv_gen);
+  if (app->athread)     destroy_analysis_thread(app->athread);
+  if (app->dthread)     destroy_disk_thread(app->dthread);
+  if (app->sq)          destroy_additive_square(app->sq);
+  if (app->results_rb)  destroy_slot_ring(app->results_rb);
+  if (app->analysis_rb) destroy_slot_ring(app->analysis_rb);
+  if (app->rb)          destroy_slot_ring(app->rb);
+
+  arena_free(app, app->arena_size, app->arena_hugetlb, app->arena_locked);
   fftwf_cleanup();
 }
 
@@ -202,8 +455,21 @@ int
 app_start(app_t* app)
 {
   if (!app) return APP_ERR_INVAL;
+
+  struct rusage usage[1];
+  getrusage(RUSAGE_SELF, usage);
+  app->minflt_at_start = usage->ru_minflt;
+  app->majflt_at_start = usage->ru_majflt;
+
   int ret = disk_thread_start(app->dthread);
   if (ret != APP_SUCCESS) return ret;
+
+  ret = analysis_thread_start(app->athread);
+  if (ret != APP_SUCCESS) {
+    disk_thread_flush_and_stop(app->dthread);
+    return ret;
+  }
+
   app->running = true;
   return APP_SUCCESS;
 }
@@ -212,94 +478,480 @@ int
 app_stop(app_t* app)
 {
   if (!app) return APP_ERR_INVAL;
-  int ret = disk_thread_flush_and_stop(app->dthread);
+
+  /* analysis first, it writes into one of the disk thread's rings */
+  int ret = analysis_thread_flush_and_stop(app->athread);
+  if (ret != APP_SUCCESS) return ret;
+
+  ret = disk_thread_flush_and_stop(app->dthread);
   if (ret != APP_SUCCESS) return ret;
   app->running = false;
+
+  struct rusage usage[1];
+  getrusage(RUSAGE_SELF, usage);
+  printf("%-30s %ld\n", "minor faults while running", usage->ru_minflt - app->minflt_at_start);
+  printf("%-30s %ld\n", "major faults while running", usage->ru_majflt - app->majflt_at_start);
   return APP_SUCCESS;
 
   /* FIXME consider setting running to false even if this failed */
 }
 
 int
-app_poll(app_t*                app,
-         uint64_t              now_ns,
-         size_t                nframes,
-         float* restrict       square_wave_out,
-         float* restrict       exciter_out,
-         float const* restrict lxd_signal_in)
+app_set_buffer_size(app_t* app,
+                    size_t nframes)
 {
-  if (!app)          return APP_ERR_INVAL;
-  if (!app->running) return APP_ERR_INVAL;
+  if (!app)                                       return APP_ERR_INVAL;
+  if (nframes == 0 || nframes > app->max_nframes) return APP_ERR_INVAL;
 
-  int err = APP_SUCCESS;
+  /* split evenly, so a 1536 frame callback is three sets of 512 and a 600
+     frame callback is two of 300 rather than 512 and 88 */
+  size_t n_chunks   = (nframes + SAMPLE_SET_MAX_FRAMES - 1)/SAMPLE_SET_MAX_FRAMES;
+  app->chunk_frames = (nframes + n_chunks - 1)/n_chunks;
+  return APP_SUCCESS;
+}
 
-  /* Each sample represents (1/sample_rate) seconds of time */
+uint64_t
+app_note_xrun(app_t*   app,
+              uint64_t now_ns)
+{
+  atomic_store_explicit(&app->xrun_ns, now_ns, memory_order_relaxed);
+  return atomic_fetch_add_explicit(&app->xruns, 1, memory_order_release) + 1;
+}
 
-  /* Square wave just ticks away, gen stores the last phase so we won't have any discontinuity */
-  err = additive_square_generate_samples(app->sq, nframes, 440.0, square_wave_out);
-  if (err != APP_SUCCESS) return err;
+uint64_t
+app_xruns(app_t* app)
+{
+  return atomic_load_explicit(&app->xruns, memory_order_relaxed);
+}
 
-  /* Figure out if we need to generate a pulse at some point in this interval. */
+void
+app_report_rings(app_t* app)
+{
+  if (!app) return;
 
-  if (app->last_strike_ns == 0) app->last_strike_ns = now_ns-app->strike_period_ns;
-  uint64_t next_pulse     = app->last_strike_ns + app->strike_period_ns;
-  uint64_t nsec_per_frame = (1e9/app->sample_rate_hz);
-  uint64_t frame_end_ns   = now_ns + nsec_per_frame*nframes;
+  char const*  names[] = { "disk ring used", "analysis ring used", "results ring used" };
+  slot_ring_t* rings[] = { app->rb, app->analysis_rb, app->results_rb };
+  for (size_t i = 0; i < ARRAY_SIZE(rings); ++i) {
+    printf("%-30s %zu/%zu\n", names[i], slot_ring_used(rings[i]), slot_ring_n_slots(rings[i]));
+  }
 
-  size_t pulse_frames = nframes;
-  if (next_pulse <= frame_end_ns) {
-    uint64_t frames_before_pulse = 0;
-    if (next_pulse > now_ns) {
-      frames_before_pulse = (next_pulse-now_ns)/nsec_per_frame;
-      err = envelope_generate_samples(app->cv_gen, frames_before_pulse, exciter_out);
-      if (err != APP_SUCCESS) return err;
-    }
-    envelope_strike(app->cv_gen);
-    app->last_strike_ns = now_ns + (frames_before_pulse+1)*nsec_per_frame;
+  printf("%-30s %u\n", "shed level", atomic_load_explicit(&app->shed_level, memory_order_relaxed));
+  printf("%-30s %" PRIu64 "\n", "dropped records",
+         atomic_load_explicit(&app->dropped, memory_order_relaxed));
+  printf("%-30s %" PRIu64 "\n", "analysis dropped records",
+         atomic_load_explicit(&app->analysis_dropped, memory_order_relaxed));
+  printf("%-30s %" PRIu64 "\n", "analysis dropped results", analysis_thread_dropped(app->athread));
+
+  uint64_t wakeups;
+  size_t   high_water;
+  disk_thread_stats(app->dthread, &wakeups, &high_water);
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t now_ns = (uint64_t)ts.tv_sec*NS_PER_S + (uint64_t)ts.tv_nsec;
+  if (app->reported_ns) {
+    double dt_s = (double)(now_ns - app->reported_ns)/1e9;
+    printf("%-30s %.1f\n", "disk wakeups/s", (double)(wakeups - app->wakeups_reported)/dt_s);
   }
+  printf("%-30s %zu\n", "disk ring high water", high_water);
+  app->wakeups_reported = wakeups;
+  app->reported_ns      = now_ns;
+}
 
-  err = envelope_generate_samples(app->cv_gen, pulse_frames, exciter_out);
-  if (err != APP_SUCCESS) return err;
+void
+app_report_timings(app_t* app)
+{
+  if (!app) return;
 
-  bool write_fft = false;
-  for (size_t i = 0; i < nframes; ++i) {
-    app->fft_in[app->fft_in_location] = lxd_signal_in[i];
-    app->fft_in_location += 1;
-    if (app->fft_in_location >= app->fft_in_space) {
-      fftwf_execute(app->plan);
-      app->fft_in_location = 0;
-      write_fft = true;
-    }
+  double per_us = 1e3*cycle_hist_cycles_per_ns(app->timings);
+  for (size_t i = 0; i < STAGE_COUNT; ++i) {
+    cycle_hist_summary_t sum[1];
+    cycle_hist_summarize(app->timings, i, sum);
+    if (sum->n == 0) continue;
+
+    char label[64];
+    snprintf(label, sizeof(label), "%s us", stage_names[i]);
+    printf("%-30s p50 %8.2f p99 %8.2f max %8.2f n %" PRIu64 "\n", label,
+           (double)sum->p50/per_us, (double)sum->p99/per_us, (double)sum->max/per_us, sum->n);
   }
 
-  size_t fft_bin_count = write_fft ? app->fft_out_space : 0;
-  size_t message_size  = sample_set_footprint(nframes, fft_bin_count);
+  disk_thread_report_syncs(app->dthread);
+  disk_thread_report_pack(app->dthread);
+}
 
-  /* Write into this thing, then copy into ringbuffer since the copy might cross
-     from the end to the beginning of the buffer */
-  static char mem[SAMPLE_SET_MAX];
-  assert(message_size <= sizeof(mem)); // FIXME move to the app struct
+/* Time since `since` goes to `stage`, returns now so stages can be chained */
 
-  sample_set_t* sset = create_sample_set(mem, nframes, fft_bin_count, NULL);
-  if (!sset) {
-    printf("too big\n"); // FIXME
-    return APP_DROP;
-  }
+static inline uint64_t
+lap(app_t*   app,
+    size_t   stage,
+    uint64_t since)
+{
+  uint64_t now = cycle_hist_now();
+  cycle_hist_add(app->timings, stage, now - since);
+  return now;
+}
+
+/* Only the process thread writes the counters, so no locked add is needed */
+
+static inline void
+count(atomic_uint_fast64_t* c)
+{
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+/* A full ring never stops the app, the record is dropped and counted and the
+   next gap marker says so */
+
+static int
+write_record(app_t*              app,
+             record_hdr_t const* rec)
+{
+  if (record_write(app->rb, rec) != APP_SUCCESS) count(&app->dropped);
+  return APP_SUCCESS;
+}
 
+/* If jack reported xruns since the last callback, mark the discontinuity in
+   front of this callback's records */
+
+static int
+write_xrun_marker(app_t* app)
+{
+  uint64_t xruns = atomic_load_explicit(&app->xruns, memory_order_acquire);
+  if (LIKELY(xruns == app->xruns_marked)) return APP_SUCCESS;
+
+  char    mem[sizeof(xrun_t)];
+  xrun_t* x  = create_xrun(mem, app->frame);
+  x->time_ns = atomic_load_explicit(&app->xrun_ns, memory_order_relaxed);
+  x->n_new   = (uint32_t)(xruns - app->xruns_marked);
+  x->n_total = (uint32_t)xruns;
+
+  /* no room, try again next callback */
+  if (record_write(app->rb, &x->hdr) != APP_SUCCESS) return APP_SUCCESS;
+
+  app->xruns_marked = xruns;
+  return APP_SUCCESS;
+}
+
+/* Pick how much to shed from how full the disk ring is, before this
+   callback's records go in. Shed more as soon as a threshold is crossed, shed
+   less only once well below it. */
+
+static unsigned
+shed_level(app_t* app)
+{
+  static size_t const thresholds[] = { 0, SHED_SQUARE_FILL, SHED_DECIMATE_FILL, SHED_FEATURES_FILL };
+
+  size_t   n_slots = slot_ring_n_slots(app->rb);
+  size_t   used    = 100*(n_slots - slot_ring_writable(app->rb))/n_slots;
+  unsigned level   = atomic_load_explicit(&app->shed_level, memory_order_relaxed);
+
+  while (level < SHED_FEATURES && used >= thresholds[level+1])          level += 1;
+  while (level > SHED_NONE && used + SHED_HYSTERESIS < thresholds[level]) level -= 1;
+  return level;
+}
+
+/* Mark a change of shed level, or drops since the last marker, in front of
+   this callback's records */
+
+static void
+write_gap_marker(app_t*   app,
+                 unsigned level)
+{
+  uint64_t dropped = atomic_load_explicit(&app->dropped, memory_order_relaxed);
+  if (LIKELY(level == app->shed_marked && dropped == app->dropped_marked)) return;
+
+  char   mem[sizeof(gap_t)];
+  gap_t* g           = create_gap(mem, app->frame);
+  g->level           = level;
+  g->n_dropped       = (uint32_t)(dropped - app->dropped_marked);
+  g->n_dropped_total = dropped;
+
+  /* no room, try again next callback */
+  if (record_write(app->rb, &g->hdr) != APP_SUCCESS) return;
+
+  app->shed_marked    = level;
+  app->dropped_marked = dropped;
+}
+
+/* Records the analysis thread needs go to it as well as to disk */
+
+static int
+write_analysis_record(app_t*              app,
+                      record_hdr_t const* rec)
+{
+  write_record(app, rec);
+  if (record_write(app->analysis_rb, rec) != APP_SUCCESS) count(&app->analysis_dropped);
+  return APP_SUCCESS;
+}
+
+/* Build a sample set directly in a slot of `rb`, so every sample is copied
+   exactly once from the port buffers. */
+
+static int
+write_sample_set(app_t*             app,
+                 slot_ring_t*       rb,
+                 uint64_t           frame,
+                 size_t             nframes,
+                 gen_state_t const* gen,
+                 float const*       square_wave_out,
+                 float const*       exciter_out,
+                 float const*       lxd_signal_in,
+                 float const*       fft_bins)
+{
+  size_t fft_bin_count = fft_bins ? spectrum_n_bins(app->spectrum) : 0;
+  void*  mem           = record_reserve(rb, sample_set_footprint(nframes, fft_bin_count));
+  if (!mem) return APP_DROP;
+
+  sample_set_t* sset = create_sample_set(mem, frame, nframes, fft_bin_count, NULL);
+  sset->square_phase      = gen->square_phase;
+  sset->envelope_position = gen->envelope_position;
   memcpy(sample_set_square_samples(sset), square_wave_out, nframes*sizeof(float));
   memcpy(sample_set_pulse_samples(sset),  exciter_out,     nframes*sizeof(float));
   memcpy(sample_set_lxd_in_samples(sset), lxd_signal_in,   nframes*sizeof(float));
+  memcpy(sample_set_fft_bins(sset),       fft_bins,        fft_bin_count*sizeof(float));
+
+  return APP_SUCCESS;
+}
+
+/* Average each `decimation` frames of `in` into one sample of `out`, the last
+   sample gets whatever is left over */
+
+static void
+decimate(float const* in,
+         size_t       nframes,
+         size_t       decimation,
+         float*       out)
+{
+  for (size_t i = 0, j = 0; i < nframes; i += decimation, ++j) {
+    size_t n   = MIN(decimation, nframes - i);
+    float  sum = 0.0f;
+    for (size_t k = 0; k < n; ++k) sum += in[i+k];
+    out[j] = sum/(float)n;
+  }
+}
 
-  /* FIXME there's probably a cleverer way to do this */
-  for (size_t i = 0; i < fft_bin_count; ++i) {
-    sample_set_fft_bins(sset)[i] = cabsf(app->fft_out[i]);
+/* The disk's copy of a sample set at a shed level above SHED_NONE, built in
+   place like write_sample_set */
+
+static int
+write_reduced_set(app_t*       app,
+                  unsigned     level,
+                  uint64_t     frame,
+                  size_t       nframes,
+                  float const* exciter_out,
+                  float const* lxd_signal_in,
+                  float const* fft_bins)
+{
+  uint32_t channels      = level < SHED_FEATURES ? REDUCED_PULSE | REDUCED_LXD_IN : 0;
+  size_t   decimation    = level < SHED_DECIMATE ? 1 : SHED_DECIMATION;
+  size_t   fft_bin_count = fft_bins ? spectrum_n_bins(app->spectrum) : 0;
+  if (!channels && !fft_bin_count) return APP_SUCCESS;
+
+  void* mem = record_reserve(app->rb, reduced_set_footprint(channels, nframes, decimation,
+                                                            fft_bin_count));
+  if (!mem) return APP_DROP;
+
+  reduced_set_t* r = create_reduced_set(mem, frame, channels, nframes, decimation, fft_bin_count,
+                                        NULL);
+  if (channels) {
+    decimate(exciter_out,   nframes, decimation, reduced_set_channel(r, REDUCED_PULSE));
+    decimate(lxd_signal_in, nframes, decimation, reduced_set_channel(r, REDUCED_LXD_IN));
   }
 
-  size_t written = jack_ringbuffer_write(app->rb, mem, message_size);
-  if (written != message_size) {
-    printf("written=%zu size=%zu\n", written, message_size);
-    return APP_DROP;
+  memcpy(reduced_set_fft_bins(r), fft_bins, fft_bin_count*sizeof(float));
+
+  return APP_SUCCESS;
+}
+
+/* Run the envelope over frames [begin, end) of this callback, restarting it at
+   each strike in there (see strike_sched.h) */
+
+static int
+generate_envelope(app_t*   app,
+                  uint64_t now_frames,
+                  size_t   begin,
+                  size_t   end,
+                  float*   exciter_out)
+{
+  size_t   generated = begin;
+  uint64_t strike;
+  while (strike_sched_take(app->strikes, now_frames + begin, now_frames + end, &strike)) {
+    size_t at  = (size_t)(strike - now_frames);
+    int    err = envelope_generate_samples(app->cv_gen, at - generated, exciter_out + generated);
+    if (err != APP_SUCCESS) return err;
+    generated = at;
+
+    envelope_strike(app->cv_gen);
+
+    char mem[sizeof(strike_t)];
+    err = write_analysis_record(app, &create_strike(mem, app->frame + at)->hdr);
+    if (err != APP_SUCCESS) return err;
   }
 
+  return envelope_generate_samples(app->cv_gen, end - generated, exciter_out + generated);
+}
+
+/* `end_frame` is one past the last frame the tracker has consumed */
+
+static int
+write_harmonics(app_t*   app,
+                uint64_t end_frame)
+{
+  size_t n_bins = harmonic_tracker_n_bins(app->tracker);
+  size_t window = harmonic_tracker_window(app->tracker);
+
+  char mem[sizeof(harmonics_t) + 2*HARMONICS_MAX_BINS*sizeof(float)];
+  harmonics_t* h = create_harmonics(mem, end_frame - window, n_bins, window, DRIVE_FREQUENCY_HZ, NULL);
+  if (!h) return APP_ERR_INVAL;
+
+  harmonic_tracker_snapshot(app->tracker, harmonics_amplitude(h), harmonics_phase(h));
+
+  return write_record(app, &h->hdr);
+}
+
+/* Demodulate a chunk of lxd_in small enough that the output fits in a single
+   record, and write the record if anything came out. */
+
+static int
+write_demodulated(app_t*       app,
+                  float*       theta,
+                  double       step,
+                  float const* lxd_signal_in,
+                  size_t       nframes,
+                  uint64_t     frame)
+{
+  size_t decimation = lockin_decimation(app->lockin);
+  assert(nframes <= LOCKIN_MAX_POINTS*decimation); /* so at most LOCKIN_MAX_POINTS come out */
+
+  float  amplitude[LOCKIN_MAX_POINTS];
+  float  phase[LOCKIN_MAX_POINTS];
+  size_t first    = 0;
+  size_t n_points = lockin_process(app->lockin, theta, step, lxd_signal_in, nframes,
+                                   amplitude, phase, &first);
+  if (n_points == 0) return APP_SUCCESS;
+
+  char mem[sizeof(demodulated_t) + 2*LOCKIN_MAX_POINTS*sizeof(float)];
+  demodulated_t* d = create_demodulated(mem, frame + first, n_points, decimation, NULL);
+  if (!d) return APP_ERR_INVAL;
+
+  memcpy(demodulated_amplitude(d), amplitude, n_points*sizeof(float));
+  memcpy(demodulated_phase(d),     phase,     n_points*sizeof(float));
+
+  return write_analysis_record(app, &d->hdr);
+}
+
+int
+app_poll(app_t*                app,
+         uint64_t              now_frames,
+         size_t                nframes,
+         float* restrict       square_wave_out,
+         float* restrict       exciter_out,
+         float const* restrict lxd_signal_in)
+{
+  if (!app)                       return APP_ERR_INVAL;
+  if (!app->running)              return APP_ERR_INVAL;
+  if (nframes > app->max_nframes) return APP_ERR_INVAL;
+
+  /* rare, so left out of the timings */
+  int err = write_xrun_marker(app);
+  if (err != APP_SUCCESS) return err;
+
+  unsigned level = shed_level(app);
+  atomic_store_explicit(&app->shed_level, level, memory_order_relaxed);
+  write_gap_marker(app, level);
+
+  uint64_t start = cycle_hist_now();
+  uint64_t t     = start;
+
+  /* Remember where the square wave's phase starts so the lock-in can follow it */
+  float  theta = additive_square_phase(app->sq);
+  double step  = additive_square_phase_step(app->sq, DRIVE_FREQUENCY_HZ);
+
+  /* Both generators run a sample set at a time, so each set can say what
+     state they were in at its first frame (CAPTURE_SYNTH). The output doesn't
+     change with where the runs are split. */
+
+  /* Square wave just ticks away, gen stores the last phase so we won't have any discontinuity */
+  for (size_t i = 0, at = 0; at < nframes; ++i, at += app->chunk_frames) {
+    size_t n = MIN(app->chunk_frames, nframes - at);
+    app->gen_state[i].square_phase = additive_square_phase(app->sq);
+    err = additive_square_generate_samples(app->sq, n, DRIVE_FREQUENCY_HZ, square_wave_out + at);
+    if (err != APP_SUCCESS) return err;
+  }
+  t = lap(app, STAGE_SQUARE, t);
+
+  /* The envelope runs up to each strike in this buffer, restarts there, and
+     carries on to the end of the buffer */
+
+  strike_sched_start(app->strikes, now_frames);
+
+  for (size_t i = 0, at = 0; at < nframes; ++i, at += app->chunk_frames) {
+    size_t n = MIN(app->chunk_frames, nframes - at);
+    app->gen_state[i].envelope_position = envelope_position(app->cv_gen);
+    err = generate_envelope(app, now_frames, at, at + n, exciter_out);
+    if (err != APP_SUCCESS) return err;
+  }
+  t = lap(app, STAGE_ENVELOPE, t);
+
+  /* bins for each sample set a transform completes in */
+  err = spectrum_process(app->spectrum, lxd_signal_in, nframes, app->chunk_frames);
+  if (err != APP_SUCCESS) return err;
+  t = lap(app, STAGE_FFT, t);
+
+  /* Track the drive frequency and its harmonics, writing a snapshot each time
+     the tracker finishes a block */
+  size_t tracked = 0;
+  while (tracked < nframes) {
+    tracked += harmonic_tracker_process(app->tracker, lxd_signal_in + tracked, nframes - tracked);
+    if (harmonic_tracker_ready(app->tracker)) {
+      err = write_harmonics(app, app->frame + tracked);
+      if (err != APP_SUCCESS) return err;
+    }
+  }
+  t = lap(app, STAGE_HARMONICS, t);
+
+  /* Demodulate against the drive */
+  size_t max_chunk = LOCKIN_MAX_POINTS*lockin_decimation(app->lockin);
+  for (size_t demodulated = 0; demodulated < nframes; demodulated += max_chunk) {
+    size_t n = MIN(max_chunk, nframes - demodulated);
+    err = write_demodulated(app, &theta, step, lxd_signal_in + demodulated, n,
+                            app->frame + demodulated);
+    if (err != APP_SUCCESS) return err;
+  }
+  t = lap(app, STAGE_LOCKIN, t);
+
+  /* Once for disk, once for the analysis thread, in chunks that fit a slot. A
+     full ring loses the chunk, never the run. */
+  for (size_t written = 0; written < nframes; written += app->chunk_frames) {
+    size_t             n    = MIN(app->chunk_frames, nframes - written);
+    gen_state_t const* gen  = app->gen_state + written/app->chunk_frames;
+    float const*       bins = spectrum_bins(app->spectrum, written/app->chunk_frames);
+
+    if (level == SHED_NONE) {
+      err = write_sample_set(app, app->rb, app->frame + written, n, gen, square_wave_out + written,
+                             exciter_out + written, lxd_signal_in + written, bins);
+    }
+    else {
+      err = write_reduced_set(app, level, app->frame + written, n, exciter_out + written,
+                              lxd_signal_in + written, bins);
+    }
+    if (err != APP_SUCCESS) count(&app->dropped);
+
+    err = write_sample_set(app, app->analysis_rb, app->frame + written, n, gen,
+                           square_wave_out + written, exciter_out + written,
+                           lxd_signal_in + written, bins);
+    if (err != APP_SUCCESS) count(&app->analysis_dropped);
+  }
+  t = lap(app, STAGE_SAMPLE_SETS, t);
+
+  /* everything from this callback becomes visible at once */
+  slot_ring_publish(app->rb);
+  slot_ring_publish(app->analysis_rb);
+  disk_thread_poke(app->dthread, slot_ring_used(app->rb));
+  analysis_thread_poke(app->athread, slot_ring_used(app->analysis_rb));
+  lap(app, STAGE_PUBLISH, t);
+  lap(app, STAGE_TOTAL, start);
+
+  app->frame += nframes;
   return APP_SUCCESS;
 }
@@ -6,10 +6,18 @@
 /* opaque app */
 typedef struct app app_t;
 
+/* `max_nframes` is the largest buffer the app will ever be polled with, it
+   sizes the ring slots that carry sample sets. The app starts out configured
+   for buffers of `max_nframes`. Output files go in `output_dir`, named
+   starting with `output_prefix`, see disk_thread.h. */
+
 app_t*
-create_app(uint64_t sample_rate_hz,
-           uint64_t strike_period_ns,
-           int*     opt_err);
+create_app(uint64_t    sample_rate_hz,
+           uint64_t    strike_period_ns,
+           size_t      max_nframes,
+           char const* output_dir,
+           char const* output_prefix,
+           int*        opt_err);
 
 void
 destroy_app(app_t* app);
@@ -20,9 +28,38 @@ app_start(app_t* app);
 int
 app_stop(app_t* app);
 
+/* Reconfigure for a new buffer size. Not realtime safe, must not run
+   concurrently with app_poll. Fails if `nframes` is larger than the
+   `max_nframes` the app was created with. */
+
+int
+app_set_buffer_size(app_t* app,
+                    size_t nframes);
+
+/* Count an xrun reported at `now_ns`. Safe from any thread. The next app_poll
+   writes a discontinuity marker. Returns the number of xruns so far. */
+
+uint64_t
+app_note_xrun(app_t*   app,
+              uint64_t now_ns);
+
+uint64_t
+app_xruns(app_t* app);
+
+/* Print how full each ring is. Safe while the app runs. */
+
+void
+app_report_rings(app_t* app);
+
+/* Print p50/p99/max time spent in each stage of app_poll since the last
+   call. Call from one thread only, while the app runs is fine. */
+
+void
+app_report_timings(app_t* app);
+
 int
 app_poll(app_t*                app,
-         uint64_t              now_ns,           /* monotonically increasing nanosecond time */
+         uint64_t              now_frames,       /* host frame clock at the first frame, 64 bit, never wraps */
          size_t                nframes,
          float* restrict       square_wave_out,
          float* restrict       exciter_out,
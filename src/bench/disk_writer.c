@@ -0,0 +1,153 @@
+/* Sustained throughput and append latency of each disk_writer backend, with
+   and without O_DIRECT.
+
+   Appends batches of record sized buffers the way the disk thread does, then
+   finishes the file. Throughput includes the final sync. Latency is per
+   append call, which is how long the disk thread is kept away from its rings.
+   "cached" is how much of the file is left in the page cache.
+
+   usage: bench_disk_writer [path] [MiB] */
+
+#include "../common.h"
+#include "../cycle_hist.h"
+#include "../disk_writer.h"
+#include "../err.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BATCH       16ul
+#define RECORD_SIZE 3088ul /* a 256 frame sample set */
+
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static char const*
+errstr(int err)
+{
+#define ELT(e,h) case e: return h;
+  switch (err) {
+    APP_ERRORS(ELT)
+    default: return "Unknown";
+  }
+#undef ELT
+}
+
+/* MiB of `path` in the page cache */
+
+static double
+cached_mib(char const* path)
+{
+  int fd = open(path, O_RDONLY);
+  if (-1 == fd) return -1;
+
+  struct stat st;
+  double      mib = -1;
+  if (0 == fstat(fd, &st) && st.st_size > 0) {
+    size_t         pages = ((size_t)st.st_size + 4095)/4096;
+    unsigned char* vec   = malloc(pages);
+    void*          map   = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (vec && map != MAP_FAILED && 0 == mincore(map, (size_t)st.st_size, vec)) {
+      size_t resident = 0;
+      for (size_t i = 0; i < pages; ++i) resident += vec[i] & 1;
+      mib = (double)resident*4096/(1 << 20);
+    }
+    if (map != MAP_FAILED) munmap(map, (size_t)st.st_size);
+    free(vec);
+  }
+
+  close(fd);
+  return mib;
+}
+
+static int
+run(char const*   path,
+    int           backend,
+    bool          direct,
+    size_t        total,
+    char*         records,
+    cycle_hist_t* hist)
+{
+  void* mem = aligned_alloc(disk_writer_align(), disk_writer_footprint());
+  if (!mem) return APP_ERR_ALLOC;
+
+  int            err = APP_SUCCESS;
+  disk_writer_t* w   = create_disk_writer(mem, path, backend, direct, &err);
+  if (!w) {
+    free(mem);
+    return err;
+  }
+
+  struct iovec iov[BATCH];
+  uint64_t     start = now_ns();
+  for (size_t done = 0; done < total && err == APP_SUCCESS; done += BATCH*RECORD_SIZE) {
+    for (size_t i = 0; i < BATCH; ++i) {
+      iov[i].iov_base = records + i*RECORD_SIZE;
+      iov[i].iov_len  = RECORD_SIZE;
+    }
+
+    uint64_t t0 = cycle_hist_now();
+    err = disk_writer_append(w, iov, BATCH);
+    cycle_hist_add(hist, (size_t)backend, cycle_hist_now() - t0);
+  }
+  if (err == APP_SUCCESS) err = disk_writer_finish(w);
+  uint64_t elapsed = now_ns() - start;
+
+  double per_us = 1e3*cycle_hist_cycles_per_ns(hist);
+  cycle_hist_summary_t sum[1];
+  cycle_hist_summarize(hist, (size_t)backend, sum);
+
+  printf("%-10s %-8s %8.1f MB/s  append us p50 %8.2f p99 %8.2f max %8.2f  cached %8.1f MiB\n",
+         disk_writer_backend_name(disk_writer_backend(w)),
+         disk_writer_direct(w) ? "O_DIRECT" : "buffered",
+         (double)disk_writer_bytes(w)/((double)elapsed*1e-3),
+         (double)sum->p50/per_us, (double)sum->p99/per_us, (double)sum->max/per_us,
+         cached_mib(path));
+
+  free(destroy_disk_writer(w));
+  unlink(path);
+  return err;
+}
+
+int
+main(int    argc,
+     char** argv)
+{
+  char const* path  = argc > 1 ? argv[1] : "bench_disk_writer.out";
+  size_t      total = (argc > 2 ? strtoul(argv[2], NULL, 10) : 1024ul) << 20;
+
+  static char records[BATCH*RECORD_SIZE];
+  for (size_t i = 0; i < sizeof(records); ++i) records[i] = (char)i;
+
+  void* mem = aligned_alloc(cycle_hist_align(), cycle_hist_footprint());
+  if (!mem) return 1;
+  cycle_hist_t* hist = create_cycle_hist(mem, 2, NULL);
+
+  int backends[] = { DISK_WRITER_WRITE, DISK_WRITER_URING };
+  for (size_t i = 0; i < 2*ARRAY_SIZE(backends); ++i) {
+    int  backend = backends[i/2];
+    bool direct  = i%2;
+    int  err     = run(path, backend, direct, total, records, hist);
+    if (err != APP_SUCCESS) {
+      fprintf(stderr, "%s failed with '%s'\n", disk_writer_backend_name(backend), errstr(err));
+      return 1;
+    }
+  }
+
+  free(destroy_cycle_hist(hist));
+  return 0;
+}
@@ -0,0 +1,122 @@
+/* Cost of getting a sample set from the port buffers into a ring.
+
+   "staged" is how app_poll used to do it: build the whole record in a scratch
+   buffer, then jack_ringbuffer_write it. "in place" builds it straight in a
+   slot_ring slot with record_reserve.
+
+   The reader just advances, so only the writer's copies are measured. */
+
+#include "../common.h"
+#include "../disk.h"
+#include "../err.h"
+#include "../record_io.h"
+#include "../slot_ring.h"
+
+#include <inttypes.h>
+#include <jack/ringbuffer.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ITERATIONS 1000000ul
+
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void
+report(char const* name,
+       size_t      nframes,
+       uint64_t    elapsed,
+       size_t      copied)
+{
+  printf("%-10s nframes=%-4zu %8.1f ns/callback %8zu bytes copied/callback\n",
+         name, nframes, (double)elapsed/ITERATIONS, copied/ITERATIONS);
+}
+
+static void
+staged(jack_ringbuffer_t* rb,
+       size_t             nframes,
+       float const*       a,
+       float const*       b,
+       float const*       c)
+{
+  size_t   copied = 0;
+  uint64_t start  = now_ns();
+  for (size_t i = 0; i < ITERATIONS; ++i) {
+    char mem[RING_SLOT_SIZE];
+    sample_set_t* sset = create_sample_set(mem, i*nframes, nframes, 0, NULL);
+    memcpy(sample_set_square_samples(sset), a, nframes*sizeof(float));
+    memcpy(sample_set_pulse_samples(sset),  b, nframes*sizeof(float));
+    memcpy(sample_set_lxd_in_samples(sset), c, nframes*sizeof(float));
+
+    BUG(jack_ringbuffer_write_space(rb) < sset->hdr.size, "ring full\n");
+    jack_ringbuffer_write(rb, mem, sset->hdr.size);
+    copied += 3*nframes*sizeof(float) + sset->hdr.size;
+
+    jack_ringbuffer_read_advance(rb, jack_ringbuffer_read_space(rb));
+  }
+
+  report("staged", nframes, now_ns() - start, copied);
+}
+
+static void
+in_place(slot_ring_t* ring,
+         size_t       nframes,
+         float const* a,
+         float const* b,
+         float const* c)
+{
+  size_t   copied = 0;
+  uint64_t start  = now_ns();
+  for (size_t i = 0; i < ITERATIONS; ++i) {
+    void* mem = record_reserve(ring, sample_set_footprint(nframes, 0));
+    BUG(!mem, "ring full\n");
+
+    sample_set_t* sset = create_sample_set(mem, i*nframes, nframes, 0, NULL);
+    memcpy(sample_set_square_samples(sset), a, nframes*sizeof(float));
+    memcpy(sample_set_pulse_samples(sset),  b, nframes*sizeof(float));
+    memcpy(sample_set_lxd_in_samples(sset), c, nframes*sizeof(float));
+    slot_ring_publish(ring);
+    copied += 3*nframes*sizeof(float);
+
+    slot_ring_release(ring, slot_ring_readable(ring));
+  }
+
+  report("in place", nframes, now_ns() - start, copied);
+}
+
+int
+main(void)
+{
+  static float a[1024], b[1024], c[1024];
+  for (size_t i = 0; i < ARRAY_SIZE(a); ++i) {
+    a[i] = (float)i;
+    b[i] = -(float)i;
+    c[i] = 0.5f*(float)i;
+  }
+
+  jack_ringbuffer_t* rb = jack_ringbuffer_create(RING_SLOTS*RING_SLOT_SIZE);
+  if (!rb) return 1;
+
+  void* mem = NULL;
+  if (posix_memalign(&mem, slot_ring_align(), slot_ring_footprint(RING_SLOTS, RING_SLOT_SIZE))) {
+    return 1;
+  }
+  slot_ring_t* ring = create_slot_ring(mem, RING_SLOTS, RING_SLOT_SIZE, NULL);
+
+  size_t sizes[] = { 32, 64, 128, 256 };
+  for (size_t i = 0; i < ARRAY_SIZE(sizes); ++i) {
+    BUG(sample_set_footprint(sizes[i], 0) > RING_SLOT_SIZE, "too big\n");
+    staged(rb, sizes[i], a, b, c);
+    in_place(ring, sizes[i], a, b, c);
+  }
+
+  free(destroy_slot_ring(ring));
+  jack_ringbuffer_free(rb);
+  return 0;
+}
@@ -0,0 +1,199 @@
+/* Throughput and latency of slot_ring against jack_ringbuffer, with one
+   producer and one consumer thread, each moving records about the size of a
+   128 frame sample set.
+
+   Each side uses its ring the way the app does. The jack consumer copies each
+   record out (records can wrap around the end of a byte ring), the slot
+   consumer uses records where they sit.
+
+   Throughput runs publish in batches of BATCH records, latency runs publish
+   every record and measure from just before the publish to when the consumer
+   sees it. Both sides yield when they have to wait, so this still finishes on
+   a single core (where latency mostly measures the scheduler). */
+
+#include "../common.h"
+#include "../slot_ring.h"
+
+#include <inttypes.h>
+#include <jack/ringbuffer.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define MESSAGES     2000000ul
+#define RECORD_SIZE  1568ul
+#define BATCH        16ul
+
+typedef struct {
+  uint64_t sent_ns;
+  uint64_t seq;
+} stamp_t;
+
+typedef struct {
+  bool               use_slots;
+  bool               batch;
+  slot_ring_t*       ring;
+  jack_ringbuffer_t* rb;
+  uint64_t*          latencies;  /* MESSAGES of them */
+  atomic_bool        go;
+} bench_t;
+
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void*
+producer(void* arg)
+{
+  bench_t* b = (bench_t*)arg;
+  char     payload[RECORD_SIZE];
+  memset(payload, 0xab, sizeof(payload));
+
+  while (!atomic_load(&b->go)) { }
+
+  for (uint64_t i = 0; i < MESSAGES; ++i) {
+    bool publish = !b->batch || (i+1) % BATCH == 0 || i+1 == MESSAGES;
+
+    if (b->use_slots) {
+      char* slot;
+      while (!(slot = slot_ring_acquire(b->ring))) {
+        slot_ring_publish(b->ring);
+        sched_yield();
+      }
+
+      memcpy(slot, payload, RECORD_SIZE);
+      stamp_t s = { publish ? now_ns() : 0, i };
+      memcpy(slot, &s, sizeof(s));
+      if (publish) slot_ring_publish(b->ring);
+    }
+    else {
+      /* jack has no deferred publish, every write is visible */
+      while (jack_ringbuffer_write_space(b->rb) < RECORD_SIZE) sched_yield();
+
+      stamp_t s = { now_ns(), i };
+      memcpy(payload, &s, sizeof(s));
+      jack_ringbuffer_write(b->rb, payload, RECORD_SIZE);
+    }
+  }
+
+  return NULL;
+}
+
+static void
+consume(bench_t*       b,
+        stamp_t const* s,
+        uint64_t       expected)
+{
+  BUG(s->seq != expected, "out of order %" PRIu64 " != %" PRIu64 "\n", s->seq, expected);
+  if (s->sent_ns) b->latencies[expected] = now_ns() - s->sent_ns;
+}
+
+static void*
+consumer(void* arg)
+{
+  bench_t* b = (bench_t*)arg;
+  char     buffer[RECORD_SIZE];
+
+  while (!atomic_load(&b->go)) { }
+
+  uint64_t received = 0;
+  while (received < MESSAGES) {
+    if (b->use_slots) {
+      size_t n = slot_ring_readable(b->ring);
+      if (n == 0) sched_yield();
+      for (size_t i = 0; i < n; ++i) {
+        consume(b, (stamp_t const*)slot_ring_slot(b->ring, i), received++);
+      }
+      slot_ring_release(b->ring, n);
+    }
+    else {
+      if (jack_ringbuffer_read_space(b->rb) < RECORD_SIZE) sched_yield();
+      while (jack_ringbuffer_read_space(b->rb) >= RECORD_SIZE) {
+        jack_ringbuffer_read(b->rb, buffer, RECORD_SIZE);
+        consume(b, (stamp_t const*)buffer, received++);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static int
+compare(void const* a,
+        void const* b)
+{
+  uint64_t x = *(uint64_t const*)a, y = *(uint64_t const*)b;
+  return (x > y) - (x < y);
+}
+
+static void
+run(char const* name,
+    bench_t*    b)
+{
+  memset(b->latencies, 0, MESSAGES*sizeof(uint64_t));
+  atomic_store(&b->go, false);
+
+  pthread_t p, c;
+  pthread_create(&c, NULL, consumer, b);
+  pthread_create(&p, NULL, producer, b);
+
+  uint64_t start = now_ns();
+  atomic_store(&b->go, true);
+  pthread_join(p, NULL);
+  pthread_join(c, NULL);
+  uint64_t elapsed = now_ns() - start;
+
+  /* only the stamped messages count */
+  size_t n = 0;
+  for (size_t i = 0; i < MESSAGES; ++i) {
+    if (b->latencies[i]) b->latencies[n++] = b->latencies[i];
+  }
+  qsort(b->latencies, n, sizeof(uint64_t), compare);
+
+  printf("%-22s %7.2f Mrec/s %7.2f GB/s   latency p50 %6" PRIu64 " ns p99 %6" PRIu64 " ns\n",
+         name,
+         (double)MESSAGES*1e3/(double)elapsed,
+         (double)MESSAGES*RECORD_SIZE/(double)elapsed,
+         n ? b->latencies[n/2] : 0,
+         n ? b->latencies[n*99/100] : 0);
+}
+
+int
+main(void)
+{
+  static bench_t b[1];
+  b->latencies = malloc(MESSAGES*sizeof(uint64_t));
+  b->rb        = jack_ringbuffer_create(RING_SLOTS*RECORD_SIZE);
+
+  void* mem = NULL;
+  if (!b->latencies || !b->rb) return 1;
+  if (posix_memalign(&mem, slot_ring_align(), slot_ring_footprint(RING_SLOTS, RECORD_SIZE))) {
+    return 1;
+  }
+
+  b->use_slots = false;
+  b->batch     = false;
+  run("jack_ringbuffer", b);
+
+  b->ring      = create_slot_ring(mem, RING_SLOTS, RECORD_SIZE, NULL);
+  b->use_slots = true;
+  run("slot_ring", b);
+
+  b->ring      = create_slot_ring(mem, RING_SLOTS, RECORD_SIZE, NULL);
+  b->batch     = true;
+  run("slot_ring, batched", b);
+
+  free(destroy_slot_ring(b->ring));
+  jack_ringbuffer_free(b->rb);
+  free(b->latencies);
+  return 0;
+}
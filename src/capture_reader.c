@@ -0,0 +1,531 @@
+#include "capture_reader.h"
+
+#include "capture_synth.h"
+#include "capture_writer.h"
+#include "column_codec.h"
+#include "column_quant.h"
+#include "common.h"
+#include "crc32c.h"
+#include "err.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* most chunks a segment can have, see capture_writer_index_full */
+#define MAX_CHUNKS (CAPTURE_MAX_CHUNKS + CAPTURE_INDEX_SLACK)
+
+struct capture_reader {
+  char const*          map;
+  size_t               size;
+  chunk_index_t const* index;   /* the segment's own, or `found` */
+
+  /* chunks found by walking the records when the segment has no index we
+     can use, and how many of them the sequence numbers say are missing,
+     trailing. Every one of them has had its crc checked. */
+  chunk_index_t*       found;
+  size_t               n_lost;
+
+  /* last chunk capture_reader_read checked the crc of */
+  size_t               verified;
+
+  /* for COLUMN_SYNTH, NULL if the meta's generators can't be run, trailing */
+  capture_synth_t*     synth;
+
+  /* last packed column decoded for a partial read, CAPTURE_CHUNK_FRAMES
+     floats in the trailing memory */
+  float*               scratch;
+  size_t               scratch_chunk;
+  size_t               scratch_channel;
+};
+
+/* Where channel `ch` of a chunk is and how it's stored */
+
+typedef struct {
+  uint32_t    encoding;
+  size_t      bytes;
+  char const* data;
+} column_t;
+
+static column_t
+locate(chunk_t const* c,
+       size_t         ch)
+{
+  char const* data = (char const*)c + c->data_offset;
+  column_t    col;
+
+  if (c->layout == CHUNK_RAW) {
+    col.encoding = COLUMN_FLOAT32;
+    col.bytes    = c->n_frames*sizeof(float);
+    col.data     = data + ch*col.bytes;
+    return col;
+  }
+
+  column_hdr_t const* hdrs = (column_hdr_t const*)data;
+  col.data = data + c->n_channels*sizeof(column_hdr_t);
+  for (size_t i = 0; i < ch; ++i) col.data += hdrs[i].bytes;
+  col.encoding = hdrs[ch].encoding;
+  col.bytes    = hdrs[ch].bytes;
+  return col;
+}
+
+/* The columns fit in the record and are stored in ways we know */
+
+static bool
+check_columns(chunk_t const* c)
+{
+  uint64_t room = c->hdr.size - c->data_offset;
+
+  if (c->layout == CHUNK_RAW) return (uint64_t)c->n_channels*c->n_frames*sizeof(float) <= room;
+  if (c->layout != CHUNK_PACKED) return false;
+
+  if ((uint64_t)c->n_channels*sizeof(column_hdr_t) > room) return false;
+  room -= c->n_channels*sizeof(column_hdr_t);
+
+  column_hdr_t const* hdrs = (column_hdr_t const*)((char const*)c + c->data_offset);
+  for (size_t ch = 0; ch < c->n_channels; ++ch) {
+    if (hdrs[ch].bytes > room) return false;
+    room -= hdrs[ch].bytes;
+
+    uint32_t encoding = hdrs[ch].encoding;
+    uint64_t bytes    = hdrs[ch].bytes;
+    bool     ok       = encoding == COLUMN_XOR_PLANES || encoding == COLUMN_SYNTH;
+    if (encoding == COLUMN_FLOAT32) ok = bytes == c->n_frames*sizeof(float);
+    if (encoding == COLUMN_INT16)   ok = bytes == column_quant_bound(c->n_frames, 16);
+    if (encoding == COLUMN_INT24)   ok = bytes == column_quant_bound(c->n_frames, 24);
+    if (!ok) return false;
+  }
+
+  return true;
+}
+
+/* The record at `offset` is inside [FILE_HDR_SIZE, end), looks like a chunk
+   and its columns fit. Says nothing about the crc. */
+
+static bool
+check_chunk(capture_reader_t const* r,
+            uint64_t                offset,
+            uint64_t                end)
+{
+  if (offset < FILE_HDR_SIZE || offset > end || end - offset < sizeof(chunk_t)) return false;
+
+  chunk_t const* c = (chunk_t const*)(r->map + offset);
+  if (c->hdr.type != RECORD_CHUNK || c->sync != CHUNK_SYNC)       return false;
+  if (c->hdr.size > end - offset)                                return false;
+  if (c->data_offset < sizeof(chunk_t))                          return false;
+  if (c->data_offset > c->hdr.size)                              return false;
+  if (c->n_frames == 0 || c->n_frames > CAPTURE_CHUNK_FRAMES)    return false;
+  return check_columns(c);
+}
+
+/* Worked out again the way the writer did, see disk.h. Only for chunks
+   check_chunk passed. */
+
+static bool
+check_crc(chunk_t const* c)
+{
+  size_t      at  = offsetof(chunk_t, crc);
+  char const* p   = (char const*)c;
+  uint32_t    crc = crc32c(0, p, at);
+  crc = crc32c(crc, p + at + sizeof(uint32_t), c->hdr.size - at - sizeof(uint32_t));
+  return crc == c->crc;
+}
+
+/* Everything the index points at is inside the file and looks like a chunk,
+   in frame and sequence order. Their crcs are left for when they're read,
+   which is what keeps opening a segment from reading all of it. */
+
+static bool
+check_index(capture_reader_t const* r,
+            uint64_t                end)
+{
+  chunk_index_t const* idx = r->index;
+  size_t max_entries       = (idx->hdr.size - sizeof(chunk_index_t))/sizeof(index_entry_t);
+  if (idx->n_entries > max_entries) return false;
+
+  uint64_t next = 0;
+  uint32_t seq  = 0;
+  for (size_t i = 0; i < idx->n_entries; ++i) {
+    index_entry_t const* e = idx->entries + i;
+    if (e->frame < next || !check_chunk(r, e->offset, end)) return false;
+
+    chunk_t const* c = (chunk_t const*)(r->map + e->offset);
+    if (c->hdr.frame != e->frame || c->n_frames != e->n_frames) return false;
+    if (i > 0 && c->sequence != seq + 1)                       return false;
+
+    next = e->frame + e->n_frames;
+    seq  = c->sequence;
+  }
+
+  return true;
+}
+
+/* Start of the first chunk from `from` on that checks out, crc and all, or
+   `end` if there isn't one */
+
+static uint64_t
+resync(capture_reader_t const* r,
+       uint64_t                from,
+       uint64_t                end)
+{
+  uint32_t const sync = CHUNK_SYNC;
+  size_t const   at   = offsetof(chunk_t, sync);
+
+  while (from < end && end - from >= sizeof(chunk_t)) {
+    char const* p = (char const*)memmem(r->map + from + at, end - from - at, &sync, sizeof(sync));
+    if (!p) break;
+
+    uint64_t offset = (uint64_t)(p - r->map) - at;
+    if (check_chunk(r, offset, end) && check_crc((chunk_t const*)(r->map + offset))) return offset;
+    from = offset + 1;
+  }
+
+  return end;
+}
+
+/* Find the chunks of a segment without a usable index by walking its
+   records. A record that can't be right (zeros past the last one of a
+   segment that wasn't closed, too) or a chunk that doesn't check out means
+   something is damaged: everything after the last good chunk is suspect, so
+   look again from there for the next chunk that does check out, and walk on
+   from it. */
+
+static void
+scan(capture_reader_t* r,
+     uint64_t          end)
+{
+  chunk_index_t* idx  = r->found;
+  uint64_t       pos  = FILE_HDR_SIZE;
+  uint64_t       good = FILE_HDR_SIZE; /* just past the last good chunk */
+  uint64_t       next = 0;             /* frame */
+  uint32_t       seq  = 0;
+
+  memset(idx, 0, sizeof(chunk_index_t));
+  idx->hdr.type = RECORD_INDEX;
+
+  while (pos < end && idx->n_entries < MAX_CHUNKS) {
+    record_hdr_t const* h  = (record_hdr_t const*)(r->map + pos);
+    bool                ok = end - pos >= sizeof(record_hdr_t)
+                             && h->size >= sizeof(record_hdr_t) && h->size <= end - pos;
+    if (ok && h->type == RECORD_CHUNK) {
+      ok = check_chunk(r, pos, end) && check_crc((chunk_t const*)h);
+    }
+    if (!ok) {
+      pos = resync(r, good, end);
+      continue;
+    }
+
+    /* anything going backwards can't be from this run's writer */
+    chunk_t const* c     = (chunk_t const*)h;
+    bool           ahead = idx->n_entries == 0 || (h->frame >= next && c->sequence > seq);
+    if (h->type == RECORD_CHUNK && ahead) {
+      if (idx->n_entries > 0) r->n_lost += c->sequence - seq - 1;
+
+      index_entry_t* e = idx->entries + idx->n_entries++;
+      e->frame    = h->frame;
+      e->n_frames = c->n_frames;
+      e->reserved = 0;
+      e->offset   = pos;
+
+      next = h->frame + c->n_frames;
+      seq  = c->sequence;
+    }
+
+    pos += h->size;
+    if (h->type == RECORD_CHUNK) good = pos;
+  }
+
+  idx->hdr.size  = (uint32_t)(sizeof(chunk_index_t) + idx->n_entries*sizeof(index_entry_t));
+  idx->hdr.frame = idx->n_entries ? idx->entries[0].frame : 0;
+}
+
+/* The segment was closed cleanly and its index is sound */
+
+static bool
+usable_index(capture_reader_t* r,
+             uint64_t          end)
+{
+  file_hdr_t const* hdr = capture_reader_hdr(r);
+  if (hdr->length == FILE_LENGTH_UNKNOWN || hdr->index == 0)                return false;
+  if (hdr->length > r->size - FILE_HDR_SIZE)                                return false;
+  if (hdr->index < FILE_HDR_SIZE || hdr->index > end - sizeof(chunk_index_t)) return false;
+
+  r->index = (chunk_index_t const*)(r->map + hdr->index);
+  return r->index->hdr.type == RECORD_INDEX
+         && r->index->hdr.size >= sizeof(chunk_index_t)
+         && r->index->hdr.size <= end - hdr->index
+         && check_index(r, end);
+}
+
+size_t
+capture_reader_footprint(void)
+{
+  size_t footprint = ALIGN(sizeof(capture_reader_t), CACHELINE);
+  footprint += CAPTURE_CHUNK_FRAMES*sizeof(float);
+  footprint = ALIGN(footprint, capture_synth_align());
+  footprint += capture_synth_footprint();
+  footprint = ALIGN(footprint, _Alignof(chunk_index_t));
+  footprint += sizeof(chunk_index_t) + MAX_CHUNKS*sizeof(index_entry_t);
+  return footprint;
+}
+
+size_t
+capture_reader_align(void)
+{
+  return CACHELINE;
+}
+
+capture_reader_t*
+create_capture_reader(void*       mem,
+                      char const* path,
+                      int*        opt_err)
+{
+  if (!mem || !path) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    if (opt_err) *opt_err = APP_ERR_OPEN;
+    return NULL;
+  }
+
+  struct stat st;
+  if (0 != fstat(fd, &st) || (size_t)st.st_size < FILE_HDR_SIZE) {
+    close(fd);
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  /* the mapping holds its own reference to the file */
+  size_t size = (size_t)st.st_size;
+  void*  map  = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    if (opt_err) *opt_err = APP_ERR_OPEN;
+    return NULL;
+  }
+
+  capture_reader_t* r = (capture_reader_t*)mem;
+  r->map   = (char const*)map;
+  r->size  = size;
+  r->index = NULL;
+  r->synth = NULL;
+  r->scratch = (float*)((char*)mem + ALIGN(sizeof(capture_reader_t), CACHELINE));
+  r->scratch_chunk   = SIZE_MAX;
+  r->scratch_channel = SIZE_MAX;
+  r->n_lost   = 0;
+  r->verified = SIZE_MAX;
+
+  file_hdr_t const* hdr = capture_reader_hdr(r);
+  if (hdr->magic != FILE_MAGIC || hdr->version != FILE_VERSION || hdr->hdr_size != FILE_HDR_SIZE) {
+    munmap(map, size);
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  char* ptr = (char*)(r->scratch + CAPTURE_CHUNK_FRAMES);
+  ptr = (char*)ALIGN((size_t)ptr, capture_synth_align());
+
+  /* only synthesized columns need it, so a meta it can't use isn't fatal */
+  r->synth = create_capture_synth(ptr, capture_reader_meta(r), NULL);
+  ptr += capture_synth_footprint();
+
+  ptr = (char*)ALIGN((size_t)ptr, _Alignof(chunk_index_t));
+  r->found = (chunk_index_t*)ptr;
+
+  /* records stop at the length, if we have one that fits */
+  uint64_t end = size;
+  if (hdr->length != FILE_LENGTH_UNKNOWN && hdr->length <= size - FILE_HDR_SIZE) {
+    end = FILE_HDR_SIZE + hdr->length;
+  }
+
+  if (!usable_index(r, end)) {
+    scan(r, end);
+    r->index = r->found;
+  }
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return r;
+}
+
+void*
+destroy_capture_reader(capture_reader_t* r)
+{
+  if (!r) return NULL;
+
+  if (r->synth) destroy_capture_synth(r->synth);
+  munmap((void*)r->map, r->size);
+  return (void*)r;
+}
+
+file_hdr_t const*
+capture_reader_hdr(capture_reader_t const* r)
+{
+  return (file_hdr_t const*)r->map;
+}
+
+capture_meta_t const*
+capture_reader_meta(capture_reader_t const* r)
+{
+  return (capture_meta_t const*)(r->map + FILE_META_OFFSET);
+}
+
+size_t
+capture_reader_n_chunks(capture_reader_t const* r)
+{
+  return (size_t)r->index->n_entries;
+}
+
+size_t
+capture_reader_n_lost(capture_reader_t const* r)
+{
+  return r->n_lost;
+}
+
+bool
+capture_reader_scanned(capture_reader_t const* r)
+{
+  return r->index == r->found;
+}
+
+chunk_t const*
+capture_reader_chunk(capture_reader_t const* r,
+                     size_t                  i)
+{
+  return (chunk_t const*)(r->map + r->index->entries[i].offset);
+}
+
+size_t
+capture_reader_find(capture_reader_t const* r,
+                    uint64_t                frame)
+{
+  index_entry_t const* e = r->index->entries;
+  size_t               n = capture_reader_n_chunks(r);
+  if (n == 0 || frame < e[0].frame) return n;
+
+  /* without gaps every chunk but the last is full */
+  size_t chunk_frames = capture_reader_meta(r)->chunk_frames;
+  if (chunk_frames) {
+    uint64_t guess = (frame - e[0].frame)/chunk_frames;
+    if (guess < n && frame >= e[guess].frame && frame - e[guess].frame < e[guess].n_frames) {
+      return (size_t)guess;
+    }
+  }
+
+  /* last chunk starting at or before frame */
+  size_t lo = 0;
+  size_t hi = n;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo)/2;
+    if (e[mid].frame <= frame) lo = mid;
+    else                       hi = mid;
+  }
+
+  return frame - e[lo].frame < e[lo].n_frames ? lo : n;
+}
+
+int
+capture_reader_verify(capture_reader_t const* r,
+                      size_t                  i)
+{
+  /* found ones were checked on the way in */
+  if (capture_reader_scanned(r)) return APP_SUCCESS;
+  return check_crc(capture_reader_chunk(r, i)) ? APP_SUCCESS : APP_ERR_CORRUPT;
+}
+
+/* capture_reader_column, leaving the crc to the caller */
+
+static int
+decode(capture_reader_t const* r,
+       size_t                  i,
+       size_t                  channel,
+       float*                  out)
+{
+  chunk_t const* c   = capture_reader_chunk(r, i);
+  column_t       col = locate(c, channel);
+  if (col.encoding == COLUMN_FLOAT32) {
+    memcpy(out, col.data, col.bytes);
+    return APP_SUCCESS;
+  }
+
+  if (col.encoding == COLUMN_SYNTH) {
+    if (!r->synth) return APP_ERR_INVAL;
+    return capture_synth_column(r->synth, channel, col.data, col.bytes, c->n_frames, out);
+  }
+
+  if (col.encoding == COLUMN_INT16 || col.encoding == COLUMN_INT24) {
+    unsigned bits = col.encoding == COLUMN_INT16 ? 16 : 24;
+    return column_quant_decode((uint8_t const*)col.data, col.bytes, c->n_frames, bits, out);
+  }
+
+  return column_codec_decode((uint8_t const*)col.data, col.bytes, c->n_frames, out);
+}
+
+int
+capture_reader_column(capture_reader_t const* r,
+                      size_t                  i,
+                      size_t                  channel,
+                      float*                  out)
+{
+  if (channel >= capture_reader_chunk(r, i)->n_channels) return APP_ERR_INVAL;
+
+  int err = capture_reader_verify(r, i);
+  if (err != APP_SUCCESS) return err;
+  return decode(r, i, channel, out);
+}
+
+size_t
+capture_reader_read(capture_reader_t* r,
+                    size_t            channel,
+                    uint64_t          frame,
+                    float*            out,
+                    size_t            n_frames)
+{
+  size_t n    = capture_reader_n_chunks(r);
+  size_t done = 0;
+  size_t i    = capture_reader_find(r, frame);
+
+  while (done < n_frames && i < n) {
+    chunk_t const* c = capture_reader_chunk(r, i);
+    if (channel >= c->n_channels) break;
+
+    uint64_t at = frame + done;
+    if (at < c->hdr.frame || at - c->hdr.frame >= c->n_frames) break; /* gap */
+
+    /* a damaged chunk is as far as this goes, the next can be found */
+    if (r->verified != i) {
+      if (capture_reader_verify(r, i) != APP_SUCCESS) break;
+      r->verified = i;
+    }
+
+    size_t   skip = (size_t)(at - c->hdr.frame);
+    size_t   take = MIN(n_frames - done, c->n_frames - skip);
+    column_t col  = locate(c, channel);
+
+    if (col.encoding == COLUMN_FLOAT32) {
+      memcpy(out + done, (float const*)col.data + skip, take*sizeof(float));
+    }
+    else if (take == c->n_frames) {
+      if (decode(r, i, channel, out + done) != APP_SUCCESS) break;
+    }
+    else {
+      /* partial reads of one column tend to come in a row */
+      if (r->scratch_chunk != i || r->scratch_channel != channel) {
+        r->scratch_chunk = SIZE_MAX;
+        if (decode(r, i, channel, r->scratch) != APP_SUCCESS) break;
+        r->scratch_chunk   = i;
+        r->scratch_channel = channel;
+      }
+      memcpy(out + done, r->scratch + skip, take*sizeof(float));
+    }
+    done += take;
+    i    += 1;
+  }
+
+  return done;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "disk.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Reads the sample columns of one segment (disk.h) in place,
+   through a read only mmap of the file.
+
+   The index at the end of the segment is what makes this cheap: finding the
+   chunk that holds a frame is a guess from chunk_frames, checked against the
+   index, with a binary search when gaps threw the guess off. Raw columns are
+   read straight out of the mapping, packed and quantized ones (CHUNK_PACKED)
+   are decoded and synthesized ones made again by the generators
+   (capture_synth.h) on the way, so callers don't need to care which they
+   got.
+
+   Each chunk's crc (disk.h) is checked before anything is taken from it,
+   once per chunk for reads that come in a row, and a chunk that fails is
+   treated like one that isn't there. Reading on past it finds the next one
+   through the index as usual.
+
+   Segments without an index (the run didn't stop cleanly), or whose index
+   doesn't hold together, have their records walked on opening instead, and
+   the chunks found there stand in for the index. Damage on the way is
+   stepped over by looking for the next CHUNK_SYNC that starts a chunk whose
+   crc checks out. That reads the whole segment, so those chunks aren't
+   checked again. */
+
+typedef struct capture_reader capture_reader_t;
+
+size_t
+capture_reader_footprint(void);
+
+size_t
+capture_reader_align(void);
+
+/* APP_ERR_OPEN if `path` can't be opened or mapped, APP_ERR_INVAL if it isn't
+   a version FILE_VERSION segment */
+
+capture_reader_t*
+create_capture_reader(void*       mem,
+                      char const* path,
+                      int*        opt_err);
+
+void*
+destroy_capture_reader(capture_reader_t* r);
+
+file_hdr_t const*
+capture_reader_hdr(capture_reader_t const* r);
+
+capture_meta_t const*
+capture_reader_meta(capture_reader_t const* r);
+
+size_t
+capture_reader_n_chunks(capture_reader_t const* r);
+
+/* The chunks came from walking the records, not the segment's index */
+
+bool
+capture_reader_scanned(capture_reader_t const* r);
+
+/* Chunks the walk found gaps in the sequence numbers for: ones that were
+   written but were too damaged to find. Doesn't see any lost before the first
+   chunk found or after the last. 0 with an index. */
+
+size_t
+capture_reader_n_lost(capture_reader_t const* r);
+
+/* APP_ERR_CORRUPT if chunk `i` fails its crc */
+
+int
+capture_reader_verify(capture_reader_t const* r,
+                      size_t                  i);
+
+/* Chunk `i`, in frame order. Its columns are only usable as they are for
+   CHUNK_RAW, see capture_reader_column. */
+
+chunk_t const*
+capture_reader_chunk(capture_reader_t const* r,
+                     size_t                  i);
+
+/* Chunk holding `frame`, or capture_reader_n_chunks if no chunk does */
+
+size_t
+capture_reader_find(capture_reader_t const* r,
+                    uint64_t                frame);
+
+/* All of `channel` in chunk `i`, the chunk's n_frames samples, into `out`.
+   APP_ERR_INVAL if the channel doesn't exist or wouldn't decode,
+   APP_ERR_CORRUPT if the chunk fails its crc. Uses the
+   reader's generators for synthesized columns, so it's one caller at a time
+   like capture_reader_read. */
+
+int
+capture_reader_column(capture_reader_t const* r,
+                      size_t                  i,
+                      size_t                  channel,
+                      float*                  out);
+
+/* Copy up to `n_frames` of `channel` from `frame` on into `out`. Stops at the
+   first frame the segment doesn't have (or can't decode, or is in a chunk
+   that fails its crc), and returns how many were copied. Keeps the last
+   packed column it decoded, so it's one caller at a time. */
+
+size_t
+capture_reader_read(capture_reader_t* r,
+                    size_t            channel,
+                    uint64_t          frame,
+                    float*            out,
+                    size_t            n_frames);
@@ -0,0 +1,154 @@
+#include "capture_synth.h"
+
+#include "additive_square.h"
+#include "common.h"
+#include "envelope.h"
+#include "err.h"
+
+#include <string.h>
+
+struct capture_synth {
+  float              frequency_hz;
+  size_t             square_channel;  /* in the meta's channels, SIZE_MAX for none */
+  size_t             pulse_channel;
+  additive_square_t* sq;
+  envelope_t*        env;
+
+  /* Trailing memory contains the generators */
+};
+
+static size_t
+find_channel(capture_meta_t const* meta,
+             char const*           name)
+{
+  for (size_t ch = 0; ch < meta->n_channels && ch < CAPTURE_MAX_CHANNELS; ++ch) {
+    if (0 == strncmp(meta->channels[ch], name, CAPTURE_NAME_SIZE)) return ch;
+  }
+  return SIZE_MAX;
+}
+
+static int
+synth_square(capture_synth_t* s,
+             void const*      state,
+             size_t           bytes,
+             size_t           n_frames,
+             float*           out)
+{
+  synth_square_t sq[1];
+  if (bytes != sizeof(sq)) return APP_ERR_INVAL;
+  memcpy(sq, state, sizeof(sq));
+
+  additive_square_set_phase(s->sq, sq->phase);
+  return additive_square_generate_samples(s->sq, n_frames, s->frequency_hz, out);
+}
+
+/* Same steps app_poll takes: run up to each strike, restart, carry on */
+
+static int
+synth_pulse(capture_synth_t* s,
+            void const*      state,
+            size_t           bytes,
+            size_t           n_frames,
+            float*           out)
+{
+  synth_pulse_t p[1];
+  if (bytes < sizeof(p)) return APP_ERR_INVAL;
+  memcpy(p, state, sizeof(p));
+  if (bytes != sizeof(p) + p->n_strikes*sizeof(uint32_t)) return APP_ERR_INVAL;
+
+  uint32_t const* strikes = (uint32_t const*)((char const*)state + sizeof(p));
+  envelope_set_position(s->env, p->position);
+
+  size_t generated = 0;
+  for (size_t i = 0; i < p->n_strikes; ++i) {
+    uint32_t at;
+    memcpy(&at, strikes + i, sizeof(at));
+    if (at < generated || at >= n_frames) return APP_ERR_INVAL;
+
+    int err = envelope_generate_samples(s->env, at - generated, out + generated);
+    if (err != APP_SUCCESS) return err;
+    generated = at;
+
+    envelope_strike(s->env);
+  }
+
+  return envelope_generate_samples(s->env, n_frames - generated, out + generated);
+}
+
+size_t
+capture_synth_footprint(void)
+{
+  size_t footprint = sizeof(capture_synth_t);
+  footprint = ALIGN(footprint, additive_square_align());
+  footprint += additive_square_footprint();
+  footprint = ALIGN(footprint, envelope_align());
+  footprint += envelope_footprint();
+  return footprint;
+}
+
+size_t
+capture_synth_align(void)
+{
+  return MAX(_Alignof(capture_synth_t), MAX(additive_square_align(), envelope_align()));
+}
+
+capture_synth_t*
+create_capture_synth(void*                 mem,
+                     capture_meta_t const* meta,
+                     int*                  opt_err)
+{
+  /* the square wave sums harmonics up to nyquist, so needs a positive
+     frequency to ever finish */
+  if (!mem || !meta || meta->sample_rate_hz == 0 || !(meta->drive_frequency_hz > 0.0f)
+      || meta->envelope_type > ENVELOPE_LOGARITHMIC) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  capture_synth_t* s = (capture_synth_t*)mem;
+  s->frequency_hz   = meta->drive_frequency_hz;
+  s->square_channel = find_channel(meta, "square_out");
+  s->pulse_channel  = find_channel(meta, "pulse_out");
+
+  /* every type's parameter is the union's one float */
+  envelope_setting_t setting[1];
+  memset(setting, 0, sizeof(setting));
+  setting->type              = (int)meta->envelope_type;
+  setting->u.constant->value = meta->envelope_param;
+
+  char* ptr = (char*)mem + sizeof(capture_synth_t);
+  ptr = (char*)ALIGN((size_t)ptr, additive_square_align());
+  s->sq = create_additive_square(ptr, meta->sample_rate_hz, opt_err);
+  if (!s->sq) return NULL; /* opt_err already set */
+  ptr += additive_square_footprint();
+
+  ptr = (char*)ALIGN((size_t)ptr, envelope_align());
+  s->env = create_envelope(ptr, setting, opt_err);
+  if (!s->env) return NULL; /* opt_err already set */
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return s;
+}
+
+void*
+destroy_capture_synth(capture_synth_t* s)
+{
+  if (!s) return NULL;
+
+  destroy_envelope(s->env);
+  destroy_additive_square(s->sq);
+  return (void*)s;
+}
+
+int
+capture_synth_column(capture_synth_t* s,
+                     size_t           channel,
+                     void const*      state,
+                     size_t           bytes,
+                     size_t           n_frames,
+                     float*           out)
+{
+  if (channel == s->square_channel) return synth_square(s, state, bytes, n_frames, out);
+  if (channel == s->pulse_channel)  return synth_pulse(s, state, bytes, n_frames, out);
+  return APP_ERR_INVAL;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "disk.h"
+
+#include <stddef.h>
+
+/* Makes a COLUMN_SYNTH column's samples (disk.h) again, from the state the
+   generator was in at the chunk's first frame and the run's capture_meta.
+
+   It runs the same additive_square and envelope code app_poll does, from the
+   same state, so the samples come out bit for bit the same, as long as it's
+   the same build. The disk thread only leaves a column out after checking
+   that here. */
+
+typedef struct capture_synth capture_synth_t;
+
+size_t
+capture_synth_footprint(void);
+
+size_t
+capture_synth_align(void);
+
+/* APP_ERR_INVAL if `meta` doesn't describe generators this code can run */
+
+capture_synth_t*
+create_capture_synth(void*                 mem,
+                     capture_meta_t const* meta,
+                     int*                  opt_err);
+
+void*
+destroy_capture_synth(capture_synth_t* s);
+
+/* Channel `channel` of the meta's channels, n_frames of it, from the
+   synth_square or synth_pulse in `state`. APP_ERR_INVAL if the channel isn't
+   square_out or pulse_out, or the state doesn't make sense for n_frames. */
+
+int
+capture_synth_column(capture_synth_t* s,
+                     size_t           channel,
+                     void const*      state,
+                     size_t           bytes,
+                     size_t           n_frames,
+                     float*           out);
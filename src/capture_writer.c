@@ -0,0 +1,499 @@
+#include "capture_writer.h"
+
+#include "capture_synth.h"
+#include "column_codec.h"
+#include "column_quant.h"
+#include "common.h"
+#include "crc32c.h"
+#include "err.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+
+/* records handed to the writer at once, fft bins take two */
+#define MAX_IOV 64
+
+/* sample sets carry these, in this order */
+#define N_CHANNELS 3
+#define SQUARE_OUT 0
+#define PULSE_OUT  1
+
+#if CAPTURE_CHUNK_FRAMES < SAMPLE_SET_MAX_FRAMES
+#error "a sample set has to fit in a chunk"
+#endif
+
+#define VALID_BITS(b) ((b) == 32 || (b) == 24 || (b) == 16)
+#if !VALID_BITS(CAPTURE_SQUARE_BITS) || !VALID_BITS(CAPTURE_PULSE_BITS) || !VALID_BITS(CAPTURE_LXD_IN_BITS)
+#error "channels are stored as 32 bit floats, or 24 or 16 bit ints"
+#endif
+
+/* anything but raw floats needs the column_hdrs of CHUNK_PACKED */
+#define COLUMN_HDRS (CAPTURE_PACK || CAPTURE_SYNTH || CAPTURE_SQUARE_BITS < 32 \
+                     || CAPTURE_PULSE_BITS < 32 || CAPTURE_LXD_IN_BITS < 32)
+
+static char const*    channel_names[N_CHANNELS] = { "square_out", "pulse_out", "lxd_in" };
+static unsigned const channel_bits[N_CHANNELS]  = { CAPTURE_SQUARE_BITS, CAPTURE_PULSE_BITS,
+                                                    CAPTURE_LXD_IN_BITS };
+
+struct capture_writer {
+  disk_writer_t* w;
+
+  /* chunk being filled */
+  uint64_t       first;      /* frame */
+  size_t         n_frames;
+  float*         columns;    /* N_CHANNELS columns of CAPTURE_CHUNK_FRAMES, trailing */
+  float          square_phase;      /* generators at `first`, from its sample set */
+  uint32_t       envelope_position;
+
+  /* CAPTURE_SYNTH: strikes seen that no chunk has covered yet, in order */
+  uint64_t       strikes[CAPTURE_MAX_STRIKES];
+  size_t         n_strikes;
+
+  /* CAPTURE_SYNTH: makes the chunk's square_out and pulse_out again to check
+     they come out the same, NULL if the meta's generators can't be run.
+     Both trailing. */
+  capture_synth_t* synth;
+  float*           check;    /* CAPTURE_CHUNK_FRAMES */
+  synth_square_t   square_state[1];
+  _Alignas(8) char pulse_state[sizeof(synth_pulse_t) + CAPTURE_MAX_STRIKES*sizeof(uint32_t)];
+
+  /* this segment's chunks, trailing */
+  chunk_index_t* index;
+  uint32_t       sequence;   /* the next chunk's, counted over the run */
+
+  /* added and not committed yet */
+  struct iovec   iov[MAX_IOV];
+  size_t         n_iov;
+  fft_bins_t     fft[MAX_IOV/2];
+  size_t         n_fft;
+
+  /* chunk header, the padding after it, and column_hdrs */
+  _Alignas(8) char chunk_hdr[sizeof(chunk_t) + CHUNK_COLUMN_ALIGN + N_CHANNELS*sizeof(column_hdr_t)];
+
+  /* CAPTURE_PACK or quantized output, column_codec_bound(CAPTURE_CHUNK_FRAMES)
+     per channel (more than either needs), trailing */
+  uint8_t*       packed;
+
+  /* CAPTURE_DITHER noise */
+  column_quant_rng_t rng[1];
+
+  /* read by whoever reports on the codec */
+  atomic_uint_fast64_t raw_bytes;
+  atomic_uint_fast64_t packed_bytes;
+  atomic_uint_fast64_t pack_ns;
+};
+
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void
+add_stat(atomic_uint_fast64_t* stat,
+         uint64_t              v)
+{
+  /* only this thread writes */
+  atomic_store_explicit(stat, atomic_load_explicit(stat, memory_order_relaxed) + v,
+                        memory_order_relaxed);
+}
+
+static size_t
+index_footprint(void)
+{
+  return sizeof(chunk_index_t) + (CAPTURE_MAX_CHUNKS + CAPTURE_INDEX_SLACK)*sizeof(index_entry_t);
+}
+
+/* Forget strikes before `frame`, no chunk from here on can have them */
+
+static void
+drop_strikes(capture_writer_t* c,
+             uint64_t          frame)
+{
+  size_t n = 0;
+  while (n < c->n_strikes && c->strikes[n] < frame) n += 1;
+
+  memmove(c->strikes, c->strikes + n, (c->n_strikes - n)*sizeof(c->strikes[0]));
+  c->n_strikes -= n;
+}
+
+/* The generator state that makes channel `ch` of the chunk being filled, in
+   *state, if there is one and it makes exactly the samples we have. Returns
+   its size, 0 if the column has to be stored. */
+
+static size_t
+synth_column(capture_writer_t* c,
+             size_t            ch,
+             void**            state)
+{
+  size_t bytes = 0;
+
+  if (ch == SQUARE_OUT) {
+    memset(c->square_state, 0, sizeof(c->square_state));
+    c->square_state->phase = c->square_phase;
+    *state = c->square_state;
+    bytes  = sizeof(c->square_state);
+  }
+  else if (ch == PULSE_OUT) {
+    synth_pulse_t* p       = (synth_pulse_t*)c->pulse_state;
+    uint32_t*      strikes = (uint32_t*)(c->pulse_state + sizeof(synth_pulse_t));
+    p->position  = c->envelope_position;
+    p->n_strikes = 0;
+
+    for (size_t i = 0; i < c->n_strikes && c->strikes[i] < c->first + c->n_frames; ++i) {
+      if (c->strikes[i] < c->first) continue;
+      strikes[p->n_strikes++] = (uint32_t)(c->strikes[i] - c->first);
+    }
+    *state = p;
+    bytes  = sizeof(synth_pulse_t) + p->n_strikes*sizeof(uint32_t);
+  }
+  else {
+    return 0;
+  }
+
+  /* a dropped strike record, say, would make something else */
+  int err = capture_synth_column(c->synth, ch, *state, bytes, c->n_frames, c->check);
+  if (err != APP_SUCCESS) return 0;
+  if (0 != memcmp(c->check, c->columns + ch*CAPTURE_CHUNK_FRAMES, c->n_frames*sizeof(float))) {
+    return 0;
+  }
+  return bytes;
+}
+
+/* Encode each column: left out for its generator state if CAPTURE_SYNTH and
+   that makes it again, rounded to ints in c->packed if its channel_bits say
+   so, packed there if CAPTURE_PACK and that makes it smaller, raw floats
+   otherwise. Fills in the column_hdrs and the iovecs after the header's. */
+
+static size_t
+encode_columns(capture_writer_t* c,
+               column_hdr_t*     cols,
+               struct iovec*     iov)
+{
+  uint64_t start = now_ns();
+  size_t   raw   = c->n_frames*sizeof(float);
+  size_t   total = 0;
+
+  for (size_t ch = 0; ch < N_CHANNELS; ++ch) {
+    float const* in    = c->columns + ch*CAPTURE_CHUNK_FRAMES;
+    uint8_t*     out   = c->packed + ch*column_codec_bound(CAPTURE_CHUNK_FRAMES);
+    void*        state = NULL;
+    size_t       n     = 0;
+
+    memset(cols + ch, 0, sizeof(*cols));
+    if (CAPTURE_SYNTH && c->synth && (n = synth_column(c, ch, &state)) != 0) {
+      cols[ch].encoding = COLUMN_SYNTH;
+      iov[ch].iov_base  = state;
+    }
+    else if (channel_bits[ch] < 32
+             && (n = column_quant_encode(in, c->n_frames, channel_bits[ch],
+                                         CAPTURE_DITHER ? c->rng : NULL, out)) != 0) {
+      cols[ch].encoding = channel_bits[ch] == 16 ? COLUMN_INT16 : COLUMN_INT24;
+      iov[ch].iov_base  = out;
+    }
+    else if (CAPTURE_PACK && (n = column_codec_encode(in, c->n_frames, out)) < raw) {
+      cols[ch].encoding = COLUMN_XOR_PLANES;
+      iov[ch].iov_base  = out;
+    }
+    else {
+      cols[ch].encoding = COLUMN_FLOAT32;
+      iov[ch].iov_base  = (void*)in;
+      n                 = raw;
+    }
+    cols[ch].bytes  = (uint32_t)n;
+    iov[ch].iov_len = n;
+    total          += n;
+  }
+
+  add_stat(&c->raw_bytes, N_CHANNELS*raw);
+  add_stat(&c->packed_bytes, total);
+  add_stat(&c->pack_ns, now_ns() - start);
+  return total;
+}
+
+/* CRC32C of the chunk as it will be in the file, skipping the crc field */
+
+static uint32_t
+chunk_crc(struct iovec const* iov,
+          size_t              n)
+{
+  size_t   at  = offsetof(chunk_t, crc);
+  char*    hdr = (char*)iov[0].iov_base;
+  uint32_t crc = crc32c(0, hdr, at);
+  crc = crc32c(crc, hdr + at + sizeof(uint32_t), iov[0].iov_len - at - sizeof(uint32_t));
+
+  for (size_t i = 1; i < n; ++i) crc = crc32c(crc, iov[i].iov_base, iov[i].iov_len);
+  return crc;
+}
+
+/* Write the chunk being filled, if it has anything. Goes ahead of whatever
+   is waiting for commit, that only changes the order in the file. */
+
+static int
+write_chunk(capture_writer_t* c)
+{
+  if (c->n_frames == 0) return APP_SUCCESS;
+
+  chunk_index_t* idx = c->index;
+  if (idx->n_entries == CAPTURE_MAX_CHUNKS + CAPTURE_INDEX_SLACK) return APP_ERR_INVAL;
+
+  /* columns go where they're aligned in the file */
+  uint64_t offset = FILE_HDR_SIZE + disk_writer_bytes(c->w);
+  uint64_t data   = ALIGN(offset + sizeof(chunk_t), CHUNK_COLUMN_ALIGN);
+
+  memset(c->chunk_hdr, 0, sizeof(c->chunk_hdr));
+  chunk_t* chunk     = (chunk_t*)c->chunk_hdr;
+  chunk->hdr.type    = RECORD_CHUNK;
+  chunk->hdr.frame   = c->first;
+  chunk->n_frames    = (uint32_t)c->n_frames;
+  chunk->n_channels  = N_CHANNELS;
+  chunk->data_offset = (uint32_t)(data - offset);
+
+  struct iovec iov[1 + N_CHANNELS];
+  iov[0].iov_base = chunk;
+  iov[0].iov_len  = chunk->data_offset;
+
+  size_t columns;
+  if (COLUMN_HDRS) {
+    chunk->layout   = CHUNK_PACKED;
+    iov[0].iov_len += N_CHANNELS*sizeof(column_hdr_t);
+    columns = encode_columns(c, (column_hdr_t*)(c->chunk_hdr + chunk->data_offset), iov + 1);
+  }
+  else {
+    chunk->layout = CHUNK_RAW;
+    for (size_t ch = 0; ch < N_CHANNELS; ++ch) {
+      iov[1 + ch].iov_base = c->columns + ch*CAPTURE_CHUNK_FRAMES;
+      iov[1 + ch].iov_len  = c->n_frames*sizeof(float);
+    }
+    columns = N_CHANNELS*c->n_frames*sizeof(float);
+  }
+  chunk->hdr.size = (uint32_t)(iov[0].iov_len + columns);
+  chunk->sync     = CHUNK_SYNC;
+  chunk->sequence = c->sequence;
+  chunk->crc      = chunk_crc(iov, ARRAY_SIZE(iov));
+
+  int err = disk_writer_append(c->w, iov, ARRAY_SIZE(iov));
+  if (err != APP_SUCCESS) return err;
+
+  index_entry_t* e = idx->entries + idx->n_entries++;
+  e->frame    = c->first;
+  e->n_frames = (uint32_t)c->n_frames;
+  e->reserved = 0;
+  e->offset   = offset;
+  c->sequence += 1;
+
+  drop_strikes(c, c->first + c->n_frames);
+  c->n_frames = 0;
+  return APP_SUCCESS;
+}
+
+size_t
+capture_writer_footprint(void)
+{
+  size_t footprint = sizeof(capture_writer_t);
+  footprint = ALIGN(footprint, CACHELINE);
+  footprint += N_CHANNELS*CAPTURE_CHUNK_FRAMES*sizeof(float);
+  footprint = ALIGN(footprint, CACHELINE);
+  footprint += index_footprint();
+  footprint = ALIGN(footprint, CACHELINE);
+  footprint += N_CHANNELS*column_codec_bound(CAPTURE_CHUNK_FRAMES);
+  footprint = ALIGN(footprint, CACHELINE);
+  footprint += CAPTURE_CHUNK_FRAMES*sizeof(float);
+  footprint = ALIGN(footprint, capture_synth_align());
+  footprint += capture_synth_footprint();
+  return footprint;
+}
+
+size_t
+capture_writer_align(void)
+{
+  return CACHELINE;
+}
+
+capture_writer_t*
+create_capture_writer(void*                 mem,
+                      disk_writer_t*        w,
+                      capture_meta_t const* meta,
+                      int*                  opt_err)
+{
+  if (!mem || !w || !meta || meta->n_channels != N_CHANNELS) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  for (size_t ch = 0; ch < N_CHANNELS; ++ch) {
+    if (0 != strncmp(meta->channels[ch], channel_names[ch], CAPTURE_NAME_SIZE)) {
+      if (opt_err) *opt_err = APP_ERR_INVAL;
+      return NULL;
+    }
+  }
+
+  capture_meta_t m[1];
+  memcpy(m, meta, sizeof(m));
+  m->chunk_frames = CAPTURE_CHUNK_FRAMES;
+
+  int err = disk_writer_set_meta(w, m, sizeof(m));
+  if (err != APP_SUCCESS) {
+    if (opt_err) *opt_err = err;
+    return NULL;
+  }
+
+  capture_writer_t* c = (capture_writer_t*)mem;
+  memset(c, 0, sizeof(*c));
+  c->w = w;
+
+  char* ptr = (char*)mem + sizeof(capture_writer_t);
+  ptr = (char*)ALIGN((size_t)ptr, CACHELINE);
+  c->columns = (float*)ptr;
+  ptr += N_CHANNELS*CAPTURE_CHUNK_FRAMES*sizeof(float);
+
+  ptr = (char*)ALIGN((size_t)ptr, CACHELINE);
+  c->index = (chunk_index_t*)ptr;
+  memset(c->index, 0, sizeof(chunk_index_t));
+  ptr += index_footprint();
+
+  ptr = (char*)ALIGN((size_t)ptr, CACHELINE);
+  c->packed = (uint8_t*)ptr;
+  ptr += N_CHANNELS*column_codec_bound(CAPTURE_CHUNK_FRAMES);
+
+  ptr = (char*)ALIGN((size_t)ptr, CACHELINE);
+  c->check = (float*)ptr;
+  ptr += CAPTURE_CHUNK_FRAMES*sizeof(float);
+
+  /* without it every column is stored */
+  ptr = (char*)ALIGN((size_t)ptr, capture_synth_align());
+  c->synth = create_capture_synth(ptr, m, NULL);
+
+  column_quant_rng_init(c->rng, 1);
+
+  atomic_init(&c->raw_bytes, 0);
+  atomic_init(&c->packed_bytes, 0);
+  atomic_init(&c->pack_ns, 0);
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return c;
+}
+
+void*
+destroy_capture_writer(capture_writer_t* c)
+{
+  if (!c) return NULL;
+
+  if (c->synth) destroy_capture_synth(c->synth);
+  return (void*)c;
+}
+
+int
+capture_writer_add(capture_writer_t*   c,
+                   record_hdr_t const* rec)
+{
+  if (c->n_iov + 2 > MAX_IOV) {
+    int err = capture_writer_commit(c);
+    if (err != APP_SUCCESS) return err;
+  }
+
+  if (rec->type == RECORD_STRIKE && CAPTURE_SYNTH) {
+    /* comes ahead of the sample set with its frame, a backlog can only be
+       from chunks that weren't written */
+    if (c->n_strikes == CAPTURE_MAX_STRIKES) drop_strikes(c, c->strikes[0] + 1);
+    c->strikes[c->n_strikes++] = rec->frame;
+  }
+
+  if (rec->type != RECORD_SAMPLE_SET) {
+    c->iov[c->n_iov].iov_base = (void*)rec;
+    c->iov[c->n_iov].iov_len  = rec->size;
+    c->n_iov += 1;
+    return APP_SUCCESS;
+  }
+
+  sample_set_t const* sset = (sample_set_t const*)rec;
+  size_t              n    = sset->n_samples;
+
+  bool contiguous = sset->hdr.frame == c->first + c->n_frames;
+  if (c->n_frames && (!contiguous || c->n_frames + n > CAPTURE_CHUNK_FRAMES)) {
+    int err = write_chunk(c);
+    if (err != APP_SUCCESS) return err;
+  }
+
+  if (c->n_frames == 0) {
+    c->first             = sset->hdr.frame;
+    c->square_phase      = sset->square_phase;
+    c->envelope_position = sset->envelope_position;
+    drop_strikes(c, c->first);
+  }
+  for (size_t ch = 0; ch < N_CHANNELS; ++ch) {
+    memcpy(c->columns + ch*CAPTURE_CHUNK_FRAMES + c->n_frames, sset->data + ch*n, n*sizeof(float));
+  }
+  c->n_frames += n;
+
+  if (c->n_frames == CAPTURE_CHUNK_FRAMES) {
+    int err = write_chunk(c);
+    if (err != APP_SUCCESS) return err;
+  }
+
+  if (sset->n_fft_bins) {
+    fft_bins_t* f = create_fft_bins(c->fft + c->n_fft++, sset->hdr.frame, sset->n_fft_bins);
+    c->iov[c->n_iov].iov_base     = f;
+    c->iov[c->n_iov].iov_len      = sizeof(fft_bins_t);
+    c->iov[c->n_iov + 1].iov_base = (void*)(sset->data + N_CHANNELS*n);
+    c->iov[c->n_iov + 1].iov_len  = sset->n_fft_bins*sizeof(float);
+    c->n_iov += 2;
+  }
+
+  return APP_SUCCESS;
+}
+
+int
+capture_writer_commit(capture_writer_t* c)
+{
+  if (c->n_iov == 0) return APP_SUCCESS;
+
+  int err = disk_writer_append(c->w, c->iov, c->n_iov);
+  c->n_iov = 0;
+  c->n_fft = 0;
+  return err;
+}
+
+int
+capture_writer_end_segment(capture_writer_t* c)
+{
+  int err = capture_writer_commit(c);
+  if (err != APP_SUCCESS) return err;
+
+  err = write_chunk(c);
+  if (err != APP_SUCCESS) return err;
+
+  chunk_index_t* idx = c->index;
+  size_t         len = sizeof(chunk_index_t) + idx->n_entries*sizeof(index_entry_t);
+  idx->hdr.type  = RECORD_INDEX;
+  idx->hdr.size  = (uint32_t)len;
+  idx->hdr.frame = idx->n_entries ? idx->entries[0].frame : 0;
+
+  struct iovec iov[1] = { { .iov_base = idx, .iov_len = len } };
+  disk_writer_mark_index(c->w);
+  err = disk_writer_append(c->w, iov, 1);
+
+  idx->n_entries = 0;
+  return err;
+}
+
+bool
+capture_writer_index_full(capture_writer_t const* c)
+{
+  return c->index->n_entries >= CAPTURE_MAX_CHUNKS;
+}
+
+void
+capture_writer_pack_stats(capture_writer_t* c,
+                          uint64_t*         raw_bytes,
+                          uint64_t*         packed_bytes,
+                          uint64_t*         pack_ns)
+{
+  *raw_bytes    = atomic_load_explicit(&c->raw_bytes, memory_order_relaxed);
+  *packed_bytes = atomic_load_explicit(&c->packed_bytes, memory_order_relaxed);
+  *pack_ns      = atomic_load_explicit(&c->pack_ns, memory_order_relaxed);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "disk.h"
+#include "disk_writer.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Turns the records coming off the disk rings into the columnar layout (see
+   disk.h) on the way into a disk_writer.
+
+   Sample sets are copied into per-channel columns until CAPTURE_CHUNK_FRAMES
+   contiguous frames have built up, then written as one chunk. A jump in the
+   frame numbers (nothing written while shedding load, or dropped records)
+   ends the chunk early. The fft bins a sample set carries become their own
+   record. Everything else goes through untouched.
+
+   With CAPTURE_PACK each column of a chunk is packed losslessly as it's
+   written (column_codec.h), or stays raw if that doesn't make it smaller.
+
+   With CAPTURE_SYNTH square_out and pulse_out aren't stored at all when the
+   generators can make them again (capture_synth.h): the state sample sets
+   carry for their first frame and the strike records in between are kept
+   instead. That's checked against the samples for every chunk, a column that
+   doesn't come out the same (a strike record was dropped, say) is stored.
+
+   Channels can also be stored as 24 or 16 bit ints (CAPTURE_*_BITS), scaled
+   per chunk (column_quant.h). That one is lossy. A column with infinities or
+   NaNs in it is kept as floats.
+
+   Every chunk is numbered and gets a CRC32C over what is written of it
+   (crc32c.h), which at ~18 GB/s costs next to nothing beside the encoding.
+
+   Each chunk's place is remembered, and capture_writer_end_segment writes the
+   list out as the segment's index. A chunk that is still filling isn't in
+   the file yet, so a crash loses up to CAPTURE_CHUNK_FRAMES frames more than
+   it would with sample sets written as they come.
+
+   Only the disk thread calls any of this, bar capture_writer_pack_stats. */
+
+/* Records the index can still take after capture_writer_index_full, which
+   is how many can be added between looking at it */
+#define CAPTURE_INDEX_SLACK 256ul
+
+typedef struct capture_writer capture_writer_t;
+
+size_t
+capture_writer_footprint(void);
+
+size_t
+capture_writer_align(void);
+
+/* `meta` describes the run and goes in every segment's header, with
+   chunk_frames filled in here. Its channels have to be the sample set's:
+   square_out, pulse_out, lxd_in. */
+
+capture_writer_t*
+create_capture_writer(void*                 mem,
+                      disk_writer_t*        w,
+                      capture_meta_t const* meta,
+                      int*                  opt_err);
+
+void*
+destroy_capture_writer(capture_writer_t* c);
+
+/* Take a record. Anything but a sample set is written straight from `rec`,
+   which has to stay put until capture_writer_commit. */
+
+int
+capture_writer_add(capture_writer_t*   c,
+                   record_hdr_t const* rec);
+
+/* Hand everything added so far to the disk_writer, after which the caller
+   can have the records' memory back */
+
+int
+capture_writer_commit(capture_writer_t* c);
+
+/* Commit, write the partly filled chunk and then the index. Call before
+   finishing or rotating the disk_writer. */
+
+int
+capture_writer_end_segment(capture_writer_t* c);
+
+/* The segment should end before more than CAPTURE_INDEX_SLACK more records
+   are added */
+
+bool
+capture_writer_index_full(capture_writer_t const* c);
+
+/* Running totals of sample bytes that went into packing, what came out, and
+   the time it took, synthesized columns and their checks included. Safe from
+   any thread. */
+
+void
+capture_writer_pack_stats(capture_writer_t* c,
+                          uint64_t*         raw_bytes,
+                          uint64_t*         packed_bytes,
+                          uint64_t*         pack_ns);
@@ -0,0 +1,173 @@
+#include "column_codec.h"
+
+#include "common.h"
+#include "err.h"
+
+#include <immintrin.h>
+#include <string.h>
+
+/* samples per group, one byte plane fills an AVX register */
+#define GROUP  32ul
+#define PLANES 4ul
+
+/* each of the 32 bit words XORed with the one before it, `prev` before the
+   first */
+
+static __m256i
+xor_prev(__m256i  cur,
+         uint32_t prev)
+{
+  __m256i before = _mm256_permutevar8x32_epi32(cur, _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6));
+  before = _mm256_blend_epi32(before, _mm256_set1_epi32((int)prev), 0x01);
+  return _mm256_xor_si256(cur, before);
+}
+
+/* undoes xor_prev: each word XORed with every one before it, and `prev` */
+
+static __m256i
+prefix_xor(__m256i  d,
+           uint32_t prev)
+{
+  __m256i zero = _mm256_setzero_si256();
+  d = _mm256_xor_si256(d, _mm256_blend_epi32(
+        _mm256_permutevar8x32_epi32(d, _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6)), zero, 0x01));
+  d = _mm256_xor_si256(d, _mm256_blend_epi32(
+        _mm256_permutevar8x32_epi32(d, _mm256_setr_epi32(0, 0, 0, 1, 2, 3, 4, 5)), zero, 0x03));
+  d = _mm256_xor_si256(d, _mm256_blend_epi32(
+        _mm256_permutevar8x32_epi32(d, _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 2, 3)), zero, 0x0f));
+  return _mm256_xor_si256(d, _mm256_set1_epi32((int)prev));
+}
+
+/* byte `b` of each of the group's words, in word order */
+
+static __m256i
+byte_plane(__m256i const v[4],
+           size_t        b)
+{
+  __m128i shift = _mm_cvtsi32_si128((int)(8*b));
+  __m256i low   = _mm256_set1_epi32(0xff);
+
+  __m256i a0 = _mm256_and_si256(_mm256_srl_epi32(v[0], shift), low);
+  __m256i a1 = _mm256_and_si256(_mm256_srl_epi32(v[1], shift), low);
+  __m256i a2 = _mm256_and_si256(_mm256_srl_epi32(v[2], shift), low);
+  __m256i a3 = _mm256_and_si256(_mm256_srl_epi32(v[3], shift), low);
+
+  /* packs work per 128 bit lane, which leaves each register's bytes split
+     between the two lanes */
+  __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(a0, a1), _mm256_packus_epi32(a2, a3));
+  return _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+static uint8_t*
+put_plane(uint8_t* out,
+          __m256i  plane)
+{
+  uint32_t bits[8];
+  size_t   w = 0;
+  for (size_t k = 0; k < 8; ++k) {
+    /* moves bit k of every byte to its top, for movemask */
+    __m256i top = _mm256_sll_epi16(plane, _mm_cvtsi32_si128((int)(7 - k)));
+    bits[k] = (uint32_t)_mm256_movemask_epi8(top);
+    if (bits[k]) w = k + 1;
+  }
+
+  *out++ = (uint8_t)w;
+  memcpy(out, bits, w*sizeof(uint32_t));
+  return out + w*sizeof(uint32_t);
+}
+
+/* a byte per bit of `bits`, 0xff where it's set */
+
+static __m256i
+expand_bits(uint32_t bits)
+{
+  __m256i byte_of = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                     2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+  __m256i bit_of  = _mm256_set1_epi64x((long long)0x8040201008040201ull);
+
+  __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32((int)bits), byte_of);
+  return _mm256_cmpeq_epi8(_mm256_and_si256(v, bit_of), bit_of);
+}
+
+size_t
+column_codec_bound(size_t n)
+{
+  return (n + GROUP - 1)/GROUP*PLANES*(1 + 8*sizeof(uint32_t));
+}
+
+size_t
+column_codec_encode(float const* in,
+                    size_t       n,
+                    uint8_t*     out)
+{
+  uint8_t* o    = out;
+  uint32_t prev = 0;
+
+  for (size_t i = 0; i < n; i += GROUP) {
+    float        pad[GROUP];
+    float const* src = in + i;
+    if (n - i < GROUP) {
+      memset(pad, 0, sizeof(pad));
+      memcpy(pad, src, (n - i)*sizeof(float));
+      src = pad;
+    }
+
+    __m256i v[4];
+    for (size_t g = 0; g < 4; ++g) {
+      __m256i cur = _mm256_loadu_si256((__m256i const*)(src + 8*g));
+      v[g] = xor_prev(cur, prev);
+      prev = (uint32_t)_mm256_extract_epi32(cur, 7);
+    }
+
+    for (size_t b = 0; b < PLANES; ++b) o = put_plane(o, byte_plane(v, b));
+  }
+
+  return (size_t)(o - out);
+}
+
+int
+column_codec_decode(uint8_t const* in,
+                    size_t         in_bytes,
+                    size_t         n,
+                    float*         out)
+{
+  uint8_t const* p    = in;
+  uint8_t const* end  = in + in_bytes;
+  uint32_t       prev = 0;
+
+  for (size_t i = 0; i < n; i += GROUP) {
+    _Alignas(32) uint8_t planes[PLANES][GROUP];
+    for (size_t b = 0; b < PLANES; ++b) {
+      if (p == end) return APP_ERR_INVAL;
+      size_t w = *p++;
+      if (w > 8 || (size_t)(end - p) < w*sizeof(uint32_t)) return APP_ERR_INVAL;
+
+      __m256i plane = _mm256_setzero_si256();
+      for (size_t k = 0; k < w; ++k) {
+        uint32_t bits;
+        memcpy(&bits, p, sizeof(bits));
+        p += sizeof(bits);
+        plane = _mm256_or_si256(plane, _mm256_and_si256(expand_bits(bits),
+                                                        _mm256_set1_epi8((char)(1u << k))));
+      }
+      _mm256_store_si256((__m256i*)planes[b], plane);
+    }
+
+    float  pad[GROUP];
+    float* dst = n - i < GROUP ? pad : out + i;
+    for (size_t g = 0; g < 4; ++g) {
+      __m256i d = _mm256_setzero_si256();
+      for (size_t b = 0; b < PLANES; ++b) {
+        __m256i bytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i const*)(planes[b] + 8*g)));
+        d = _mm256_or_si256(d, _mm256_sll_epi32(bytes, _mm_cvtsi32_si128((int)(8*b))));
+      }
+
+      __m256i x = prefix_xor(d, prev);
+      prev = (uint32_t)_mm256_extract_epi32(x, 7);
+      _mm256_storeu_si256((__m256i*)(dst + 8*g), x);
+    }
+    if (dst == pad) memcpy(out + i, pad, (n - i)*sizeof(float));
+  }
+
+  return p == end ? APP_SUCCESS : APP_ERR_INVAL;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Lossless packing for a column of float samples.
+
+   Each sample's bits are XORed with the previous sample's, which zeroes the
+   sign, the exponent and the top of the mantissa whenever the signal moves
+   slowly. The result goes 32 samples at a time, a short last group zero
+   padded. Each group is split into four byte planes (every sample's low
+   byte, then the next byte, ...), and each plane is stored as one byte
+   giving the highest bit set anywhere in it, w, then w bit planes of 4 bytes
+   each: bit 0 of each byte, bit 1, and so on. A plane of zeros takes one
+   byte, a plane of noise 33.
+
+   All of it is AVX2, 32 samples at a time. The encoding is the same on any
+   machine, the format is in the layout above rather than in register
+   order. */
+
+/* Most bytes `n` samples can take */
+
+size_t
+column_codec_bound(size_t n);
+
+/* Pack `n` samples into `out`, which has column_codec_bound(n) bytes.
+   Returns the bytes used. */
+
+size_t
+column_codec_encode(float const* in,
+                    size_t       n,
+                    uint8_t*     out);
+
+/* Unpack `n` samples from `in_bytes` bytes. APP_ERR_INVAL if they don't
+   hold exactly that. */
+
+int
+column_codec_decode(uint8_t const* in,
+                    size_t         in_bytes,
+                    size_t         n,
+                    float*         out);
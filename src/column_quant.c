@@ -0,0 +1,239 @@
+#include "column_quant.h"
+
+#include "common.h"
+#include "disk.h"
+#include "err.h"
+
+#include <immintrin.h>
+#include <math.h>
+#include <string.h>
+
+#define LANES 8ul
+
+/* keeps 1/scale finite */
+#define MIN_SCALE_EXP -126
+
+/* Largest |x| in the column, or -1 if any of it isn't finite */
+
+static float
+peak(float const* in,
+     size_t       n)
+{
+  __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  __m256 inf      = _mm256_set1_ps(INFINITY);
+  __m256 hi       = _mm256_setzero_ps();
+  __m256 finite   = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+  size_t i = 0;
+  for (; i + LANES <= n; i += LANES) {
+    __m256 a = _mm256_and_ps(_mm256_loadu_ps(in + i), abs_mask);
+    hi     = _mm256_max_ps(hi, a);
+    finite = _mm256_and_ps(finite, _mm256_cmp_ps(a, inf, _CMP_LT_OQ)); /* false for NaN */
+  }
+  if (_mm256_movemask_ps(finite) != 0xff) return -1.0f;
+
+  float lanes[LANES];
+  _mm256_storeu_ps(lanes, hi);
+
+  float p = 0.0f;
+  for (size_t k = 0; k < LANES; ++k) p = MAX(p, lanes[k]);
+  for (; i < n; ++i) {
+    if (!isfinite(in[i])) return -1.0f;
+    p = MAX(p, fabsf(in[i]));
+  }
+  return p;
+}
+
+/* xorshift32 in each lane */
+
+static __m256i
+rng_next(__m256i x)
+{
+  x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+  return _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+}
+
+/* Triangular noise in (-1, 1): the difference of two uniforms, each made by
+   putting random bits under the exponent of 1.0 */
+
+static __m256
+tpdf(__m256i* state)
+{
+  __m256i one = _mm256_set1_epi32(0x3f800000);
+  __m256i a   = rng_next(*state);
+  __m256i b   = rng_next(a);
+  *state = b;
+
+  __m256 ua = _mm256_castsi256_ps(_mm256_or_si256(_mm256_srli_epi32(a, 9), one));
+  __m256 ub = _mm256_castsi256_ps(_mm256_or_si256(_mm256_srli_epi32(b, 9), one));
+  return _mm256_sub_ps(ua, ub);
+}
+
+static uint8_t*
+put16(uint8_t* out,
+      __m256i  q)
+{
+  /* packs works per 128 bit lane, the two halves are qwords 0 and 2 */
+  __m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(q, q), 0x08);
+  _mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(p));
+  return out + LANES*2;
+}
+
+static uint8_t*
+put24(uint8_t* out,
+      __m256i  q)
+{
+  /* low three bytes of each word to the front of its lane, then the lanes'
+     twelve bytes together */
+  __m256i drop = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                  0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  __m256i p    = _mm256_shuffle_epi8(q, drop);
+  p = _mm256_permutevar8x32_epi32(p, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+
+  _mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(p));
+  _mm_storel_epi64((__m128i*)(out + 16), _mm256_extracti128_si256(p, 1));
+  return out + LANES*3;
+}
+
+static __m256i
+get16(uint8_t const* in)
+{
+  return _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i const*)in));
+}
+
+static __m256i
+get24(uint8_t const* in)
+{
+  /* 24 bytes without reading past them, the first twelve to the low lane
+     and the next twelve to the high one */
+  __m256i v = _mm256_set_m128i(_mm_loadl_epi64((__m128i const*)(in + 16)),
+                               _mm_loadu_si128((__m128i const*)in));
+  v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6));
+
+  /* each sample into the top three bytes of a word, shifted back down with
+     its sign */
+  __m256i spread = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                                    -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+  return _mm256_srai_epi32(_mm256_shuffle_epi8(v, spread), 8);
+}
+
+void
+column_quant_rng_init(column_quant_rng_t* rng,
+                      uint32_t            seed)
+{
+  for (size_t k = 0; k < LANES; ++k) {
+    uint32_t s = (seed + 0x9e3779b9u*(uint32_t)(k + 1))*0x85ebca6bu;
+    rng->s[k] = s ? s : 1; /* xorshift never leaves 0 */
+  }
+}
+
+size_t
+column_quant_bound(size_t   n,
+                   unsigned bits)
+{
+  return sizeof(quant_hdr_t) + n*(bits/8);
+}
+
+size_t
+column_quant_encode(float const*        in,
+                    size_t              n,
+                    unsigned            bits,
+                    column_quant_rng_t* rng,
+                    uint8_t*            out)
+{
+  if (bits != 16 && bits != 24) return 0;
+
+  float p = peak(in, n);
+  if (p < 0.0f) return 0;
+
+  /* p/limit is m*2^e with m < 1, so 2^e is the smallest step that fits */
+  int32_t limit = (int32_t)((1u << (bits - 1)) - 1);
+  int     e     = 0;
+  if (p > 0.0f) frexpf(p/(float)limit, &e);
+  e = MAX(e, MIN_SCALE_EXP);
+
+  quant_hdr_t hdr[1];
+  memset(hdr, 0, sizeof(hdr));
+  hdr->scale = ldexpf(1.0f, e);
+  memcpy(out, hdr, sizeof(hdr));
+
+  __m256   inv   = _mm256_set1_ps(ldexpf(1.0f, -e));
+  __m256i  lo    = _mm256_set1_epi32(-limit);
+  __m256i  hi    = _mm256_set1_epi32(limit);
+  __m256i  state = rng ? _mm256_loadu_si256((__m256i const*)rng->s) : _mm256_setzero_si256();
+  size_t   width = bits/8;
+  uint8_t* o     = out + sizeof(hdr);
+
+  for (size_t i = 0; i < n; i += LANES) {
+    float        pad[LANES];
+    float const* src = in + i;
+    if (n - i < LANES) {
+      memset(pad, 0, sizeof(pad));
+      memcpy(pad, src, (n - i)*sizeof(float));
+      src = pad;
+    }
+
+    /* exact, the scale is a power of two */
+    __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src), inv);
+    if (rng) v = _mm256_add_ps(v, tpdf(&state));
+
+    /* rounds to nearest, dither can push past the ends */
+    __m256i q = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvtps_epi32(v), lo), hi);
+
+    if (src == pad) {
+      uint8_t tail[LANES*3];
+      if (bits == 16) put16(tail, q);
+      else            put24(tail, q);
+      memcpy(o, tail, (n - i)*width);
+      o += (n - i)*width;
+    }
+    else {
+      o = bits == 16 ? put16(o, q) : put24(o, q);
+    }
+  }
+
+  if (rng) _mm256_storeu_si256((__m256i*)rng->s, state);
+  return (size_t)(o - out);
+}
+
+int
+column_quant_decode(uint8_t const* in,
+                    size_t         in_bytes,
+                    size_t         n,
+                    unsigned       bits,
+                    float*         out)
+{
+  if (bits != 16 && bits != 24)                 return APP_ERR_INVAL;
+  if (in_bytes != column_quant_bound(n, bits)) return APP_ERR_INVAL;
+
+  quant_hdr_t hdr[1];
+  memcpy(hdr, in, sizeof(hdr));
+
+  __m256         scale = _mm256_set1_ps(hdr->scale);
+  size_t         width = bits/8;
+  uint8_t const* p     = in + sizeof(hdr);
+
+  size_t i = 0;
+  for (; i + LANES <= n; i += LANES, p += LANES*width) {
+    __m256i q = bits == 16 ? get16(p) : get24(p);
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(q), scale));
+  }
+
+  /* the same arithmetic one at a time: every int is exact as a float */
+  for (; i < n; ++i, p += width) {
+    int32_t q;
+    if (bits == 16) {
+      int16_t s;
+      memcpy(&s, p, sizeof(s));
+      q = s;
+    }
+    else {
+      uint32_t u = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+      q = (int32_t)(u << 8) >> 8;
+    }
+    out[i] = (float)q*hdr->scale;
+  }
+
+  return APP_SUCCESS;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Lossy storage for a column of float samples as 16 or 24 bit integers, the
+   COLUMN_INT16 and COLUMN_INT24 encodings in disk.h: a quant_hdr with the
+   column's scale, then each sample as a little endian signed integer of that
+   width, packed back to back.
+
+   The scale is the smallest power of two that fits the column's peak, so
+   scaling is exact and samples that were on a grid at least that coarse
+   (the output of a 24 bit converter into int24, say) come back unchanged.
+   Everything else is rounded to the nearest step, or dithered first when
+   asked: triangular noise of +-1 step, which turns the rounding error into
+   plain noise instead of something that follows the signal.
+
+   Both ways are AVX2, 8 samples at a time. */
+
+/* Per-lane state for the dither's noise, seeded with column_quant_rng_init */
+
+typedef struct {
+  uint32_t s[8];
+} column_quant_rng_t;
+
+void
+column_quant_rng_init(column_quant_rng_t* rng,
+                      uint32_t            seed);
+
+/* Most bytes `n` samples take at `bits` (16 or 24) */
+
+size_t
+column_quant_bound(size_t   n,
+                   unsigned bits);
+
+/* Store `n` samples into `out`, which has column_quant_bound(n, bits) bytes,
+   dithered if `rng` isn't NULL. Returns the bytes used, or 0 if the column
+   can't be stored this way (it has infinities or NaNs, or `bits` isn't 16
+   or 24). */
+
+size_t
+column_quant_encode(float const*        in,
+                    size_t              n,
+                    unsigned            bits,
+                    column_quant_rng_t* rng,
+                    uint8_t*            out);
+
+/* Unpack `n` samples of `bits` from `in_bytes` bytes. APP_ERR_INVAL if they
+   don't hold exactly that. */
+
+int
+column_quant_decode(uint8_t const* in,
+                    size_t         in_bytes,
+                    size_t         n,
+                    unsigned       bits,
+                    float*         out);
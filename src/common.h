@@ -21,5 +21,62 @@
 
 // config stuff
 
-#define OUTPUT_DATA_FILE "/scratch/data_out"
-#define RINGBUFFER_SIZE  (4096ul*16ul)
+#define OUTPUT_DIR       "/scratch" /* defaults, main takes both on the command line */
+#define OUTPUT_PREFIX    "data_out"
+#define DISK_SEGMENT_BYTES   (1ul<<30) /* output moves on to a new file after this much */
+#define DISK_SEGMENT_SECONDS 3600ul    /* or this long, 0 for never */
+#define DISK_SYNC        1       /* 0: leave writeback to the kernel, 1: see DISK_SYNC_BYTES */
+#define DISK_SYNC_BYTES  (8ul<<20) /* start writeback every this much, fdatasync when a segment ends */
+#define DISK_BACKEND     1       /* 0: write(), 1: io_uring where the kernel has it */
+#define DISK_DIRECT      true    /* O_DIRECT, keeps long captures out of the page cache */
+#define DISK_BUFFERS     4       /* io_uring buffers, one being filled and the rest in flight */
+#define DISK_BUFFER_SIZE (1ul<<20)
+#define DISK_PREALLOC    (64ul<<20) /* output file grows this much at a time */
+#define ARENA_HUGEPAGES  0       /* app memory on 0: normal pages, 1: transparent hugepages, 2: hugetlbfs */
+#define HUGEPAGE_SIZE    (2ul<<20)
+#define RT_CPU           (-2)    /* for jack's thread. -1: leave alone, -2: first isolcpus cpu */
+#define DISK_CPU         (-1)    /* background threads stay off isolcpus unless pinned there */
+#define ANALYSIS_CPU     (-1)
+#define DISK_NICE        (-5)    /* the disk thread keeps the rings drained, so it goes first */
+#define ANALYSIS_NICE    5
+#define XRUN_ABORT_AFTER 0ul     /* stop the run at this many xruns, 0 to keep going */
+#define SHED_SQUARE_FILL    50ul /* percent of the disk ring in use before square_out is dropped */
+#define SHED_DECIMATE_FILL  70ul /* ... before pulse_out and lxd_in are decimated */
+#define SHED_FEATURES_FILL  85ul /* ... before only fft and feature records are kept */
+#define SHED_HYSTERESIS     10ul /* percent below a level's threshold before shedding less */
+#define SHED_DECIMATION     8ul
+#define RING_SLOTS       256ul   /* per ring, power of two */
+#define RING_SLOT_SIZE   4096ul  /* largest record a ring can carry, sample sets aside */
+#define DISK_WAKE_SLOTS  16ul    /* records waiting before a producer wakes the disk thread */
+#define DISK_WAKE_TIMEOUT_MS 50  /* the disk thread looks anyway after this long */
+#define ANALYSIS_WAKE_SLOTS  8ul /* records waiting before the callback wakes the analysis thread */
+#define ANALYSIS_WAKE_TIMEOUT_MS 50 /* the analysis thread looks anyway after this long */
+#define SAMPLE_SET_MAX_FRAMES 512ul /* longer callbacks are split over several sample sets */
+#define CAPTURE_CHUNK_FRAMES  16384ul /* frames per column chunk in the output, ~1/3 s at 48 kHz */
+#define CAPTURE_MAX_CHUNKS    8192ul  /* chunks indexed per segment, a full index ends the segment */
+#define CAPTURE_PACK          1       /* 0: raw float columns, 1: lossless packing (column_codec.h) */
+#define CAPTURE_SYNTH         1       /* 1: square_out and pulse_out are made again when read (capture_synth.h) */
+#define CAPTURE_MAX_STRIKES   64ul    /* strikes a synthesized pulse_out chunk can have, more are stored */
+#define CAPTURE_SQUARE_BITS   32      /* stored width of each channel, when it isn't synthesized: */
+#define CAPTURE_PULSE_BITS    32      /* 32 keeps floats, 24 or 16 rounds to ints with a scale per */
+#define CAPTURE_LXD_IN_BITS   24      /* chunk (column_quant.h). lxd_in's converter has 24 at most. */
+#define CAPTURE_DITHER        0       /* 1: dither before rounding to ints */
+
+#define DRIVE_FREQUENCY_HZ  440.0f
+#define HARMONIC_COUNT      16ul   /* fundamental, then odd harmonics */
+#define HARMONIC_BIN_HZ     10ul   /* sliding dft window is sample_rate/HARMONIC_BIN_HZ */
+#define HARMONIC_RECORD_HZ  100ul  /* harmonic snapshots written per second */
+#define LOCKIN_OUTPUT_HZ    1000ul /* rate of the demodulated amplitude/phase stream */
+#define LOCKIN_CUTOFF_HZ    200.0f /* corner of each of the lock-in's two poles */
+#define STRIKE_FIT_MAX_POINTS     4096ul /* lock-in points fit per strike */
+#define STRIKE_FIT_MAX_ITERATIONS 50ul
+#define STRIKE_FIT_MIN_TAU_S      1e-4f
+#define STRIKE_FIT_MAX_TAU_S      100.0f
+#define SYNC_AVG_WINDOW_MS        250ul  /* frames averaged after each strike */
+#define SYNC_AVG_STRIKES          16ul   /* strikes per flushed average */
+#define XSPEC_SEGMENT             1024ul /* welch segment length, frames */
+#define XSPEC_SEGMENTS            64ul   /* segments per transfer function estimate */
+#define XSPEC_INPUT_SQUARE        1      /* 1 to use square_out as the input, 0 for pulse_out */
+#define LATENCY_WINDOW            4096ul /* frames around each strike correlated for latency */
+#define LATENCY_MAX_LAG           1024ul /* largest latency searched for, frames */
+#define LATENCY_MEDIAN_STRIKES    15ul   /* strikes in the rolling median latency */
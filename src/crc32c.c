@@ -0,0 +1,75 @@
+#include "crc32c.h"
+
+#include <immintrin.h>
+#include <string.h>
+
+#if !defined(__SSE4_2__) || !defined(__PCLMUL__)
+#error "crc32c needs SSE4.2 and PCLMUL"
+#endif
+
+/* bytes in each of the three streams */
+#define BLOCK 1024ul
+
+/* x^(8*2*BLOCK - 33) and x^(8*BLOCK - 33) mod the polynomial, bit reflected,
+   see shift */
+#define SHIFT_2BLOCKS 0xa51b6135u
+#define SHIFT_1BLOCK  0x170076fau
+
+static uint64_t
+crc_bytes(uint64_t       c,
+          uint8_t const* p,
+          size_t         n)
+{
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    c = _mm_crc32_u64(c, v);
+  }
+  for (; n; --n, ++p) c = _mm_crc32_u8((uint32_t)c, *p);
+  return c;
+}
+
+/* The register after `c` is run over BLOCKs of zeros, given k = x^(8*bytes
+   - 33): the carryless product is c*k*x in the bit order crc32 reads a
+   qword in, and crc32 over it multiplies by x^32 and reduces */
+
+static uint64_t
+shift(uint64_t c,
+      uint32_t k)
+{
+  __m128i p = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)(uint32_t)c),
+                                   _mm_cvtsi32_si128((int)k), 0x00);
+  return _mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(p));
+}
+
+uint32_t
+crc32c(uint32_t    crc,
+       void const* data,
+       size_t      n)
+{
+  uint8_t const* p = (uint8_t const*)data;
+  uint64_t       c = ~crc;
+
+  /* crc32 takes 3 cycles and can start one a cycle, so three independent
+     streams keep it busy. The register is linear in its start and the data,
+     so the second and third start from 0 and are added in shifted by the
+     bytes that follow each. */
+  while (n >= 3*BLOCK) {
+    uint64_t c1 = 0;
+    uint64_t c2 = 0;
+    for (size_t i = 0; i < BLOCK; i += 8) {
+      uint64_t v0, v1, v2;
+      memcpy(&v0, p + i, 8);
+      memcpy(&v1, p + BLOCK + i, 8);
+      memcpy(&v2, p + 2*BLOCK + i, 8);
+      c  = _mm_crc32_u64(c, v0);
+      c1 = _mm_crc32_u64(c1, v1);
+      c2 = _mm_crc32_u64(c2, v2);
+    }
+    c  = shift(c, SHIFT_2BLOCKS) ^ shift(c1, SHIFT_1BLOCK) ^ c2;
+    p += 3*BLOCK;
+    n -= 3*BLOCK;
+  }
+
+  return ~(uint32_t)crc_bytes(c, p, n);
+}
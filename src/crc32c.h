@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC32C (Castagnoli), the one SSE4.2's crc32 instruction computes: reflected
+   polynomial 0x82f63b78, register started at and finished with all ones, so
+   crc32c(0, "123456789", 9) is 0xe3069283. Runs three streams at once, ~18 GB/s
+   on the dev box against ~6 for one.
+
+   Passing a previous result back in carries on from where it left off, so a
+   record in pieces can be done one piece at a time. */
+
+uint32_t
+crc32c(uint32_t    crc,
+       void const* data,
+       size_t      n);
@@ -0,0 +1,199 @@
+#include "cycle_hist.h"
+
+#include "common.h"
+#include "err.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define CALIBRATION_NS 10000000ull
+
+typedef struct {
+  atomic_uint_fast64_t count[CYCLE_HIST_BUCKETS];
+  atomic_uint_fast64_t max;
+} stage_t;
+
+struct cycle_hist {
+  size_t   n_stages;
+  double   cycles_per_ns;
+
+  /* written by the realtime thread */
+  _Alignas(CACHELINE) stage_t stages[CYCLE_HIST_MAX_STAGES];
+
+  /* reader only, counts as of the last summary */
+  _Alignas(CACHELINE) uint64_t seen[CYCLE_HIST_MAX_STAGES][CYCLE_HIST_BUCKETS];
+};
+
+/* Below 4 every value has its own bucket. Above that, the top bit picks the
+   power of two and the next two bits pick one of four linear buckets in it. */
+
+static size_t
+bucket(uint64_t v)
+{
+  if (v < 4) return (size_t)v;
+
+  unsigned e = 63u - (unsigned)__builtin_clzll(v);
+  return 4*(e-1) + ((v >> (e-2)) & 3);
+}
+
+/* Largest value that lands in bucket `b` */
+
+static uint64_t
+bucket_upper(size_t b)
+{
+  if (b < 4) return b;
+
+  unsigned e   = (unsigned)(b/4 + 1);
+  uint64_t sub = b%4;
+  if (e == 63 && sub == 3) return UINT64_MAX;
+  return ((4 + sub + 1) << (e-2)) - 1;
+}
+
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static double
+calibrate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t ns0  = now_ns();
+  uint64_t tsc0 = cycle_hist_now();
+
+  struct timespec ts = { 0, (long)CALIBRATION_NS };
+  while (0 != nanosleep(&ts, &ts)) { }
+
+  uint64_t ns1  = now_ns();
+  uint64_t tsc1 = cycle_hist_now();
+  return (double)(tsc1 - tsc0)/(double)(ns1 - ns0);
+#else
+  return 1.0;
+#endif
+}
+
+size_t
+cycle_hist_footprint(void)
+{
+  return sizeof(cycle_hist_t);
+}
+
+size_t
+cycle_hist_align(void)
+{
+  return CACHELINE;
+}
+
+cycle_hist_t*
+create_cycle_hist(void*  mem,
+                  size_t n_stages,
+                  int*   opt_err)
+{
+  if (!mem || n_stages == 0 || n_stages > CYCLE_HIST_MAX_STAGES) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  cycle_hist_t* h = (cycle_hist_t*)mem;
+  h->n_stages      = n_stages;
+  h->cycles_per_ns = calibrate();
+
+  for (size_t s = 0; s < CYCLE_HIST_MAX_STAGES; ++s) {
+    for (size_t b = 0; b < CYCLE_HIST_BUCKETS; ++b) atomic_init(&h->stages[s].count[b], 0);
+    atomic_init(&h->stages[s].max, 0);
+  }
+  memset(h->seen, 0, sizeof(h->seen));
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return h;
+}
+
+void*
+destroy_cycle_hist(cycle_hist_t* h)
+{
+  return (void*)h;
+}
+
+size_t
+cycle_hist_n_stages(cycle_hist_t const* h)
+{
+  return h->n_stages;
+}
+
+double
+cycle_hist_cycles_per_ns(cycle_hist_t const* h)
+{
+  return h->cycles_per_ns;
+}
+
+void
+cycle_hist_add(cycle_hist_t* h,
+               size_t        stage,
+               uint64_t      cycles)
+{
+  stage_t*              s = h->stages + stage;
+  atomic_uint_fast64_t* c = s->count + bucket(cycles);
+
+  /* only this thread writes, so load+store instead of a locked add */
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+
+  /* the reader swaps max back to 0, racing it can only put a value near the
+     boundary into the wrong interval */
+  if (cycles > atomic_load_explicit(&s->max, memory_order_relaxed)) {
+    atomic_store_explicit(&s->max, cycles, memory_order_relaxed);
+  }
+}
+
+void
+cycle_hist_summarize(cycle_hist_t*         h,
+                     size_t                stage,
+                     cycle_hist_summary_t* out)
+{
+  stage_t*  s    = h->stages + stage;
+  uint64_t* seen = h->seen[stage];
+
+  uint64_t delta[CYCLE_HIST_BUCKETS];
+  uint64_t n = 0;
+  for (size_t b = 0; b < CYCLE_HIST_BUCKETS; ++b) {
+    uint64_t count = atomic_load_explicit(s->count + b, memory_order_relaxed);
+    delta[b]  = count - seen[b];
+    seen[b]   = count;
+    n        += delta[b];
+  }
+
+  out->n   = n;
+  out->p50 = 0;
+  out->p99 = 0;
+  out->max = atomic_exchange_explicit(&s->max, 0, memory_order_relaxed);
+  if (n == 0) return;
+
+  /* rank of the percentile, 1 based */
+  uint64_t r50 = (n*50 + 99)/100;
+  uint64_t r99 = (n*99 + 99)/100;
+
+  uint64_t cumulative = 0;
+  bool     have_p50   = false;
+  for (size_t b = 0; b < CYCLE_HIST_BUCKETS; ++b) {
+    if (delta[b] == 0) continue;
+    cumulative += delta[b];
+    if (!have_p50 && cumulative >= r50) {
+      out->p50 = bucket_upper(b);
+      have_p50 = true;
+    }
+    if (cumulative >= r99) {
+      out->p99 = bucket_upper(b);
+      break;
+    }
+  }
+
+  /* nothing in the top bucket was above max */
+  if (out->max) {
+    out->p50 = MIN(out->p50, out->max);
+    out->p99 = MIN(out->p99, out->max);
+  }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Per stage histograms of cycle counts, written by the realtime thread and
+   read by anyone else.
+
+   Buckets are log-linear: four linear buckets per power of two, so any value
+   lands in a bucket no more than 25% wide and the whole 64 bit range fits in
+   CYCLE_HIST_BUCKETS. There is a single writer, which only does relaxed loads
+   and stores (no locked instructions, no syscalls). The reader diffs the counts
+   against the previous time it looked, so each summary covers the interval
+   since the last one. */
+
+#define CYCLE_HIST_MAX_STAGES 16
+#define CYCLE_HIST_BUCKETS    256
+
+typedef struct cycle_hist cycle_hist_t;
+
+typedef struct {
+  uint64_t n;   /* samples in the interval */
+  uint64_t p50; /* upper edge of the bucket holding the percentile */
+  uint64_t p99;
+  uint64_t max; /* exact */
+} cycle_hist_summary_t;
+
+size_t
+cycle_hist_footprint(void);
+
+size_t
+cycle_hist_align(void);
+
+/* Measures the timestamp counter against CLOCK_MONOTONIC, which takes a few
+   milliseconds */
+
+cycle_hist_t*
+create_cycle_hist(void*  mem,
+                  size_t n_stages,
+                  int*   opt_err);
+
+void*
+destroy_cycle_hist(cycle_hist_t* h);
+
+size_t
+cycle_hist_n_stages(cycle_hist_t const* h);
+
+/* Timestamp counter frequency, cycles per nanosecond */
+
+double
+cycle_hist_cycles_per_ns(cycle_hist_t const* h);
+
+/* Timestamp for cycle_hist_add. rdtsc where there is one, nanoseconds
+   otherwise. */
+
+static inline uint64_t
+cycle_hist_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* Writer side. Realtime safe, one writer only. */
+
+void
+cycle_hist_add(cycle_hist_t* h,
+               size_t        stage,
+               uint64_t      cycles);
+
+/* Reader side. One reader only. Summarizes everything added to `stage` since
+   the previous call for that stage. */
+
+void
+cycle_hist_summarize(cycle_hist_t*         h,
+                     size_t                stage,
+                     cycle_hist_summary_t* out);
@@ -3,17 +3,121 @@
 #include "err.h"
 
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
-#define SAMPLE_SET_MAX (4096ul)
+/* Data file format. Output file is a file_hdr, then a bunch of records in a
+   row.
 
-/* Data file format. Output file is a bunch of these in a row */
+   The file_hdr is padded to FILE_HDR_SIZE, so records start block aligned.
+   `length` is the number of bytes of records after it, which is
+   FILE_LENGTH_UNKNOWN until the file is closed cleanly. Files written with
+   O_DIRECT are zero padded to a whole block, so without a length readers stop
+   at the end of the file or at a record of size 0.
+
+   A capture_meta at FILE_META_OFFSET describes the run: sample rate, fft
+   size, the channels and what made them. Every segment has the same one.
+
+   A run is written as a series of segment files, which all have the same
+   `session` and consecutive `segment` numbers. Records never span segments,
+   so the run is the records of each segment in order.
+
+   Every record starts with a record_hdr, which says what kind of record follows
+   and how many bytes (header included) to skip to get to the next one. Readers
+   should skip record types they don't understand.
+
+   Since version 2 sample data is columnar: the disk thread gathers sample sets
+   into chunks of up to capture_meta.chunk_frames contiguous frames, each
+   channel's samples in a row, and the fft bins that rode along go in their own
+   records. A segment that was closed cleanly ends with an index of its chunks,
+   which `index` points at. Chunks are written as they fill, so they come after
+   the other records for the same frames; order by frame, not file position.
+
+   Since version 3 every chunk carries a CRC32C and its place in the run's
+   sequence of chunks, and starts with a sync word, so damage to one chunk
+   or to the records around it costs that much and no more: readers can look
+   for the next CHUNK_SYNC whose chunk checks out and carry on from there. */
+
+#define FILE_MAGIC          0x3144584cu /* "LXD1" */
+#define FILE_VERSION        3u
+#define FILE_HDR_SIZE       4096u
+#define FILE_META_OFFSET    64u   /* capture_meta, inside the header block */
+#define FILE_LENGTH_UNKNOWN UINT64_MAX
+
+enum {
+  FILE_DIRECT = 1, /* written with O_DIRECT, so padded */
+};
+
+typedef struct file_hdr file_hdr_t;
+
+struct __attribute__((packed)) file_hdr {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t hdr_size; /* records start here */
+  uint32_t flags;    /* FILE_* */
+  uint64_t length;
+  uint64_t session;  /* CLOCK_REALTIME ns when the run started */
+  uint32_t segment;  /* from 0 */
+  uint64_t index;    /* offset of the RECORD_INDEX from the start of the file, 0 for none */
+};
+
+#define CAPTURE_MAX_CHANNELS 8u
+#define CAPTURE_NAME_SIZE    16u
+
+typedef struct capture_meta capture_meta_t;
+
+struct __attribute__((packed)) capture_meta {
+  uint64_t sample_rate_hz;
+  uint64_t strike_period_ns;
+  uint32_t fft_size;           /* fft bins records have fft_size/2 + 1 */
+  uint32_t chunk_frames;       /* most frames in one chunk */
+  uint32_t envelope_type;      /* ENVELOPE_* */
+  float    envelope_param;     /* the setting's one parameter, e.g. lambda */
+  float    drive_frequency_hz;
+  uint32_t harmonic_count;
+  uint32_t n_channels;
+  uint32_t reserved;
+  char     channels[CAPTURE_MAX_CHANNELS][CAPTURE_NAME_SIZE]; /* column order, NUL padded */
+};
+
+enum {
+  RECORD_SAMPLE_SET = 1,
+  RECORD_HARMONICS  = 2,
+  RECORD_LOCKIN     = 3,
+  RECORD_STRIKE     = 4,
+  RECORD_STRIKE_FIT = 5,
+  RECORD_SYNC_AVG   = 6,
+  RECORD_TRANSFER   = 7,
+  RECORD_LATENCY    = 8,
+  RECORD_XRUN       = 9,
+  RECORD_REDUCED    = 10,
+  RECORD_GAP        = 11,
+  RECORD_CHUNK      = 12,
+  RECORD_FFT        = 13,
+  RECORD_INDEX      = 14,
+};
+
+typedef struct record_hdr record_hdr_t;
+
+struct __attribute__((packed)) record_hdr {
+  uint32_t type;
+  uint32_t size;  /* total size of the record, including this header */
+  uint64_t frame; /* index of the first frame the record describes */
+};
+
+/* Callbacks longer than SAMPLE_SET_MAX_FRAMES are written as several sample
+   sets with consecutive frames. FFT bins, if any, are on the set the
+   transform completed in (see spectrum.h). */
 
 typedef struct sample_set sample_set_t;
 
 struct __attribute__((packed)) sample_set {
-  size_t n_samples;
-  size_t n_fft_bins;
-  float  data[];
+  record_hdr_t hdr;
+  size_t       n_samples;
+  size_t       n_fft_bins;
+  float        square_phase;      /* generator state at hdr.frame, see synth_square */
+  uint32_t     envelope_position; /* and synth_pulse */
+  float        data[];
 
   /* square_out samples */
   /* pulse_out  samples */
@@ -31,42 +135,666 @@ sample_set_footprint(size_t n_samples,
 }
 
 static inline sample_set_t*
-create_sample_set(void*   mem,                     /* assmumed to be adequately sized */
-                  size_t  n_samples,
-                  size_t  n_fft_bins,
-                  int*    opt_err)
+create_sample_set(void*    mem,                    /* assmumed to be adequately sized */
+                  uint64_t frame,
+                  size_t   n_samples,
+                  size_t   n_fft_bins,
+                  int*     opt_err)
 {
-  if (sample_set_footprint(n_samples, n_fft_bins) > SAMPLE_SET_MAX) {
+  if (sample_set_footprint(n_samples, n_fft_bins) > UINT32_MAX) {
     if (opt_err) *opt_err = APP_ERR_INVAL;
     return NULL;
   }
 
   sample_set_t * sset = (sample_set_t*)mem;
-  sset->n_samples  = n_samples;
-  sset->n_fft_bins = n_fft_bins;
+  sset->hdr.type          = RECORD_SAMPLE_SET;
+  sset->hdr.size          = (uint32_t)sample_set_footprint(n_samples, n_fft_bins);
+  sset->hdr.frame         = frame;
+  sset->n_samples         = n_samples;
+  sset->n_fft_bins        = n_fft_bins;
+  sset->square_phase      = 0.0f;
+  sset->envelope_position = 0;
   return sset;
 }
 
+/* The records are packed, so the trailing data is found from the start of
+   the record. Taking the address of the member could be unaligned as far as
+   the compiler knows, and -Waddress-of-packed-member refuses it. */
+
 static inline float*
 sample_set_square_samples(sample_set_t* sset)
 {
-  return sset->data;
+  return (float*)((char*)sset + offsetof(sample_set_t, data));
 }
 
 static inline float*
 sample_set_pulse_samples(sample_set_t* sset)
 {
-  return sset->data + sset->n_samples;
+  return sample_set_square_samples(sset) + sset->n_samples;
 }
 
 static inline float*
 sample_set_lxd_in_samples(sample_set_t* sset)
 {
-  return sset->data + 2*sset->n_samples;
+  return sample_set_square_samples(sset) + 2*sset->n_samples;
 }
 
 static inline float*
 sample_set_fft_bins(sample_set_t* sset)
 {
-  return sset->data + 3*sset->n_samples;
+  return sample_set_square_samples(sset) + 3*sset->n_samples;
+}
+
+/* Sample set written while shedding load: some channels left out, the rest
+   optionally decimated by averaging `decimation` frames into each sample.
+   Covers n_frames frames from hdr.frame, the last sample averages whatever
+   is left over. Present channels follow in square, pulse, lxd_in order. */
+
+enum {
+  REDUCED_SQUARE = 1,
+  REDUCED_PULSE  = 2,
+  REDUCED_LXD_IN = 4,
+};
+
+typedef struct reduced_set reduced_set_t;
+
+struct __attribute__((packed)) reduced_set {
+  record_hdr_t hdr;
+  uint32_t     channels;   /* REDUCED_* present */
+  uint32_t     decimation;
+  uint32_t     n_frames;
+  uint32_t     n_fft_bins;
+  float        data[];
+
+  /* reduced_set_n_samples samples for each present channel */
+  /* fft_bin    data */
+};
+
+static inline size_t
+reduced_set_n_channels(uint32_t channels)
+{
+  return (size_t)__builtin_popcount(channels & (REDUCED_SQUARE | REDUCED_PULSE | REDUCED_LXD_IN));
+}
+
+static inline size_t
+reduced_set_samples(size_t n_frames,
+                    size_t decimation)
+{
+  return (n_frames + decimation - 1)/decimation;
+}
+
+static inline size_t
+reduced_set_footprint(uint32_t channels,
+                      size_t   n_frames,
+                      size_t   decimation,
+                      size_t   n_fft_bins)
+{
+  return sizeof(reduced_set_t)
+         + reduced_set_n_channels(channels)*reduced_set_samples(n_frames, decimation)*sizeof(float)
+         + n_fft_bins*sizeof(float);
 }
+
+static inline reduced_set_t*
+create_reduced_set(void*    mem,                    /* assumed to be adequately sized */
+                   uint64_t frame,
+                   uint32_t channels,
+                   size_t   n_frames,
+                   size_t   decimation,
+                   size_t   n_fft_bins,
+                   int*     opt_err)
+{
+  if (decimation == 0 || reduced_set_footprint(channels, n_frames, decimation, n_fft_bins) > UINT32_MAX) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  reduced_set_t* r = (reduced_set_t*)mem;
+  r->hdr.type      = RECORD_REDUCED;
+  r->hdr.size      = (uint32_t)reduced_set_footprint(channels, n_frames, decimation, n_fft_bins);
+  r->hdr.frame     = frame;
+  r->channels      = channels;
+  r->decimation    = (uint32_t)decimation;
+  r->n_frames      = (uint32_t)n_frames;
+  r->n_fft_bins    = (uint32_t)n_fft_bins;
+  return r;
+}
+
+static inline float*
+reduced_set_data(reduced_set_t* r)
+{
+  return (float*)((char*)r + offsetof(reduced_set_t, data));
+}
+
+/* NULL if `channel` (one of REDUCED_*) isn't present */
+
+static inline float*
+reduced_set_channel(reduced_set_t* r,
+                    uint32_t       channel)
+{
+  if (!(r->channels & channel)) return NULL;
+  size_t before = reduced_set_n_channels(r->channels & (channel - 1));
+  return reduced_set_data(r) + before*reduced_set_samples(r->n_frames, r->decimation);
+}
+
+static inline float*
+reduced_set_fft_bins(reduced_set_t* r)
+{
+  return reduced_set_data(r) + reduced_set_n_channels(r->channels)*reduced_set_samples(r->n_frames, r->decimation);
+}
+
+/* Snapshot of the sliding dft over the drive frequency and its odd harmonics.
+   hdr.frame is the first frame of the dft window. */
+
+#define HARMONICS_MAX_BINS (32ul)
+
+typedef struct harmonics harmonics_t;
+
+struct __attribute__((packed)) harmonics {
+  record_hdr_t hdr;
+  uint32_t     n_bins;
+  uint32_t     window;         /* frames in the dft window */
+  float        fundamental_hz;
+  uint32_t     _pad;
+  float        data[];
+
+  /* amplitude of the fundamental, 3rd, 5th, ... harmonics */
+  /* phase of each harmonic, radians, cosine phase at hdr.frame */
+};
+
+static inline size_t
+harmonics_footprint(size_t n_bins)
+{
+  return sizeof(harmonics_t) + 2*n_bins*sizeof(float);
+}
+
+static inline harmonics_t*
+create_harmonics(void*    mem,                     /* assumed to be adequately sized */
+                 uint64_t frame,
+                 size_t   n_bins,
+                 size_t   window,
+                 float    fundamental_hz,
+                 int*     opt_err)
+{
+  if (n_bins > HARMONICS_MAX_BINS) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  harmonics_t* h    = (harmonics_t*)mem;
+  h->hdr.type       = RECORD_HARMONICS;
+  h->hdr.size       = (uint32_t)harmonics_footprint(n_bins);
+  h->hdr.frame      = frame;
+  h->n_bins         = (uint32_t)n_bins;
+  h->window         = (uint32_t)window;
+  h->fundamental_hz = fundamental_hz;
+  h->_pad           = 0;
+  return h;
+}
+
+static inline float*
+harmonics_amplitude(harmonics_t* h)
+{
+  return (float*)((char*)h + offsetof(harmonics_t, data));
+}
+
+static inline float*
+harmonics_phase(harmonics_t* h)
+{
+  return harmonics_amplitude(h) + h->n_bins;
+}
+
+/* Decimated output of the lock-in amplifier demodulating lxd_in against the
+   square wave's fundamental. Points are `decimation` frames apart, hdr.frame is
+   the frame that completed the first one. */
+
+#define LOCKIN_MAX_POINTS (64ul)
+
+typedef struct demodulated demodulated_t;
+
+struct __attribute__((packed)) demodulated {
+  record_hdr_t hdr;
+  uint32_t     n_points;
+  uint32_t     decimation;
+  float        data[];
+
+  /* amplitude, relative to the drive's fundamental */
+  /* phase, radians, relative to the drive's fundamental */
+};
+
+static inline size_t
+demodulated_footprint(size_t n_points)
+{
+  return sizeof(demodulated_t) + 2*n_points*sizeof(float);
+}
+
+static inline demodulated_t*
+create_demodulated(void*    mem,                   /* assumed to be adequately sized */
+                   uint64_t frame,
+                   size_t   n_points,
+                   size_t   decimation,
+                   int*     opt_err)
+{
+  if (n_points > LOCKIN_MAX_POINTS) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  demodulated_t* d = (demodulated_t*)mem;
+  d->hdr.type      = RECORD_LOCKIN;
+  d->hdr.size      = (uint32_t)demodulated_footprint(n_points);
+  d->hdr.frame     = frame;
+  d->n_points      = (uint32_t)n_points;
+  d->decimation    = (uint32_t)decimation;
+  return d;
+}
+
+static inline float*
+demodulated_amplitude(demodulated_t* d)
+{
+  return (float*)((char*)d + offsetof(demodulated_t, data));
+}
+
+static inline float*
+demodulated_phase(demodulated_t* d)
+{
+  return demodulated_amplitude(d) + d->n_points;
+}
+
+/* The pulse generator was struck at hdr.frame. Nothing else to say. */
+
+typedef struct strike strike_t;
+
+struct __attribute__((packed)) strike {
+  record_hdr_t hdr;
+};
+
+static inline strike_t*
+create_strike(void*    mem,
+              uint64_t frame)
+{
+  strike_t* s  = (strike_t*)mem;
+  s->hdr.type  = RECORD_STRIKE;
+  s->hdr.size  = (uint32_t)sizeof(strike_t);
+  s->hdr.frame = frame;
+  return s;
+}
+
+/* Fit of the demodulated amplitude following the strike at hdr.frame, see
+   strike_fit.h for the model. */
+
+typedef struct strike_response strike_response_t;
+
+struct __attribute__((packed)) strike_response {
+  record_hdr_t hdr;
+  float        baseline;
+  float        amplitude;
+  float        tau_rise_s;
+  float        tau_fall_s;
+  float        rms_residual;
+  uint32_t     n_points;
+  uint32_t     iterations;
+  uint32_t     converged;
+};
+
+static inline strike_response_t*
+create_strike_response(void*    mem,
+                       uint64_t frame)
+{
+  strike_response_t* r = (strike_response_t*)mem;
+  memset(r, 0, sizeof(*r));
+  r->hdr.type  = RECORD_STRIKE_FIT;
+  r->hdr.size  = (uint32_t)sizeof(strike_response_t);
+  r->hdr.frame = frame;
+  return r;
+}
+
+/* Slice of the strike-synchronous average of lxd_in. An average is `window`
+   frames long and too big for a single record, so it is written as several
+   records, each holding bins [offset, offset+n_points). hdr.frame is the first
+   strike that went into the average. */
+
+#define SYNC_AVERAGE_MAX_POINTS (960ul)
+
+typedef struct sync_average sync_average_t;
+
+struct __attribute__((packed)) sync_average {
+  record_hdr_t hdr;
+  uint32_t     n_strikes;
+  uint32_t     window;
+  uint32_t     offset;
+  uint32_t     n_points;
+  float        data[];
+};
+
+static inline size_t
+sync_average_footprint(size_t n_points)
+{
+  return sizeof(sync_average_t) + n_points*sizeof(float);
+}
+
+static inline sync_average_t*
+create_sync_average(void*    mem,                  /* assumed to be adequately sized */
+                    uint64_t frame,
+                    size_t   n_strikes,
+                    size_t   window,
+                    size_t   offset,
+                    size_t   n_points,
+                    int*     opt_err)
+{
+  if (n_points > SYNC_AVERAGE_MAX_POINTS) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  sync_average_t* a = (sync_average_t*)mem;
+  a->hdr.type       = RECORD_SYNC_AVG;
+  a->hdr.size       = (uint32_t)sync_average_footprint(n_points);
+  a->hdr.frame      = frame;
+  a->n_strikes      = (uint32_t)n_strikes;
+  a->window         = (uint32_t)window;
+  a->offset         = (uint32_t)offset;
+  a->n_points       = (uint32_t)n_points;
+  return a;
+}
+
+static inline float*
+sync_average_samples(sync_average_t* a)
+{
+  return (float*)((char*)a + offsetof(sync_average_t, data));
+}
+
+/* Slice of a transfer function estimate (see xspec.h). Like the synchronous
+   average, one estimate spans several records, each holding bins
+   [first_bin, first_bin+n_bins) of H1 and the coherence. hdr.frame is the start
+   of the first segment that went into the estimate. */
+
+#define TRANSFER_MAX_BINS (256ul)
+
+typedef struct transfer transfer_t;
+
+struct __attribute__((packed)) transfer {
+  record_hdr_t hdr;
+  uint32_t     n_segments;
+  uint32_t     segment;    /* fft length, bin k is k*sample_rate/segment Hz */
+  uint32_t     first_bin;
+  uint32_t     n_bins;
+  float        data[];
+
+  /* H1 real part */
+  /* H1 imaginary part */
+  /* coherence */
+};
+
+static inline size_t
+transfer_footprint(size_t n_bins)
+{
+  return sizeof(transfer_t) + 3*n_bins*sizeof(float);
+}
+
+static inline transfer_t*
+create_transfer(void*    mem,                  /* assumed to be adequately sized */
+                uint64_t frame,
+                size_t   n_segments,
+                size_t   segment,
+                size_t   first_bin,
+                size_t   n_bins,
+                int*     opt_err)
+{
+  if (n_bins > TRANSFER_MAX_BINS) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  transfer_t* t   = (transfer_t*)mem;
+  t->hdr.type     = RECORD_TRANSFER;
+  t->hdr.size     = (uint32_t)transfer_footprint(n_bins);
+  t->hdr.frame    = frame;
+  t->n_segments   = (uint32_t)n_segments;
+  t->segment      = (uint32_t)segment;
+  t->first_bin    = (uint32_t)first_bin;
+  t->n_bins       = (uint32_t)n_bins;
+  return t;
+}
+
+static inline float*
+transfer_real(transfer_t* t)
+{
+  return (float*)((char*)t + offsetof(transfer_t, data));
+}
+
+static inline float*
+transfer_imag(transfer_t* t)
+{
+  return transfer_real(t) + t->n_bins;
+}
+
+static inline float*
+transfer_coherence(transfer_t* t)
+{
+  return transfer_real(t) + 2*t->n_bins;
+}
+
+/* Latency from pulse_out to lxd_in around one strike (see gcc_phat.h), and the
+   median of the last n_median of them. hdr.frame is the strike. */
+
+typedef struct latency latency_t;
+
+struct __attribute__((packed)) latency {
+  record_hdr_t hdr;
+  float        delay_frames;
+  float        peak;
+  float        median_frames;
+  uint32_t     n_median;
+};
+
+static inline latency_t*
+create_latency(void*    mem,
+               uint64_t frame)
+{
+  latency_t* l = (latency_t*)mem;
+  memset(l, 0, sizeof(*l));
+  l->hdr.type  = RECORD_LATENCY;
+  l->hdr.size  = (uint32_t)sizeof(latency_t);
+  l->hdr.frame = frame;
+  return l;
+}
+
+/* Discontinuity marker. jack reported xruns since the previous callback, so
+   the audio before hdr.frame and from hdr.frame on isn't contiguous in time,
+   even though the frame numbers are. */
+
+typedef struct xrun xrun_t;
+
+struct __attribute__((packed)) xrun {
+  record_hdr_t hdr;
+  uint64_t     time_ns;    /* when the latest of them was reported */
+  uint32_t     n_new;      /* xruns since the previous marker */
+  uint32_t     n_total;    /* xruns since the start of the run */
+};
+
+static inline xrun_t*
+create_xrun(void*    mem,
+            uint64_t frame)
+{
+  xrun_t* x    = (xrun_t*)mem;
+  memset(x, 0, sizeof(*x));
+  x->hdr.type  = RECORD_XRUN;
+  x->hdr.size  = (uint32_t)sizeof(xrun_t);
+  x->hdr.frame = frame;
+  return x;
+}
+
+/* Written when the app changes how much load it sheds, or after it had to
+   drop records because the disk ring was full. From hdr.frame on, sample
+   data is written at `level`:
+
+     0  full sample sets
+     1  reduced sets without square_out
+     2  reduced sets without square_out, decimated
+     3  no sample data, fft bins only */
+
+typedef struct gap gap_t;
+
+struct __attribute__((packed)) gap {
+  record_hdr_t hdr;
+  uint32_t     level;
+  uint32_t     n_dropped;      /* records dropped since the previous marker */
+  uint64_t     n_dropped_total;
+};
+
+static inline gap_t*
+create_gap(void*    mem,
+           uint64_t frame)
+{
+  gap_t* g     = (gap_t*)mem;
+  memset(g, 0, sizeof(*g));
+  g->hdr.type  = RECORD_GAP;
+  g->hdr.size  = (uint32_t)sizeof(gap_t);
+  g->hdr.frame = frame;
+  return g;
+}
+
+/* Columnar sample data, see the top of the file. Covers n_frames contiguous
+   frames from hdr.frame. data_offset is picked so what follows it starts
+   CHUNK_COLUMN_ALIGN aligned in the file, which keeps it aligned when the
+   file is mmapped.
+
+   CHUNK_RAW chunks have n_channels columns of n_frames floats there.
+   CHUNK_PACKED chunks have a column_hdr per channel, then each channel's
+   data back to back, encoded as its column_hdr says. COLUMN_XOR_PLANES is
+   lossless, see column_codec.h. A COLUMN_SYNTH column has no samples, only
+   the state the generator that made the channel (square_out or pulse_out)
+   was in at hdr.frame, which is enough to make them again, see
+   capture_synth.h. COLUMN_INT16 and COLUMN_INT24 are lossy, each sample
+   rounded to a multiple of the column's scale, see column_quant.h.
+
+   `crc` is the CRC32C (crc32c.h) of the hdr.size bytes of the record, all
+   but the four of `crc` itself. `sequence` counts the run's chunks from 0
+   and carries on across segments, so a jump says chunks are missing rather
+   than frames having never been written. */
+
+#define CHUNK_COLUMN_ALIGN 64u
+#define CHUNK_SYNC         0x4b4e4843u /* "CHNK" */
+
+enum {
+  CHUNK_RAW    = 0,
+  CHUNK_PACKED = 1,
+};
+
+enum {
+  COLUMN_FLOAT32    = 0, /* n_frames floats */
+  COLUMN_XOR_PLANES = 1,
+  COLUMN_SYNTH      = 2, /* synth_square or synth_pulse */
+  COLUMN_INT16      = 3, /* quant_hdr, then n_frames int16 */
+  COLUMN_INT24      = 4, /* quant_hdr, then n_frames 3 byte ints */
+};
+
+typedef struct column_hdr column_hdr_t;
+
+struct __attribute__((packed)) column_hdr {
+  uint32_t encoding; /* COLUMN_* */
+  uint32_t bytes;
+  uint64_t reserved;
+};
+
+typedef struct chunk chunk_t;
+
+struct __attribute__((packed)) chunk {
+  record_hdr_t hdr;
+  uint32_t     n_frames;
+  uint32_t     n_channels;
+  uint32_t     data_offset; /* from the start of the record to the first column */
+  uint32_t     layout;      /* CHUNK_* */
+  uint32_t     sync;        /* CHUNK_SYNC */
+  uint32_t     sequence;
+  uint32_t     crc;
+  uint32_t     reserved;
+
+  /* padding up to data_offset */
+  /* columns, in capture_meta.channels order */
+};
+
+/* COLUMN_SYNTH for square_out: additive_square's phase at the first frame */
+
+typedef struct synth_square synth_square_t;
+
+struct __attribute__((packed)) synth_square {
+  float    phase;
+  uint32_t reserved;
+};
+
+/* COLUMN_SYNTH for pulse_out: the envelope's position at the first frame,
+   and the frames it was struck at, counted from the first */
+
+typedef struct synth_pulse synth_pulse_t;
+
+struct __attribute__((packed)) synth_pulse {
+  uint32_t position;
+  uint32_t n_strikes;
+
+  /* n_strikes uint32_t, ascending */
+};
+
+/* Start of a COLUMN_INT16 or COLUMN_INT24 column: sample i is ints[i]*scale */
+
+typedef struct quant_hdr quant_hdr_t;
+
+struct __attribute__((packed)) quant_hdr {
+  float    scale;
+  uint32_t reserved;
+};
+
+/* Only for CHUNK_RAW */
+
+static inline float const*
+chunk_column(chunk_t const* c,
+             size_t         channel)
+{
+  return (float const*)((char const*)c + c->data_offset) + channel*c->n_frames;
+}
+
+/* FFT bins of the transform that completed in the sample set at hdr.frame */
+
+typedef struct fft_bins fft_bins_t;
+
+struct __attribute__((packed)) fft_bins {
+  record_hdr_t hdr;
+  uint32_t     n_bins;
+  uint32_t     reserved;
+
+  /* n_bins floats */
+};
+
+static inline fft_bins_t*
+create_fft_bins(void*    mem,
+                uint64_t frame,
+                size_t   n_bins)
+{
+  fft_bins_t* f = (fft_bins_t*)mem;
+  memset(f, 0, sizeof(*f));
+  f->hdr.type  = RECORD_FFT;
+  f->hdr.size  = (uint32_t)(sizeof(fft_bins_t) + n_bins*sizeof(float));
+  f->hdr.frame = frame;
+  f->n_bins    = (uint32_t)n_bins;
+  return f;
+}
+
+/* Last record of a cleanly closed segment: where each of its chunks is, in
+   frame order. hdr.frame is the first chunk's first frame. */
+
+typedef struct index_entry index_entry_t;
+
+struct __attribute__((packed)) index_entry {
+  uint64_t frame;    /* first frame */
+  uint32_t n_frames;
+  uint32_t reserved;
+  uint64_t offset;   /* of the chunk record, from the start of the file */
+};
+
+typedef struct chunk_index chunk_index_t;
+
+struct __attribute__((packed)) chunk_index {
+  record_hdr_t  hdr;
+  uint64_t      n_entries;
+  index_entry_t entries[];
+};
@@ -1,32 +1,158 @@
+#include "capture_writer.h"
 #include "common.h"
+#include "cycle_hist.h"
 #include "disk.h"
 #include "disk_thread.h"
+#include "disk_writer.h"
+#include "record_io.h"
+#include "thread_setup.h"
 
 #include <assert.h>
 #include <errno.h>
-#include <errno.h>
-#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
 
+/* records taken from a ring at once */
+#define MAX_BATCH 64
+
+#if 2*MAX_BATCH > CAPTURE_INDEX_SLACK
+#error "rotation is looked at after a batch from each ring"
+#endif
+
+/* Syncs that get timed */
+enum {
+  SYNC_WRITEBACK, /* sync_file_range every DISK_SYNC_BYTES */
+  SYNC_SEGMENT,   /* fdatasync as a segment ends */
+  SYNC_COUNT,
+};
+
+static char const* sync_names[SYNC_COUNT] = { "disk writeback", "disk segment sync" };
+
 struct disk_thread {
   /* shared between main thread and background thread */
   pthread_t          t;
   bool               thread_valid;
   atomic_bool        flush;
+  int                efd;         /* eventfd the producer pokes the thread through */
+  atomic_bool        sleeping;    /* the thread is (about to be) blocked on efd */
+  atomic_uint_fast64_t wakeups;
+  atomic_size_t      high_water;  /* most slots waiting in one ring, since last read */
 
   /* stuff only accessed from the thread */
-  jack_ringbuffer_t* read_ring;
-  int                fd;
-  char               buffer[4096*4]; // FIXME size?
+  slot_ring_t*       read_rings[DISK_THREAD_MAX_RINGS];
+  size_t             n_rings;
+  disk_writer_t*     writer;      /* in the trailing memory, owns the file */
+  capture_writer_t*  capture;     /* here too, lays the records out on the way in */
+  cycle_hist_t*      sync_times;  /* and this, per SYNC_* */
+  char               base[PATH_MAX];  /* dir/prefix-start time, segments add -NNNN.lxd */
+  char               path[PATH_MAX];  /* current segment */
+  unsigned           segment;
+  uint64_t           segment_bytes;
+  uint64_t           segment_start_ns;
 };
 
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static bool
+segment_path(disk_thread_t* dt)
+{
+  int n = snprintf(dt->path, sizeof(dt->path), "%s-%04u.lxd", dt->base, dt->segment);
+  return n >= 0 && (size_t)n < sizeof(dt->path);
+}
+
+/* Segments end once they reach segment_bytes, are DISK_SEGMENT_SECONDS
+   old, or their index is full. An empty one is left alone, so an idle run
+   doesn't pile up files. */
+
+static bool
+rotation_due(disk_thread_t* dt)
+{
+  uint64_t bytes = disk_writer_bytes(dt->writer);
+  if (bytes == 0)                  return false;
+  if (bytes >= dt->segment_bytes)  return true;
+  if (capture_writer_index_full(dt->capture)) return true;
+
+  return DISK_SEGMENT_SECONDS
+         && now_ns() - dt->segment_start_ns >= DISK_SEGMENT_SECONDS*1000000000ull;
+}
+
+/* Only ever called here. Producers just see the rings fill a little more
+   while the files change over. */
+
+static int
+rotate(disk_thread_t* dt)
+{
+  dt->segment += 1;
+  if (!segment_path(dt)) return APP_ERR_INVAL;
+
+  uint64_t start = now_ns();
+  int      err   = capture_writer_end_segment(dt->capture);
+  if (err != APP_SUCCESS) return err;
+
+  if (DISK_SYNC) {
+    uint64_t t0 = cycle_hist_now();
+    err = disk_writer_finish(dt->writer);
+    cycle_hist_add(dt->sync_times, SYNC_SEGMENT, cycle_hist_now() - t0);
+    if (err != APP_SUCCESS) return err;
+  }
+
+  err = disk_writer_rotate(dt->writer, dt->path);
+  dt->segment_start_ns = now_ns();
+
+  printf("%-30s %s in %.2f ms\n", "disk thread rotated to", dt->path,
+         (double)(dt->segment_start_ns - start)/1e6);
+  return err;
+}
+
+static size_t
+pending(disk_thread_t* dt)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < dt->n_rings; ++i) n += slot_ring_used(dt->read_rings[i]);
+  return n;
+}
+
+/* Block until poked, or DISK_WAKE_TIMEOUT_MS for anything that was written
+   without a poke. `sleeping` is set before the last look at the rings, so a
+   producer that publishes after that look sees it and pokes. */
+
+static void
+wait_for_work(disk_thread_t* dt)
+{
+  atomic_store(&dt->sleeping, true);
+  if (pending(dt) >= DISK_WAKE_SLOTS || atomic_load(&dt->flush)) {
+    atomic_store(&dt->sleeping, false);
+    return;
+  }
+
+  struct pollfd pfd[1] = { { .fd = dt->efd, .events = POLLIN, .revents = 0 } };
+  poll(pfd, 1, DISK_WAKE_TIMEOUT_MS);
+
+  uint64_t count;
+  ssize_t  ret = read(dt->efd, &count, sizeof(count)); /* non-blocking, just clears it */
+  (void)ret;
+
+  atomic_store(&dt->sleeping, false);
+  atomic_store_explicit(&dt->wakeups, atomic_load_explicit(&dt->wakeups, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+}
+
 static void*
 thread(void* arg)
 {
@@ -37,65 +163,179 @@ thread(void* arg)
     fprintf(stderr, "couldn't set thread name, why=\n");
   }
 
+  /* failures are reported, but the thread works wherever it ends up */
+  thread_setup_pin(DISK_CPU);
+  thread_setup_nice(DISK_NICE);
+  thread_setup_report("disk thread");
+  printf("%-30s %s\n", "disk thread writing to", dt->path);
+  printf("%-30s %s%s\n", "disk thread backend",
+         disk_writer_backend_name(disk_writer_backend(dt->writer)),
+         disk_writer_direct(dt->writer) ? ", O_DIRECT" : "");
+
   while (true) {
-    bool flushing = atomic_load(&dt->flush);
-    size_t r = jack_ringbuffer_read(dt->read_ring, dt->buffer, sizeof(dt->buffer));
-    if (flushing && r == 0) break;
-
-    char*  ptr  = dt->buffer;
-    size_t left = r;
-    while (left) {
-      ssize_t ret = write(dt->fd, ptr, left);
-      if (-1 == ret) {
-        fprintf(stderr, "Write failed with '%s'\n", strerror(errno));
+    bool   flushing = atomic_load(&dt->flush);
+    size_t total    = 0;
+
+    /* slots go back as soon as the writer is done with them, which for
+       io_uring is once they've been copied into its buffers, and for sample
+       data once it's in the chunk being filled */
+    for (size_t i = 0; i < dt->n_rings; ++i) {
+      slot_ring_t* ring     = dt->read_rings[i];
+      size_t       readable = slot_ring_readable(ring);
+      size_t       n        = MIN(readable, MAX_BATCH);
+      total += n;
+
+      if (readable > atomic_load_explicit(&dt->high_water, memory_order_relaxed)) {
+        atomic_store_explicit(&dt->high_water, readable, memory_order_relaxed);
+      }
+
+      int err = APP_SUCCESS;
+      for (size_t j = 0; j < n && err == APP_SUCCESS; ++j) {
+        err = capture_writer_add(dt->capture, record_at(ring, j));
+      }
+      if (err == APP_SUCCESS) err = capture_writer_commit(dt->capture);
+
+      if (err != APP_SUCCESS) {
         /* FIXME main thread should watchdog the other threads */
         return NULL;
       }
 
-      assert((size_t)ret <= left);
-      left -= (size_t)ret;
+      slot_ring_release(ring, n);
     }
 
-    usleep(1000);
+    if (rotation_due(dt) && rotate(dt) != APP_SUCCESS) {
+      /* FIXME main thread should watchdog the other threads */
+      return NULL;
+    }
+
+    /* a bounded amount of dirty data at a time instead of writeback storms */
+    if (DISK_SYNC && disk_writer_unsynced(dt->writer) >= DISK_SYNC_BYTES) {
+      uint64_t t0 = cycle_hist_now();
+      if (disk_writer_writeback(dt->writer) != APP_SUCCESS) return NULL;
+      cycle_hist_add(dt->sync_times, SYNC_WRITEBACK, cycle_hist_now() - t0);
+    }
+
+    if (flushing && total == 0) break;
+
+    /* keep going while there's anything to write, and don't sit on a
+       partly filled buffer while idle */
+    if (total == 0) {
+      if (disk_writer_flush(dt->writer) != APP_SUCCESS) return NULL;
+      wait_for_work(dt);
+    }
   }
 
+  uint64_t t0 = cycle_hist_now();
+  if (capture_writer_end_segment(dt->capture) != APP_SUCCESS
+      || disk_writer_finish(dt->writer) != APP_SUCCESS) {
+    fprintf(stderr, "disk thread couldn't finish the output file\n");
+  }
+  cycle_hist_add(dt->sync_times, SYNC_SEGMENT, cycle_hist_now() - t0);
+
   return NULL;
 }
 
 size_t
 disk_thread_footprint(void)
 {
-  return sizeof(disk_thread_t);
+  size_t footprint = sizeof(disk_thread_t);
+  footprint = ALIGN(footprint, cycle_hist_align());
+  footprint += cycle_hist_footprint();
+  footprint = ALIGN(footprint, disk_writer_align());
+  footprint += disk_writer_footprint();
+  footprint = ALIGN(footprint, capture_writer_align());
+  footprint += capture_writer_footprint();
+  return footprint;
 }
 
 size_t
 disk_thread_align(void)
 {
-  return 1;
+  return disk_writer_align();
 }
 
 disk_thread_t*
-create_disk_thread(void*              mem,
-                   jack_ringbuffer_t* read_ring,
-                   int*               opt_err)
+create_disk_thread(void*                 mem,
+                   slot_ring_t* const*   read_rings,
+                   size_t                n_rings,
+                   char const*           output_dir,
+                   char const*           output_prefix,
+                   capture_meta_t const* meta,
+                   uint64_t              segment_bytes,
+                   int*                  opt_err)
 {
   /* FIXME check alignment */
 
-  int fd = open(OUTPUT_DATA_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
-  if (-1 == fd) {
-    if (opt_err) *opt_err = APP_ERR_OPEN;
-    fprintf(stderr, "Failed to open file with '%s'", strerror(errno));
+  if (n_rings == 0 || n_rings > DISK_THREAD_MAX_RINGS || !output_dir || !output_prefix || !meta
+      || segment_bytes == 0) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
     return NULL;
   }
 
   disk_thread_t* dt = (disk_thread_t*)mem;
+
+  /* every run gets its own files, named for when it started */
+  char      stamp[32];
+  time_t    now = time(NULL);
+  struct tm tm[1];
+  localtime_r(&now, tm);
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", tm);
+
+  int n = snprintf(dt->base, sizeof(dt->base), "%s/%s-%s", output_dir, output_prefix, stamp);
+  dt->segment = 0;
+  if (n < 0 || (size_t)n >= sizeof(dt->base) || !segment_path(dt)) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (-1 == efd) {
+    if (opt_err) *opt_err = APP_ERR_OPEN;
+    fprintf(stderr, "Failed to create eventfd with '%s'", strerror(errno));
+    return NULL;
+  }
+
+  char* ptr = (char*)mem + sizeof(disk_thread_t);
+
+  ptr = (char*)ALIGN((size_t)ptr, cycle_hist_align());
+  cycle_hist_t* sync_times = create_cycle_hist(ptr, SYNC_COUNT, opt_err);
+  if (!sync_times) {
+    close(efd);
+    return NULL; /* opt_err already set */
+  }
+  ptr += cycle_hist_footprint();
+
+  ptr = (char*)ALIGN((size_t)ptr, disk_writer_align());
+  disk_writer_t* writer = create_disk_writer(ptr, dt->path, DISK_BACKEND, DISK_DIRECT, opt_err);
+  if (!writer) {
+    close(efd);
+    return NULL; /* opt_err already set */
+  }
+  ptr += disk_writer_footprint();
+
+  ptr = (char*)ALIGN((size_t)ptr, capture_writer_align());
+  capture_writer_t* capture = create_capture_writer(ptr, writer, meta, opt_err);
+  if (!capture) {
+    destroy_disk_writer(writer);
+    close(efd);
+    return NULL; /* opt_err already set */
+  }
+
   dt->t             = 0; /* no portable way to init */
   dt->thread_valid  = false;
   /* flush follows */
-  dt->read_ring     = read_ring;
-  dt->fd            = fd;
-  memset(dt->buffer, 0, sizeof(dt->buffer)); /* why not */
+  for (size_t i = 0; i < n_rings; ++i) dt->read_rings[i] = read_rings[i];
+  dt->n_rings       = n_rings;
+  dt->writer        = writer;
+  dt->capture       = capture;
+  dt->sync_times    = sync_times;
+  dt->efd           = efd;
+  dt->segment_bytes = segment_bytes;
+  dt->segment_start_ns = now_ns();
   atomic_store(&dt->flush, false);
+  atomic_store(&dt->sleeping, false);
+  atomic_store(&dt->wakeups, 0);
+  atomic_store(&dt->high_water, 0);
 
   if (opt_err) *opt_err = APP_SUCCESS;
   return dt;
@@ -107,7 +347,9 @@ destroy_disk_thread(disk_thread_t* dt)
   if (!dt) return NULL;
   assert(!dt->thread_valid);
 
-  /* doesn't actually do anything */
+  destroy_capture_writer(dt->capture);
+  destroy_disk_writer(dt->writer);
+  close(dt->efd);
   return (void*)dt;
 }
 
@@ -135,15 +377,68 @@ disk_thread_flush_and_stop(disk_thread_t* dt)
 
   atomic_store(&dt->flush, true);
 
+  /* don't wait out the timeout */
+  uint64_t one = 1;
+  ssize_t  n   = write(dt->efd, &one, sizeof(one));
+  (void)n;
+
   int ret = pthread_join(dt->t, NULL);
   dt->thread_valid = false;
   if (0 != ret) return APP_ERR_THREAD_JOIN;
 
-  ret = close(dt->fd);
-  if (-1 == ret) {
-    /* not recoverable */
-    fprintf(stderr, "close failed with '%s'\n", strerror(errno));
+  return APP_SUCCESS;
+}
+
+void
+disk_thread_poke(disk_thread_t* dt,
+                 size_t         pending)
+{
+  if (pending < DISK_WAKE_SLOTS) return;
+
+  /* order our publish before looking at `sleeping`, pairs with the store in
+     wait_for_work */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!atomic_load_explicit(&dt->sleeping, memory_order_relaxed)) return;
+  if (!atomic_exchange(&dt->sleeping, false))                     return; /* someone beat us to it */
+
+  uint64_t one = 1;
+  ssize_t  ret = write(dt->efd, &one, sizeof(one));
+  (void)ret;
+}
+
+void
+disk_thread_stats(disk_thread_t* dt,
+                  uint64_t*      wakeups,
+                  size_t*        high_water)
+{
+  *wakeups    = atomic_load_explicit(&dt->wakeups, memory_order_relaxed);
+  *high_water = atomic_exchange_explicit(&dt->high_water, 0, memory_order_relaxed);
+}
+
+void
+disk_thread_report_syncs(disk_thread_t* dt)
+{
+  double per_us = 1e3*cycle_hist_cycles_per_ns(dt->sync_times);
+  for (size_t i = 0; i < SYNC_COUNT; ++i) {
+    cycle_hist_summary_t sum[1];
+    cycle_hist_summarize(dt->sync_times, i, sum);
+    if (sum->n == 0) continue;
+
+    char label[64];
+    snprintf(label, sizeof(label), "%s us", sync_names[i]);
+    printf("%-30s p50 %8.2f p99 %8.2f max %8.2f n %" PRIu64 "\n", label,
+           (double)sum->p50/per_us, (double)sum->p99/per_us, (double)sum->max/per_us, sum->n);
   }
+}
 
-  return APP_SUCCESS;
+void
+disk_thread_report_pack(disk_thread_t* dt)
+{
+  uint64_t raw, packed, ns;
+  capture_writer_pack_stats(dt->capture, &raw, &packed, &ns);
+  if (raw == 0 || packed == 0) return;
+
+  printf("%-30s %.2fx, %.1f of %.1f MiB at %.1f MB/s\n", "capture packing",
+         (double)raw/(double)packed, (double)packed/(1 << 20), (double)raw/(1 << 20),
+         ns ? (double)raw*1e3/(double)ns : 0.0);
 }
@@ -1,6 +1,9 @@
 #pragma once
 
-#include <jack/ringbuffer.h>
+#include "disk.h"
+#include "slot_ring.h"
+
+#include <stdint.h>
 
 typedef struct disk_thread disk_thread_t;
 
@@ -10,10 +13,37 @@ disk_thread_footprint(void);
 size_t
 disk_thread_align(void);
 
+/* Max number of rings one disk thread can drain */
+#define DISK_THREAD_MAX_RINGS 4
+
+/* The thread drains whole records from each of the `n_rings` rings into the
+   output file, so records from different producers never interleave. Records
+   are written straight from the ring's slots, a batch at a time, except for
+   sample sets, which are gathered into column chunks (capture_writer.h). Each
+   segment's header carries `meta`.
+
+   Between batches the thread sleeps on an eventfd. Producers call
+   disk_thread_poke after publishing, which only wakes it once enough is
+   waiting, at most once per sleep. Anything short of that is picked up after
+   DISK_WAKE_TIMEOUT_MS.
+
+   Output goes to `output_dir`/`output_prefix`-YYYYmmdd-HHMMSS-NNNN.lxd, named
+   for when the thread was created. The thread moves on to the next NNNN
+   after `segment_bytes` (DISK_SEGMENT_BYTES in the app) or
+   DISK_SEGMENT_SECONDS.
+
+   With DISK_SYNC the thread starts writeback every DISK_SYNC_BYTES, waiting
+   for the previous batch, and fdatasyncs each segment as it ends. */
+
 disk_thread_t*
-create_disk_thread(void*              mem,
-                   jack_ringbuffer_t* read_ring,
-                   int*               opt_err);
+create_disk_thread(void*                 mem,
+                   slot_ring_t* const*   read_rings,
+                   size_t                n_rings,
+                   char const*           output_dir,
+                   char const*           output_prefix,
+                   capture_meta_t const* meta,
+                   uint64_t              segment_bytes,
+                   int*                  opt_err);
 
 void*
 destroy_disk_thread(disk_thread_t* dt);
@@ -23,3 +53,31 @@ disk_thread_start(disk_thread_t* dt);
 
 int
 disk_thread_flush_and_stop(disk_thread_t* dt);
+
+/* Wake the thread if it sleeps and `pending` slots (the caller's ring fill)
+   have reached DISK_WAKE_SLOTS. Realtime safe: a non-blocking eventfd write,
+   and only on the first poke of a sleep. */
+
+void
+disk_thread_poke(disk_thread_t* dt,
+                 size_t         pending);
+
+/* Times the thread woke up since it started, and the most slots it found
+   waiting in one ring since the previous call */
+
+void
+disk_thread_stats(disk_thread_t* dt,
+                  uint64_t*      wakeups,
+                  size_t*        high_water);
+
+/* Print how long writeback and segment syncs took since the previous call.
+   One caller at a time. */
+
+void
+disk_thread_report_syncs(disk_thread_t* dt);
+
+/* Print how well sample columns have packed (CAPTURE_PACK) since the start,
+   and how fast */
+
+void
+disk_thread_report_pack(disk_thread_t* dt);
@@ -0,0 +1,942 @@
+#include "common.h"
+#include "disk.h"
+#include "disk_writer.h"
+#include "err.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAGE         4096ul
+#define RING_ENTRIES 16u
+
+#if DISK_BUFFERS + 2 > RING_ENTRIES
+#error "every buffer, a fallocate and a control op must fit in the submission queue"
+#endif
+
+#if DISK_BUFFERS < 2
+#error "need a buffer to fill while another is written"
+#endif
+
+/* user_data of everything that isn't a buffer write, which use the buffer
+   index */
+#define UD_FALLOCATE ((uint64_t)-1)
+#define UD_CTL       ((uint64_t)-2)  /* open, fsync or close, one at a time */
+
+typedef struct {
+  uint64_t offset; /* where the buffer goes in the file */
+  size_t   len;    /* bytes in it */
+  size_t   done;   /* written so far, writes can come back short */
+  bool     busy;   /* submitted and not completed */
+} buffer_t;
+
+typedef struct {
+  int                  fd;
+  void*                sq_ptr;
+  size_t               sq_len;
+  void*                cq_ptr;
+  size_t               cq_len;
+  struct io_uring_sqe* sqes;
+  size_t               sqes_len;
+  unsigned*            sq_head;
+  unsigned*            sq_tail;
+  unsigned*            sq_mask;
+  unsigned*            sq_array;
+  unsigned*            cq_head;
+  unsigned*            cq_tail;
+  unsigned*            cq_mask;
+  struct io_uring_cqe* cqes;
+  bool                 fixed;     /* buffers are registered */
+  unsigned             in_flight; /* submitted and not reaped */
+  bool                 ctl_done;
+  int                  ctl_res;
+} uring_t;
+
+struct disk_writer {
+  int      backend;
+  int      flags;         /* for open */
+  bool     direct;        /* current file is O_DIRECT */
+  bool     staged;        /* records are copied into bufs, see disk_writer_append */
+  int      fd;
+  int      error;         /* first failure, sticky */
+  bool     can_fallocate;
+  uint64_t offset;        /* file offset after everything appended, buffered included */
+  uint64_t allocated;     /* fallocated up to here */
+  uint64_t session;       /* same in every segment of one run */
+  uint32_t segment;
+  bool     ended;         /* end_file has run on the current file */
+  uint64_t index;         /* see disk_writer_mark_index, 0 for none */
+  uint64_t wb_waited;     /* writeback is known done below here */
+  uint64_t wb_started;    /* and was started below here */
+  uring_t  ring[1];
+  size_t   cur;           /* buffer being filled */
+  buffer_t bufs[DISK_BUFFERS];
+  char*    hdr;           /* FILE_HDR_SIZE block, in the trailing memory */
+  char*    data;          /* DISK_BUFFERS*DISK_BUFFER_SIZE, after hdr */
+};
+
+/* liburing isn't always around, the three syscalls are all we need */
+
+static int
+uring_setup(unsigned                entries,
+            struct io_uring_params* p)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+uring_enter(int      fd,
+            unsigned to_submit,
+            unsigned min_complete,
+            unsigned flags)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int
+uring_register(int      fd,
+               unsigned opcode,
+               void*    arg,
+               unsigned n)
+{
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, n);
+}
+
+static void
+uring_fini(uring_t* r)
+{
+  if (r->sqes)                                  munmap(r->sqes, r->sqes_len);
+  if (r->cq_ptr && r->cq_ptr != r->sq_ptr)      munmap(r->cq_ptr, r->cq_len);
+  if (r->sq_ptr)                                munmap(r->sq_ptr, r->sq_len);
+  if (r->fd >= 0)                               close(r->fd);
+  memset(r, 0, sizeof(*r));
+  r->fd = -1;
+}
+
+static bool
+uring_init(uring_t* r)
+{
+  memset(r, 0, sizeof(*r));
+
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  r->fd = uring_setup(RING_ENTRIES, &p);
+  if (r->fd < 0) {
+    r->fd = -1;
+    return false;
+  }
+
+  r->sq_len   = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  r->cq_len   = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  r->sqes_len = p.sq_entries*sizeof(struct io_uring_sqe);
+
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single) r->sq_len = r->cq_len = MAX(r->sq_len, r->cq_len);
+
+  void* sq = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                  IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) goto fail;
+  r->sq_ptr = sq;
+
+  void* cq = sq;
+  if (!single) {
+    cq = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+              IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) goto fail;
+  }
+  r->cq_ptr = cq;
+
+  void* sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                    IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) goto fail;
+  r->sqes = (struct io_uring_sqe*)sqes;
+
+  r->sq_head  = (unsigned*)((char*)sq + p.sq_off.head);
+  r->sq_tail  = (unsigned*)((char*)sq + p.sq_off.tail);
+  r->sq_mask  = (unsigned*)((char*)sq + p.sq_off.ring_mask);
+  r->sq_array = (unsigned*)((char*)sq + p.sq_off.array);
+  r->cq_head  = (unsigned*)((char*)cq + p.cq_off.head);
+  r->cq_tail  = (unsigned*)((char*)cq + p.cq_off.tail);
+  r->cq_mask  = (unsigned*)((char*)cq + p.cq_off.ring_mask);
+  r->cqes     = (struct io_uring_cqe*)((char*)cq + p.cq_off.cqes);
+  return true;
+
+fail:
+  uring_fini(r);
+  return false;
+}
+
+/* Next free sqe, zeroed. We never queue more than fits, see RING_ENTRIES. */
+
+static struct io_uring_sqe*
+uring_sqe(uring_t* r)
+{
+  unsigned tail = *r->sq_tail; /* only we write it */
+  unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+  BUG(tail - head > *r->sq_mask, "io_uring submission queue full\n");
+
+  unsigned             i   = tail & *r->sq_mask;
+  struct io_uring_sqe* sqe = r->sqes + i;
+  memset(sqe, 0, sizeof(*sqe));
+  r->sq_array[i] = i;
+  return sqe;
+}
+
+static int
+uring_submit(uring_t* r)
+{
+  __atomic_store_n(r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE);
+  r->in_flight += 1;
+
+  while (true) {
+    int ret = uring_enter(r->fd, 1, 0, 0);
+    if (ret >= 0)        return APP_SUCCESS;
+    if (errno != EINTR)  break;
+  }
+
+  fprintf(stderr, "io_uring submit failed with '%s'\n", strerror(errno));
+  return APP_ERR_WRITE;
+}
+
+static void
+uring_wait(uring_t* r)
+{
+  while (-1 == uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS) && errno == EINTR) { }
+}
+
+static int submit_write(disk_writer_t* w, size_t i);
+
+/* Handle whatever has completed, without blocking */
+
+static void
+reap(disk_writer_t* w)
+{
+  uring_t* r    = w->ring;
+  unsigned head = *r->cq_head;
+  unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; ++head) {
+    struct io_uring_cqe* cqe = r->cqes + (head & *r->cq_mask);
+    uint64_t             ud  = cqe->user_data;
+    int                  res = cqe->res;
+    r->in_flight -= 1;
+
+    if (ud == UD_FALLOCATE) {
+      if (res < 0) w->can_fallocate = false;
+      continue;
+    }
+
+    if (ud == UD_CTL) {
+      r->ctl_done = true;
+      r->ctl_res  = res;
+      continue;
+    }
+
+    buffer_t* b = w->bufs + ud;
+    if (res <= 0) {
+      fprintf(stderr, "Write failed with '%s'\n", res ? strerror(-res) : "no space");
+      b->busy = false;
+      if (!w->error) w->error = APP_ERR_WRITE;
+      continue;
+    }
+
+    b->done += (size_t)res;
+    if (b->done < b->len) {
+      /* short write, the cqe slot is ours again once head moves */
+      __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+      if (submit_write(w, ud) != APP_SUCCESS && !w->error) w->error = APP_ERR_WRITE;
+      continue;
+    }
+
+    b->busy = false;
+  }
+
+  __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Run one open/fsync/close prepared in `sqe` and wait for its result */
+
+static int
+ctl(disk_writer_t*       w,
+    struct io_uring_sqe* sqe)
+{
+  uring_t* r    = w->ring;
+  sqe->user_data = UD_CTL;
+  r->ctl_done    = false;
+  if (uring_submit(r) != APP_SUCCESS) return -EIO;
+
+  reap(w);
+  while (!r->ctl_done) {
+    uring_wait(r);
+    reap(w);
+  }
+  return r->ctl_res;
+}
+
+/* Grow the allocation ahead of a write ending at `end` */
+
+static void
+preallocate(disk_writer_t* w,
+            uint64_t       end)
+{
+  if (!w->can_fallocate || end <= w->allocated) return;
+
+  uint64_t to  = ALIGN(end, DISK_PREALLOC);
+  uint64_t len = to - w->allocated;
+
+  if (w->backend == DISK_WRITER_URING) {
+    /* nothing waits on it, a failure just stops further attempts */
+    struct io_uring_sqe* sqe = uring_sqe(w->ring);
+    sqe->opcode    = IORING_OP_FALLOCATE;
+    sqe->fd        = w->fd;
+    sqe->off       = w->allocated;
+    sqe->addr      = len;
+    sqe->len       = FALLOC_FL_KEEP_SIZE;
+    sqe->user_data = UD_FALLOCATE;
+    if (uring_submit(w->ring) != APP_SUCCESS) w->can_fallocate = false;
+  }
+  else if (0 != fallocate(w->fd, FALLOC_FL_KEEP_SIZE, (off_t)w->allocated, (off_t)len)) {
+    w->can_fallocate = false;
+  }
+
+  w->allocated = to;
+}
+
+static char*
+buffer_data(disk_writer_t* w,
+            size_t         i)
+{
+  return w->data + i*DISK_BUFFER_SIZE;
+}
+
+static int
+submit_write(disk_writer_t* w,
+             size_t         i)
+{
+  uring_t*             r   = w->ring;
+  buffer_t*            b   = w->bufs + i;
+  struct io_uring_sqe* sqe = uring_sqe(r);
+
+  sqe->opcode    = r->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  sqe->fd        = w->fd;
+  sqe->addr      = (uint64_t)(uintptr_t)(buffer_data(w, i) + b->done);
+  sqe->len       = (uint32_t)(b->len - b->done);
+  sqe->off       = b->offset + b->done;
+  sqe->buf_index = r->fixed ? (uint16_t)i : 0;
+  sqe->user_data = i;
+  b->busy        = true;
+  return uring_submit(r);
+}
+
+/* pwrite until everything is out */
+
+static int
+pwrite_all(int         fd,
+           char const* buf,
+           size_t      len,
+           uint64_t    offset)
+{
+  while (len) {
+    ssize_t ret = pwrite(fd, buf, len, (off_t)offset);
+    if (-1 == ret) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "Write failed with '%s'\n", strerror(errno));
+      return APP_ERR_WRITE;
+    }
+
+    buf    += ret;
+    len    -= (size_t)ret;
+    offset += (uint64_t)ret;
+  }
+
+  return APP_SUCCESS;
+}
+
+/* Write buffer `i` out, or start to with io_uring */
+
+static int
+start_write(disk_writer_t* w,
+            size_t         i)
+{
+  buffer_t* b = w->bufs + i;
+  preallocate(w, b->offset + b->len);
+
+  if (w->backend == DISK_WRITER_URING) return submit_write(w, i);
+
+  int err = pwrite_all(w->fd, buffer_data(w, i), b->len, b->offset);
+  b->done = b->len;
+  return err;
+}
+
+static void
+wait_all(disk_writer_t* w)
+{
+  if (w->backend != DISK_WRITER_URING) return;
+
+  uring_t* r = w->ring;
+  reap(w);
+  while (r->in_flight) {
+    uring_wait(r);
+    reap(w);
+  }
+}
+
+/* Write out the current buffer except for its last `tail` bytes, which move
+   to the start of the next one. The next one might still be in flight, if so
+   wait for it. */
+
+static int
+next_buffer(disk_writer_t* w,
+            size_t         tail)
+{
+  buffer_t*   b   = w->bufs + w->cur;
+  char const* src = buffer_data(w, w->cur) + b->len - tail;
+  b->len -= tail;
+
+  int err = start_write(w, w->cur);
+  if (err != APP_SUCCESS) return err;
+
+  w->cur         = (w->cur + 1) % DISK_BUFFERS;
+  buffer_t* next = w->bufs + w->cur;
+  while (next->busy) {
+    uring_wait(w->ring);
+    reap(w);
+  }
+
+  /* reading a buffer that's being written is fine */
+  memcpy(buffer_data(w, w->cur), src, tail);
+  next->offset = b->offset + b->len;
+  next->len    = tail;
+  next->done   = 0;
+  return w->error;
+}
+
+/* pwritev until everything is out, clobbers iov. Positioned, since the
+   header writes don't move the file offset past themselves. */
+
+static int
+write_all(int           fd,
+          struct iovec* iov,
+          size_t        n,
+          uint64_t      offset)
+{
+  while (n) {
+    ssize_t ret = pwritev(fd, iov, (int)n, (off_t)offset);
+    if (-1 == ret) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "Write failed with '%s'\n", strerror(errno));
+      return APP_ERR_WRITE;
+    }
+
+    /* skip whatever made it out, the last iovec might be partial */
+    size_t left = (size_t)ret;
+    offset     += (uint64_t)ret;
+    while (n && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      iov  += 1;
+      n    -= 1;
+    }
+
+    if (n) {
+      iov->iov_base  = (char*)iov->iov_base + left;
+      iov->iov_len  -= left;
+    }
+  }
+
+  return APP_SUCCESS;
+}
+
+/* Write the file header, with the length of the records if it's known. It
+   gets a block to itself so it can be written with O_DIRECT. The meta after
+   FILE_META_OFFSET is left as disk_writer_set_meta put it. */
+
+static int
+write_hdr(disk_writer_t* w,
+          uint64_t       length)
+{
+  memset(w->hdr, 0, FILE_META_OFFSET);
+  file_hdr_t* hdr = (file_hdr_t*)w->hdr;
+  hdr->magic      = FILE_MAGIC;
+  hdr->version    = FILE_VERSION;
+  hdr->hdr_size   = FILE_HDR_SIZE;
+  hdr->flags      = w->direct ? FILE_DIRECT : 0;
+  hdr->length     = length;
+  hdr->session    = w->session;
+  hdr->segment    = w->segment;
+  hdr->index      = w->index;
+
+  if (w->backend != DISK_WRITER_URING) return pwrite_all(w->fd, w->hdr, FILE_HDR_SIZE, 0);
+
+  struct io_uring_sqe* sqe = uring_sqe(w->ring);
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd     = w->fd;
+  sqe->addr   = (uint64_t)(uintptr_t)w->hdr;
+  sqe->len    = FILE_HDR_SIZE;
+  sqe->off    = 0;
+  int res     = ctl(w, sqe);
+  if (res != (int)FILE_HDR_SIZE) {
+    fprintf(stderr, "Write failed with '%s'\n", res < 0 ? strerror(-res) : "short write");
+    return APP_ERR_WRITE;
+  }
+
+  return APP_SUCCESS;
+}
+
+static int
+datasync(disk_writer_t* w)
+{
+  if (w->backend != DISK_WRITER_URING) {
+    if (0 != fdatasync(w->fd)) {
+      fprintf(stderr, "fdatasync failed with '%s'\n", strerror(errno));
+      return APP_ERR_WRITE;
+    }
+    return APP_SUCCESS;
+  }
+
+  struct io_uring_sqe* sqe = uring_sqe(w->ring);
+  sqe->opcode      = IORING_OP_FSYNC;
+  sqe->fd          = w->fd;
+  sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+  int res          = ctl(w, sqe);
+  if (res < 0) {
+    fprintf(stderr, "fdatasync failed with '%s'\n", strerror(-res));
+    return APP_ERR_WRITE;
+  }
+
+  return APP_SUCCESS;
+}
+
+/* A failed sync can mean written pages were lost, and a later one that works
+   doesn't bring them back, so it sticks like a failed write */
+
+static int
+sync_failed(disk_writer_t* w)
+{
+  if (!w->error) w->error = APP_ERR_WRITE;
+  return w->error;
+}
+
+/* Open `path` and write a header without a length. With io_uring EINVAL is a
+   kernel older than 5.6 (APP_ERR_UNIMPL, the caller falls back to write()).
+   Either way it can be a filesystem without O_DIRECT, so that's tried again
+   without. */
+
+static int
+open_file(disk_writer_t* w,
+          char const*    path)
+{
+  int flags = w->flags;
+  int res   = -EINVAL;
+  while (true) {
+    if (w->backend == DISK_WRITER_URING) {
+      struct io_uring_sqe* sqe = uring_sqe(w->ring);
+      sqe->opcode     = IORING_OP_OPENAT;
+      sqe->fd         = AT_FDCWD;
+      sqe->addr       = (uint64_t)(uintptr_t)path;
+      sqe->len        = 0644;
+      sqe->open_flags = (uint32_t)flags;
+      res             = ctl(w, sqe);
+    }
+    else {
+      res = open(path, flags, 0644);
+      if (-1 == res) res = -errno;
+    }
+
+    if (res != -EINVAL || !(flags & O_DIRECT)) break;
+    flags &= ~O_DIRECT;
+  }
+
+  if (w->backend == DISK_WRITER_URING && (res == -EINVAL || res == -EOPNOTSUPP)) {
+    return APP_ERR_UNIMPL;
+  }
+  if (res < 0) {
+    fprintf(stderr, "Failed to open file with '%s'", strerror(-res));
+    return APP_ERR_OPEN;
+  }
+  if ((w->flags & O_DIRECT) && !(flags & O_DIRECT)) {
+    fprintf(stderr, "%s doesn't support O_DIRECT, writing through the page cache\n", path);
+  }
+
+  /* everything from the previous file is out, see end_file */
+  w->fd            = res;
+  w->direct        = flags & O_DIRECT;
+  w->can_fallocate = true;
+  w->offset        = FILE_HDR_SIZE;
+  w->allocated     = 0;
+  w->cur           = 0;
+  w->ended         = false;
+  w->index         = 0;
+  w->wb_waited     = 0;
+  w->wb_started    = 0;
+  memset(w->bufs, 0, sizeof(w->bufs));
+  w->bufs[0].offset = FILE_HDR_SIZE;
+
+  return write_hdr(w, FILE_LENGTH_UNKNOWN);
+}
+
+/* Get everything out, the last partial block zero padded, then the length
+   into the header. The size is truncated to the records, which also drops
+   the padding and what was preallocated past them. */
+
+static int
+end_file(disk_writer_t* w)
+{
+  if (w->error) return w->error;
+  if (w->ended) return APP_SUCCESS;
+
+  buffer_t* b = w->bufs + w->cur;
+  if (w->staged && b->len) {
+    size_t len = w->direct ? ALIGN(b->len, PAGE) : b->len;
+    memset(buffer_data(w, w->cur) + b->len, 0, len - b->len);
+    b->len = len;
+
+    int err = start_write(w, w->cur);
+    if (err != APP_SUCCESS) return err;
+  }
+
+  wait_all(w);
+  if (w->error) return w->error;
+
+  int err = write_hdr(w, w->offset - FILE_HDR_SIZE);
+  if (err != APP_SUCCESS) return err;
+
+  if (0 != ftruncate(w->fd, (off_t)w->offset)) {
+    fprintf(stderr, "ftruncate failed with '%s'\n", strerror(errno));
+  }
+
+  w->ended = true;
+  return APP_SUCCESS;
+}
+
+/* Everything below this has been written, to the page cache at least */
+
+static uint64_t
+completed(disk_writer_t* w)
+{
+  if (!w->staged) return w->offset;
+
+  if (w->backend == DISK_WRITER_URING) reap(w);
+  uint64_t end = w->bufs[w->cur].offset;
+  for (size_t i = 0; i < DISK_BUFFERS; ++i) {
+    if (w->bufs[i].busy) end = MIN(end, w->bufs[i].offset);
+  }
+  return end;
+}
+
+static int
+sync_range(disk_writer_t* w,
+           uint64_t       offset,
+           uint64_t       len,
+           unsigned       flags)
+{
+  int res = 0;
+  if (w->backend == DISK_WRITER_URING) {
+    struct io_uring_sqe* sqe = uring_sqe(w->ring);
+    sqe->opcode           = IORING_OP_SYNC_FILE_RANGE;
+    sqe->fd               = w->fd;
+    sqe->off              = offset;
+    sqe->len              = (uint32_t)len;
+    sqe->sync_range_flags = flags;
+    res                   = ctl(w, sqe);
+  }
+  else if (0 != sync_file_range(w->fd, (off_t)offset, (off_t)len, flags)) {
+    res = -errno;
+  }
+
+  if (res < 0) {
+    fprintf(stderr, "sync_file_range failed with '%s'\n", strerror(-res));
+    return sync_failed(w);
+  }
+  return APP_SUCCESS;
+}
+
+static void
+close_file(disk_writer_t* w)
+{
+  if (w->backend == DISK_WRITER_URING) {
+    wait_all(w);
+
+    struct io_uring_sqe* sqe = uring_sqe(w->ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd     = w->fd;
+    int res     = ctl(w, sqe);
+    if (res < 0) {
+      fprintf(stderr, "close failed with '%s'\n", strerror(-res));
+    }
+  }
+  else if (-1 == close(w->fd)) {
+    /* not recoverable */
+    fprintf(stderr, "close failed with '%s'\n", strerror(errno));
+  }
+
+  w->fd = -1;
+}
+
+size_t
+disk_writer_footprint(void)
+{
+  return ALIGN(sizeof(disk_writer_t), PAGE) + FILE_HDR_SIZE + DISK_BUFFERS*DISK_BUFFER_SIZE;
+}
+
+size_t
+disk_writer_align(void)
+{
+  return PAGE;
+}
+
+disk_writer_t*
+create_disk_writer(void*       mem,
+                   char const* path,
+                   int         backend,
+                   bool        direct,
+                   int*        opt_err)
+{
+  if (!mem || !path || (backend != DISK_WRITER_WRITE && backend != DISK_WRITER_URING)) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  disk_writer_t* w = (disk_writer_t*)mem;
+  memset(w, 0, sizeof(*w));
+  w->fd       = -1;
+  w->ring->fd = -1;
+  w->flags    = O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC | (direct ? O_DIRECT : 0);
+  w->session  = (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+  w->segment  = 0;
+  w->hdr      = (char*)mem + ALIGN(sizeof(disk_writer_t), PAGE);
+  w->data     = w->hdr + FILE_HDR_SIZE;
+  memset(w->hdr, 0, FILE_HDR_SIZE);
+
+  if (backend == DISK_WRITER_URING && !uring_init(w->ring)) backend = DISK_WRITER_WRITE;
+  w->backend = backend;
+
+  if (backend == DISK_WRITER_URING) {
+    /* registered buffers save pinning pages on every write, but count against
+       RLIMIT_MEMLOCK on older kernels. Plain writes work without. */
+    struct iovec iov[DISK_BUFFERS];
+    for (size_t i = 0; i < DISK_BUFFERS; ++i) {
+      iov[i].iov_base = buffer_data(w, i);
+      iov[i].iov_len  = DISK_BUFFER_SIZE;
+    }
+    w->ring->fixed = 0 == uring_register(w->ring->fd, IORING_REGISTER_BUFFERS, iov, DISK_BUFFERS);
+  }
+
+  /* writev straight from the caller's memory isn't aligned, and io_uring
+     needs its own copy so the caller can have its memory back */
+  w->staged = backend == DISK_WRITER_URING || direct;
+
+  int err = open_file(w, path);
+  if (err == APP_ERR_UNIMPL) {
+    uring_fini(w->ring);
+    w->backend = DISK_WRITER_WRITE;
+    err        = open_file(w, path);
+  }
+
+  if (err != APP_SUCCESS) {
+    if (opt_err) *opt_err = err;
+    if (w->fd >= 0)                      close(w->fd);
+    if (w->backend == DISK_WRITER_URING) uring_fini(w->ring);
+    return NULL;
+  }
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return w;
+}
+
+void*
+destroy_disk_writer(disk_writer_t* w)
+{
+  if (!w) return NULL;
+
+  if (w->fd >= 0)                      close_file(w);
+  if (w->backend == DISK_WRITER_URING) uring_fini(w->ring);
+  return (void*)w;
+}
+
+int
+disk_writer_backend(disk_writer_t const* w)
+{
+  return w->backend;
+}
+
+char const*
+disk_writer_backend_name(int backend)
+{
+  switch (backend) {
+    case DISK_WRITER_WRITE: return "write";
+    case DISK_WRITER_URING: return "io_uring";
+    default:                return "unknown";
+  }
+}
+
+bool
+disk_writer_direct(disk_writer_t const* w)
+{
+  return w->direct;
+}
+
+int
+disk_writer_append(disk_writer_t* w,
+                   struct iovec*  iov,
+                   size_t         n)
+{
+  if (w->error) return w->error;
+
+  if (!w->staged) {
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < n; ++i) bytes += iov[i].iov_len;
+
+    preallocate(w, w->offset + bytes);
+    w->error   = write_all(w->fd, iov, n, w->offset);
+    w->offset += bytes;
+    return w->error;
+  }
+
+  if (w->backend == DISK_WRITER_URING) reap(w);
+  for (size_t i = 0; i < n; ++i) {
+    char const* src  = (char const*)iov[i].iov_base;
+    size_t      left = iov[i].iov_len;
+
+    while (left) {
+      buffer_t* b = w->bufs + w->cur;
+      if (b->len == DISK_BUFFER_SIZE) {
+        int err = next_buffer(w, 0);
+        if (err != APP_SUCCESS) return err;
+        continue;
+      }
+
+      size_t chunk = MIN(left, DISK_BUFFER_SIZE - b->len);
+      memcpy(buffer_data(w, w->cur) + b->len, src, chunk);
+      b->len    += chunk;
+      w->offset += chunk;
+      src       += chunk;
+      left      -= chunk;
+    }
+  }
+
+  return w->error;
+}
+
+int
+disk_writer_flush(disk_writer_t* w)
+{
+  if (w->error)   return w->error;
+  if (!w->staged) return APP_SUCCESS;
+
+  if (w->backend == DISK_WRITER_URING) reap(w);
+
+  /* O_DIRECT only writes whole blocks, a partial one stays for next time */
+  buffer_t* b    = w->bufs + w->cur;
+  size_t    tail = w->direct ? b->len % PAGE : 0;
+  if (b->len == tail) return APP_SUCCESS;
+
+  return next_buffer(w, tail);
+}
+
+int
+disk_writer_sync(disk_writer_t* w)
+{
+  int err = disk_writer_flush(w);
+  if (err != APP_SUCCESS) return err;
+
+  wait_all(w);
+  if (w->error) return w->error;
+
+  if (datasync(w) != APP_SUCCESS) return sync_failed(w);
+  return APP_SUCCESS;
+}
+
+uint64_t
+disk_writer_unsynced(disk_writer_t* w)
+{
+  return completed(w) - w->wb_started;
+}
+
+int
+disk_writer_writeback(disk_writer_t* w)
+{
+  if (w->error) return w->error;
+
+  /* the ring's sync_file_range takes a 32 bit length */
+  uint64_t end = MIN(completed(w), w->wb_started + UINT32_MAX/2);
+
+  if (w->wb_started > w->wb_waited) {
+    int err = sync_range(w, w->wb_waited, w->wb_started - w->wb_waited,
+                         SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                         | SYNC_FILE_RANGE_WAIT_AFTER);
+    if (err != APP_SUCCESS) return err;
+    w->wb_waited = w->wb_started;
+  }
+
+  if (end > w->wb_started) {
+    int err = sync_range(w, w->wb_started, end - w->wb_started, SYNC_FILE_RANGE_WRITE);
+    if (err != APP_SUCCESS) return err;
+    w->wb_started = end;
+  }
+
+  return APP_SUCCESS;
+}
+
+int
+disk_writer_finish(disk_writer_t* w)
+{
+  int err = end_file(w);
+  if (err != APP_SUCCESS) return err;
+
+  if (datasync(w) != APP_SUCCESS) return sync_failed(w);
+  return APP_SUCCESS;
+}
+
+int
+disk_writer_rotate(disk_writer_t* w,
+                   char const*    path)
+{
+  int err = end_file(w);
+  if (err != APP_SUCCESS) return err;
+
+  close_file(w);
+  w->segment += 1;
+
+  err = open_file(w, path);
+  if (err != APP_SUCCESS && !w->error) w->error = err;
+  return err;
+}
+
+int
+disk_writer_set_meta(disk_writer_t* w,
+                     void const*    meta,
+                     size_t         len)
+{
+  if (len > FILE_HDR_SIZE - FILE_META_OFFSET) return APP_ERR_INVAL;
+  if (w->error)                               return w->error;
+
+  memset(w->hdr + FILE_META_OFFSET, 0, FILE_HDR_SIZE - FILE_META_OFFSET);
+  memcpy(w->hdr + FILE_META_OFFSET, meta, len);
+  if (w->ended) return APP_SUCCESS;
+
+  int err = write_hdr(w, FILE_LENGTH_UNKNOWN);
+  if (err != APP_SUCCESS) w->error = err;
+  return err;
+}
+
+void
+disk_writer_mark_index(disk_writer_t* w)
+{
+  w->index = w->offset;
+}
+
+uint64_t
+disk_writer_bytes(disk_writer_t const* w)
+{
+  return w->offset - FILE_HDR_SIZE;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* Appends records to the output file for the disk thread, and owns the file
+   from open to close.
+
+   DISK_WRITER_WRITE writes the caller's buffers with writev, blocking until
+   they are out. DISK_WRITER_URING copies them into one of DISK_BUFFERS
+   registered buffers and only submits a write once a buffer fills, so the
+   caller can hand its memory back while earlier buffers are still being
+   written. Open, preallocation, sync and close go through the ring as well.
+   On kernels without io_uring (or the opcodes we need) create falls back to
+   DISK_WRITER_WRITE, see disk_writer_backend.
+
+   With `direct` the file is opened O_DIRECT so a long capture doesn't fill
+   the page cache. Both backends then stage records in the (page aligned)
+   buffers and only ever write whole blocks; the last partial block goes out
+   zero padded when the file is finished. Filesystems without O_DIRECT get
+   buffered writes instead, see disk_writer_direct.
+
+   The writer puts the file_hdr (disk.h) in front of the records, and fills
+   in their length when the file is finished or rotated away from. What goes
+   after it in the header block is up to the caller, see disk_writer_set_meta.
+
+   The file grows by DISK_PREALLOC bytes at a time with fallocate, which keeps
+   the size at what was actually written. Filesystems without fallocate just
+   skip it. */
+
+#define DISK_WRITER_WRITE 0
+#define DISK_WRITER_URING 1
+
+typedef struct disk_writer disk_writer_t;
+
+size_t
+disk_writer_footprint(void);
+
+/* Page aligned, so the buffers can be */
+
+size_t
+disk_writer_align(void);
+
+disk_writer_t*
+create_disk_writer(void*       mem,
+                   char const* path,
+                   int         backend,
+                   bool        direct,
+                   int*        opt_err);
+
+/* Waits for anything still in flight and closes the file. Doesn't finish or
+   sync it. */
+
+void*
+destroy_disk_writer(disk_writer_t* w);
+
+/* Backend actually in use */
+
+int
+disk_writer_backend(disk_writer_t const* w);
+
+char const*
+disk_writer_backend_name(int backend);
+
+/* Whether the file really is O_DIRECT */
+
+bool
+disk_writer_direct(disk_writer_t const* w);
+
+/* Append `n` buffers. The caller can reuse them as soon as this returns, but
+   the iovecs themselves are clobbered. Returns APP_ERR_WRITE if this, or any
+   earlier write still in flight, failed. */
+
+int
+disk_writer_append(disk_writer_t* w,
+                   struct iovec*  iov,
+                   size_t         n);
+
+/* Start writing a partly filled buffer instead of waiting for it to fill,
+   e.g. before going idle. With O_DIRECT a trailing partial block stays
+   behind. */
+
+int
+disk_writer_flush(disk_writer_t* w);
+
+/* Flush, wait for every write, then fdatasync */
+
+int
+disk_writer_sync(disk_writer_t* w);
+
+/* Bytes written to the file since the last disk_writer_writeback */
+
+uint64_t
+disk_writer_unsynced(disk_writer_t* w);
+
+/* Smooths writeback out instead of leaving the kernel to flush in bursts:
+   waits for the writeback the previous call started, then starts it on
+   everything written since (sync_file_range). Neither covers metadata, so
+   it doesn't make anything durable by itself, see disk_writer_finish.
+
+   A failed sync here, in disk_writer_sync or in disk_writer_finish returns
+   APP_ERR_WRITE from then on, the same as a failed write. */
+
+int
+disk_writer_writeback(disk_writer_t* w);
+
+/* Write everything including the padded last block, then the length into the
+   header, and fdatasync. Nothing can be appended afterwards, except by
+   rotating. */
+
+int
+disk_writer_finish(disk_writer_t* w);
+
+/* Finish the current file, unless disk_writer_finish already has, without
+   syncing it, and carry on in a new one at `path`, the next segment of the
+   same session. Blocks the caller for the writes in flight, the header, and
+   the close and open. */
+
+int
+disk_writer_rotate(disk_writer_t* w,
+                   char const*    path);
+
+/* Copy `len` bytes to FILE_META_OFFSET in the header of this and every later
+   segment, and rewrite the current one's header. Meant for right after
+   create, as the rewrite blocks. */
+
+int
+disk_writer_set_meta(disk_writer_t* w,
+                     void const*    meta,
+                     size_t         len);
+
+/* The next append is the current file's index, which the header points at
+   from when the file ends. Cleared by rotating. */
+
+void
+disk_writer_mark_index(disk_writer_t* w);
+
+/* Bytes appended to the current file so far */
+
+uint64_t
+disk_writer_bytes(disk_writer_t const* w);
@@ -109,6 +109,20 @@ envelope_zero(envelope_t* e)
   return APP_SUCCESS;
 }
 
+uint32_t
+envelope_position(envelope_t const* e)
+{
+  return e->n_samples;
+}
+
+int
+envelope_set_position(envelope_t* e,
+                      uint32_t    n_samples)
+{
+  e->n_samples = n_samples;
+  return APP_SUCCESS;
+}
+
 int
 envelope_change_setting(envelope_t*               e,
                         envelope_setting_t const* setting)
@@ -81,6 +81,19 @@ envelope_strike(envelope_t* e);
 int
 envelope_zero(envelope_t* e);
 
+/* Samples generated since the last strike, which is all the state the decay
+   has. Wraps at UINT32_MAX. */
+
+uint32_t
+envelope_position(envelope_t const* e);
+
+/* Pick the decay up `n_samples` after a strike, e.g. from a saved
+   envelope_position */
+
+int
+envelope_set_position(envelope_t* e,
+                      uint32_t    n_samples);
+
 /* Change the current decay function to the function described by the provided
    settings. If the envelope is currently in the middle of decaying something,
    the decay function will switch to the newly specified decay function. The
@@ -6,6 +6,8 @@
   _(APP_ERR_UNIMPL,      "not implemented")\
   _(APP_ERR_THREAD_JOIN, "couldn't join a thread")\
   _(APP_ERR_OPEN,        "couldn't open file")\
+  _(APP_ERR_WRITE,       "couldn't write file")\
+  _(APP_ERR_CORRUPT,     "data failed its checksum")\
   _(APP_DROP,            "dropped a message")\
 
 enum {
@@ -0,0 +1,241 @@
+#include "gcc_phat.h"
+
+#include "common.h"
+#include "err.h"
+#include "rfft.h"
+
+#include <math.h>
+#include <string.h>
+
+/* PHAT weight is 1/|conj(X)*Y|, bins weaker than this are dropped instead */
+#define MIN_CROSS_POWER 1e-20f
+
+struct gcc_phat {
+  size_t    window;
+  size_t    max_lag;
+  bool      capturing;
+  uint64_t  start;       /* first frame of the capture window */
+  uint64_t  next_frame;  /* frame the next gcc_phat_add should start at */
+  uint64_t  valid_from;  /* first frame of the contiguous run ending at next_frame */
+
+  /* Pointers into the trailing memory */
+  rfft_t*   x_fft;       /* 2*window, also does the inverse */
+  rfft_t*   y_fft;       /* 2*window */
+  float*    taper;       /* window */
+  float*    x;           /* 2*window, history indexed by frame % (2*window) */
+  float*    y;           /* 2*window, same */
+};
+
+static size_t
+x_fft_offset(void)
+{
+  return ALIGN(sizeof(gcc_phat_t), rfft_align());
+}
+
+static size_t
+y_fft_offset(size_t window)
+{
+  return ALIGN(x_fft_offset() + rfft_footprint(2*window), rfft_align());
+}
+
+static size_t
+taper_offset(size_t window)
+{
+  return ALIGN(y_fft_offset(window) + rfft_footprint(2*window), CACHELINE);
+}
+
+static size_t
+history_offset(size_t window)
+{
+  return ALIGN(taper_offset(window) + window*sizeof(float), CACHELINE);
+}
+
+size_t
+gcc_phat_footprint(size_t window)
+{
+  return history_offset(window) + 4*window*sizeof(float);
+}
+
+size_t
+gcc_phat_align(void)
+{
+  return MAX(_Alignof(gcc_phat_t), rfft_align());
+}
+
+gcc_phat_t*
+create_gcc_phat(void*  mem,
+                size_t window,
+                size_t max_lag,
+                int*   opt_err)
+{
+  if (!mem || window < 4 || max_lag + 1 >= window || (size_t)mem % gcc_phat_align()) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  char*   base  = (char*)mem;
+  rfft_t* x_fft = create_rfft(base + x_fft_offset(), 2*window, RFFT_INVERSE, opt_err);
+  if (!x_fft) return NULL; /* opt_err already set */
+
+  rfft_t* y_fft = create_rfft(base + y_fft_offset(window), 2*window, RFFT_FORWARD, opt_err);
+  if (!y_fft) {
+    destroy_rfft(x_fft);
+    return NULL; /* opt_err already set */
+  }
+
+  gcc_phat_t* gp = (gcc_phat_t*)mem;
+  gp->window     = window;
+  gp->max_lag    = max_lag;
+  gp->capturing  = false;
+  gp->start      = 0;
+  gp->next_frame = 0;
+  gp->valid_from = 0;
+  gp->x_fft      = x_fft;
+  gp->y_fft      = y_fft;
+  gp->taper      = (float*)(base + taper_offset(window));
+  gp->x          = (float*)(base + history_offset(window));
+  gp->y          = gp->x + 2*window;
+
+  for (size_t i = 0; i < window; ++i) {
+    gp->taper[i] = (float)(0.5 - 0.5*cos(2.0*M_PI*(double)i/(double)window));
+  }
+
+  memset(gp->x, 0, 4*window*sizeof(float));
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return gp;
+}
+
+void*
+destroy_gcc_phat(gcc_phat_t* gp)
+{
+  if (!gp) return NULL;
+  destroy_rfft(gp->y_fft);
+  destroy_rfft(gp->x_fft);
+  return (void*)gp;
+}
+
+size_t
+gcc_phat_window(gcc_phat_t const* gp)
+{
+  return gp->window;
+}
+
+void
+gcc_phat_strike(gcc_phat_t* gp,
+                uint64_t    frame)
+{
+  /* too early to have the frames before it, skip it */
+  size_t lead   = gp->window/4;
+  gp->capturing = frame >= lead;
+  gp->start     = gp->capturing ? frame - lead : 0;
+}
+
+static bool
+complete(gcc_phat_t const* gp)
+{
+  return gp->capturing
+         && gp->valid_from <= gp->start
+         && gp->next_frame >= gp->start + gp->window;
+}
+
+bool
+gcc_phat_add(gcc_phat_t*  gp,
+             uint64_t     frame,
+             float const* x,
+             float const* y,
+             size_t       n)
+{
+  if (frame != gp->next_frame) gp->valid_from = frame;
+  gp->next_frame = frame + n;
+
+  /* history is twice the window, so the frames that complete a capture can't
+     overwrite its start */
+  size_t len  = 2*gp->window;
+  size_t skip = n > len ? n - len : 0;
+  for (size_t i = skip; i < n; ++i) {
+    size_t at = (frame + i) % len;
+    gp->x[at] = x[i];
+    gp->y[at] = y[i];
+  }
+
+  return complete(gp);
+}
+
+/* Unwrap the capture window out of the history, remove the mean, taper, and
+   zero pad */
+
+static void
+load(gcc_phat_t const* gp,
+     float const*      history,
+     float*            out)
+{
+  size_t len   = 2*gp->window;
+  size_t first = gp->start % len;
+
+  double mean = 0.0;
+  for (size_t i = 0; i < gp->window; ++i) {
+    out[i] = history[(first + i) % len];
+    mean  += out[i];
+  }
+  mean /= (double)gp->window;
+
+  for (size_t i = 0; i < gp->window; ++i) {
+    out[i] = (out[i] - (float)mean)*gp->taper[i];
+  }
+
+  memset(out + gp->window, 0, gp->window*sizeof(float));
+}
+
+int
+gcc_phat_estimate(gcc_phat_t*        gp,
+                  gcc_phat_result_t* out)
+{
+  if (!complete(gp)) return APP_ERR_INVAL;
+
+  /* one more add could overwrite the window, so this is the only chance */
+  gp->capturing = false;
+  if (gp->next_frame > gp->start + 2*gp->window) return APP_ERR_INVAL;
+
+  load(gp, gp->x, rfft_in(gp->x_fft));
+  load(gp, gp->y, rfft_in(gp->y_fft));
+  rfft_execute(gp->x_fft);
+  rfft_execute(gp->y_fft);
+
+  /* whitened cross spectrum, written over X and transformed back in place */
+  fftwf_complex*       X = rfft_out(gp->x_fft);
+  fftwf_complex const* Y = rfft_out(gp->y_fft);
+  for (size_t k = 0; k < rfft_n_bins(gp->x_fft); ++k) {
+    fftwf_complex g   = conjf(X[k])*Y[k];
+    float         mag = cabsf(g);
+    X[k] = mag > MIN_CROSS_POWER ? g/mag : 0.0f;
+  }
+
+  rfft_execute_inverse(gp->x_fft);
+
+  /* positive lags from the front, negative from the back */
+  float const* r = rfft_in(gp->x_fft);
+  size_t       n = 2*gp->window;
+
+  size_t best = 0;
+  for (size_t lag = 1; lag <= gp->max_lag; ++lag) {
+    if (r[lag]   > r[best]) best = lag;
+    if (r[n-lag] > r[best]) best = n-lag;
+  }
+
+  /* A whitened delay of d frames correlates as sinc(lag - d). Sampled at the
+     peak k and its neighbours, with d = k + f and 0 <= f < 1, that's
+     r[k] = s/f and r[k+1] = s/(1-f) with s = sin(pi*f)/pi, so f falls out of
+     the ratio r[k+1]/r[k]. Same on the other side for negative f. */
+  float left   = r[(best + n - 1) % n];
+  float center = r[best];
+  float right  = r[(best + 1) % n];
+  float frac   = 0.0f;
+  if      (right >= left && right > 0.0f) frac =  right/(center + right);
+  else if (left  >  right && left > 0.0f) frac = -left/(center + left);
+
+  float lag  = best <= gp->max_lag ? (float)best : -(float)(n - best);
+  out->delay = lag + frac;
+  out->peak  = center/(float)n;
+  return APP_SUCCESS;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Delay estimation by generalized cross-correlation with phase transform
+   (GCC-PHAT).
+
+   Around each strike, `window` frames of input `x` (what we sent) and output
+   `y` (what came back) are captured, starting a quarter window before the
+   strike so the edge is well inside the (Hann) window, and zero padded to twice
+   the length so the correlation isn't circular. The cross spectrum conj(X)*Y
+   is whitened to unit magnitude and transformed back, which leaves a sharp
+   peak at the delay no matter how coloured the signals are. The ratio of the
+   peak to its larger neighbour gives the sub-frame part, exactly for the sinc
+   shaped peak a whitened delay produces.
+
+   Uses an rfft_t, create before starting any threads. */
+
+typedef struct gcc_phat        gcc_phat_t;
+typedef struct gcc_phat_result gcc_phat_result_t;
+
+struct gcc_phat_result {
+  float delay;  /* frames y lags x by, negative if y leads */
+  float peak;   /* height of the correlation peak, 1 for a perfect match */
+};
+
+size_t
+gcc_phat_footprint(size_t window);
+
+size_t
+gcc_phat_align(void);
+
+/* Delays are searched over [-max_lag, max_lag] frames, max_lag < window */
+
+gcc_phat_t*
+create_gcc_phat(void*  mem,
+                size_t window,
+                size_t max_lag,
+                int*   opt_err);
+
+void*
+destroy_gcc_phat(gcc_phat_t* gp);
+
+size_t
+gcc_phat_window(gcc_phat_t const* gp);
+
+/* Capture the window around a strike at `frame`, throwing away any capture in
+   progress. The frames before the strike come from history, so they must
+   already have been added. A strike less than a quarter window from frame 0
+   is ignored. */
+
+void
+gcc_phat_strike(gcc_phat_t* gp,
+                uint64_t    frame);
+
+/* Add `n` frames of input and output, the first of which is at `frame`.
+   Call for every frame, capturing or not. Returns true once the capture window
+   is complete, after which gcc_phat_estimate can be called. */
+
+bool
+gcc_phat_add(gcc_phat_t*  gp,
+             uint64_t     frame,
+             float const* x,
+             float const* y,
+             size_t       n);
+
+/* Estimate the delay over the captured window and stop capturing. Returns
+   APP_ERR_INVAL if the window isn't full. */
+
+int
+gcc_phat_estimate(gcc_phat_t*        gp,
+                  gcc_phat_result_t* out);
@@ -0,0 +1,205 @@
+#include "harmonic_tracker.h"
+
+#include "common.h"
+#include "err.h"
+
+#include <assert.h>
+#include <immintrin.h>
+#include <math.h>
+#include <string.h>
+
+/* Bins are updated four at a time, one AVX register of doubles.
+
+   The state is kept in doubles. A sliding DFT with its poles on the unit circle
+   never forgets an error, but the comb subtracts exactly the float that was
+   added `window` samples ago, so the only thing that accumulates is rounding
+   in the rotation. In double that stays well below float resolution for
+   captures many hours long. */
+
+#define LANES        4ul
+#define VECTOR_ALIGN 32ul
+
+struct harmonic_tracker {
+  size_t  n_bins;       /* number of bins the user asked for */
+  size_t  n_padded;     /* n_bins rounded up to a multiple of LANES */
+  size_t  window;       /* length of the dft in frames */
+  size_t  block;        /* frames between snapshots */
+  size_t  hist_pos;     /* next slot in hist to overwrite */
+  size_t  block_pos;    /* frames into the current block */
+  size_t  n_seen;       /* frames seen, saturates at window */
+  bool    ready;
+
+  /* Pointers into the trailing memory. Each of the double arrays is n_padded
+     long. Padding bins rotate by 1+0i and are never reported. */
+  double* re;
+  double* im;
+  double* wr;           /* e^{j 2 pi k / window} for each bin */
+  double* wi;
+  float*  hist;         /* last `window` input samples */
+};
+
+static size_t
+padded_bins(size_t n_bins)
+{
+  return ALIGN(n_bins, LANES);
+}
+
+size_t
+harmonic_tracker_footprint(size_t n_bins,
+                           size_t window)
+{
+  size_t footprint = ALIGN(sizeof(harmonic_tracker_t), VECTOR_ALIGN);
+  footprint += 4 * padded_bins(n_bins) * sizeof(double);
+  footprint += window * sizeof(float);
+  return footprint;
+}
+
+size_t
+harmonic_tracker_align(void)
+{
+  return VECTOR_ALIGN;
+}
+
+harmonic_tracker_t*
+create_harmonic_tracker(void*  mem,
+                        size_t sample_rate_hz,
+                        float  fundamental_hz,
+                        size_t n_bins,
+                        size_t window,
+                        size_t block,
+                        int*   opt_err)
+{
+  if (!mem || n_bins == 0 || window == 0 || block == 0 || fundamental_hz <= 0) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  if ((size_t)mem % VECTOR_ALIGN) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  harmonic_tracker_t* ht = (harmonic_tracker_t*)mem;
+  size_t n_padded        = padded_bins(n_bins);
+  char*  ptr             = (char*)mem + ALIGN(sizeof(harmonic_tracker_t), VECTOR_ALIGN);
+
+  ht->re   = (double*)ptr; ptr += n_padded * sizeof(double);
+  ht->im   = (double*)ptr; ptr += n_padded * sizeof(double);
+  ht->wr   = (double*)ptr; ptr += n_padded * sizeof(double);
+  ht->wi   = (double*)ptr; ptr += n_padded * sizeof(double);
+  ht->hist = (float*)ptr;
+
+  for (size_t i = 0; i < n_padded; ++i) {
+    ht->re[i] = 0.0;
+    ht->im[i] = 0.0;
+    ht->wr[i] = 1.0;
+    ht->wi[i] = 0.0;
+  }
+
+  for (size_t i = 0; i < n_bins; ++i) {
+    double harmonic = (double)(2*i + 1);
+    double bin      = round(harmonic * fundamental_hz * (double)window / (double)sample_rate_hz);
+    if (bin <= 0 || bin >= (double)window/2) {
+      /* past nyquist, or so close to DC it can't be resolved */
+      if (opt_err) *opt_err = APP_ERR_INVAL;
+      return NULL;
+    }
+
+    ht->wr[i] = cos(2*M_PI*bin/(double)window);
+    ht->wi[i] = sin(2*M_PI*bin/(double)window);
+  }
+
+  memset(ht->hist, 0, window * sizeof(float));
+
+  ht->n_bins    = n_bins;
+  ht->n_padded  = n_padded;
+  ht->window    = window;
+  ht->block     = block;
+  ht->hist_pos  = 0;
+  ht->block_pos = 0;
+  ht->n_seen    = 0;
+  ht->ready     = false;
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return ht;
+}
+
+void*
+destroy_harmonic_tracker(harmonic_tracker_t* ht)
+{
+  return (void*)ht;
+}
+
+size_t
+harmonic_tracker_n_bins(harmonic_tracker_t const* ht)
+{
+  return ht->n_bins;
+}
+
+size_t
+harmonic_tracker_window(harmonic_tracker_t const* ht)
+{
+  return ht->window;
+}
+
+size_t
+harmonic_tracker_process(harmonic_tracker_t* ht,
+                         float const*        in,
+                         size_t              n_frames)
+{
+  size_t n = MIN(n_frames, ht->block - ht->block_pos);
+
+  double* restrict re       = ht->re;
+  double* restrict im       = ht->im;
+  double const*    wr       = ht->wr;
+  double const*    wi       = ht->wi;
+  float*           hist     = ht->hist;
+  size_t           hist_pos = ht->hist_pos;
+
+  for (size_t i = 0; i < n; ++i) {
+    /* X_k <- e^{j 2 pi k / N} * (X_k + x[n] - x[n-N]) */
+    __m256d d = _mm256_set1_pd((double)in[i] - (double)hist[hist_pos]);
+    hist[hist_pos] = in[i];
+    hist_pos = (hist_pos + 1 == ht->window) ? 0 : hist_pos + 1;
+
+    for (size_t k = 0; k < ht->n_padded; k += LANES) {
+      __m256d r  = _mm256_add_pd(_mm256_load_pd(re + k), d);
+      __m256d j  = _mm256_load_pd(im + k);
+      __m256d cr = _mm256_load_pd(wr + k);
+      __m256d ci = _mm256_load_pd(wi + k);
+
+      _mm256_store_pd(re + k, _mm256_sub_pd(_mm256_mul_pd(r, cr), _mm256_mul_pd(j, ci)));
+      _mm256_store_pd(im + k, _mm256_add_pd(_mm256_mul_pd(r, ci), _mm256_mul_pd(j, cr)));
+    }
+  }
+
+  ht->hist_pos   = hist_pos;
+  ht->n_seen     = MIN(ht->window, ht->n_seen + n);
+  ht->block_pos += n;
+
+  ht->ready = false;
+  if (ht->block_pos == ht->block) {
+    ht->block_pos = 0;
+    ht->ready     = ht->n_seen == ht->window;
+  }
+
+  return n;
+}
+
+bool
+harmonic_tracker_ready(harmonic_tracker_t const* ht)
+{
+  return ht->ready;
+}
+
+void
+harmonic_tracker_snapshot(harmonic_tracker_t const* ht,
+                          float*                    amplitude,
+                          float*                    phase)
+{
+  double scale = 2.0/(double)ht->window;
+  for (size_t i = 0; i < ht->n_bins; ++i) {
+    amplitude[i] = (float)(scale * hypot(ht->re[i], ht->im[i]));
+    phase[i]     = (float)atan2(ht->im[i], ht->re[i]);
+  }
+}
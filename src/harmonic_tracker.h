@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Sliding DFT tracker for a handful of known frequencies.
+
+   Instead of computing every bin of a full FFT, this keeps a running DFT over
+   the last `window` samples for just the bins we care about: the drive
+   frequency and its odd harmonics (the only places a square wave has energy).
+   Each input sample costs one complex multiply-add per tracked bin, done four
+   bins at a time. Every `block` samples a snapshot of the bins is made
+   available.
+
+   Bins are snapped to the nearest multiple of sample_rate/window, so pick a
+   window where the fundamental lands exactly on a bin (for example
+   sample_rate/10 for anything that is a multiple of 10 Hz). */
+
+typedef struct harmonic_tracker harmonic_tracker_t;
+
+/* Return the size of the tracker in bytes */
+
+size_t
+harmonic_tracker_footprint(size_t n_bins,
+                           size_t window);
+
+/* Return required alignment in bytes for the first byte of the structure */
+
+size_t
+harmonic_tracker_align(void);
+
+/* Create a tracker for `n_bins` frequencies: the fundamental, then the 3rd,
+   5th, ... harmonics. Every tracked harmonic must be below nyquist.
+
+   The memory region must be `harmonic_tracker_footprint(n_bins, window)` bytes
+   and aligned to `harmonic_tracker_align()`. */
+
+harmonic_tracker_t*
+create_harmonic_tracker(void*  mem,
+                        size_t sample_rate_hz,
+                        float  fundamental_hz,
+                        size_t n_bins,
+                        size_t window,
+                        size_t block,
+                        int*   opt_err);
+
+void*
+destroy_harmonic_tracker(harmonic_tracker_t* ht);
+
+size_t
+harmonic_tracker_n_bins(harmonic_tracker_t const* ht);
+
+size_t
+harmonic_tracker_window(harmonic_tracker_t const* ht);
+
+/* Feed up to n_frames samples into the tracker. Stops early if a block
+   completes, so callers should loop until all of their input is consumed,
+   checking `harmonic_tracker_ready` after each call.
+
+   Returns the number of frames consumed. */
+
+size_t
+harmonic_tracker_process(harmonic_tracker_t* ht,
+                         float const*        in,
+                         size_t              n_frames);
+
+/* True if a block just completed and the window has been filled at least
+   once. Cleared by the next call to `harmonic_tracker_process`. */
+
+bool
+harmonic_tracker_ready(harmonic_tracker_t const* ht);
+
+/* Copy out the current state of each tracked bin.
+
+   amplitude is the peak amplitude of the sinusoid at that frequency. phase is
+   the phase (radians) of a cosine at that frequency, measured at the first
+   sample of the window. */
+
+void
+harmonic_tracker_snapshot(harmonic_tracker_t const* ht,
+                          float*                    amplitude,
+                          float*                    phase);
@@ -0,0 +1,133 @@
+#include "lockin.h"
+
+#include "additive_square.h"
+#include "common.h"
+#include "err.h"
+
+#include <math.h>
+
+struct lockin {
+  float  alpha;       /* one-pole filter coefficient */
+  size_t decimation;
+
+  /* filter state, two poles each for the in-phase and quadrature products */
+  float  i1, i2;
+  float  q1, q2;
+
+  /* integrate and dump accumulators */
+  float  sum_i;
+  float  sum_q;
+  size_t count;
+};
+
+size_t
+lockin_footprint(void)
+{
+  return sizeof(lockin_t);
+}
+
+size_t
+lockin_align(void)
+{
+  return 1;
+}
+
+lockin_t*
+create_lockin(void*  mem,
+              size_t sample_rate_hz,
+              float  cutoff_hz,
+              size_t decimation,
+              int*   opt_err)
+{
+  if (!mem || decimation == 0 || cutoff_hz <= 0 || cutoff_hz >= sample_rate_hz/2.) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  lockin_t* li   = (lockin_t*)mem;
+  li->alpha      = (float)(1.0 - exp(-2*M_PI*cutoff_hz/(double)sample_rate_hz));
+  li->decimation = decimation;
+  li->i1         = 0;
+  li->i2         = 0;
+  li->q1         = 0;
+  li->q2         = 0;
+  li->sum_i      = 0;
+  li->sum_q      = 0;
+  li->count      = 0;
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return li;
+}
+
+void*
+destroy_lockin(lockin_t* li)
+{
+  return (void*)li;
+}
+
+size_t
+lockin_decimation(lockin_t const* li)
+{
+  return li->decimation;
+}
+
+size_t
+lockin_process(lockin_t*    li,
+               float*       theta_io,
+               double       step,
+               float const* in,
+               size_t       n_frames,
+               float*       amplitude,
+               float*       phase,
+               size_t*      opt_first)
+{
+  float  theta = *theta_io;
+  float  a     = li->alpha;
+  float  i1    = li->i1, i2 = li->i2;
+  float  q1    = li->q1, q2 = li->q2;
+  float  sum_i = li->sum_i;
+  float  sum_q = li->sum_q;
+  size_t count = li->count;
+  size_t n_out = 0;
+
+  for (size_t n = 0; n < n_frames; ++n) {
+    float s, c;
+    sincosf((float)(2*M_PI)*theta, &s, &c);
+    theta = additive_square_advance_phase(theta, step);
+
+    i1 += a*(in[n]*s - i1);
+    q1 += a*(in[n]*c - q1);
+    i2 += a*(i1 - i2);
+    q2 += a*(q1 - q2);
+
+    sum_i += i2;
+    sum_q += q2;
+    count += 1;
+
+    if (count == li->decimation) {
+      /* x = A sin(wt + phi) mixes down to I = A/2 cos(phi), Q = A/2 sin(phi) */
+      float mean_i = sum_i/(float)count;
+      float mean_q = sum_q/(float)count;
+
+      if (n_out == 0 && opt_first) *opt_first = n;
+      amplitude[n_out] = 2*hypotf(mean_i, mean_q);
+      phase[n_out]     = atan2f(mean_q, mean_i);
+      n_out += 1;
+
+      sum_i = 0;
+      sum_q = 0;
+      count = 0;
+    }
+  }
+
+  li->i1    = i1;
+  li->i2    = i2;
+  li->q1    = q1;
+  li->q2    = q2;
+  li->sum_i = sum_i;
+  li->sum_q = sum_q;
+  li->count = count;
+
+  *theta_io = theta;
+  return n_out;
+}
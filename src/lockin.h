@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Digital lock-in amplifier.
+
+   Mixes the input against sin/cos of a reference phase (I/Q demodulation),
+   low-passes both products with two cascaded one-pole filters, then averages
+   and dumps every `decimation` frames. The output is the amplitude and phase of
+   the input relative to a unit sin(2*pi*theta) reference, so an input equal to
+   the reference reads amplitude 1, phase 0. */
+
+typedef struct lockin lockin_t;
+
+size_t
+lockin_footprint(void);
+
+size_t
+lockin_align(void);
+
+/* `cutoff_hz` is the corner of each of the one-pole filters. It should sit well
+   below twice the reference frequency, where the mixing products land. */
+
+lockin_t*
+create_lockin(void*  mem,
+              size_t sample_rate_hz,
+              float  cutoff_hz,
+              size_t decimation,
+              int*   opt_err);
+
+void*
+destroy_lockin(lockin_t* li);
+
+size_t
+lockin_decimation(lockin_t const* li);
+
+/* Demodulate `n_frames` of input. The reference phase (in cycles) is `*theta`
+   at in[0] and advances by `step` cycles per frame, using
+   `additive_square_advance_phase`. On return `*theta` holds the phase of the
+   frame after the last one processed.
+
+   Every time a decimation period completes, one amplitude/phase pair is written
+   to the output arrays, which must have room for n_frames/decimation + 1
+   entries. `*opt_first` is set to the index of the input frame that completed
+   the first output period (only meaningful if something was written).
+
+   Returns the number of outputs written. */
+
+size_t
+lockin_process(lockin_t*    li,
+               float*       theta,
+               double       step,
+               float const* in,
+               size_t       n_frames,
+               float*       amplitude,
+               float*       phase,
+               size_t*      opt_first);
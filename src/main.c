@@ -1,15 +1,18 @@
 #include "app.h"
 #include "common.h"
 #include "err.h"
+#include "thread_setup.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <signal.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include <jack/jack.h>
@@ -45,12 +48,15 @@ static atomic_int   why;               /* technically wrong */
 static int          error_if_why_error;
 
 static app_t*       app               = NULL;
+static uint64_t     frame_time        = 0;  /* jack's frame clock, widened to 64 bits */
+static uint32_t     last_frame_time   = 0;
 static jack_port_t* ports[PORT_COUNT] = { NULL, NULL, NULL };
 
 static void
 usage(char const * appname)
 {
-  fprintf(stderr, "Usage: %s: square-out pulse-out result-in\n", appname);
+  fprintf(stderr, "Usage: %s: square-out pulse-out result-in [output-dir [output-prefix]]\n",
+          appname);
 }
 
 /* Responsible for getting and populating the buffers associated with all of our ports */
@@ -59,7 +65,7 @@ static int
 jack_process_callback(jack_nframes_t nframes, void* arg)
 {
   /* REALTIME SAFE */
-  (void)arg;
+  jack_client_t* client = (jack_client_t*)arg;
   assert(app); /* super sketchy */
 
   /* FIXME not clear if it is safe to access these ports and connect these ports
@@ -75,8 +81,14 @@ jack_process_callback(jack_nframes_t nframes, void* arg)
   jack_default_audio_sample_t const* result =
     (jack_default_audio_sample_t const*)jack_port_get_buffer(ports[RESULT_IN], nframes);
 
-  jack_time_t now_mics = jack_get_time();
-  int ret = app_poll(app, now_mics*1000, (size_t)nframes, square, pulse, result);
+  /* jack's frame clock is 32 bits and wraps after a day at 48kHz. The
+     difference survives the wrap, so keep a running 64 bit total. The first
+     callback's difference from 0 starts it at jack's time. */
+  jack_nframes_t now = jack_last_frame_time(client);
+  frame_time      += (uint32_t)(now - last_frame_time);
+  last_frame_time  = now;
+
+  int ret = app_poll(app, frame_time, (size_t)nframes, square, pulse, result);
   if (ret != APP_SUCCESS) {
     atomic_store(&why, WHY_ERROR);
     atomic_store(&running, false);
@@ -88,22 +100,63 @@ jack_process_callback(jack_nframes_t nframes, void* arg)
   }
 }
 
+/* Runs on jack's process thread before its first cycle, where we can still
+   make syscalls and print. The thread's MXCSR and affinity are whatever jack
+   gave it, so fix them up here. */
+
+static void
+jack_thread_init_callback(void* arg)
+{
+  (void)arg;
+  thread_setup_denormals();
+  thread_setup_pin(RT_CPU);
+  thread_setup_report("process thread");
+}
+
 /* If a client was too slow, this is triggered.
-   FIXME is this triggered if any client is too slow, or just if we are too slow? */
+   FIXME is this triggered if any client is too slow, or just if we are too slow?
+
+   The app marks the discontinuity in the data and carries on, unless we've
+   hit XRUN_ABORT_AFTER. */
 
 static int
 jack_xrun_callback(void* arg)
 {
   /* not required to be realtime safe */
   (void)arg;
+  assert(app);
 
-  atomic_store(&why, WHY_XRUN);
-  atomic_store(&running, false);
+  uint64_t xruns = app_note_xrun(app, jack_get_time()*1000);
+  if (xruns == XRUN_ABORT_AFTER) { /* never, for 0 */
+    atomic_store(&why, WHY_XRUN);
+    atomic_store(&running, false);
+  }
 
   return 0;
 }
 
-/* FIXME do we care about buffer size changes? */
+/* Jack doesn't run the process callback while this runs, so the app can be
+   reconfigured from here. Buffers bigger than the one the app was sized for
+   stop the run. */
+
+static int
+jack_buffer_size_callback(jack_nframes_t nframes, void* arg)
+{
+  /* not required to be realtime safe */
+  (void)arg;
+  assert(app);
+
+  int ret = app_set_buffer_size(app, (size_t)nframes);
+  if (ret != APP_SUCCESS) {
+    atomic_store(&why, WHY_ERROR);
+    atomic_store(&running, false);
+    error_if_why_error = ret;
+    return 1;
+  }
+
+  printf("%-30s %u\n", "buffer size changed to", nframes);
+  return 0;
+}
 
 static void
 handle_signal(int signo)
@@ -118,11 +171,14 @@ int
 main(int argc, char ** argv)
 {
   int ret = 0;
-  if (argc != 4) {
+  if (argc < 4 || argc > 6) {
     usage(argv[0]);
     return 1;
   }
 
+  char const* output_dir    = argc > 4 ? argv[4] : OUTPUT_DIR;
+  char const* output_prefix = argc > 5 ? argv[5] : OUTPUT_PREFIX;
+
   char const* connect_port_names[PORT_COUNT] = {
     argv[SQUARE_OUT+1], argv[PULSE_OUT+1], argv[RESULT_IN+1]
   };
@@ -137,11 +193,14 @@ main(int argc, char ** argv)
   char const*    client_name = jack_get_client_name(client); /* ref to some internal structure */
   jack_nframes_t sample_rate = jack_get_sample_rate(client);
   jack_nframes_t buffer_size = jack_get_buffer_size(client); /* subject to change during processing */
+  size_t         max_buffer  = jack_port_type_get_buffer_size(client, JACK_DEFAULT_AUDIO_TYPE)
+                               / sizeof(jack_default_audio_sample_t);
   int            rt          = jack_is_realtime(client);
 
   printf("Successfully initialized jack client named '%s'.\nProperties:\n", client_name);
   printf("%-30s %u\n", "sample rate", sample_rate);
   printf("%-30s %u\n", "buffer size", buffer_size);
+  printf("%-30s %zu\n", "max buffer size", max_buffer);
   printf("%-30s %s\n", "realtime",    rt ? "true" : "false");
 
   /* Create the ports that we need */
@@ -159,12 +218,20 @@ main(int argc, char ** argv)
   }
 
   /* Setup the audio processing app */
-  app = create_app(sample_rate, 1e9/2, &ret);
+  app = create_app(sample_rate, 1e9/2, MAX(max_buffer, buffer_size), output_dir, output_prefix,
+                   &ret);
   if (!app) {
     fprintf(stderr, "failed to create app with '%s'\n", app_errstr(ret));
     goto exit;
   }
 
+  /* The app locks its own memory. This gets the rest of what the process
+     callback can reach: fftw's plans, our code and libraries. */
+  if (0 != mlockall(MCL_CURRENT)) {
+    fprintf(stderr, "failed to lock process memory with: '%s' (%d). Moving along\n",
+            strerror(errno), errno);
+  }
+
   /* Set up jack callback handlers */
   ret = jack_set_xrun_callback(client, jack_xrun_callback, NULL);
   if (ret != 0) {
@@ -172,12 +239,31 @@ main(int argc, char ** argv)
     goto exit;
   }
 
-  ret = jack_set_process_callback(client, jack_process_callback, NULL);
+  ret = jack_set_thread_init_callback(client, jack_thread_init_callback, NULL);
+  if (ret != 0) {
+    fprintf(stderr, "failed to set thread init callback ret=%d\n", ret);
+    goto exit;
+  }
+
+  ret = jack_set_process_callback(client, jack_process_callback, client);
   if (ret != 0) {
     fprintf(stderr, "failed to set processing callback ret=%d\n", ret);
     goto exit;
   }
 
+  ret = app_set_buffer_size(app, buffer_size);
+  if (ret != APP_SUCCESS) {
+    fprintf(stderr, "failed to configure app for buffer size %u with '%s'\n", buffer_size,
+            app_errstr(ret));
+    goto exit;
+  }
+
+  ret = jack_set_buffer_size_callback(client, jack_buffer_size_callback, NULL);
+  if (ret != 0) {
+    fprintf(stderr, "failed to set buffer size callback ret=%d\n", ret);
+    goto exit;
+  }
+
   /* Set running to true before setting up signal handlers */
 
   atomic_store(&running, true);
@@ -219,14 +305,18 @@ main(int argc, char ** argv)
   /* Wait for something to shut us down */
 
   while (atomic_load(&running)) {
-    // printf("\rnow=%ld", time(NULL));
-    fflush(stdout);
     usleep(1000 /*millis */ * 1000 /* seconds */ * 1);
+    printf("%-30s %.1f%%\n", "dsp load", jack_cpu_load(client));
+    printf("%-30s %" PRIu64 "\n", "xruns", app_xruns(app));
+    app_report_rings(app);
+    app_report_timings(app);
+    fflush(stdout);
   }
   printf("\n");
 
 exit:
   printf("Shutting down '%s' due to %s\n", argv[0], whys[atomic_load(&why)]);
+  if (app) printf("%-30s %" PRIu64 "\n", "xruns during run", app_xruns(app));
   if (atomic_load(&why) == WHY_ERROR) {
     printf("error was '%s'\n", app_errstr(error_if_why_error));
   }
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "common.h"
+#include "disk.h"
+#include "err.h"
+#include "slot_ring.h"
+
+#include <string.h>
+
+/* Helpers for moving whole records through a slot_ring, one record per slot.
+
+   A slot is contiguous, so records are built (or copied) straight into it and
+   the consumer uses them where they sit. Nothing written here is visible to the
+   consumer until the producer calls slot_ring_publish, which it should do once
+   per batch. */
+
+/* Room for a record of `size` bytes, or NULL if the ring is full. Realtime
+   safe. */
+
+static inline void*
+record_reserve(slot_ring_t* r,
+               size_t       size)
+{
+  BUG(size > slot_ring_slot_size(r), "record of %zu bytes won't fit a slot\n", size);
+  return slot_ring_acquire(r);
+}
+
+/* Copy a record into the ring, or nothing at all if it's full. Realtime safe. */
+
+static inline int
+record_write(slot_ring_t*        r,
+             record_hdr_t const* rec)
+{
+  void* slot = record_reserve(r, rec->size);
+  if (!slot) return APP_DROP;
+
+  memcpy(slot, rec, rec->size);
+  return APP_SUCCESS;
+}
+
+/* The i'th readable record */
+
+static inline record_hdr_t*
+record_at(slot_ring_t* r,
+          size_t       i)
+{
+  record_hdr_t* hdr = (record_hdr_t*)slot_ring_slot(r, i);
+  BUG(hdr->size < sizeof(*hdr) || hdr->size > slot_ring_slot_size(r),
+      "corrupt record size %u\n", hdr->size);
+  return hdr;
+}
@@ -0,0 +1,134 @@
+#include "rfft.h"
+
+#include "common.h"
+#include "err.h"
+
+#include <assert.h>
+#include <string.h>
+
+struct rfft {
+  size_t         n;
+  size_t         n_bins;
+  fftwf_plan     plan;     /* precomputed fft plan (typefed ptr) */
+  fftwf_plan     inverse;  /* NULL unless created with RFFT_INVERSE */
+
+  /* Pointers into the trailing memory */
+  float*         in;
+  fftwf_complex* out;
+};
+
+/* aligning fft buffers to cache size will be more than sufficient for SIMD alignment. */
+
+static size_t
+in_offset(void)
+{
+  return ALIGN(sizeof(rfft_t), CACHELINE);
+}
+
+static size_t
+out_offset(size_t n)
+{
+  return ALIGN(in_offset() + n*sizeof(float), CACHELINE);
+}
+
+size_t
+rfft_footprint(size_t n)
+{
+  return out_offset(n) + (n/2+1)*sizeof(fftwf_complex);
+}
+
+size_t
+rfft_align(void)
+{
+  return CACHELINE;
+}
+
+rfft_t*
+create_rfft(void*    mem,
+            size_t   n,
+            unsigned flags,
+            int*     opt_err)
+{
+  if (!mem || n == 0 || (size_t)mem % CACHELINE) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  rfft_t* r = (rfft_t*)mem;
+  r->n       = n;
+  r->n_bins  = n/2+1;
+  r->in      = (float*)((char*)mem + in_offset());
+  r->out     = (fftwf_complex*)((char*)mem + out_offset(n));
+  r->inverse = NULL;
+
+  /* This does some calculations to determine the fastest way, trashing both
+     buffers while it does */
+  r->plan = fftwf_plan_dft_r2c_1d((int)n, r->in, r->out, FFTW_MEASURE);
+  if (!r->plan) {
+    if (opt_err) *opt_err = APP_ERR_ALLOC; /* FIXME? */
+    return NULL;
+  }
+
+  if (flags & RFFT_INVERSE) {
+    r->inverse = fftwf_plan_dft_c2r_1d((int)n, r->out, r->in, FFTW_MEASURE);
+    if (!r->inverse) {
+      fftwf_destroy_plan(r->plan);
+      if (opt_err) *opt_err = APP_ERR_ALLOC;
+      return NULL;
+    }
+  }
+
+  memset(r->in,  0, n*sizeof(float));
+  memset(r->out, 0, r->n_bins*sizeof(fftwf_complex));
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return r;
+}
+
+void*
+destroy_rfft(rfft_t* r)
+{
+  if (!r) return NULL;
+  if (r->inverse) fftwf_destroy_plan(r->inverse);
+  if (r->plan)    fftwf_destroy_plan(r->plan);
+  r->inverse = NULL;
+  r->plan    = NULL;
+  return (void*)r;
+}
+
+size_t
+rfft_n(rfft_t const* r)
+{
+  return r->n;
+}
+
+size_t
+rfft_n_bins(rfft_t const* r)
+{
+  return r->n_bins;
+}
+
+float*
+rfft_in(rfft_t* r)
+{
+  return r->in;
+}
+
+fftwf_complex*
+rfft_out(rfft_t* r)
+{
+  return r->out;
+}
+
+void
+rfft_execute(rfft_t* r)
+{
+  fftwf_execute(r->plan);
+}
+
+void
+rfft_execute_inverse(rfft_t* r)
+{
+  assert(r->inverse);
+  fftwf_execute(r->inverse);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "inc_fftw.h"
+
+#include <stddef.h>
+
+/* Real to complex fft of a fixed size, with the plan and both buffers kept
+   together. Optionally also plans the inverse (complex to real) transform over
+   the same two buffers.
+
+   Planning is not thread safe in fftw, so create these before starting any
+   threads. Executing different plans from different threads is fine. */
+
+typedef struct rfft rfft_t;
+
+enum {
+  RFFT_FORWARD = 0,
+  RFFT_INVERSE = 1, /* also plan rfft_execute_inverse */
+};
+
+size_t
+rfft_footprint(size_t n);
+
+size_t
+rfft_align(void);
+
+rfft_t*
+create_rfft(void*    mem,
+            size_t   n,
+            unsigned flags,
+            int*     opt_err);
+
+/* Destroys the plans */
+
+void*
+destroy_rfft(rfft_t* r);
+
+/* Number of real inputs, and number of complex outputs (n/2+1) */
+
+size_t
+rfft_n(rfft_t const* r);
+
+size_t
+rfft_n_bins(rfft_t const* r);
+
+/* Fill rfft_in, call rfft_execute, read rfft_out. Execute clobbers nothing but
+   the output. */
+
+float*
+rfft_in(rfft_t* r);
+
+fftwf_complex*
+rfft_out(rfft_t* r);
+
+void
+rfft_execute(rfft_t* r);
+
+/* rfft_out back into rfft_in, unnormalized (the result is n times the original
+   input). Trashes rfft_out. Only valid if created with RFFT_INVERSE. */
+
+void
+rfft_execute_inverse(rfft_t* r);
@@ -0,0 +1,162 @@
+#include "slot_ring.h"
+
+#include "common.h"
+#include "err.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Indices count up forever, the slot is index & mask */
+
+struct slot_ring {
+  /* set at create, only read afterwards */
+  size_t n_slots;
+  size_t mask;
+  size_t slot_size;
+  char*  slots;
+
+  /* producer's line */
+  _Alignas(CACHELINE) atomic_size_t head;  /* one past the last published slot */
+  size_t acquired;                         /* one past the last acquired slot */
+  size_t tail_cache;                       /* last tail the producer saw */
+
+  /* consumer's line */
+  _Alignas(CACHELINE) atomic_size_t tail;  /* one past the last released slot */
+  size_t head_cache;                       /* last head the consumer saw */
+
+  /* Trailing memory holds the slots */
+};
+
+static size_t
+rounded_slot_size(size_t slot_size)
+{
+  return ALIGN(slot_size, CACHELINE);
+}
+
+static size_t
+slots_offset(void)
+{
+  return ALIGN(sizeof(slot_ring_t), CACHELINE);
+}
+
+size_t
+slot_ring_footprint(size_t n_slots,
+                    size_t slot_size)
+{
+  return slots_offset() + n_slots*rounded_slot_size(slot_size);
+}
+
+size_t
+slot_ring_align(void)
+{
+  return CACHELINE;
+}
+
+slot_ring_t*
+create_slot_ring(void*  mem,
+                 size_t n_slots,
+                 size_t slot_size,
+                 int*   opt_err)
+{
+  bool pow2 = n_slots && !(n_slots & (n_slots - 1));
+  if (!mem || !pow2 || slot_size == 0 || (size_t)mem % CACHELINE) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  slot_ring_t* r = (slot_ring_t*)mem;
+  r->n_slots     = n_slots;
+  r->mask        = n_slots - 1;
+  r->slot_size   = rounded_slot_size(slot_size);
+  r->slots       = (char*)mem + slots_offset();
+  r->acquired    = 0;
+  r->tail_cache  = 0;
+  r->head_cache  = 0;
+  atomic_store(&r->head, 0);
+  atomic_store(&r->tail, 0);
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return r;
+}
+
+void*
+destroy_slot_ring(slot_ring_t* r)
+{
+  return (void*)r;
+}
+
+size_t
+slot_ring_slot_size(slot_ring_t const* r)
+{
+  return r->slot_size;
+}
+
+size_t
+slot_ring_n_slots(slot_ring_t const* r)
+{
+  return r->n_slots;
+}
+
+size_t
+slot_ring_used(slot_ring_t* r)
+{
+  /* tail first, head can only have moved further since */
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+  return head - tail;
+}
+
+void*
+slot_ring_acquire(slot_ring_t* r)
+{
+  if (r->acquired - r->tail_cache == r->n_slots) {
+    r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (r->acquired - r->tail_cache == r->n_slots) return NULL;
+  }
+
+  char* slot = r->slots + (r->acquired & r->mask)*r->slot_size;
+  r->acquired += 1;
+  return slot;
+}
+
+size_t
+slot_ring_writable(slot_ring_t* r)
+{
+  r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+  return r->n_slots - (r->acquired - r->tail_cache);
+}
+
+void
+slot_ring_publish(slot_ring_t* r)
+{
+  atomic_store_explicit(&r->head, r->acquired, memory_order_release);
+}
+
+size_t
+slot_ring_readable(slot_ring_t* r)
+{
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed); /* ours */
+  if (r->head_cache == tail) {
+    r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+  }
+
+  return r->head_cache - tail;
+}
+
+void*
+slot_ring_slot(slot_ring_t* r,
+               size_t       i)
+{
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  return r->slots + ((tail + i) & r->mask)*r->slot_size;
+}
+
+void
+slot_ring_release(slot_ring_t* r,
+                  size_t       n)
+{
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+}
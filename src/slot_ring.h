@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Single producer, single consumer ring of fixed size slots.
+
+   Every slot is a multiple of CACHELINE bytes and starts on a cacheline, so a
+   record built in a slot is always contiguous and never shares a line with its
+   neighbours. The producer's and consumer's indices live on separate
+   cachelines, and each side keeps a cached copy of the other's index so it
+   only touches the shared line when the cache says the ring is full (or
+   empty).
+
+   Both sides work in batches: the producer acquires any number of slots and
+   makes them visible with one publish, the consumer looks at everything
+   readable and releases it with one release. */
+
+typedef struct slot_ring slot_ring_t;
+
+/* `n_slots` must be a power of two. `slot_size` is rounded up to a multiple of
+   CACHELINE. */
+
+size_t
+slot_ring_footprint(size_t n_slots,
+                    size_t slot_size);
+
+size_t
+slot_ring_align(void);
+
+slot_ring_t*
+create_slot_ring(void*  mem,
+                 size_t n_slots,
+                 size_t slot_size,
+                 int*   opt_err);
+
+void*
+destroy_slot_ring(slot_ring_t* r);
+
+size_t
+slot_ring_slot_size(slot_ring_t const* r);
+
+size_t
+slot_ring_n_slots(slot_ring_t const* r);
+
+/* Published slots the consumer hasn't released yet. Safe from any thread, for
+   monitoring. */
+
+size_t
+slot_ring_used(slot_ring_t* r);
+
+/* Producer side. Realtime safe. */
+
+/* Next free slot, or NULL if the ring is full. Invisible to the consumer until
+   published. */
+
+void*
+slot_ring_acquire(slot_ring_t* r);
+
+/* Number of slots that can be acquired right now. Always looks at the
+   consumer's index. */
+
+size_t
+slot_ring_writable(slot_ring_t* r);
+
+/* Make every slot acquired so far visible to the consumer */
+
+void
+slot_ring_publish(slot_ring_t* r);
+
+/* Consumer side */
+
+/* Number of published slots not yet released. Only looks at the producer's
+   index when the cached copy says there are none, so it can lag behind. */
+
+size_t
+slot_ring_readable(slot_ring_t* r);
+
+/* The i'th readable slot, i < slot_ring_readable() */
+
+void*
+slot_ring_slot(slot_ring_t* r,
+               size_t       i);
+
+/* Hand the first `n` readable slots back to the producer */
+
+void
+slot_ring_release(slot_ring_t* r,
+                  size_t       n);
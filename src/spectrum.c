@@ -0,0 +1,145 @@
+#include "spectrum.h"
+
+#include "common.h"
+#include "err.h"
+#include "inc_fftw.h"
+#include "rfft.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+struct spectrum {
+  size_t  n;
+  size_t  n_bins;
+  size_t  max_sets;
+  size_t  fill;      /* frames of the current transform collected so far */
+  size_t  n_sets;    /* in the last spectrum_process */
+
+  /* Pointers into the trailing memory */
+  rfft_t* fft;
+  float*  bins;      /* max_sets*n_bins */
+  bool*   done;      /* max_sets, a transform completed in the set */
+};
+
+static size_t
+fft_offset(void)
+{
+  return ALIGN(sizeof(spectrum_t), rfft_align());
+}
+
+static size_t
+bins_offset(size_t n)
+{
+  return ALIGN(fft_offset() + rfft_footprint(n), CACHELINE);
+}
+
+static size_t
+done_offset(size_t n,
+            size_t max_sets)
+{
+  return bins_offset(n) + max_sets*(n/2+1)*sizeof(float);
+}
+
+size_t
+spectrum_footprint(size_t n,
+                   size_t max_sets)
+{
+  return done_offset(n, max_sets) + max_sets*sizeof(bool);
+}
+
+size_t
+spectrum_align(void)
+{
+  return MAX(_Alignof(spectrum_t), rfft_align());
+}
+
+spectrum_t*
+create_spectrum(void*  mem,
+                size_t n,
+                size_t max_sets,
+                int*   opt_err)
+{
+  if (!mem || n == 0 || max_sets == 0 || (size_t)mem % spectrum_align()) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  rfft_t* fft = create_rfft((char*)mem + fft_offset(), n, RFFT_FORWARD, opt_err);
+  if (!fft) return NULL; /* opt_err already set */
+
+  spectrum_t* s = (spectrum_t*)mem;
+  s->n        = n;
+  s->n_bins   = n/2+1;
+  s->max_sets = max_sets;
+  s->fill     = 0;
+  s->n_sets   = 0;
+  s->fft      = fft;
+  s->bins     = (float*)((char*)mem + bins_offset(n));
+  s->done     = (bool*)((char*)mem + done_offset(n, max_sets));
+
+  memset(s->bins, 0, max_sets*s->n_bins*sizeof(float));
+  memset(s->done, 0, max_sets*sizeof(bool));
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return s;
+}
+
+void*
+destroy_spectrum(spectrum_t* s)
+{
+  if (!s) return NULL;
+  destroy_rfft(s->fft);
+  return (void*)s;
+}
+
+size_t
+spectrum_n(spectrum_t const* s)
+{
+  return s->n;
+}
+
+size_t
+spectrum_n_bins(spectrum_t const* s)
+{
+  return s->n_bins;
+}
+
+int
+spectrum_process(spectrum_t*  s,
+                 float const* in,
+                 size_t       nframes,
+                 size_t       set_frames)
+{
+  if (set_frames == 0 || set_frames > s->n)                return APP_ERR_INVAL;
+  if ((nframes + set_frames - 1)/set_frames > s->max_sets) return APP_ERR_INVAL;
+
+  s->n_sets = 0;
+  for (size_t at = 0; at < nframes; at += set_frames) {
+    size_t set = s->n_sets++;
+    size_t end = MIN(at + set_frames, nframes);
+    s->done[set] = false;
+
+    for (size_t i = at; i < end; ++i) {
+      rfft_in(s->fft)[s->fill++] = in[i];
+      if (s->fill < s->n) continue;
+
+      rfft_execute(s->fft);
+      s->fill = 0;
+
+      fftwf_complex const* out  = rfft_out(s->fft);
+      float*               bins = s->bins + set*s->n_bins;
+      for (size_t j = 0; j < s->n_bins; ++j) bins[j] = cabsf(out[j]);
+      s->done[set] = true;
+    }
+  }
+
+  return APP_SUCCESS;
+}
+
+float const*
+spectrum_bins(spectrum_t const* s,
+              size_t            set)
+{
+  if (set >= s->n_sets || !s->done[set]) return NULL;
+  return s->bins + set*s->n_bins;
+}
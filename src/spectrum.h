@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Magnitude spectrum of lxd_in for the sample sets, an `n` point transform
+   every `n` frames, not windowed or overlapped.
+
+   A callback is written as sample sets of `set_frames` (see app_poll), and a
+   transform can complete in any of them. A callback several times `n` long
+   completes several. Each transform's magnitudes are kept for the set it
+   completed in, so none is overwritten by the next one and each goes out with
+   the frame of its own set. Sets are at most `n` frames, so at most one
+   transform completes in each.
+
+   Uses an rfft_t, so the same planning caveats apply: create before starting
+   any threads. */
+
+typedef struct spectrum spectrum_t;
+
+size_t
+spectrum_footprint(size_t n,
+                   size_t max_sets);
+
+size_t
+spectrum_align(void);
+
+spectrum_t*
+create_spectrum(void*  mem,
+                size_t n,
+                size_t max_sets,  /* most sample sets a callback is split into */
+                int*   opt_err);
+
+void*
+destroy_spectrum(spectrum_t* s);
+
+/* Transform size, and bins (n/2+1) in each set's magnitudes */
+
+size_t
+spectrum_n(spectrum_t const* s);
+
+size_t
+spectrum_n_bins(spectrum_t const* s);
+
+/* Run the transform over `nframes` of input, carrying on from the last call,
+   with the callback split into sets of `set_frames` (the last one takes what
+   is left over). Fails if `set_frames` is more than `n` or the callback
+   doesn't fit in `max_sets` sets. */
+
+int
+spectrum_process(spectrum_t*  s,
+                 float const* in,
+                 size_t       nframes,
+                 size_t       set_frames);
+
+/* Magnitudes of the transform that completed in set `set` of the last
+   spectrum_process, NULL if none did */
+
+float const*
+spectrum_bins(spectrum_t const* s,
+              size_t            set);
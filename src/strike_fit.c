@@ -0,0 +1,316 @@
+#include "strike_fit.h"
+
+#include "common.h"
+#include "err.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* The solver works on log(tau) so the time constants can never go negative,
+   and clamps them to the configured range after every step. */
+
+enum {
+  P_BASELINE = 0,
+  P_AMPLITUDE,
+  P_LOG_RISE,
+  P_LOG_FALL,
+  N_PARAMS,
+};
+
+/* need a handful of points per parameter before a fit means anything */
+#define MIN_POINTS (2*N_PARAMS)
+
+/* stop once an accepted step improves the cost by less than this fraction */
+#define COST_TOLERANCE 1e-9
+
+struct strike_fit {
+  size_t max_points;
+  size_t max_iterations;
+  double min_log_tau;
+  double max_log_tau;
+  size_t n_points;
+
+  /* Pointers into the trailing memory, max_points each */
+  float* t;
+  float* y;
+};
+
+size_t
+strike_fit_footprint(size_t max_points)
+{
+  return sizeof(strike_fit_t) + 2*max_points*sizeof(float);
+}
+
+size_t
+strike_fit_align(void)
+{
+  return _Alignof(strike_fit_t);
+}
+
+strike_fit_t*
+create_strike_fit(void*  mem,
+                  size_t max_points,
+                  size_t max_iterations,
+                  float  min_tau_s,
+                  float  max_tau_s,
+                  int*   opt_err)
+{
+  if (!mem || max_points < MIN_POINTS || min_tau_s <= 0 || max_tau_s <= min_tau_s) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  strike_fit_t* sf   = (strike_fit_t*)mem;
+  sf->max_points     = max_points;
+  sf->max_iterations = max_iterations;
+  sf->min_log_tau    = log(min_tau_s);
+  sf->max_log_tau    = log(max_tau_s);
+  sf->n_points       = 0;
+  sf->t              = (float*)(sf + 1);
+  sf->y              = sf->t + max_points;
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return sf;
+}
+
+void*
+destroy_strike_fit(strike_fit_t* sf)
+{
+  return (void*)sf;
+}
+
+void
+strike_fit_reset(strike_fit_t* sf)
+{
+  sf->n_points = 0;
+}
+
+size_t
+strike_fit_n_points(strike_fit_t const* sf)
+{
+  return sf->n_points;
+}
+
+void
+strike_fit_add(strike_fit_t* sf,
+               float         t_s,
+               float         y)
+{
+  if (sf->n_points == sf->max_points) return;
+  sf->t[sf->n_points] = t_s;
+  sf->y[sf->n_points] = y;
+  sf->n_points += 1;
+}
+
+static double
+clamp(double v, double lo, double hi)
+{
+  return MIN(hi, MAX(lo, v));
+}
+
+/* Sum of squared residuals at p. If jtj is provided, also accumulate the normal
+   equations (J^T J and J^T r) for the Jacobian of the model at p. */
+
+static double
+evaluate(strike_fit_t const* sf,
+         double const*       p,
+         double              jtj[N_PARAMS][N_PARAMS],
+         double              jtr[N_PARAMS])
+{
+  double tau_r = exp(p[P_LOG_RISE]);
+  double tau_f = exp(p[P_LOG_FALL]);
+  double cost  = 0;
+
+  if (jtj) {
+    memset(jtj, 0, sizeof(double)*N_PARAMS*N_PARAMS);
+    memset(jtr, 0, sizeof(double)*N_PARAMS);
+  }
+
+  for (size_t i = 0; i < sf->n_points; ++i) {
+    double t  = sf->t[i];
+    double er = exp(-t/tau_r);
+    double ef = exp(-t/tau_f);
+    double r  = sf->y[i] - (p[P_BASELINE] + p[P_AMPLITUDE]*(ef - er));
+    cost += r*r;
+
+    if (!jtj) continue;
+
+    double j[N_PARAMS];
+    j[P_BASELINE]  = 1.0;
+    j[P_AMPLITUDE] = ef - er;
+    j[P_LOG_RISE]  = -p[P_AMPLITUDE]*er*t/tau_r; /* d/d(log tau) = tau * d/d(tau) */
+    j[P_LOG_FALL]  =  p[P_AMPLITUDE]*ef*t/tau_f;
+
+    for (size_t a = 0; a < N_PARAMS; ++a) {
+      jtr[a] += j[a]*r;
+      for (size_t b = 0; b <= a; ++b) jtj[a][b] += j[a]*j[b];
+    }
+  }
+
+  if (jtj) {
+    for (size_t a = 0; a < N_PARAMS; ++a) {
+      for (size_t b = a+1; b < N_PARAMS; ++b) jtj[a][b] = jtj[b][a];
+    }
+  }
+
+  return cost;
+}
+
+/* Cholesky solve of a (symmetric positive definite) x = b. Returns false if a
+   isn't positive definite. */
+
+static bool
+solve(double const a[N_PARAMS][N_PARAMS],
+      double const b[N_PARAMS],
+      double       x[N_PARAMS])
+{
+  double l[N_PARAMS][N_PARAMS] = {{0}};
+  for (size_t i = 0; i < N_PARAMS; ++i) {
+    for (size_t j = 0; j <= i; ++j) {
+      double sum = a[i][j];
+      for (size_t k = 0; k < j; ++k) sum -= l[i][k]*l[j][k];
+
+      if (i == j) {
+        if (!(sum > 0)) return false;
+        l[i][i] = sqrt(sum);
+      }
+      else {
+        l[i][j] = sum/l[j][j];
+      }
+    }
+  }
+
+  double z[N_PARAMS];
+  for (size_t i = 0; i < N_PARAMS; ++i) {
+    double sum = b[i];
+    for (size_t k = 0; k < i; ++k) sum -= l[i][k]*z[k];
+    z[i] = sum/l[i][i];
+  }
+
+  for (size_t i = N_PARAMS; i-- > 0;) {
+    double sum = z[i];
+    for (size_t k = i+1; k < N_PARAMS; ++k) sum -= l[k][i]*x[k];
+    x[i] = sum/l[i][i];
+  }
+
+  return true;
+}
+
+/* Rough starting point read straight off the data: baseline from the tail,
+   rise from the time to the peak, fall from the time it takes the peak to
+   drop by 1/e. */
+
+static void
+initial_guess(strike_fit_t const* sf,
+              double*             p)
+{
+  size_t n      = sf->n_points;
+  size_t n_tail = MAX(1, n/10);
+
+  double baseline = 0;
+  for (size_t i = n - n_tail; i < n; ++i) baseline += sf->y[i];
+  baseline /= (double)n_tail;
+
+  size_t peak = 0;
+  for (size_t i = 1; i < n; ++i) {
+    if (fabs(sf->y[i] - baseline) > fabs(sf->y[peak] - baseline)) peak = i;
+  }
+  double height = sf->y[peak] - baseline;
+
+  double min_tau = exp(sf->min_log_tau);
+  double tau_r   = MAX(2*min_tau, sf->t[peak]/3.0);
+  double tau_f   = (sf->t[n-1] - sf->t[peak])/3.0;
+  for (size_t i = peak+1; i < n; ++i) {
+    if (fabs(sf->y[i] - baseline) < fabs(height)/M_E) {
+      tau_f = sf->t[i] - sf->t[peak];
+      break;
+    }
+  }
+  tau_f = MAX(tau_f, 2*tau_r);
+
+  /* the difference of exponentials peaks below 1, scale so the model's peak
+     matches the data */
+  double t_peak = log(tau_f/tau_r)*tau_r*tau_f/(tau_f - tau_r);
+  double g      = exp(-t_peak/tau_f) - exp(-t_peak/tau_r);
+
+  p[P_BASELINE]  = baseline;
+  p[P_AMPLITUDE] = height/g;
+  p[P_LOG_RISE]  = clamp(log(tau_r), sf->min_log_tau, sf->max_log_tau);
+  p[P_LOG_FALL]  = clamp(log(tau_f), sf->min_log_tau, sf->max_log_tau);
+}
+
+int
+strike_fit_solve(strike_fit_t*        sf,
+                 strike_fit_result_t* out)
+{
+  if (sf->n_points < MIN_POINTS) return APP_ERR_INVAL;
+
+  double p[N_PARAMS];
+  initial_guess(sf, p);
+
+  double jtj[N_PARAMS][N_PARAMS];
+  double jtr[N_PARAMS];
+  double cost      = evaluate(sf, p, jtj, jtr);
+  double lambda    = 1e-3;
+  bool   converged = false;
+  size_t it        = 0;
+
+  for (; it < sf->max_iterations && !converged; ++it) {
+    /* damp the normal equations, scaled by their own diagonal (Marquardt) */
+    double a[N_PARAMS][N_PARAMS];
+    memcpy(a, jtj, sizeof(a));
+    for (size_t d = 0; d < N_PARAMS; ++d) a[d][d] += lambda*jtj[d][d] + 1e-12;
+
+    double step[N_PARAMS];
+    if (!solve((double const (*)[N_PARAMS])a, jtr, step)) {
+      lambda *= 10;
+      continue;
+    }
+
+    double q[N_PARAMS];
+    for (size_t d = 0; d < N_PARAMS; ++d) q[d] = p[d] + step[d];
+    q[P_LOG_RISE] = clamp(q[P_LOG_RISE], sf->min_log_tau, sf->max_log_tau);
+    q[P_LOG_FALL] = clamp(q[P_LOG_FALL], sf->min_log_tau, sf->max_log_tau);
+
+    double q_jtj[N_PARAMS][N_PARAMS];
+    double q_jtr[N_PARAMS];
+    double q_cost = evaluate(sf, q, q_jtj, q_jtr);
+
+    if (q_cost < cost) {
+      converged = cost - q_cost <= COST_TOLERANCE*cost;
+      memcpy(p,   q,     sizeof(p));
+      memcpy(jtj, q_jtj, sizeof(jtj));
+      memcpy(jtr, q_jtr, sizeof(jtr));
+      cost   = q_cost;
+      lambda = MAX(lambda/10, 1e-12);
+    }
+    else {
+      /* no step in any direction helps, as good as it gets */
+      lambda *= 10;
+      if (lambda > 1e12) converged = true;
+    }
+  }
+
+  /* the model is symmetric in the two time constants if amplitude flips, keep
+     them in a consistent order */
+  double amplitude = p[P_AMPLITUDE];
+  double tau_r     = exp(p[P_LOG_RISE]);
+  double tau_f     = exp(p[P_LOG_FALL]);
+  if (tau_r > tau_f) {
+    double tmp = tau_r;
+    tau_r      = tau_f;
+    tau_f      = tmp;
+    amplitude  = -amplitude;
+  }
+
+  out->baseline     = (float)p[P_BASELINE];
+  out->amplitude    = (float)amplitude;
+  out->tau_rise_s   = (float)tau_r;
+  out->tau_fall_s   = (float)tau_f;
+  out->rms_residual = (float)sqrt(cost/(double)sf->n_points);
+  out->n_points     = (uint32_t)sf->n_points;
+  out->iterations   = (uint32_t)it;
+  out->converged    = converged;
+  return APP_SUCCESS;
+}
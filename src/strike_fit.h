@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fit the response to a single strike of the pulse generator.
+
+   After a strike the LXD's transmission swings away from its resting value and
+   then relaxes back. We model that as a difference of exponentials
+
+     y(t) = baseline + amplitude * (exp(-t/tau_fall) - exp(-t/tau_rise))
+
+   with t in seconds since the strike, and fit it with a Levenberg-Marquardt
+   solver that runs for a bounded number of iterations. All storage is carved
+   out of the memory region handed to create_strike_fit; nothing allocates. */
+
+typedef struct strike_fit        strike_fit_t;
+typedef struct strike_fit_result strike_fit_result_t;
+
+struct strike_fit_result {
+  float    baseline;
+  float    amplitude;
+  float    tau_rise_s;    /* always <= tau_fall_s */
+  float    tau_fall_s;
+  float    rms_residual;
+  uint32_t n_points;
+  uint32_t iterations;
+  uint32_t converged;     /* 0 if we ran out of iterations */
+};
+
+size_t
+strike_fit_footprint(size_t max_points);
+
+size_t
+strike_fit_align(void);
+
+/* Time constants are kept within [min_tau_s, max_tau_s] while fitting */
+
+strike_fit_t*
+create_strike_fit(void*  mem,
+                  size_t max_points,
+                  size_t max_iterations,
+                  float  min_tau_s,
+                  float  max_tau_s,
+                  int*   opt_err);
+
+void*
+destroy_strike_fit(strike_fit_t* sf);
+
+/* Forget all of the points, start a new segment */
+
+void
+strike_fit_reset(strike_fit_t* sf);
+
+size_t
+strike_fit_n_points(strike_fit_t const* sf);
+
+/* Add a point `t_s` seconds after the strike. Points past max_points are
+   silently ignored, the fit just uses the start of the response. */
+
+void
+strike_fit_add(strike_fit_t* sf,
+               float         t_s,
+               float         y);
+
+/* Fit the points added since the last reset. Returns APP_ERR_INVAL if there
+   aren't enough points to say anything meaningful. */
+
+int
+strike_fit_solve(strike_fit_t*        sf,
+                 strike_fit_result_t* out);
@@ -0,0 +1,90 @@
+#include "strike_sched.h"
+
+#include "common.h"
+#include "err.h"
+
+#define NS_PER_S 1000000000ull
+
+struct strike_sched {
+  uint64_t step;       /* strike period in billionths of a frame */
+  uint64_t next;       /* frame of the next strike */
+  uint64_t next_rem;   /* and the billionths of a frame after it */
+  bool     started;    /* next is set */
+};
+
+size_t
+strike_sched_footprint(void)
+{
+  return sizeof(strike_sched_t);
+}
+
+size_t
+strike_sched_align(void)
+{
+  return _Alignof(strike_sched_t);
+}
+
+strike_sched_t*
+create_strike_sched(void*    mem,
+                    uint64_t sample_rate_hz,
+                    uint64_t strike_period_ns,
+                    int*     opt_err)
+{
+  /* at least a frame apart, with room to carry the remainder */
+  bool ok = sample_rate_hz
+            && strike_period_ns <= (UINT64_MAX - NS_PER_S)/sample_rate_hz
+            && strike_period_ns*sample_rate_hz >= NS_PER_S;
+
+  if (!mem || !ok) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  strike_sched_t* s = (strike_sched_t*)mem;
+  s->step     = strike_period_ns*sample_rate_hz;
+  s->next     = 0;
+  s->next_rem = 0;
+  s->started  = false;
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return s;
+}
+
+void*
+destroy_strike_sched(strike_sched_t* s)
+{
+  return (void*)s;
+}
+
+void
+strike_sched_start(strike_sched_t* s,
+                   uint64_t        frame)
+{
+  if (s->started) return;
+
+  s->next    = frame;
+  s->started = true;
+}
+
+/* Move the next strike one period on */
+
+static void
+advance(strike_sched_t* s)
+{
+  s->next_rem += s->step;
+  s->next     += s->next_rem/NS_PER_S;
+  s->next_rem %= NS_PER_S;
+}
+
+bool
+strike_sched_take(strike_sched_t* s,
+                  uint64_t        begin,
+                  uint64_t        end,
+                  uint64_t*       at)
+{
+  if (!s->started || s->next >= end) return false;
+
+  *at = MAX(s->next, begin);
+  do advance(s); while (s->next <= *at);
+  return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* When to strike, on the host's frame clock.
+
+   Strikes come every `strike_period_ns`, which is rarely a whole number of
+   frames, so the fraction is carried exactly (in billionths of a frame)
+   instead of rounded every time and the schedule never drifts. The clock
+   keeps counting through xruns; strikes it skips over are dropped, not
+   bunched up after it. */
+
+typedef struct strike_sched strike_sched_t;
+
+size_t
+strike_sched_footprint(void);
+
+size_t
+strike_sched_align(void);
+
+/* Strikes have to be at least a frame apart, and the period short enough to
+   carry the remainder in 64 bits */
+
+strike_sched_t*
+create_strike_sched(void*    mem,
+                    uint64_t sample_rate_hz,
+                    uint64_t strike_period_ns,
+                    int*     opt_err);
+
+void*
+destroy_strike_sched(strike_sched_t* s);
+
+/* First strike at `frame`. Later calls do nothing. */
+
+void
+strike_sched_start(strike_sched_t* s,
+                   uint64_t        frame);
+
+/* The next strike in frames [begin, end), in `*at`, and moves the schedule on
+   past it. A strike that was due before `begin` happens at `begin`, once, and
+   the ones after it that also fell before `begin` are dropped. Returns false
+   when there's none before `end` (or before strike_sched_start). */
+
+bool
+strike_sched_take(strike_sched_t* s,
+                  uint64_t        begin,
+                  uint64_t        end,
+                  uint64_t*       at);
@@ -0,0 +1,159 @@
+#include "sync_avg.h"
+
+#include "common.h"
+#include "err.h"
+
+#include <immintrin.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* input is added eight floats (one AVX register) at a time */
+#define LANES        8ul
+#define VECTOR_ALIGN 32ul
+
+struct sync_avg {
+  size_t    window;
+  size_t    n_strikes;
+  uint64_t  first_strike;  /* frame of the first strike since reset */
+  uint64_t  strike;        /* frame of the strike we're currently aligned to */
+  bool      have_strike;
+
+  /* Pointers into the trailing memory, window long each */
+  float*    sum;
+  uint32_t* count;
+};
+
+static size_t
+sums_offset(void)
+{
+  return ALIGN(sizeof(sync_avg_t), VECTOR_ALIGN);
+}
+
+static size_t
+counts_offset(size_t window)
+{
+  return sums_offset() + ALIGN(window*sizeof(float), VECTOR_ALIGN);
+}
+
+size_t
+sync_avg_footprint(size_t window)
+{
+  return counts_offset(window) + window*sizeof(uint32_t);
+}
+
+size_t
+sync_avg_align(void)
+{
+  return VECTOR_ALIGN;
+}
+
+sync_avg_t*
+create_sync_avg(void*  mem,
+                size_t window,
+                int*   opt_err)
+{
+  if (!mem || window == 0 || (size_t)mem % VECTOR_ALIGN) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  sync_avg_t* sa = (sync_avg_t*)mem;
+  sa->window     = window;
+  sa->sum        = (float*)((char*)mem + sums_offset());
+  sa->count      = (uint32_t*)((char*)mem + counts_offset(window));
+  sync_avg_reset(sa);
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return sa;
+}
+
+void*
+destroy_sync_avg(sync_avg_t* sa)
+{
+  return (void*)sa;
+}
+
+size_t
+sync_avg_window(sync_avg_t const* sa)
+{
+  return sa->window;
+}
+
+size_t
+sync_avg_n_strikes(sync_avg_t const* sa)
+{
+  return sa->n_strikes;
+}
+
+uint64_t
+sync_avg_first_strike(sync_avg_t const* sa)
+{
+  return sa->first_strike;
+}
+
+void
+sync_avg_strike(sync_avg_t* sa,
+                uint64_t    frame)
+{
+  if (sa->n_strikes == 0) sa->first_strike = frame;
+  sa->n_strikes  += 1;
+  sa->strike      = frame;
+  sa->have_strike = true;
+}
+
+void
+sync_avg_add(sync_avg_t*  sa,
+             uint64_t     frame,
+             float const* in,
+             size_t       n)
+{
+  if (!sa->have_strike) return;
+
+  /* overlap of the input with the strike's window */
+  uint64_t begin = MAX(frame, sa->strike);
+  uint64_t end   = MIN(frame + n, sa->strike + sa->window);
+  if (begin >= end) return;
+
+  size_t       len   = end - begin;
+  float const* src   = in + (begin - frame);
+  float*       sum   = sa->sum + (begin - sa->strike);
+  uint32_t*    count = sa->count + (begin - sa->strike);
+
+  /* neither side is aligned to anything in particular */
+  __m256i one = _mm256_set1_epi32(1);
+  size_t  i   = 0;
+  for (; i + LANES <= len; i += LANES) {
+    __m256  s = _mm256_add_ps(_mm256_loadu_ps(sum + i), _mm256_loadu_ps(src + i));
+    __m256i c = _mm256_add_epi32(_mm256_loadu_si256((__m256i const*)(count + i)), one);
+    _mm256_storeu_ps(sum + i, s);
+    _mm256_storeu_si256((__m256i*)(count + i), c);
+  }
+
+  for (; i < len; ++i) {
+    sum[i]   += src[i];
+    count[i] += 1;
+  }
+}
+
+void
+sync_avg_mean(sync_avg_t const* sa,
+              size_t            offset,
+              size_t            n,
+              float*            out)
+{
+  for (size_t i = offset; i < MIN(offset + n, sa->window); ++i) {
+    uint32_t c    = sa->count[i];
+    out[i-offset] = c ? sa->sum[i]/(float)c : 0.0f;
+  }
+}
+
+void
+sync_avg_reset(sync_avg_t* sa)
+{
+  memset(sa->sum,   0, sa->window*sizeof(float));
+  memset(sa->count, 0, sa->window*sizeof(uint32_t));
+  sa->n_strikes    = 0;
+  sa->first_strike = 0;
+  sa->strike       = 0;
+  sa->have_strike  = false;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Strike-synchronous averager.
+
+   Accumulates the `window` frames of input following each strike into a fixed
+   length buffer. Anything locked to the strike (the LXD's response) adds up
+   coherently, everything else averages away, and memory stays O(window) no
+   matter how many strikes go in.
+
+   Every bin keeps its own count, so strikes that are cut short (the next strike
+   came early, or some input went missing) still average correctly. */
+
+typedef struct sync_avg sync_avg_t;
+
+size_t
+sync_avg_footprint(size_t window);
+
+size_t
+sync_avg_align(void);
+
+sync_avg_t*
+create_sync_avg(void*  mem,
+                size_t window,
+                int*   opt_err);
+
+void*
+destroy_sync_avg(sync_avg_t* sa);
+
+size_t
+sync_avg_window(sync_avg_t const* sa);
+
+/* Number of strikes accumulated since the last reset, and the frame of the
+   first one */
+
+size_t
+sync_avg_n_strikes(sync_avg_t const* sa);
+
+uint64_t
+sync_avg_first_strike(sync_avg_t const* sa);
+
+/* Samples at or after `frame` are now aligned to this strike */
+
+void
+sync_avg_strike(sync_avg_t* sa,
+                uint64_t    frame);
+
+/* Add `n` samples, the first of which is at `frame`. Anything outside of the
+   current strike's window is ignored. */
+
+void
+sync_avg_add(sync_avg_t*  sa,
+             uint64_t     frame,
+             float const* in,
+             size_t       n);
+
+/* Write the average of bins [offset, offset+n) into `out`. Bins nothing has
+   landed in yet read as zero. */
+
+void
+sync_avg_mean(sync_avg_t const* sa,
+              size_t            offset,
+              size_t            n,
+              float*            out);
+
+/* Drop everything accumulated so far, including the current strike */
+
+void
+sync_avg_reset(sync_avg_t* sa);
@@ -0,0 +1,144 @@
+#include "common.h"
+#include "err.h"
+#include "thread_setup.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#define MXCSR_FTZ 0x8000u
+#define MXCSR_DAZ 0x0040u
+#endif
+
+/* First cpu listed in isolcpus, or -1. The file holds a list like "2-3,6" */
+
+static int
+first_isolated_cpu(void)
+{
+  FILE* f = fopen("/sys/devices/system/cpu/isolated", "r");
+  if (!f) return -1;
+
+  int cpu = -1;
+  if (1 != fscanf(f, "%d", &cpu)) cpu = -1;
+  fclose(f);
+  return cpu;
+}
+
+static pid_t
+tid(void)
+{
+  return (pid_t)syscall(SYS_gettid);
+}
+
+void
+thread_setup_denormals(void)
+{
+#if defined(__SSE__)
+  _mm_setcsr(_mm_getcsr() | MXCSR_FTZ | MXCSR_DAZ);
+#endif
+}
+
+int
+thread_setup_pin(int cpu)
+{
+  if (cpu == THREAD_CPU_ISOLATED) cpu = first_isolated_cpu();
+  if (cpu < 0)                    return APP_SUCCESS;
+  if (cpu >= CPU_SETSIZE)         return APP_ERR_INVAL;
+
+  cpu_set_t set[1];
+  CPU_ZERO(set);
+  CPU_SET(cpu, set);
+
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), set);
+  if (0 != ret) {
+    fprintf(stderr, "couldn't pin thread to cpu %d with '%s'\n", cpu, strerror(ret));
+    return APP_ERR_INVAL;
+  }
+
+  return APP_SUCCESS;
+}
+
+int
+thread_setup_nice(int nice)
+{
+  if (0 != setpriority(PRIO_PROCESS, (id_t)tid(), nice)) {
+    fprintf(stderr, "couldn't set nice %d with '%s'\n", nice, strerror(errno));
+    return APP_ERR_INVAL;
+  }
+
+  return APP_SUCCESS;
+}
+
+/* "0-2,5" style list of the cpus in `set` */
+
+static void
+format_cpus(cpu_set_t const* set,
+            char*            buf,
+            size_t           len)
+{
+  size_t used = 0;
+  buf[0]      = '\0';
+
+  for (int cpu = 0; cpu < CPU_SETSIZE && used < len; ++cpu) {
+    if (!CPU_ISSET(cpu, set)) continue;
+
+    int last = cpu;
+    while (last+1 < CPU_SETSIZE && CPU_ISSET(last+1, set)) last += 1;
+
+    int n = last == cpu ? snprintf(buf+used, len-used, "%s%d",    used ? "," : "", cpu)
+                        : snprintf(buf+used, len-used, "%s%d-%d", used ? "," : "", cpu, last);
+    if (n < 0) break;
+    used += (size_t)n;
+    cpu   = last;
+  }
+}
+
+void
+thread_setup_report(char const* name)
+{
+  char label[64];
+  char cpus[256] = "unknown";
+
+  cpu_set_t set[1];
+  CPU_ZERO(set);
+  if (0 == pthread_getaffinity_np(pthread_self(), sizeof(set), set)) {
+    format_cpus(set, cpus, sizeof(cpus));
+  }
+
+  int                policy = 0;
+  struct sched_param param[1];
+  memset(param, 0, sizeof(*param));
+  pthread_getschedparam(pthread_self(), &policy, param);
+
+  char const* policy_name = policy == SCHED_FIFO  ? "SCHED_FIFO"
+                          : policy == SCHED_RR    ? "SCHED_RR"
+                          : policy == SCHED_OTHER ? "SCHED_OTHER"
+                          : "other";
+
+  errno    = 0;
+  int nice = getpriority(PRIO_PROCESS, (id_t)tid());
+
+  bool ftz = false, daz = false;
+#if defined(__SSE__)
+  ftz = _mm_getcsr() & MXCSR_FTZ;
+  daz = _mm_getcsr() & MXCSR_DAZ;
+#endif
+
+  snprintf(label, sizeof(label), "%s cpus", name);
+  printf("%-30s %s\n", label, cpus);
+
+  snprintf(label, sizeof(label), "%s scheduling", name);
+  printf("%-30s %s priority %d nice %d\n", label, policy_name, param->sched_priority,
+         errno ? 0 : nice);
+
+  snprintf(label, sizeof(label), "%s denormals", name);
+  printf("%-30s ftz %s daz %s\n", label, ftz ? "on" : "off", daz ? "on" : "off");
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+/* Per thread setup for the realtime and background threads. Everything here
+   acts on the calling thread, and is meant to be called once as the thread
+   starts. None of it is realtime safe. */
+
+/* Values for the cpu passed to thread_setup_pin, see RT_CPU and friends in
+   common.h */
+
+#define THREAD_CPU_ANY      (-1) /* leave the affinity alone */
+#define THREAD_CPU_ISOLATED (-2) /* first cpu in isolcpus, or leave alone if there is none */
+
+/* Flush denormal results to zero and treat denormal inputs as zero (FTZ and
+   DAZ in MXCSR). Nothing happens off x86. */
+
+void
+thread_setup_denormals(void);
+
+/* Pin to a single cpu, or one of THREAD_CPU_*. Returns APP_ERR_INVAL if the
+   cpu doesn't exist or we aren't allowed on it. */
+
+int
+thread_setup_pin(int cpu);
+
+/* Set the nice level. Linux nice levels are per thread. Raising priority
+   (negative nice) needs CAP_SYS_NICE or a suitable RLIMIT_NICE. */
+
+int
+thread_setup_nice(int nice);
+
+/* Print the cpus, scheduling policy, priority, nice level and denormal mode
+   the thread actually ended up with */
+
+void
+thread_setup_report(char const* name);
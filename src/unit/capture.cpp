@@ -0,0 +1,467 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+extern "C" {
+#include "../additive_square.h"
+#include "../capture_reader.h"
+#include "../capture_writer.h"
+#include "../common.h"
+#include "../disk.h"
+#include "../disk_writer.h"
+#include "../envelope.h"
+#include "../err.h"
+}
+
+namespace {
+constexpr size_t SET_FRAMES = 256;
+constexpr size_t FFT_BINS   = 9;
+
+capture_meta_t
+test_meta()
+{
+  capture_meta_t meta;
+  memset(&meta, 0, sizeof(meta));
+  meta.sample_rate_hz = 48000;
+  meta.fft_size       = 16;
+  meta.n_channels     = 3;
+  strcpy(meta.channels[0], "square_out");
+  strcpy(meta.channels[1], "pulse_out");
+  strcpy(meta.channels[2], "lxd_in");
+  return meta;
+}
+
+/* with generators capture_synth can run */
+capture_meta_t
+synth_meta()
+{
+  envelope_setting_t setting;
+  REQUIRE(populate_envelope_setting(ENVELOPE_EXPONENTIAL, 5000000, 48000, &setting) == APP_SUCCESS);
+
+  capture_meta_t meta     = test_meta();
+  meta.drive_frequency_hz = 440.0f;
+  meta.envelope_type      = ENVELOPE_EXPONENTIAL;
+  meta.envelope_param     = setting.u.exponential->lambda;
+  return meta;
+}
+
+/* sample value for a channel and frame, so reads can be checked anywhere */
+float
+value(size_t   channel,
+      uint64_t frame)
+{
+  return (float)channel*1e6f + (float)frame;
+}
+
+struct capture {
+  capture(capture_meta_t meta = test_meta())
+    : path("capture_test.lxd")
+  {
+    wmem = aligned_alloc(disk_writer_align(), disk_writer_footprint());
+    cmem = aligned_alloc(capture_writer_align(), capture_writer_footprint());
+    REQUIRE(wmem);
+    REQUIRE(cmem);
+
+    int err = 0;
+    w = create_disk_writer(wmem, path.c_str(), DISK_WRITER_WRITE, false, &err);
+    REQUIRE(w);
+
+    c = create_capture_writer(cmem, w, &meta, &err);
+    REQUIRE(c);
+    REQUIRE(err == APP_SUCCESS);
+
+    set.resize(sample_set_footprint(SET_FRAMES, FFT_BINS));
+  }
+
+  ~capture()
+  {
+    free(destroy_capture_writer(c));
+    free(destroy_disk_writer(w));
+    unlink(path.c_str());
+  }
+
+  void add_set(uint64_t frame, size_t n_fft_bins = 0)
+  {
+    sample_set_t* sset = create_sample_set(set.data(), frame, SET_FRAMES, n_fft_bins, NULL);
+    REQUIRE(sset);
+    for (size_t i = 0; i < SET_FRAMES; ++i) {
+      sample_set_square_samples(sset)[i] = value(0, frame + i);
+      sample_set_pulse_samples(sset)[i]  = value(1, frame + i);
+      sample_set_lxd_in_samples(sset)[i] = value(2, frame + i);
+    }
+    for (size_t i = 0; i < n_fft_bins; ++i) sample_set_fft_bins(sset)[i] = (float)i;
+
+    REQUIRE(capture_writer_add(c, &sset->hdr) == APP_SUCCESS);
+    REQUIRE(capture_writer_commit(c) == APP_SUCCESS);
+  }
+
+  void finish()
+  {
+    REQUIRE(capture_writer_end_segment(c) == APP_SUCCESS);
+    REQUIRE(disk_writer_finish(w) == APP_SUCCESS);
+  }
+
+  std::string       path;
+  void*             wmem;
+  void*             cmem;
+  disk_writer_t*    w;
+  capture_writer_t* c;
+  std::vector<char> set;
+};
+
+/* flip the bits of `mask` in `n` bytes of the file from `offset` on */
+void
+damage(std::string const& path,
+       uint64_t           offset,
+       size_t             n,
+       uint8_t            mask = 0x5a)
+{
+  int fd = open(path.c_str(), O_RDWR);
+  REQUIRE(fd != -1);
+  std::vector<uint8_t> bytes(n);
+  REQUIRE(pread(fd, bytes.data(), n, (off_t)offset) == (ssize_t)n);
+  for (auto& b : bytes) b ^= mask;
+  REQUIRE(pwrite(fd, bytes.data(), n, (off_t)offset) == (ssize_t)n);
+  close(fd);
+}
+
+struct reader {
+  reader(char const* path)
+  {
+    mem = aligned_alloc(capture_reader_align(), capture_reader_footprint());
+    REQUIRE(mem);
+    r = create_capture_reader(mem, path, &err);
+  }
+
+  ~reader()
+  {
+    if (r) destroy_capture_reader(r);
+    free(mem);
+  }
+
+  void*             mem;
+  int               err = 0;
+  capture_reader_t* r;
+};
+
+} // anon namespace
+
+TEST_CASE("sample sets come back as columns, in chunks", "[capture]")
+{
+  capture cap;
+
+  /* two and a half chunks, with an fft and something else along the way */
+  size_t   n_sets = (5*CAPTURE_CHUNK_FRAMES/2)/SET_FRAMES;
+  uint64_t end    = n_sets*SET_FRAMES;
+  for (size_t i = 0; i < n_sets; ++i) {
+    if (i == 3) {
+      xrun_t x[1];
+      create_xrun(x, i*SET_FRAMES);
+      REQUIRE(capture_writer_add(cap.c, &x->hdr) == APP_SUCCESS);
+    }
+    cap.add_set(i*SET_FRAMES, i == 5 ? FFT_BINS : 0);
+  }
+  cap.finish();
+
+  reader rd(cap.path.c_str());
+  REQUIRE(rd.r);
+
+  file_hdr_t const* hdr = capture_reader_hdr(rd.r);
+  REQUIRE(hdr->version == FILE_VERSION);
+  REQUIRE(hdr->length != FILE_LENGTH_UNKNOWN);
+
+  capture_meta_t const* meta = capture_reader_meta(rd.r);
+  REQUIRE(meta->sample_rate_hz == 48000);
+  REQUIRE(meta->chunk_frames == CAPTURE_CHUNK_FRAMES);
+  REQUIRE(std::string(meta->channels[2]) == "lxd_in");
+
+  /* anything but raw floats has column_hdrs */
+  bool hdrs = CAPTURE_PACK || CAPTURE_SYNTH || CAPTURE_SQUARE_BITS < 32 || CAPTURE_PULSE_BITS < 32
+              || CAPTURE_LXD_IN_BITS < 32;
+
+  REQUIRE(capture_reader_n_chunks(rd.r) == 3);
+  for (size_t i = 0; i < 3; ++i) {
+    chunk_t const* chunk = capture_reader_chunk(rd.r, i);
+    REQUIRE(chunk->hdr.frame == i*CAPTURE_CHUNK_FRAMES);
+    REQUIRE(chunk->layout == (hdrs ? CHUNK_PACKED : CHUNK_RAW));
+    REQUIRE(chunk->sync == CHUNK_SYNC);
+    REQUIRE(chunk->sequence == i);
+    REQUIRE(capture_reader_verify(rd.r, i) == APP_SUCCESS);
+    REQUIRE((uintptr_t)((char const*)chunk + chunk->data_offset) % CHUNK_COLUMN_ALIGN == 0);
+
+    /* whole numbers this size stay exact in int24 */
+    column_hdr_t const* cols = (column_hdr_t const*)((char const*)chunk + chunk->data_offset);
+    if (CAPTURE_LXD_IN_BITS == 24) REQUIRE(cols[2].encoding == COLUMN_INT24);
+
+    /* a ramp packs well */
+    if (CAPTURE_PACK) REQUIRE(chunk->hdr.size < 3*chunk->n_frames*sizeof(float));
+  }
+
+  /* lxd_in stored as ints is a step of its chunk's scale off at most, but
+     whole numbers this size come through int24 unchanged unless dithered */
+  float tol = CAPTURE_LXD_IN_BITS == 32 || (CAPTURE_LXD_IN_BITS == 24 && !CAPTURE_DITHER)
+              ? 0.0f : 8e6f/(float)(1u << (CAPTURE_LXD_IN_BITS - 1));
+
+  std::vector<float> column(CAPTURE_CHUNK_FRAMES);
+  REQUIRE(capture_reader_column(rd.r, 1, 2, column.data()) == APP_SUCCESS);
+  for (size_t i = 0; i < column.size(); ++i) {
+    REQUIRE(std::fabs(column[i] - value(2, CAPTURE_CHUNK_FRAMES + i)) <= tol);
+  }
+  REQUIRE(capture_reader_column(rd.r, 1, 3, column.data()) == APP_ERR_INVAL);
+
+  REQUIRE(capture_reader_find(rd.r, 0) == 0);
+  REQUIRE(capture_reader_find(rd.r, CAPTURE_CHUNK_FRAMES) == 1);
+  REQUIRE(capture_reader_find(rd.r, end - 1) == 2);
+  REQUIRE(capture_reader_find(rd.r, end) == 3);
+
+  /* a read across a chunk boundary, and one running off the end */
+  std::vector<float> out(1000);
+  uint64_t from = CAPTURE_CHUNK_FRAMES - 10;
+  REQUIRE(capture_reader_read(rd.r, 1, from, out.data(), out.size()) == out.size());
+  for (size_t i = 0; i < out.size(); ++i) REQUIRE(out[i] == value(1, from + i));
+
+  REQUIRE(capture_reader_read(rd.r, 2, end - 5, out.data(), out.size()) == 5);
+  REQUIRE(std::fabs(out[4] - value(2, end - 1)) <= tol);
+}
+
+TEST_CASE("generated channels are made again bit exact", "[capture]")
+{
+  capture_meta_t meta = synth_meta();
+  capture        cap(meta);
+
+  std::vector<char> sq_mem(additive_square_footprint());
+  std::vector<char> env_mem(envelope_footprint());
+  envelope_setting_t setting;
+  setting.type                  = ENVELOPE_EXPONENTIAL;
+  setting.u.exponential->lambda  = meta.envelope_param;
+  additive_square_t* sq  = create_additive_square(sq_mem.data(), meta.sample_rate_hz, NULL);
+  envelope_t*        env = create_envelope(env_mem.data(), &setting, NULL);
+
+  /* the way app_poll runs them, struck every 1000 frames. The strike in the
+     second chunk never makes it to the writer. */
+  size_t   n_sets = 2*CAPTURE_CHUNK_FRAMES/SET_FRAMES;
+  uint64_t lost   = 20000;
+  std::vector<float> square(n_sets*SET_FRAMES);
+  std::vector<float> pulse(n_sets*SET_FRAMES);
+
+  for (size_t i = 0; i < n_sets; ++i) {
+    uint64_t      frame = i*SET_FRAMES;
+    sample_set_t* sset  = create_sample_set(cap.set.data(), frame, SET_FRAMES, 0, NULL);
+    sset->square_phase      = additive_square_phase(sq);
+    sset->envelope_position = envelope_position(env);
+
+    additive_square_generate_samples(sq, SET_FRAMES, meta.drive_frequency_hz, square.data() + frame);
+
+    size_t generated = 0;
+    for (uint64_t f = frame; f < frame + SET_FRAMES; ++f) {
+      if (f % 1000) continue;
+      envelope_generate_samples(env, f - frame - generated, pulse.data() + frame + generated);
+      envelope_strike(env);
+      generated = f - frame;
+
+      strike_t s[1];
+      create_strike(s, f);
+      if (f != lost) REQUIRE(capture_writer_add(cap.c, &s->hdr) == APP_SUCCESS);
+    }
+    envelope_generate_samples(env, SET_FRAMES - generated, pulse.data() + frame + generated);
+
+    memcpy(sample_set_square_samples(sset), square.data() + frame, SET_FRAMES*sizeof(float));
+    memcpy(sample_set_pulse_samples(sset),  pulse.data() + frame,  SET_FRAMES*sizeof(float));
+    for (size_t k = 0; k < SET_FRAMES; ++k) sample_set_lxd_in_samples(sset)[k] = value(2, frame + k);
+
+    REQUIRE(capture_writer_add(cap.c, &sset->hdr) == APP_SUCCESS);
+    REQUIRE(capture_writer_commit(cap.c) == APP_SUCCESS);
+  }
+  cap.finish();
+
+  reader rd(cap.path.c_str());
+  REQUIRE(rd.r);
+  REQUIRE(capture_reader_n_chunks(rd.r) == 2);
+
+  if (CAPTURE_SYNTH) {
+    chunk_t const*      first  = capture_reader_chunk(rd.r, 0);
+    chunk_t const*      second = capture_reader_chunk(rd.r, 1);
+    column_hdr_t const* a = (column_hdr_t const*)((char const*)first + first->data_offset);
+    column_hdr_t const* b = (column_hdr_t const*)((char const*)second + second->data_offset);
+
+    REQUIRE(a[0].encoding == COLUMN_SYNTH);
+    REQUIRE(a[1].encoding == COLUMN_SYNTH);
+    REQUIRE(a[2].encoding != COLUMN_SYNTH);
+    REQUIRE(b[0].encoding == COLUMN_SYNTH);
+    REQUIRE(b[1].encoding != COLUMN_SYNTH); /* stored, it wouldn't come out the same */
+  }
+
+  std::vector<float> out(square.size());
+  REQUIRE(capture_reader_read(rd.r, 0, 0, out.data(), out.size()) == out.size());
+  REQUIRE(0 == memcmp(out.data(), square.data(), out.size()*sizeof(float)));
+  REQUIRE(capture_reader_read(rd.r, 1, 0, out.data(), out.size()) == out.size());
+  REQUIRE(0 == memcmp(out.data(), pulse.data(), out.size()*sizeof(float)));
+
+  /* and from the middle of a chunk */
+  REQUIRE(capture_reader_read(rd.r, 1, 1234, out.data(), 100) == 100);
+  REQUIRE(0 == memcmp(out.data(), pulse.data() + 1234, 100*sizeof(float)));
+}
+
+TEST_CASE("a jump in frames ends the chunk", "[capture]")
+{
+  capture cap;
+
+  cap.add_set(0);
+  cap.add_set(SET_FRAMES);
+  cap.add_set(10*SET_FRAMES);
+  cap.finish();
+
+  reader rd(cap.path.c_str());
+  REQUIRE(rd.r);
+  REQUIRE(capture_reader_n_chunks(rd.r) == 2);
+  REQUIRE(capture_reader_chunk(rd.r, 0)->n_frames == 2*SET_FRAMES);
+  REQUIRE(capture_reader_chunk(rd.r, 1)->hdr.frame == 10*SET_FRAMES);
+
+  REQUIRE(capture_reader_find(rd.r, 2*SET_FRAMES) == 2);
+  REQUIRE(capture_reader_find(rd.r, 10*SET_FRAMES + 1) == 1);
+
+  std::vector<float> out(4*SET_FRAMES);
+  REQUIRE(capture_reader_read(rd.r, 0, SET_FRAMES, out.data(), out.size()) == SET_FRAMES);
+  REQUIRE(capture_reader_read(rd.r, 0, 3*SET_FRAMES, out.data(), out.size()) == 0);
+}
+
+TEST_CASE("a segment without an index is walked for its chunks", "[capture]")
+{
+  capture cap;
+
+  /* two chunks written, the third still filling when it stops */
+  size_t n_sets = (5*CAPTURE_CHUNK_FRAMES/2)/SET_FRAMES;
+  for (size_t i = 0; i < n_sets; ++i) cap.add_set(i*SET_FRAMES, i % 7 == 0 ? FFT_BINS : 0);
+  REQUIRE(disk_writer_finish(cap.w) == APP_SUCCESS);
+
+  reader rd(cap.path.c_str());
+  REQUIRE(rd.r);
+  REQUIRE(capture_reader_scanned(rd.r));
+  REQUIRE(capture_reader_n_chunks(rd.r) == 2);
+  REQUIRE(capture_reader_n_lost(rd.r) == 0);
+  REQUIRE(capture_reader_chunk(rd.r, 1)->hdr.frame == CAPTURE_CHUNK_FRAMES);
+
+  std::vector<float> out(2*CAPTURE_CHUNK_FRAMES + 10);
+  REQUIRE(capture_reader_read(rd.r, 1, 0, out.data(), out.size()) == 2*CAPTURE_CHUNK_FRAMES);
+  REQUIRE(out[CAPTURE_CHUNK_FRAMES + 3] == value(1, CAPTURE_CHUNK_FRAMES + 3));
+}
+
+TEST_CASE("a chunk that fails its crc is read around", "[capture]")
+{
+  capture cap;
+
+  size_t n_sets = 3*CAPTURE_CHUNK_FRAMES/SET_FRAMES;
+  for (size_t i = 0; i < n_sets; ++i) cap.add_set(i*SET_FRAMES);
+  cap.finish();
+
+  uint64_t at;
+  {
+    reader rd(cap.path.c_str());
+    REQUIRE(rd.r);
+    chunk_t const* c = capture_reader_chunk(rd.r, 1);
+    at = (uint64_t)((char const*)c - (char const*)capture_reader_hdr(rd.r)) + c->hdr.size - 1;
+  }
+  damage(cap.path, at, 1);
+
+  reader rd(cap.path.c_str());
+  REQUIRE(rd.r);
+  REQUIRE(!capture_reader_scanned(rd.r));
+  REQUIRE(capture_reader_n_chunks(rd.r) == 3);
+  REQUIRE(capture_reader_verify(rd.r, 0) == APP_SUCCESS);
+  REQUIRE(capture_reader_verify(rd.r, 1) == APP_ERR_CORRUPT);
+
+  std::vector<float> column(CAPTURE_CHUNK_FRAMES);
+  REQUIRE(capture_reader_column(rd.r, 1, 2, column.data()) == APP_ERR_CORRUPT);
+
+  /* reads stop at it, and pick up again after */
+  std::vector<float> out(3*CAPTURE_CHUNK_FRAMES);
+  REQUIRE(capture_reader_read(rd.r, 0, 10, out.data(), out.size()) == CAPTURE_CHUNK_FRAMES - 10);
+  REQUIRE(capture_reader_read(rd.r, 0, CAPTURE_CHUNK_FRAMES + 5, out.data(), 10) == 0);
+  REQUIRE(capture_reader_read(rd.r, 0, 2*CAPTURE_CHUNK_FRAMES, out.data(), out.size())
+          == CAPTURE_CHUNK_FRAMES);
+  REQUIRE(out[7] == value(0, 2*CAPTURE_CHUNK_FRAMES + 7));
+}
+
+TEST_CASE("damaged records are stepped over to the next good chunk", "[capture]")
+{
+  capture cap;
+
+  /* four chunks with other records in between */
+  size_t n_sets = 4*CAPTURE_CHUNK_FRAMES/SET_FRAMES;
+  for (size_t i = 0; i < n_sets; ++i) cap.add_set(i*SET_FRAMES, i % 5 == 0 ? FFT_BINS : 0);
+  cap.finish();
+
+  std::vector<uint64_t> offsets;
+  uint64_t              index;
+  {
+    reader rd(cap.path.c_str());
+    REQUIRE(rd.r);
+    REQUIRE(capture_reader_n_chunks(rd.r) == 4);
+    for (size_t i = 0; i < 4; ++i) {
+      char const* c = (char const*)capture_reader_chunk(rd.r, i);
+      offsets.push_back((uint64_t)(c - (char const*)capture_reader_hdr(rd.r)));
+    }
+    index = capture_reader_hdr(rd.r)->index;
+  }
+
+  SECTION("a damaged index means walking the records") {
+    damage(cap.path, index + sizeof(chunk_index_t) + offsetof(index_entry_t, offset), 8);
+
+    reader rd(cap.path.c_str());
+    REQUIRE(rd.r);
+    REQUIRE(capture_reader_scanned(rd.r));
+    REQUIRE(capture_reader_n_chunks(rd.r) == 4);
+    REQUIRE(capture_reader_n_lost(rd.r) == 0);
+  }
+
+  SECTION("a chunk whose size is wrong is lost, the ones after it aren't") {
+    damage(cap.path, offsets[1] + offsetof(record_hdr_t, size), 4, 0x70);
+    damage(cap.path, index, 4); /* and no index to go by */
+
+    reader rd(cap.path.c_str());
+    REQUIRE(rd.r);
+    REQUIRE(capture_reader_n_chunks(rd.r) == 3);
+    REQUIRE(capture_reader_n_lost(rd.r) == 1);
+    REQUIRE(capture_reader_chunk(rd.r, 1)->hdr.frame == 2*CAPTURE_CHUNK_FRAMES);
+    REQUIRE(capture_reader_chunk(rd.r, 1)->sequence == 2);
+
+    std::vector<float> out(2*CAPTURE_CHUNK_FRAMES);
+    uint64_t from = 2*CAPTURE_CHUNK_FRAMES;
+    REQUIRE(capture_reader_read(rd.r, 2, from, out.data(), out.size()) == out.size());
+  }
+
+  SECTION("garbage over the records before a chunk costs only those") {
+    /* the fft bins record and sample data ahead of chunk 2 */
+    damage(cap.path, offsets[1] + 200, offsets[2] - offsets[1] - 200, 0xff);
+    damage(cap.path, index, 4);
+
+    reader rd(cap.path.c_str());
+    REQUIRE(rd.r);
+    REQUIRE(capture_reader_n_chunks(rd.r) == 3);
+    REQUIRE(capture_reader_n_lost(rd.r) == 1);
+    REQUIRE(capture_reader_chunk(rd.r, 2)->hdr.frame == 3*CAPTURE_CHUNK_FRAMES);
+  }
+}
+
+TEST_CASE("channels have to be the sample set's", "[capture]")
+{
+  capture cap;
+
+  void* mem = aligned_alloc(capture_writer_align(), capture_writer_footprint());
+  REQUIRE(mem);
+
+  capture_meta_t meta = test_meta();
+  strcpy(meta.channels[1], "pulse_in");
+
+  int err = 0;
+  REQUIRE(!create_capture_writer(mem, cap.w, &meta, &err));
+  REQUIRE(err == APP_ERR_INVAL);
+  free(mem);
+}
@@ -0,0 +1,104 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include "../column_codec.h"
+#include "../err.h"
+}
+
+namespace {
+
+/* encode, decode, and compare bit for bit. Returns the encoded size. */
+size_t
+round_trip(std::vector<float> const& in)
+{
+  std::vector<uint8_t> packed(column_codec_bound(in.size()));
+  size_t bytes = column_codec_encode(in.data(), in.size(), packed.data());
+  REQUIRE(bytes <= packed.size());
+
+  std::vector<float> out(in.size() + 1, 12345.0f);
+  REQUIRE(column_codec_decode(packed.data(), bytes, in.size(), out.data()) == APP_SUCCESS);
+  REQUIRE(0 == memcmp(in.data(), out.data(), in.size()*sizeof(float)));
+  REQUIRE(out[in.size()] == 12345.0f); /* nothing past the end */
+  return bytes;
+}
+
+} // anon namespace
+
+TEST_CASE("columns come back bit exact", "[column_codec]")
+{
+  std::mt19937                          gen(7);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+  /* lengths on and off the 32 sample group */
+  for (size_t n : { 0ul, 1ul, 31ul, 32ul, 33ul, 1000ul, 16384ul }) {
+    std::vector<float> in(n);
+    for (auto& x : in) x = dist(gen);
+    round_trip(in);
+  }
+
+  /* bit patterns arithmetic wouldn't keep */
+  std::vector<float> odd = { -0.0f, 0.0f, std::numeric_limits<float>::infinity(),
+                             -std::numeric_limits<float>::infinity(),
+                             std::numeric_limits<float>::quiet_NaN(),
+                             std::numeric_limits<float>::denorm_min(),
+                             std::numeric_limits<float>::max() };
+  uint32_t payload_nan = 0x7fc01234u;
+  float    f;
+  memcpy(&f, &payload_nan, sizeof(f));
+  odd.push_back(f);
+  round_trip(odd);
+}
+
+TEST_CASE("smooth and silent columns pack small", "[column_codec]")
+{
+  size_t n = 16384;
+
+  std::vector<float> silence(n, 0.0f);
+  REQUIRE(round_trip(silence) == n/32*4);
+
+  /* only the first group has anything to say */
+  std::vector<float> held(n, 0.25f);
+  REQUIRE(round_trip(held) <= n/32*4 + 4*32);
+
+  /* full float mantissas barely shrink, whatever resolution the source had
+     shows up as zero low planes */
+  std::vector<float> sine(n);
+  std::vector<float> sine16(n);
+  for (size_t i = 0; i < n; ++i) {
+    sine[i]   = 0.5f*std::sin(2.0f*float(M_PI)*440.0f*float(i)/48000.0f);
+    sine16[i] = std::round(sine[i]*32768.0f)/32768.0f;
+  }
+  REQUIRE(round_trip(sine) < n*sizeof(float));
+  REQUIRE(round_trip(sine16) < n*sizeof(float)*3/4);
+
+  /* noise doesn't, but only grows by the per plane byte */
+  std::mt19937                          gen(1);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  std::vector<float>                    noise(n);
+  for (auto& x : noise) x = dist(gen);
+  REQUIRE(round_trip(noise) <= column_codec_bound(n));
+}
+
+TEST_CASE("truncated or padded input is rejected", "[column_codec]")
+{
+  std::vector<float> in(100, 1.0f);
+  in[50] = -3.0f;
+
+  std::vector<uint8_t> packed(column_codec_bound(in.size()) + 1);
+  size_t bytes = column_codec_encode(in.data(), in.size(), packed.data());
+
+  std::vector<float> out(in.size() + 32);
+  REQUIRE(column_codec_decode(packed.data(), bytes - 1, in.size(), out.data()) == APP_ERR_INVAL);
+  REQUIRE(column_codec_decode(packed.data(), bytes + 1, in.size(), out.data()) == APP_ERR_INVAL);
+  REQUIRE(column_codec_decode(packed.data(), bytes, in.size() + 32, out.data()) == APP_ERR_INVAL);
+
+  packed[0] = 9; /* no such width */
+  REQUIRE(column_codec_decode(packed.data(), bytes, in.size(), out.data()) == APP_ERR_INVAL);
+}
@@ -0,0 +1,129 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include "../column_quant.h"
+#include "../disk.h"
+#include "../err.h"
+}
+
+namespace {
+
+/* encode and decode, checking the size on the way. Returns the scale. */
+float
+round_trip(std::vector<float> const& in,
+           unsigned                  bits,
+           std::vector<float>&       out,
+           column_quant_rng_t*       rng = NULL)
+{
+  std::vector<uint8_t> packed(column_quant_bound(in.size(), bits));
+  size_t bytes = column_quant_encode(in.data(), in.size(), bits, rng, packed.data());
+  REQUIRE(bytes == packed.size());
+
+  out.assign(in.size() + 1, 12345.0f);
+  REQUIRE(column_quant_decode(packed.data(), bytes, in.size(), bits, out.data()) == APP_SUCCESS);
+  REQUIRE(out[in.size()] == 12345.0f); /* nothing past the end */
+  out.pop_back();
+
+  quant_hdr_t hdr;
+  memcpy(&hdr, packed.data(), sizeof(hdr));
+  return hdr.scale;
+}
+
+} // anon namespace
+
+TEST_CASE("a 24 bit source comes back exactly from int24", "[column_quant]")
+{
+  std::mt19937                       gen(3);
+  std::uniform_int_distribution<int> dist(-(1 << 22), (1 << 22) - 1);
+
+  /* lengths on and off the 8 sample step, peak under half scale */
+  for (size_t n : { 1ul, 7ul, 8ul, 9ul, 1000ul, 16384ul }) {
+    std::vector<float> in(n);
+    for (auto& x : in) x = (float)dist(gen)/(float)(1 << 23);
+
+    std::vector<float> out;
+    REQUIRE(round_trip(in, 24, out) <= 1.0f/(float)(1 << 23));
+    REQUIRE(0 == memcmp(in.data(), out.data(), n*sizeof(float)));
+  }
+}
+
+TEST_CASE("rounding is within half a step", "[column_quant]")
+{
+  std::mt19937                          gen(5);
+  std::uniform_real_distribution<float> dist(-3.0f, 3.0f);
+
+  std::vector<float> in(4099);
+  for (auto& x : in) x = dist(gen);
+  in[17] = 3.0f; /* the peak maps to the top */
+
+  for (unsigned bits : { 16u, 24u }) {
+    std::vector<float> out;
+    float scale = round_trip(in, bits, out);
+
+    /* the smallest power of two that fits */
+    float limit = (float)((1u << (bits - 1)) - 1);
+    REQUIRE(std::log2(scale) == std::floor(std::log2(scale)));
+    REQUIRE(3.0f <= scale*limit);
+    REQUIRE(3.0f > scale*limit/2);
+
+    for (size_t i = 0; i < in.size(); ++i) REQUIRE(std::fabs(out[i] - in[i]) <= scale/2);
+  }
+
+  /* silence has nothing to scale */
+  std::vector<float> silence(100, 0.0f);
+  std::vector<float> out;
+  round_trip(silence, 16, out);
+  for (float x : out) REQUIRE(x == 0.0f);
+}
+
+TEST_CASE("dither stays within a step and a half", "[column_quant]")
+{
+  column_quant_rng_t rng;
+  column_quant_rng_init(&rng, 1);
+
+  /* a level between two steps comes back as both, averaging out near it */
+  std::vector<float> in(8192, 0.3f);
+  in[0] = 1.0f;
+
+  std::vector<float> out;
+  float  scale = round_trip(in, 16, out, &rng);
+  double sum   = 0.0;
+  for (size_t i = 1; i < in.size(); ++i) {
+    REQUIRE(std::fabs(out[i] - in[i]) < 1.5f*scale);
+    sum += out[i];
+  }
+  REQUIRE(std::fabs(sum/(double)(in.size() - 1) - 0.3) < scale/4);
+
+  /* and the noise moves on from call to call */
+  std::vector<float> again;
+  round_trip(in, 16, again, &rng);
+  REQUIRE(0 != memcmp(out.data(), again.data(), out.size()*sizeof(float)));
+}
+
+TEST_CASE("columns that won't quantize are refused", "[column_quant]")
+{
+  std::vector<float>   in(20, 0.5f);
+  std::vector<uint8_t> packed(column_quant_bound(in.size(), 24));
+
+  REQUIRE(column_quant_encode(in.data(), in.size(), 12, NULL, packed.data()) == 0);
+
+  in[3] = std::numeric_limits<float>::infinity();
+  REQUIRE(column_quant_encode(in.data(), in.size(), 24, NULL, packed.data()) == 0);
+  in[3]  = 0.5f;
+  in[19] = std::numeric_limits<float>::quiet_NaN();
+  REQUIRE(column_quant_encode(in.data(), in.size(), 24, NULL, packed.data()) == 0);
+
+  /* and input of the wrong length */
+  in[19] = 0.5f;
+  size_t bytes = column_quant_encode(in.data(), in.size(), 24, NULL, packed.data());
+  std::vector<float> out(in.size());
+  REQUIRE(column_quant_decode(packed.data(), bytes - 1, in.size(), 24, out.data()) == APP_ERR_INVAL);
+  REQUIRE(column_quant_decode(packed.data(), bytes, in.size(), 16, out.data()) == APP_ERR_INVAL);
+}
@@ -0,0 +1,60 @@
+#include "catch.hpp"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include "../crc32c.h"
+}
+
+namespace {
+
+/* a bit at a time, straight from the polynomial */
+uint32_t
+slow_crc32c(uint32_t       crc,
+            uint8_t const* p,
+            size_t         n)
+{
+  crc = ~crc;
+  for (size_t i = 0; i < n; ++i) {
+    crc ^= p[i];
+    for (int k = 0; k < 8; ++k) crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78u : crc >> 1;
+  }
+  return ~crc;
+}
+
+} // anon namespace
+
+TEST_CASE("crc32c check value", "[crc32c]")
+{
+  REQUIRE(crc32c(0, "123456789", 9) == 0xe3069283u);
+  REQUIRE(crc32c(0, "", 0) == 0);
+}
+
+TEST_CASE("crc32c matches the polynomial at any length and alignment", "[crc32c]")
+{
+  std::mt19937         gen(11);
+  std::vector<uint8_t> buf(20000);
+  for (auto& b : buf) b = (uint8_t)gen();
+
+  /* short, around the three stream blocks, and several of them */
+  for (size_t n : { 0ul, 1ul, 7ul, 8ul, 9ul, 3071ul, 3072ul, 3073ul, 6150ul, 19990ul }) {
+    for (size_t offset = 0; offset < 8; ++offset) {
+      uint8_t const* p = buf.data() + offset;
+      REQUIRE(crc32c(0x1234u, p, n) == slow_crc32c(0x1234u, p, n));
+    }
+  }
+}
+
+TEST_CASE("crc32c carries on across pieces", "[crc32c]")
+{
+  std::vector<uint8_t> buf(10000);
+  for (size_t i = 0; i < buf.size(); ++i) buf[i] = (uint8_t)(i*7 + 3);
+
+  uint32_t whole = crc32c(0, buf.data(), buf.size());
+  for (size_t split : { 1ul, 100ul, 3072ul, 9999ul }) {
+    uint32_t crc = crc32c(0, buf.data(), split);
+    REQUIRE(crc32c(crc, buf.data() + split, buf.size() - split) == whole);
+  }
+}
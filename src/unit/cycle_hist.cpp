@@ -0,0 +1,103 @@
+#include "catch.hpp"
+#include "module.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+
+extern "C" {
+#include "../err.h"
+#include "../cycle_hist.h"
+}
+
+namespace {
+
+struct hist : module<cycle_hist_t, destroy_cycle_hist> {
+  hist() : module(cycle_hist_align(), cycle_hist_footprint(), create_cycle_hist, 2) {}
+};
+
+} // anon namespace
+
+TEST_CASE("too many stages are rejected", "[cycle_hist]")
+{
+  void* mem = aligned_alloc(cycle_hist_align(), cycle_hist_footprint());
+  REQUIRE(mem);
+
+  int err = 0;
+  REQUIRE(!create_cycle_hist(mem, CYCLE_HIST_MAX_STAGES + 1, &err));
+  REQUIRE(err == APP_ERR_INVAL);
+  free(mem);
+}
+
+TEST_CASE("timestamp counter is calibrated", "[cycle_hist]")
+{
+  hist h;
+  REQUIRE(cycle_hist_cycles_per_ns(h) > 0.1);
+  REQUIRE(cycle_hist_cycles_per_ns(h) < 10.0);
+
+  uint64_t before = cycle_hist_now();
+  uint64_t after  = cycle_hist_now();
+  REQUIRE(before <= after);
+}
+
+TEST_CASE("percentiles land within a bucket of the truth", "[cycle_hist]")
+{
+  hist h;
+
+  /* 1..10000, p50 is 5000 and p99 is 9900 */
+  for (uint64_t v = 1; v <= 10000; ++v) cycle_hist_add(h, 0, v);
+  cycle_hist_add(h, 1, 7);
+
+  cycle_hist_summary_t sum[1];
+  cycle_hist_summarize(h, 0, sum);
+
+  REQUIRE(sum->n == 10000);
+  REQUIRE(sum->max == 10000);
+  REQUIRE(sum->p50 >= 5000);
+  REQUIRE(sum->p50 <= 5000*1.25);
+  REQUIRE(sum->p99 >= 9900);
+  REQUIRE(sum->p99 <= 10000);
+
+  /* stages are independent */
+  cycle_hist_summarize(h, 1, sum);
+  REQUIRE(sum->n == 1);
+  REQUIRE(sum->p50 == 7);
+  REQUIRE(sum->p99 == 7);
+  REQUIRE(sum->max == 7);
+}
+
+TEST_CASE("each summary only covers what was added since the last", "[cycle_hist]")
+{
+  hist h;
+
+  for (size_t i = 0; i < 100; ++i) cycle_hist_add(h, 0, 1000000);
+
+  cycle_hist_summary_t sum[1];
+  cycle_hist_summarize(h, 0, sum);
+  REQUIRE(sum->n == 100);
+  REQUIRE(sum->max == 1000000);
+
+  cycle_hist_summarize(h, 0, sum);
+  REQUIRE(sum->n == 0);
+  REQUIRE(sum->max == 0);
+
+  for (size_t i = 0; i < 100; ++i) cycle_hist_add(h, 0, 3);
+  cycle_hist_summarize(h, 0, sum);
+  REQUIRE(sum->n == 100);
+  REQUIRE(sum->p99 == 3);
+  REQUIRE(sum->max == 3);
+}
+
+TEST_CASE("the whole 64 bit range has a bucket", "[cycle_hist]")
+{
+  hist h;
+
+  cycle_hist_add(h, 0, 0);
+  cycle_hist_add(h, 0, UINT64_MAX);
+
+  cycle_hist_summary_t sum[1];
+  cycle_hist_summarize(h, 0, sum);
+  REQUIRE(sum->n == 2);
+  REQUIRE(sum->p50 == 0);
+  REQUIRE(sum->p99 == UINT64_MAX);
+  REQUIRE(sum->max == UINT64_MAX);
+}
@@ -0,0 +1,202 @@
+#include "catch.hpp"
+#include "module.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+extern "C" {
+#include "../capture_reader.h"
+#include "../common.h"
+#include "../disk.h"
+#include "../disk_thread.h"
+#include "../err.h"
+#include "../record_io.h"
+#include "../slot_ring.h"
+}
+
+namespace {
+constexpr size_t   SET_FRAMES    = 256;
+constexpr uint64_t SEGMENT_BYTES = 64ul << 10; // a chunk or two a segment
+
+struct ring : module<slot_ring_t, destroy_slot_ring> {
+  ring()
+    : module(slot_ring_align(), slot_ring_footprint(RING_SLOTS, sample_set_footprint(SET_FRAMES, 0)),
+             create_slot_ring, RING_SLOTS, sample_set_footprint(SET_FRAMES, 0))
+  {}
+};
+
+struct disk : module<disk_thread_t, destroy_disk_thread> {
+  disk(slot_ring_t* const* rings, char const* dir, capture_meta_t const* meta)
+    : module(disk_thread_align(), disk_thread_footprint(), create_disk_thread, rings, (size_t)1,
+             dir, "rotate", meta, SEGMENT_BYTES)
+  {}
+};
+
+/* an empty directory of our own, and everything in it gone afterwards */
+struct scratch {
+  scratch()
+  {
+    strcpy(dir, "disk_thread_test.XXXXXX");
+    REQUIRE(mkdtemp(dir));
+  }
+
+  ~scratch()
+  {
+    for (std::string const& name : files()) unlink((std::string(dir) + "/" + name).c_str());
+    rmdir(dir);
+  }
+
+  std::vector<std::string> files() const
+  {
+    std::vector<std::string> names;
+    DIR* d = opendir(dir);
+    REQUIRE(d);
+    while (struct dirent* e = readdir(d)) {
+      if (e->d_name[0] != '.') names.push_back(e->d_name);
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    return names;
+  }
+
+  char dir[32];
+};
+
+capture_meta_t
+test_meta()
+{
+  capture_meta_t meta;
+  memset(&meta, 0, sizeof(meta));
+  meta.sample_rate_hz = 48000;
+  meta.n_channels     = 3;
+  strcpy(meta.channels[0], "square_out");
+  strcpy(meta.channels[1], "pulse_out");
+  strcpy(meta.channels[2], "lxd_in");
+  return meta;
+}
+
+float
+value(size_t   channel,
+      uint64_t frame)
+{
+  return (float)channel*1e6f + (float)frame;
+}
+
+/* Hand `n_sets` sample sets to the thread the way the app does, waiting for
+   room when it falls behind */
+
+void
+produce(slot_ring_t*   r,
+        disk_thread_t* dt,
+        size_t         n_sets)
+{
+  std::vector<char> mem(sample_set_footprint(SET_FRAMES, 0));
+  for (size_t i = 0; i < n_sets; ++i) {
+    uint64_t      frame = i*SET_FRAMES;
+    sample_set_t* sset  = create_sample_set(mem.data(), frame, SET_FRAMES, 0, NULL);
+    for (size_t j = 0; j < SET_FRAMES; ++j) {
+      sample_set_square_samples(sset)[j] = value(0, frame + j);
+      sample_set_pulse_samples(sset)[j]  = value(1, frame + j);
+      sample_set_lxd_in_samples(sset)[j] = value(2, frame + j);
+    }
+
+    while (record_write(r, &sset->hdr) != APP_SUCCESS) {
+      slot_ring_publish(r);
+      disk_thread_poke(dt, slot_ring_used(r));
+      usleep(100);
+    }
+    slot_ring_publish(r);
+    disk_thread_poke(dt, slot_ring_used(r));
+  }
+}
+
+} // anon namespace
+
+TEST_CASE("segments rotate into numbered files that each end cleanly", "[disk_thread]")
+{
+  scratch        tmp;
+  ring           r;
+  capture_meta_t meta    = test_meta();
+  slot_ring_t*   rings[] = { r };
+
+  size_t n_sets = 8*CAPTURE_CHUNK_FRAMES/SET_FRAMES;
+  {
+    disk dt(rings, tmp.dir, &meta);
+    REQUIRE(disk_thread_start(dt) == APP_SUCCESS);
+    produce(r, dt, n_sets);
+    REQUIRE(disk_thread_flush_and_stop(dt) == APP_SUCCESS);
+  }
+
+  /* rotate-YYYYmmdd-HHMMSS-NNNN.lxd, one stamp, numbered on from 0000 */
+  std::vector<std::string> names = tmp.files();
+  REQUIRE(names.size() > 2);
+
+  std::string stamp = names[0].substr(0, names[0].size() - strlen("-0000.lxd"));
+  REQUIRE(stamp.size() == strlen("rotate-YYYYmmdd-HHMMSS"));
+  for (size_t i = 0; i < names.size(); ++i) {
+    char expected[64];
+    snprintf(expected, sizeof(expected), "%s-%04zu.lxd", stamp.c_str(), i);
+    REQUIRE(names[i] == expected);
+  }
+
+  /* each with its own header, a length that covers the file exactly, and
+     an index, so nothing after it had to be walked or was lost. The chunks
+     carry on from one segment to the next. */
+  uint64_t session = 0;
+  uint64_t frame   = 0;
+  for (size_t i = 0; i < names.size(); ++i) {
+    std::string path = std::string(tmp.dir) + "/" + names[i];
+
+    struct stat st;
+    REQUIRE(stat(path.c_str(), &st) == 0);
+
+    void* mem = aligned_alloc(capture_reader_align(), capture_reader_footprint());
+    REQUIRE(mem);
+    int               err = 0;
+    capture_reader_t* rd  = create_capture_reader(mem, path.c_str(), &err);
+    REQUIRE(rd);
+
+    file_hdr_t const* hdr = capture_reader_hdr(rd);
+    REQUIRE(hdr->segment == i);
+    REQUIRE(hdr->length != FILE_LENGTH_UNKNOWN);
+    REQUIRE(hdr->length == (uint64_t)st.st_size - FILE_HDR_SIZE);
+    REQUIRE(hdr->index != 0);
+    if (i == 0) session = hdr->session;
+    REQUIRE(hdr->session == session);
+
+    REQUIRE(!capture_reader_scanned(rd));
+    REQUIRE(capture_reader_n_lost(rd) == 0);
+    for (size_t c = 0; c < capture_reader_n_chunks(rd); ++c) {
+      chunk_t const* chunk = capture_reader_chunk(rd, c);
+      REQUIRE(chunk->hdr.frame == frame);
+      REQUIRE(capture_reader_verify(rd, c) == APP_SUCCESS);
+      frame += chunk->n_frames;
+    }
+
+    destroy_capture_reader(rd);
+    free(mem);
+  }
+
+  REQUIRE(frame == n_sets*SET_FRAMES);
+}
+
+TEST_CASE("disk thread refuses a zero segment size", "[disk_thread]")
+{
+  ring              r;
+  capture_meta_t    meta    = test_meta();
+  slot_ring_t*      rings[] = { r };
+  std::vector<char> mem(disk_thread_footprint() + disk_thread_align());
+  void*             aligned = (void*)ALIGN((uintptr_t)mem.data(), disk_thread_align());
+
+  int err = 0;
+  REQUIRE(!create_disk_thread(aligned, rings, 1, ".", "rotate", &meta, 0, &err));
+  REQUIRE(err == APP_ERR_INVAL);
+}
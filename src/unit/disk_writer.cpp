@@ -0,0 +1,229 @@
+#include "catch.hpp"
+#include "module.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+extern "C" {
+#include "../common.h"
+#include "../disk.h"
+#include "../disk_writer.h"
+#include "../err.h"
+}
+
+namespace {
+
+/* byte `i` of the records, so anything misplaced, lost or padded shows */
+uint8_t
+pattern(uint64_t i)
+{
+  return (uint8_t)(i*31 + (i >> 13));
+}
+
+struct writer : module<disk_writer_t, destroy_disk_writer> {
+  writer(int backend, bool direct, std::string const& path = "disk_writer_test.lxd")
+    : module(disk_writer_align(), disk_writer_footprint(), create_disk_writer, path.c_str(), backend,
+             direct),
+      path(path)
+  {}
+
+  ~writer()
+  {
+    unlink(path.c_str());
+  }
+
+  /* `n` more bytes of the pattern, `piece` bytes an iovec, a few iovecs an
+     append the way the disk thread batches records */
+  void append(size_t n, size_t piece)
+  {
+    std::vector<uint8_t> bytes(n);
+    for (size_t i = 0; i < n; ++i) bytes[i] = pattern(written + i);
+
+    for (size_t at = 0; at < n; ) {
+      struct iovec iov[3];
+      size_t       n_iov = 0;
+      for (; n_iov < 3 && at < n; ++n_iov) {
+        iov[n_iov].iov_base = bytes.data() + at;
+        iov[n_iov].iov_len  = std::min(piece, n - at);
+        at                 += iov[n_iov].iov_len;
+      }
+      REQUIRE(disk_writer_append(p, iov, n_iov) == APP_SUCCESS);
+    }
+
+    written += n;
+  }
+
+  std::string path;
+  uint64_t    written = 0;
+};
+
+std::vector<uint8_t>
+read_file(std::string const& path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  REQUIRE(fd != -1);
+
+  struct stat st;
+  REQUIRE(fstat(fd, &st) == 0);
+  std::vector<uint8_t> bytes((size_t)st.st_size);
+  REQUIRE(pread(fd, bytes.data(), bytes.size(), 0) == (ssize_t)bytes.size());
+  close(fd);
+  return bytes;
+}
+
+/* A finished file: header with the length, then exactly the pattern */
+
+void
+check_file(std::string const& path,
+           uint64_t           written)
+{
+  std::vector<uint8_t> bytes = read_file(path);
+  REQUIRE(bytes.size() == FILE_HDR_SIZE + written);
+
+  file_hdr_t hdr;
+  memcpy(&hdr, bytes.data(), sizeof(hdr));
+  REQUIRE(hdr.magic == FILE_MAGIC);
+  REQUIRE(hdr.hdr_size == FILE_HDR_SIZE);
+  REQUIRE(hdr.length == written);
+
+  for (uint64_t i = 0; i < written; ++i) {
+    if (bytes[FILE_HDR_SIZE + i] != pattern(i)) FAIL("byte " << i << " is wrong");
+  }
+}
+
+} // anon namespace
+
+TEST_CASE("io_uring writes every buffer out in order", "[disk_writer]")
+{
+  writer w(DISK_WRITER_URING, false);
+  if (disk_writer_backend(w) != DISK_WRITER_URING) {
+    WARN("no io_uring on this kernel, checking the write() fallback instead");
+  }
+
+  /* enough to go round every buffer twice, in pieces that straddle their
+     edges, with an idle flush sending a partly filled one out early */
+  w.append(DISK_BUFFER_SIZE/2 + 5, 3088);
+  REQUIRE(disk_writer_flush(w) == APP_SUCCESS);
+  w.append(2*DISK_BUFFERS*DISK_BUFFER_SIZE, 10007);
+  REQUIRE(disk_writer_bytes(w) == w.written);
+  REQUIRE(disk_writer_finish(w) == APP_SUCCESS);
+
+  check_file(w.path, w.written);
+}
+
+TEST_CASE("io_uring and write() produce the same file", "[disk_writer]")
+{
+  writer a(DISK_WRITER_URING, false, "disk_writer_test_a.lxd");
+  writer b(DISK_WRITER_WRITE, false, "disk_writer_test_b.lxd");
+  for (writer* w : { &a, &b }) {
+    w->append(3*DISK_BUFFER_SIZE + 123, 4096 + 17);
+    REQUIRE(disk_writer_finish(*w) == APP_SUCCESS);
+  }
+
+  std::vector<uint8_t> bytes_a = read_file(a.path);
+  std::vector<uint8_t> bytes_b = read_file(b.path);
+  REQUIRE(bytes_a.size() == bytes_b.size());
+
+  /* the session is when each writer was created */
+  size_t session = offsetof(file_hdr_t, session);
+  memset(bytes_a.data() + session, 0, sizeof(uint64_t));
+  memset(bytes_b.data() + session, 0, sizeof(uint64_t));
+  REQUIRE(bytes_a == bytes_b);
+}
+
+TEST_CASE("O_DIRECT pads only in flight, the file ends at the last record", "[disk_writer]")
+{
+  /* under a block, a partial last block, and a whole number of blocks */
+  for (int backend : { DISK_WRITER_WRITE, DISK_WRITER_URING }) {
+    for (size_t n : { 100ul, 2*DISK_BUFFER_SIZE + 4096 + 1234, 3*4096ul }) {
+      writer w(backend, true);
+      if (!disk_writer_direct(w)) WARN("no O_DIRECT on this filesystem, writing buffered");
+
+      /* an idle flush leaves the partial block behind for the next append */
+      w.append(n/2, 3088);
+      REQUIRE(disk_writer_flush(w) == APP_SUCCESS);
+      w.append(n - n/2, 3088);
+      REQUIRE(disk_writer_finish(w) == APP_SUCCESS);
+
+      check_file(w.path, w.written);
+
+      file_hdr_t hdr;
+      memcpy(&hdr, read_file(w.path).data(), sizeof(hdr));
+      REQUIRE(hdr.flags == (disk_writer_direct(w) ? FILE_DIRECT : 0u));
+    }
+  }
+}
+
+TEST_CASE("writeback leaves the file as it would have been", "[disk_writer]")
+{
+  for (int backend : { DISK_WRITER_WRITE, DISK_WRITER_URING }) {
+    for (bool direct : { false, true }) {
+      writer w(backend, direct);
+
+      /* starting and waiting on writeback between appends, with buffers in
+         flight, and at the end of the segment right before it's finished */
+      for (size_t i = 0; i < 2*DISK_BUFFERS; ++i) {
+        w.append(DISK_BUFFER_SIZE/2 + 777, 3088);
+        REQUIRE(disk_writer_writeback(w) == APP_SUCCESS);
+      }
+      REQUIRE(disk_writer_flush(w) == APP_SUCCESS);
+      REQUIRE(disk_writer_writeback(w) == APP_SUCCESS);
+      REQUIRE(disk_writer_writeback(w) == APP_SUCCESS);
+      REQUIRE(disk_writer_unsynced(w) == 0);
+      REQUIRE(disk_writer_finish(w) == APP_SUCCESS);
+
+      check_file(w.path, w.written);
+    }
+  }
+}
+
+TEST_CASE("a failed writeback is an error from then on", "[disk_writer]")
+{
+  for (int backend : { DISK_WRITER_WRITE, DISK_WRITER_URING }) {
+    writer w(backend, false);
+    w.append(DISK_BUFFER_SIZE + 100, 3088);
+    REQUIRE(disk_writer_sync(w) == APP_SUCCESS);
+    REQUIRE(disk_writer_unsynced(w) > 0);
+
+    /* sync_file_range refuses a pipe, swap one in under the writer's fd */
+    char file[PATH_MAX];
+    REQUIRE(realpath(w.path.c_str(), file));
+
+    int fd = -1;
+    for (int i = 0; i < 1024 && fd == -1; ++i) {
+      char link[64];
+      char target[PATH_MAX];
+      snprintf(link, sizeof(link), "/proc/self/fd/%d", i);
+      ssize_t n = readlink(link, target, sizeof(target) - 1);
+      if (n <= 0) continue;
+      target[n] = 0;
+      if (0 == strcmp(target, file)) fd = i;
+    }
+    REQUIRE(fd != -1);
+
+    int pipe_fds[2];
+    REQUIRE(pipe(pipe_fds) == 0);
+    REQUIRE(dup2(pipe_fds[1], fd) == fd);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    REQUIRE(disk_writer_writeback(w) == APP_ERR_WRITE);
+
+    /* and isn't forgotten by the next call */
+    struct iovec iov[1] = { { file, 10 } };
+    REQUIRE(disk_writer_append(w, iov, 1) == APP_ERR_WRITE);
+    REQUIRE(disk_writer_writeback(w) == APP_ERR_WRITE);
+    REQUIRE(disk_writer_finish(w) == APP_ERR_WRITE);
+  }
+}
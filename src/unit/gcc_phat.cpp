@@ -0,0 +1,117 @@
+#include "catch.hpp"
+#include "module.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include "../err.h"
+#include "../gcc_phat.h"
+}
+
+namespace {
+constexpr size_t WINDOW  = 1024;
+constexpr size_t MAX_LAG = 256;
+constexpr size_t BLOCK   = 100; // frames per add, doesn't line up with anything
+constexpr size_t TAPS    = 32;  // each side of the fractional delay filter
+
+struct estimator : module<gcc_phat_t, destroy_gcc_phat> {
+  estimator()
+    : module(gcc_phat_align(), gcc_phat_footprint(WINDOW), create_gcc_phat, WINDOW, MAX_LAG)
+  {}
+};
+
+/* y[n] = x[n - delay] for white x, by windowed sinc interpolation */
+std::vector<float> delayed(std::vector<float> const& x, double delay)
+{
+  std::vector<float> y(x.size(), 0.0f);
+  for (size_t n = 0; n < x.size(); ++n) {
+    double acc = 0;
+    for (long k = -(long)TAPS; k <= (long)TAPS; ++k) {
+      long   m = (long)std::floor(n - delay) + k;
+      if (m < 0 || m >= (long)x.size()) continue;
+      double t = n - delay - m;
+      double s = t == 0 ? 1.0 : std::sin(M_PI*t)/(M_PI*t);
+      double w = 0.5 + 0.5*std::cos(M_PI*t/(TAPS+1));
+      acc += x[m]*s*w;
+    }
+    y[n] = (float)acc;
+  }
+  return y;
+}
+
+/* feed [0, n) and estimate the strike at `strike` */
+gcc_phat_result_t run(estimator& e, std::vector<float> const& x, std::vector<float> const& y,
+                      uint64_t strike)
+{
+  bool done = false;
+  gcc_phat_result_t result{};
+  for (size_t i = 0; i < x.size() && !done; i += BLOCK) {
+    size_t n = std::min(BLOCK, x.size() - i);
+    if (strike >= i && strike < i + n) gcc_phat_strike(e, strike);
+    if (gcc_phat_add(e, i, x.data() + i, y.data() + i, n)) {
+      REQUIRE(gcc_phat_estimate(e, &result) == APP_SUCCESS);
+      done = true;
+    }
+  }
+  REQUIRE(done);
+  return result;
+}
+
+} // anon namespace
+
+TEST_CASE("finds fractional delays", "[gcc_phat]")
+{
+  std::mt19937                    gen(1234);
+  std::normal_distribution<float> dist(0.0, 1.0);
+
+  std::vector<float> x(4*WINDOW);
+  for (auto& v: x) v = dist(gen);
+
+  for (double delay: {0.0, 3.3, 17.75, -5.5, 100.1}) {
+    estimator e;
+    auto y = delayed(x, delay);
+    auto r = run(e, x, y, 2*WINDOW);
+    REQUIRE(r.delay == Approx(delay).margin(0.05));
+    REQUIRE(r.peak > 0.5);
+  }
+}
+
+TEST_CASE("doesn't care about the output's colour or gain", "[gcc_phat]")
+{
+  std::mt19937                    gen(4321);
+  std::normal_distribution<float> dist(0.0, 1.0);
+
+  std::vector<float> x(4*WINDOW);
+  for (auto& v: x) v = dist(gen);
+
+  /* one-pole low-pass and a gain, then delay */
+  std::vector<float> filtered(x.size());
+  float state = 0;
+  for (size_t i = 0; i < x.size(); ++i) filtered[i] = state = 0.7f*state + 0.1f*x[i];
+
+  estimator e;
+  auto y = delayed(filtered, 42.0);
+  auto r = run(e, x, y, 2*WINDOW);
+
+  /* a minimum phase filter's group delay averages to zero over the band, and
+     whitening weights every bin equally */
+  REQUIRE(r.delay == Approx(42.0).margin(1.0));
+}
+
+TEST_CASE("capture needs the frames before the strike", "[gcc_phat]")
+{
+  estimator e;
+
+  std::vector<float> x(WINDOW, 1.0f), y(WINDOW, 1.0f);
+
+  /* strike at 100 wants history from before 0, which never arrives */
+  gcc_phat_add(e, 1000, x.data(), y.data(), 10);
+  gcc_phat_strike(e, 1100);
+  REQUIRE(!gcc_phat_add(e, 1010, x.data(), y.data(), WINDOW));
+
+  gcc_phat_result_t result{};
+  REQUIRE(gcc_phat_estimate(e, &result) == APP_ERR_INVAL);
+}
@@ -0,0 +1,108 @@
+#include "catch.hpp"
+#include "module.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+extern "C" {
+#include "../additive_square.h"
+#include "../err.h"
+#include "../harmonic_tracker.h"
+}
+
+namespace {
+constexpr size_t SAMPLE_RATE = 48000;
+constexpr size_t WINDOW      = SAMPLE_RATE/10;
+constexpr size_t N_BINS      = 8;
+
+struct tracker : module<harmonic_tracker_t, destroy_harmonic_tracker> {
+  tracker(float fundamental, size_t block)
+    : module(harmonic_tracker_align(), harmonic_tracker_footprint(N_BINS, WINDOW),
+             create_harmonic_tracker, (size_t)SAMPLE_RATE, fundamental, N_BINS, WINDOW, block)
+  {}
+};
+
+} // anon namespace
+
+TEST_CASE("tracker measures a square wave's harmonics", "[harmonic_tracker]")
+{
+  tracker t(440.0, 512);
+
+  void* mem = malloc(additive_square_footprint());
+  REQUIRE(mem);
+  additive_square_t* sq = create_additive_square(mem, SAMPLE_RATE, nullptr);
+  REQUIRE(sq);
+
+  std::vector<float> samples(3*WINDOW);
+  REQUIRE(APP_SUCCESS == additive_square_generate_samples(sq, samples.size(), 440.0, samples.data()));
+
+  size_t n_ready = 0;
+  size_t done    = 0;
+  while (done < samples.size()) {
+    size_t n = harmonic_tracker_process(t, samples.data() + done, samples.size() - done);
+    REQUIRE(n > 0);
+    REQUIRE(n <= 512);
+    done += n;
+
+    if (!harmonic_tracker_ready(t)) continue;
+    n_ready += 1;
+
+    // we should never hear about partially filled windows
+    REQUIRE(done >= WINDOW);
+
+    float amplitude[N_BINS];
+    float phase[N_BINS];
+    harmonic_tracker_snapshot(t, amplitude, phase);
+
+    // additive_square sums sin(h*x)/h for odd h
+    for (size_t i = 0; i < N_BINS; ++i) {
+      float harmonic = 2*i + 1;
+      REQUIRE(std::abs(amplitude[i] - 1.0/harmonic) < 1e-3);
+    }
+  }
+
+  REQUIRE(n_ready == (samples.size() - WINDOW)/512 + 1);
+
+  free(destroy_additive_square(sq));
+}
+
+TEST_CASE("tracker reports cosine phase at the window start", "[harmonic_tracker]")
+{
+  tracker t(1000.0, WINDOW);
+
+  float const phi = 0.3;
+  std::vector<float> samples(WINDOW);
+  for (size_t i = 0; i < samples.size(); ++i) {
+    samples[i] = 0.5*std::cos(2*M_PI*1000.0*i/SAMPLE_RATE + phi);
+  }
+
+  REQUIRE(WINDOW == harmonic_tracker_process(t, samples.data(), samples.size()));
+  REQUIRE(harmonic_tracker_ready(t));
+
+  float amplitude[N_BINS];
+  float phase[N_BINS];
+  harmonic_tracker_snapshot(t, amplitude, phase);
+
+  REQUIRE(std::abs(amplitude[0] - 0.5) < 1e-5);
+  REQUIRE(std::abs(phase[0] - phi) < 1e-4);
+
+  // nothing at the odd harmonics
+  for (size_t i = 1; i < N_BINS; ++i) {
+    REQUIRE(amplitude[i] < 1e-5);
+  }
+}
+
+TEST_CASE("tracker rejects harmonics past nyquist", "[harmonic_tracker]")
+{
+  void* mem = aligned_alloc(harmonic_tracker_align(),
+                            harmonic_tracker_footprint(N_BINS, WINDOW));
+  REQUIRE(mem);
+
+  int err = 0;
+  // 15th harmonic of 2 kHz is 30 kHz
+  REQUIRE(!create_harmonic_tracker(mem, SAMPLE_RATE, 2000.0, N_BINS, WINDOW, 512, &err));
+  REQUIRE(err == APP_ERR_INVAL);
+
+  free(mem);
+}
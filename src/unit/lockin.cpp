@@ -0,0 +1,99 @@
+#include "catch.hpp"
+#include "module.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+extern "C" {
+#include "../err.h"
+#include "../lockin.h"
+}
+
+namespace {
+constexpr size_t SAMPLE_RATE = 48000;
+constexpr float  DRIVE_HZ    = 440.0f;
+constexpr float  CUTOFF_HZ   = 20.0f;
+constexpr size_t DECIMATION  = 48;  // 1 kHz out
+constexpr size_t BLOCK       = 100; // frames per call, doesn't line up with the decimation
+
+struct amp : module<lockin_t, destroy_lockin> {
+  amp()
+    : module(lockin_align(), lockin_footprint(), create_lockin, SAMPLE_RATE, CUTOFF_HZ, DECIMATION)
+  {}
+};
+
+/* a sin(2 pi f t + phi) at the drive frequency, one second of it */
+std::vector<float> drive(float a, float phi)
+{
+  std::vector<float> x(SAMPLE_RATE);
+  for (size_t n = 0; n < x.size(); ++n) {
+    x[n] = a*(float)std::sin(2*M_PI*DRIVE_HZ*(double)n/SAMPLE_RATE + phi);
+  }
+  return x;
+}
+
+} // anon namespace
+
+TEST_CASE("lock-in recovers amplitude and phase of the drive", "[lockin]")
+{
+  for (float phi : { 0.0f, 0.7f, -2.0f }) {
+    amp li;
+
+    std::vector<float> x = drive(0.25f, phi);
+    std::vector<float> amplitude(x.size()/DECIMATION + 1);
+    std::vector<float> phase(amplitude.size());
+
+    float  theta = 0.0f;
+    size_t n_out = lockin_process(li, &theta, DRIVE_HZ/(double)SAMPLE_RATE, x.data(), x.size(),
+                                  amplitude.data(), phase.data(), NULL);
+    REQUIRE(n_out == x.size()/DECIMATION);
+
+    /* the filters have long settled by the second half */
+    for (size_t i = n_out/2; i < n_out; ++i) {
+      REQUIRE(std::fabs(amplitude[i] - 0.25f) < 0.25f*0.01f);
+      REQUIRE(std::fabs(std::remainder(phase[i] - phi, 2*M_PI)) < 0.01);
+    }
+  }
+}
+
+TEST_CASE("lock-in outputs once per decimation period", "[lockin]")
+{
+  amp li;
+
+  std::vector<float> x = drive(1.0f, 0.0f);
+  std::vector<float> amplitude(BLOCK/DECIMATION + 1);
+  std::vector<float> phase(amplitude.size());
+
+  float  theta = 0.0f;
+  size_t total = 0;
+  for (size_t at = 0; at < x.size(); at += BLOCK) {
+    size_t n     = std::min(BLOCK, x.size() - at);
+    size_t first = SIZE_MAX;
+    size_t n_out = lockin_process(li, &theta, DRIVE_HZ/(double)SAMPLE_RATE, x.data() + at, n,
+                                  amplitude.data(), phase.data(), &first);
+
+    /* the frames that finish a period are DECIMATION - 1, 2*DECIMATION - 1, ... */
+    size_t done_before = at/DECIMATION;
+    size_t done_after  = (at + n)/DECIMATION;
+    REQUIRE(n_out == done_after - done_before);
+    if (n_out) REQUIRE(at + first == (done_before + 1)*DECIMATION - 1);
+    else       REQUIRE(first == SIZE_MAX);
+
+    total += n_out;
+  }
+
+  REQUIRE(total == x.size()/DECIMATION);
+  REQUIRE(lockin_decimation(li) == DECIMATION);
+}
+
+TEST_CASE("lock-in refuses settings it can't filter", "[lockin]")
+{
+  std::vector<char> mem(lockin_footprint());
+
+  int err = 0;
+  REQUIRE(!create_lockin(mem.data(), SAMPLE_RATE, CUTOFF_HZ, 0, &err));
+  REQUIRE(err == APP_ERR_INVAL);
+  REQUIRE(!create_lockin(mem.data(), SAMPLE_RATE, SAMPLE_RATE/2, DECIMATION, &err));
+  REQUIRE(err == APP_ERR_INVAL);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "catch.hpp"
+
+#include <cstdlib>
+
+extern "C" {
+#include "../err.h"
+}
+
+/* One of our modules for the length of a test: memory of the module's
+   footprint and align, create_xxx(mem, args..., &err) into it, which has to
+   work, and destroy_xxx and free on the way out. Stands in for the T* in
+   calls, e.g.
+
+     struct ring : module<slot_ring_t, destroy_slot_ring> {
+       ring() : module(slot_ring_align(), slot_ring_footprint(8, 100), create_slot_ring, 8, 100) {}
+     }; */
+
+template <typename T, void* (*Destroy)(T*)>
+struct module {
+  template <typename Create, typename... Args>
+  module(size_t align, size_t footprint, Create create, Args... args)
+  {
+    mem = aligned_alloc(align, footprint);
+    REQUIRE(mem);
+
+    int err = 0;
+    p = create(mem, args..., &err);
+    REQUIRE(p);
+    REQUIRE(err == APP_SUCCESS);
+  }
+
+  ~module()
+  {
+    free(Destroy(p));
+  }
+
+  module(module const&)            = delete;
+  module& operator=(module const&) = delete;
+
+  operator T*() const { return p; }
+
+  void* mem;
+  T*    p;
+};
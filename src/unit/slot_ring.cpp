@@ -0,0 +1,101 @@
+#include "catch.hpp"
+#include "module.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+extern "C" {
+#include "../err.h"
+#include "../slot_ring.h"
+}
+
+namespace {
+constexpr size_t N_SLOTS   = 8;
+constexpr size_t SLOT_SIZE = 100; // rounded up to a cacheline multiple
+
+struct ring : module<slot_ring_t, destroy_slot_ring> {
+  ring()
+    : module(slot_ring_align(), slot_ring_footprint(N_SLOTS, SLOT_SIZE), create_slot_ring,
+             N_SLOTS, SLOT_SIZE)
+  {}
+};
+
+} // anon namespace
+
+TEST_CASE("slots are cacheline sized and aligned", "[slot_ring]")
+{
+  ring r;
+
+  REQUIRE(slot_ring_slot_size(r) >= SLOT_SIZE);
+  REQUIRE(slot_ring_slot_size(r) % CACHELINE == 0);
+
+  for (size_t i = 0; i < N_SLOTS; ++i) {
+    void* slot = slot_ring_acquire(r);
+    REQUIRE(slot);
+    REQUIRE((uintptr_t)slot % CACHELINE == 0);
+  }
+}
+
+TEST_CASE("nothing is readable until published", "[slot_ring]")
+{
+  ring r;
+
+  for (size_t i = 0; i < N_SLOTS; ++i) {
+    uint64_t* slot = (uint64_t*)slot_ring_acquire(r);
+    REQUIRE(slot);
+    *slot = i;
+  }
+
+  /* full, even though nothing has been published */
+  REQUIRE(!slot_ring_acquire(r));
+  REQUIRE(slot_ring_readable(r) == 0);
+
+  slot_ring_publish(r);
+  REQUIRE(slot_ring_readable(r) == N_SLOTS);
+  for (size_t i = 0; i < N_SLOTS; ++i) {
+    REQUIRE(*(uint64_t*)slot_ring_slot(r, i) == i);
+  }
+
+  /* releasing some makes room for that many */
+  slot_ring_release(r, 3);
+  for (size_t i = 0; i < 3; ++i) REQUIRE(slot_ring_acquire(r));
+  REQUIRE(!slot_ring_acquire(r));
+
+  REQUIRE(slot_ring_readable(r) == N_SLOTS - 3);
+  REQUIRE(*(uint64_t*)slot_ring_slot(r, 0) == 3);
+}
+
+TEST_CASE("order survives a producer and a consumer thread", "[slot_ring]")
+{
+  ring r;
+  constexpr uint64_t count = 100000;
+
+  std::thread producer([&] {
+    for (uint64_t i = 0; i < count; ++i) {
+      uint64_t* slot;
+      while (!(slot = (uint64_t*)slot_ring_acquire(r))) {
+        slot_ring_publish(r);
+        std::this_thread::yield();
+      }
+      *slot = i;
+      if (i % 3 == 0) slot_ring_publish(r);
+    }
+    slot_ring_publish(r);
+  });
+
+  uint64_t expected = 0;
+  bool     in_order = true;
+  while (expected < count) {
+    size_t n = slot_ring_readable(r);
+    if (n == 0) std::this_thread::yield();
+    for (size_t i = 0; i < n; ++i) {
+      in_order &= *(uint64_t*)slot_ring_slot(r, i) == expected++;
+    }
+    slot_ring_release(r, n);
+  }
+
+  producer.join();
+  REQUIRE(in_order);
+}
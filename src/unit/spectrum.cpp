@@ -0,0 +1,119 @@
+#include "catch.hpp"
+#include "module.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include "../common.h"
+#include "../err.h"
+#include "../spectrum.h"
+}
+
+namespace {
+constexpr size_t N        = 1024;
+constexpr size_t MAX_SETS = 8;
+
+struct spec : module<spectrum_t, destroy_spectrum> {
+  spec()
+    : module(spectrum_align(), spectrum_footprint(N, MAX_SETS), create_spectrum, N, MAX_SETS)
+  {}
+};
+
+/* A whole-bin cosine that moves up 8 bins every transform, so each
+   transform's bins say which one it was */
+std::vector<float>
+input(uint64_t first,
+      size_t   nframes)
+{
+  std::vector<float> in(nframes);
+  for (size_t i = 0; i < nframes; ++i) {
+    uint64_t frame = first + i;
+    uint64_t bin   = 8*(frame/N + 1);
+    in[i] = (float)std::cos(2.0*M_PI*(double)(bin*(frame % N))/(double)N);
+  }
+  return in;
+}
+
+/* Bins of the transform over frames [end - N, end) */
+void
+check_bins(float const* bins,
+           uint64_t     end)
+{
+  REQUIRE(bins);
+  size_t peak = (size_t)(std::max_element(bins, bins + N/2 + 1) - bins);
+  REQUIRE(peak == 8*(end/N));
+  REQUIRE(bins[peak] == Approx(N/2).epsilon(1e-3));
+}
+
+} // anon namespace
+
+TEST_CASE("a callback longer than the transform keeps every one of them", "[spectrum]")
+{
+  spec s;
+  REQUIRE(spectrum_n(s) == N);
+  REQUIRE(spectrum_n_bins(s) == N/2 + 1);
+
+  /* four transforms complete, one in every other set */
+  std::vector<float> in = input(0, 4*N);
+  REQUIRE(spectrum_process(s, in.data(), 4*N, N/2) == APP_SUCCESS);
+  for (size_t set = 0; set < 8; ++set) {
+    if (set % 2 == 0) REQUIRE(!spectrum_bins(s, set));
+    else              check_bins(spectrum_bins(s, set), (set + 1)*N/2);
+  }
+  REQUIRE(!spectrum_bins(s, 8));
+}
+
+TEST_CASE("transforms carry on across callbacks and land in their own set", "[spectrum]")
+{
+  /* neither callbacks nor sets line up with the transform */
+  spec     s;
+  uint64_t frame = 0;
+  size_t   done  = 0;
+  for (size_t callback = 0; callback < 10; ++callback) {
+    std::vector<float> in = input(frame, 1000);
+    REQUIRE(spectrum_process(s, in.data(), 1000, 333) == APP_SUCCESS);
+
+    for (size_t set = 0; set < 4; ++set) {
+      uint64_t begin = frame + set*333;
+      uint64_t end   = frame + std::min<size_t>((set + 1)*333, 1000);
+      uint64_t edge  = (end/N)*N; /* the last transform to finish, one past its last frame */
+      if (edge > begin && edge <= end) {
+        check_bins(spectrum_bins(s, set), edge);
+        done += 1;
+      }
+      else {
+        REQUIRE(!spectrum_bins(s, set));
+      }
+    }
+
+    frame += 1000;
+  }
+
+  REQUIRE(done == frame/N);
+}
+
+TEST_CASE("spectrum refuses sets it can't keep bins for", "[spectrum]")
+{
+  spec               s;
+  std::vector<float> in(MAX_SETS*N + 1);
+
+  /* two transforms could complete in one set */
+  REQUIRE(spectrum_process(s, in.data(), 2*N, N + 1) == APP_ERR_INVAL);
+  REQUIRE(spectrum_process(s, in.data(), 2*N, 0) == APP_ERR_INVAL);
+
+  /* more sets than there is room for */
+  REQUIRE(spectrum_process(s, in.data(), MAX_SETS*N/2 + 1, N/2) == APP_ERR_INVAL);
+  REQUIRE(spectrum_process(s, in.data(), MAX_SETS*N/2, N/2) == APP_SUCCESS);
+
+  std::vector<char> mem(spectrum_footprint(N, MAX_SETS) + spectrum_align());
+  void*             aligned = (void*)ALIGN((uintptr_t)mem.data(), spectrum_align());
+
+  int err = 0;
+  REQUIRE(!create_spectrum(aligned, 0, MAX_SETS, &err));
+  REQUIRE(err == APP_ERR_INVAL);
+  REQUIRE(!create_spectrum(aligned, N, 0, &err));
+  REQUIRE(err == APP_ERR_INVAL);
+}
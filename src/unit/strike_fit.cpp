@@ -0,0 +1,88 @@
+#include "catch.hpp"
+#include "module.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <random>
+
+extern "C" {
+#include "../err.h"
+#include "../strike_fit.h"
+}
+
+namespace {
+constexpr size_t MAX_POINTS     = 1024;
+constexpr size_t MAX_ITERATIONS = 100;
+constexpr float  POINT_PERIOD   = 0.001; // 1 kHz, like the lock-in output
+
+float response(float t, float baseline, float amplitude, float tau_r, float tau_f)
+{
+  return baseline + amplitude*(std::exp(-t/tau_f) - std::exp(-t/tau_r));
+}
+
+struct fitter : module<strike_fit_t, destroy_strike_fit> {
+  fitter()
+    : module(strike_fit_align(), strike_fit_footprint(MAX_POINTS), create_strike_fit,
+             MAX_POINTS, MAX_ITERATIONS, POINT_PERIOD/4, 100.0f)
+  {}
+};
+
+} // anon namespace
+
+TEST_CASE("fit recovers time constants", "[strike_fit]")
+{
+  fitter f;
+
+  std::mt19937                    gen(1234);
+  std::normal_distribution<float> noise(0.0, 0.001);
+
+  for (float amplitude : {0.4f, -0.25f}) {
+    for (float tau_r : {0.002f, 0.01f}) {
+      for (float tau_f : {0.05f, 0.12f}) {
+        strike_fit_reset(f);
+        for (size_t i = 0; i < 500; ++i) {
+          float t = i*POINT_PERIOD;
+          strike_fit_add(f, t, response(t, 0.3, amplitude, tau_r, tau_f) + noise(gen));
+        }
+
+        strike_fit_result_t result[1];
+        REQUIRE(APP_SUCCESS == strike_fit_solve(f, result));
+
+        REQUIRE(result->n_points == 500);
+        REQUIRE(result->iterations <= MAX_ITERATIONS);
+        REQUIRE(result->converged);
+        REQUIRE(std::abs(result->baseline - 0.3) < 0.01);
+        REQUIRE(std::abs(result->amplitude - amplitude)/std::abs(amplitude) < 0.05);
+        REQUIRE(std::abs(result->tau_rise_s - tau_r)/tau_r < 0.05);
+        REQUIRE(std::abs(result->tau_fall_s - tau_f)/tau_f < 0.05);
+        REQUIRE(result->rms_residual < 0.002);
+      }
+    }
+  }
+}
+
+TEST_CASE("fit needs enough points", "[strike_fit]")
+{
+  fitter f;
+
+  for (size_t i = 0; i < 3; ++i) strike_fit_add(f, i*POINT_PERIOD, 1.0);
+
+  strike_fit_result_t result[1];
+  REQUIRE(APP_ERR_INVAL == strike_fit_solve(f, result));
+}
+
+TEST_CASE("fit ignores points past the end of its storage", "[strike_fit]")
+{
+  fitter f;
+
+  for (size_t i = 0; i < 2*MAX_POINTS; ++i) {
+    float t = i*POINT_PERIOD;
+    strike_fit_add(f, t, response(t, 0.0, 1.0, 0.005, 0.2));
+  }
+  REQUIRE(strike_fit_n_points(f) == MAX_POINTS);
+
+  strike_fit_result_t result[1];
+  REQUIRE(APP_SUCCESS == strike_fit_solve(f, result));
+  REQUIRE(result->converged);
+  REQUIRE(std::abs(result->tau_fall_s - 0.2)/0.2 < 0.01);
+}
@@ -0,0 +1,136 @@
+#include "catch.hpp"
+#include "module.hpp"
+
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include "../err.h"
+#include "../strike_sched.h"
+}
+
+namespace {
+constexpr uint64_t SAMPLE_RATE = 48000;
+constexpr uint64_t PERIOD_NS   = 500000000; // 24000 frames
+constexpr uint64_t PERIOD      = 24000;
+constexpr uint64_t BUFFER      = 256;       // doesn't divide the period
+
+struct sched : module<strike_sched_t, destroy_strike_sched> {
+  sched(uint64_t period_ns)
+    : module(strike_sched_align(), strike_sched_footprint(), create_strike_sched, SAMPLE_RATE,
+             period_ns)
+  {}
+};
+
+/* every strike in [begin, end), a buffer at a time */
+std::vector<uint64_t> run(strike_sched_t* s,
+                          uint64_t        begin,
+                          uint64_t        end)
+{
+  std::vector<uint64_t> strikes;
+  for (uint64_t at = begin; at < end; at += BUFFER) {
+    uint64_t strike;
+    while (strike_sched_take(s, at, at + BUFFER, &strike)) {
+      REQUIRE(strike >= at);
+      REQUIRE(strike < at + BUFFER);
+      strikes.push_back(strike);
+    }
+  }
+  return strikes;
+}
+
+} // anon namespace
+
+TEST_CASE("strikes come a whole period apart without drifting", "[strike_sched]")
+{
+  sched s(PERIOD_NS);
+  strike_sched_start(s, 1000);
+
+  std::vector<uint64_t> strikes = run(s, 1000, 1000 + 1000*PERIOD);
+  REQUIRE(strikes.size() == 1000);
+  for (size_t k = 0; k < strikes.size(); ++k) REQUIRE(strikes[k] == 1000 + k*PERIOD);
+}
+
+TEST_CASE("fractional periods carry the remainder exactly", "[strike_sched]")
+{
+  /* 1/3 s is 15999.99998 frames: whole-frame periods of 16000 would be late
+     from the second strike on, 15999 a frame earlier every strike */
+  uint64_t period_ns = 333333333;
+  sched    s(period_ns);
+  strike_sched_start(s, 0);
+
+  std::vector<uint64_t> strikes = run(s, 0, 19999*16000 + 8000);
+  REQUIRE(strikes.size() == 20000);
+  for (uint64_t k = 0; k < strikes.size(); ++k) {
+    REQUIRE(strikes[k] == k*period_ns*SAMPLE_RATE/1000000000ull);
+  }
+}
+
+TEST_CASE("strikes land mid-buffer and on buffer boundaries", "[strike_sched]")
+{
+  uint64_t strike = 0;
+
+  SECTION("mid-buffer") {
+    sched s(PERIOD_NS);
+    strike_sched_start(s, 100);
+
+    REQUIRE(strike_sched_take(s, 0, BUFFER, &strike));
+    REQUIRE(strike == 100);
+    REQUIRE(!strike_sched_take(s, 0, BUFFER, &strike));
+  }
+
+  SECTION("first frame of the next buffer") {
+    sched s(PERIOD_NS);
+    strike_sched_start(s, BUFFER);
+
+    REQUIRE(!strike_sched_take(s, 0, BUFFER, &strike));
+    REQUIRE(strike_sched_take(s, BUFFER, 2*BUFFER, &strike));
+    REQUIRE(strike == BUFFER);
+  }
+
+  SECTION("last frame of a buffer") {
+    sched s(PERIOD_NS);
+    strike_sched_start(s, BUFFER - 1);
+
+    REQUIRE(strike_sched_take(s, 0, BUFFER, &strike));
+    REQUIRE(strike == BUFFER - 1);
+    REQUIRE(!strike_sched_take(s, BUFFER, 2*BUFFER, &strike));
+  }
+}
+
+TEST_CASE("strikes skipped over by the frame clock are dropped", "[strike_sched]")
+{
+  sched    s(PERIOD_NS);
+  uint64_t strike = 0;
+
+  /* nothing before the first poll says where the clock is */
+  REQUIRE(!strike_sched_take(s, 0, BUFFER, &strike));
+
+  strike_sched_start(s, 0);
+  strike_sched_start(s, 5000); /* only the first counts */
+  REQUIRE(strike_sched_take(s, 0, BUFFER, &strike));
+  REQUIRE(strike == 0);
+
+  /* an xrun jumps the clock past five strikes, mid-way between two */
+  uint64_t resume = 5*PERIOD + PERIOD/2;
+  REQUIRE(strike_sched_take(s, resume, resume + BUFFER, &strike));
+  REQUIRE(strike == resume); /* the overdue one happens now, once */
+  REQUIRE(!strike_sched_take(s, resume, resume + BUFFER, &strike));
+
+  /* and the schedule picks up where it would have been */
+  std::vector<uint64_t> strikes = run(s, resume + BUFFER, 8*PERIOD + PERIOD/2);
+  REQUIRE(strikes == std::vector<uint64_t>({ 6*PERIOD, 7*PERIOD, 8*PERIOD }));
+}
+
+TEST_CASE("strike schedule refuses periods under a frame", "[strike_sched]")
+{
+  std::vector<char> mem(strike_sched_footprint());
+
+  int err = 0;
+  REQUIRE(!create_strike_sched(mem.data(), SAMPLE_RATE, 1000, &err));
+  REQUIRE(err == APP_ERR_INVAL);
+  REQUIRE(!create_strike_sched(mem.data(), 0, PERIOD_NS, &err));
+  REQUIRE(err == APP_ERR_INVAL);
+  REQUIRE(!create_strike_sched(mem.data(), SAMPLE_RATE, UINT64_MAX/SAMPLE_RATE, &err));
+  REQUIRE(err == APP_ERR_INVAL);
+}
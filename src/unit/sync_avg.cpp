@@ -0,0 +1,105 @@
+#include "catch.hpp"
+#include "module.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include "../err.h"
+#include "../sync_avg.h"
+}
+
+namespace {
+constexpr size_t WINDOW = 1000;
+constexpr size_t PERIOD = 1500; // frames between strikes
+constexpr size_t BLOCK  = 128;  // frames per add, doesn't line up with anything
+
+float response(size_t i)
+{
+  return std::exp(-(float)i/200.0f);
+}
+
+struct averager : module<sync_avg_t, destroy_sync_avg> {
+  averager() : module(sync_avg_align(), sync_avg_footprint(WINDOW), create_sync_avg, WINDOW) {}
+};
+
+} // anon namespace
+
+TEST_CASE("noise averages away", "[sync_avg]")
+{
+  averager a;
+
+  std::mt19937                    gen(1234);
+  std::normal_distribution<float> noise(0.0, 0.5);
+
+  constexpr size_t n_strikes = 64;
+  constexpr size_t n_frames  = n_strikes*PERIOD;
+
+  std::vector<float> in(n_frames);
+  for (size_t i = 0; i < n_frames; ++i) {
+    in[i] = response(i % PERIOD) + noise(gen);
+  }
+
+  size_t next_strike = 0;
+  for (size_t frame = 0; frame < n_frames; frame += BLOCK) {
+    size_t n = std::min(BLOCK, n_frames - frame);
+
+    /* strikes land mid-block, split the block like the analysis thread sees it */
+    if (next_strike >= frame && next_strike < frame + n) {
+      size_t before = next_strike - frame;
+      sync_avg_add(a, frame, in.data() + frame, before);
+      sync_avg_strike(a, next_strike);
+      sync_avg_add(a, next_strike, in.data() + next_strike, n - before);
+      next_strike += PERIOD;
+    }
+    else {
+      sync_avg_add(a, frame, in.data() + frame, n);
+    }
+  }
+
+  REQUIRE(sync_avg_n_strikes(a) == n_strikes);
+  REQUIRE(sync_avg_first_strike(a) == 0);
+
+  std::vector<float> mean(WINDOW);
+  sync_avg_mean(a, 0, WINDOW, mean.data());
+
+  /* noise sigma drops by sqrt(64) = 8 */
+  for (size_t i = 0; i < WINDOW; ++i) {
+    REQUIRE(mean[i] == Approx(response(i)).margin(0.3));
+  }
+
+  double err = 0;
+  for (size_t i = 0; i < WINDOW; ++i) err += std::pow(mean[i] - response(i), 2);
+  REQUIRE(std::sqrt(err/WINDOW) < 0.5/8*1.2);
+}
+
+TEST_CASE("short strikes only count where they have data", "[sync_avg]")
+{
+  averager a;
+
+  std::vector<float> ones(WINDOW, 1.0f);
+  std::vector<float> threes(WINDOW, 3.0f);
+
+  /* first strike covers the whole window, second is cut short at 100 frames */
+  sync_avg_strike(a, 0);
+  sync_avg_add(a, 0, ones.data(), WINDOW);
+  sync_avg_strike(a, 5000);
+  sync_avg_add(a, 5000, threes.data(), 100);
+
+  std::vector<float> mean(WINDOW);
+  sync_avg_mean(a, 0, WINDOW, mean.data());
+  for (size_t i = 0;   i < 100;    ++i) REQUIRE(mean[i] == Approx(2.0f));
+  for (size_t i = 100; i < WINDOW; ++i) REQUIRE(mean[i] == Approx(1.0f));
+
+  /* input past the end of the window is ignored */
+  sync_avg_add(a, 5000 + WINDOW, threes.data(), WINDOW);
+  sync_avg_mean(a, 0, WINDOW, mean.data());
+  REQUIRE(mean[WINDOW-1] == Approx(1.0f));
+
+  sync_avg_reset(a);
+  REQUIRE(sync_avg_n_strikes(a) == 0);
+  sync_avg_mean(a, 0, WINDOW, mean.data());
+  REQUIRE(mean[0] == 0.0f);
+}
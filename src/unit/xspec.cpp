@@ -0,0 +1,124 @@
+#include "catch.hpp"
+#include "module.hpp"
+
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include "../err.h"
+#include "../xspec.h"
+}
+
+namespace {
+constexpr size_t SEGMENT = 256;
+constexpr size_t BLOCK   = 100; // frames per add, doesn't line up with anything
+
+struct estimator : module<xspec_t, destroy_xspec> {
+  estimator() : module(xspec_align(), xspec_footprint(SEGMENT), create_xspec, SEGMENT) {}
+
+  void add(std::vector<float> const& x, std::vector<float> const& y, uint64_t first_frame)
+  {
+    for (size_t i = 0; i < x.size(); i += BLOCK) {
+      size_t n = std::min(BLOCK, x.size() - i);
+      xspec_add(p, first_frame + i, x.data() + i, y.data() + i, n);
+    }
+  }
+};
+
+} // anon namespace
+
+TEST_CASE("recovers a known filter", "[xspec]")
+{
+  estimator e;
+
+  std::mt19937                    gen(1234);
+  std::normal_distribution<float> input(0.0, 1.0);
+  std::normal_distribution<float> noise(0.0, 0.05);
+
+  /* y[n] = 0.5*x[n] + 0.25*x[n-1], plus a little noise on the output */
+  constexpr size_t n_frames = 64*SEGMENT;
+  std::vector<float> x(n_frames), y(n_frames);
+  for (size_t i = 0; i < n_frames; ++i) {
+    x[i] = input(gen);
+    y[i] = 0.5f*x[i] + (i ? 0.25f*x[i-1] : 0.0f) + noise(gen);
+  }
+
+  e.add(x, y, 1000);
+
+  /* 50% overlap, so one less than twice as many segments as fit end to end */
+  REQUIRE(xspec_n_segments(e) == 2*n_frames/SEGMENT - 1);
+  REQUIRE(xspec_first_frame(e) == 1000);
+
+  size_t n_bins = xspec_n_bins(e);
+  REQUIRE(n_bins == SEGMENT/2+1);
+
+  std::vector<float> re(n_bins), im(n_bins), coh(n_bins);
+  xspec_estimate(e, 0, n_bins, re.data(), im.data(), coh.data());
+
+  for (size_t k = 0; k < n_bins; ++k) {
+    std::complex<double> expected = 0.5 + 0.25*std::polar(1.0, -2*M_PI*k/SEGMENT);
+    REQUIRE(re[k] == Approx(expected.real()).margin(0.02));
+    REQUIRE(im[k] == Approx(expected.imag()).margin(0.02));
+    REQUIRE(coh[k] > 0.9);
+  }
+
+  /* slices line up with the whole */
+  std::vector<float> re2(10), im2(10), coh2(10);
+  xspec_estimate(e, 50, 10, re2.data(), im2.data(), coh2.data());
+  for (size_t k = 0; k < 10; ++k) {
+    REQUIRE(re2[k]  == re[50+k]);
+    REQUIRE(coh2[k] == coh[50+k]);
+  }
+}
+
+TEST_CASE("unrelated output has low coherence", "[xspec]")
+{
+  estimator e;
+
+  std::mt19937                    gen(4321);
+  std::normal_distribution<float> dist(0.0, 1.0);
+
+  constexpr size_t n_frames = 64*SEGMENT;
+  std::vector<float> x(n_frames), y(n_frames);
+  for (size_t i = 0; i < n_frames; ++i) {
+    x[i] = dist(gen);
+    y[i] = dist(gen);
+  }
+
+  e.add(x, y, 0);
+
+  size_t n_bins = xspec_n_bins(e);
+  std::vector<float> re(n_bins), im(n_bins), coh(n_bins);
+  xspec_estimate(e, 0, n_bins, re.data(), im.data(), coh.data());
+
+  /* expected coherence of independent noise is roughly 1/segments */
+  double mean = 0;
+  for (size_t k = 0; k < n_bins; ++k) mean += coh[k];
+  mean /= n_bins;
+  REQUIRE(mean < 0.05);
+}
+
+TEST_CASE("segments never span a gap", "[xspec]")
+{
+  estimator e;
+
+  std::vector<float> x(SEGMENT, 1.0f), y(SEGMENT, 1.0f);
+
+  /* half a segment, then skip ahead, then exactly one segment */
+  xspec_add(e, 0, x.data(), y.data(), SEGMENT/2);
+  REQUIRE(xspec_n_segments(e) == 0);
+
+  xspec_add(e, 10*SEGMENT, x.data(), y.data(), SEGMENT);
+  REQUIRE(xspec_n_segments(e) == 1);
+  REQUIRE(xspec_first_frame(e) == 10*SEGMENT);
+
+  /* reset keeps the overlap, so another hop completes a segment */
+  xspec_reset(e);
+  REQUIRE(xspec_n_segments(e) == 0);
+  xspec_add(e, 11*SEGMENT, x.data(), y.data(), SEGMENT/2);
+  REQUIRE(xspec_n_segments(e) == 1);
+  REQUIRE(xspec_first_frame(e) == 10*SEGMENT + SEGMENT/2);
+}
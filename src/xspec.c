@@ -0,0 +1,252 @@
+#include "xspec.h"
+
+#include "common.h"
+#include "err.h"
+#include "rfft.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+struct xspec {
+  size_t    segment;
+  size_t    hop;          /* frames between segment starts */
+  size_t    n_bins;
+  size_t    fill;         /* frames of the current segment collected so far */
+  size_t    n_segments;
+  uint64_t  first_frame;  /* start of the first segment since reset */
+  uint64_t  next_frame;   /* frame the next xspec_add should start at */
+  bool      have_frame;   /* false until the first xspec_add */
+
+  /* Pointers into the trailing memory */
+  rfft_t*   x_fft;
+  rfft_t*   y_fft;
+  float*    window;       /* segment */
+  float*    x;            /* segment, input history */
+  float*    y;            /* segment, output history */
+  double*   sxx;          /* n_bins */
+  double*   syy;          /* n_bins */
+  double*   sxy;          /* 2*n_bins, interleaved real/imag */
+};
+
+static size_t
+x_fft_offset(void)
+{
+  return ALIGN(sizeof(xspec_t), rfft_align());
+}
+
+static size_t
+y_fft_offset(size_t segment)
+{
+  return ALIGN(x_fft_offset() + rfft_footprint(segment), rfft_align());
+}
+
+static size_t
+window_offset(size_t segment)
+{
+  return ALIGN(y_fft_offset(segment) + rfft_footprint(segment), CACHELINE);
+}
+
+static size_t
+history_offset(size_t segment)
+{
+  return ALIGN(window_offset(segment) + segment*sizeof(float), CACHELINE);
+}
+
+static size_t
+spectra_offset(size_t segment)
+{
+  return ALIGN(history_offset(segment) + 2*segment*sizeof(float), CACHELINE);
+}
+
+size_t
+xspec_footprint(size_t segment)
+{
+  size_t n_bins = segment/2+1;
+  return spectra_offset(segment) + 4*n_bins*sizeof(double);
+}
+
+size_t
+xspec_align(void)
+{
+  return MAX(_Alignof(xspec_t), rfft_align());
+}
+
+xspec_t*
+create_xspec(void*  mem,
+             size_t segment,
+             int*   opt_err)
+{
+  if (!mem || segment < 2 || segment % 2 || (size_t)mem % xspec_align()) {
+    if (opt_err) *opt_err = APP_ERR_INVAL;
+    return NULL;
+  }
+
+  char*   base  = (char*)mem;
+  rfft_t* x_fft = create_rfft(base + x_fft_offset(), segment, RFFT_FORWARD, opt_err);
+  if (!x_fft) return NULL; /* opt_err already set */
+
+  rfft_t* y_fft = create_rfft(base + y_fft_offset(segment), segment, RFFT_FORWARD, opt_err);
+  if (!y_fft) {
+    destroy_rfft(x_fft);
+    return NULL; /* opt_err already set */
+  }
+
+  xspec_t* xs    = (xspec_t*)mem;
+  xs->segment    = segment;
+  xs->hop        = segment/2;
+  xs->n_bins     = segment/2+1;
+  xs->fill       = 0;
+  xs->have_frame = false;
+  xs->next_frame = 0;
+  xs->x_fft      = x_fft;
+  xs->y_fft      = y_fft;
+  xs->window     = (float*)((char*)mem + window_offset(segment));
+  xs->x          = (float*)((char*)mem + history_offset(segment));
+  xs->y          = xs->x + segment;
+  xs->sxx        = (double*)((char*)mem + spectra_offset(segment));
+  xs->syy        = xs->sxx + xs->n_bins;
+  xs->sxy        = xs->syy + xs->n_bins;
+
+  /* periodic hann, sums to a constant at 50% overlap */
+  for (size_t i = 0; i < segment; ++i) {
+    xs->window[i] = (float)(0.5 - 0.5*cos(2.0*M_PI*(double)i/(double)segment));
+  }
+
+  memset(xs->x, 0, 2*segment*sizeof(float));
+  xspec_reset(xs);
+
+  if (opt_err) *opt_err = APP_SUCCESS;
+  return xs;
+}
+
+void*
+destroy_xspec(xspec_t* xs)
+{
+  if (!xs) return NULL;
+  destroy_rfft(xs->y_fft);
+  destroy_rfft(xs->x_fft);
+  return (void*)xs;
+}
+
+size_t
+xspec_segment(xspec_t const* xs)
+{
+  return xs->segment;
+}
+
+size_t
+xspec_n_bins(xspec_t const* xs)
+{
+  return xs->n_bins;
+}
+
+size_t
+xspec_n_segments(xspec_t const* xs)
+{
+  return xs->n_segments;
+}
+
+uint64_t
+xspec_first_frame(xspec_t const* xs)
+{
+  return xs->first_frame;
+}
+
+/* Transform the full history and add it to the spectra */
+
+static void
+accumulate(xspec_t* xs)
+{
+  float* xin = rfft_in(xs->x_fft);
+  float* yin = rfft_in(xs->y_fft);
+  for (size_t i = 0; i < xs->segment; ++i) {
+    xin[i] = xs->x[i]*xs->window[i];
+    yin[i] = xs->y[i]*xs->window[i];
+  }
+
+  rfft_execute(xs->x_fft);
+  rfft_execute(xs->y_fft);
+
+  fftwf_complex const* X = rfft_out(xs->x_fft);
+  fftwf_complex const* Y = rfft_out(xs->y_fft);
+  for (size_t k = 0; k < xs->n_bins; ++k) {
+    double xr = crealf(X[k]), xi = cimagf(X[k]);
+    double yr = crealf(Y[k]), yi = cimagf(Y[k]);
+
+    /* conj(X)*Y */
+    xs->sxx[k]     += xr*xr + xi*xi;
+    xs->syy[k]     += yr*yr + yi*yi;
+    xs->sxy[2*k]   += xr*yr + xi*yi;
+    xs->sxy[2*k+1] += xr*yi - xi*yr;
+  }
+}
+
+void
+xspec_add(xspec_t*     xs,
+          uint64_t     frame,
+          float const* x,
+          float const* y,
+          size_t       n)
+{
+  if (xs->have_frame && frame != xs->next_frame) xs->fill = 0;
+  xs->have_frame = true;
+  xs->next_frame = frame + n;
+
+  size_t i = 0;
+  while (i < n) {
+    size_t take = MIN(n - i, xs->segment - xs->fill);
+    memcpy(xs->x + xs->fill, x + i, take*sizeof(float));
+    memcpy(xs->y + xs->fill, y + i, take*sizeof(float));
+    xs->fill += take;
+    i        += take;
+
+    if (xs->fill < xs->segment) break;
+
+    if (xs->n_segments == 0) xs->first_frame = frame + i - xs->segment;
+    accumulate(xs);
+    xs->n_segments += 1;
+
+    /* slide by a hop, keeping the overlap */
+    size_t keep = xs->segment - xs->hop;
+    memmove(xs->x, xs->x + xs->hop, keep*sizeof(float));
+    memmove(xs->y, xs->y + xs->hop, keep*sizeof(float));
+    xs->fill = keep;
+  }
+}
+
+void
+xspec_estimate(xspec_t const* xs,
+               size_t         first_bin,
+               size_t         n,
+               float*         h_real,
+               float*         h_imag,
+               float*         coherence)
+{
+  for (size_t k = first_bin; k < MIN(first_bin + n, xs->n_bins); ++k) {
+    double sxx = xs->sxx[k];
+    double syy = xs->syy[k];
+    double re  = xs->sxy[2*k];
+    double im  = xs->sxy[2*k+1];
+
+    size_t j = k - first_bin;
+    if (sxx > 0.0 && syy > 0.0) {
+      h_real[j]    = (float)(re/sxx);
+      h_imag[j]    = (float)(im/sxx);
+      coherence[j] = (float)((re*re + im*im)/(sxx*syy));
+    }
+    else {
+      h_real[j]    = 0.0f;
+      h_imag[j]    = 0.0f;
+      coherence[j] = 0.0f;
+    }
+  }
+}
+
+void
+xspec_reset(xspec_t* xs)
+{
+  memset(xs->sxx, 0, 4*xs->n_bins*sizeof(double));
+  xs->n_segments  = 0;
+  xs->first_frame = 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Cross-spectral (H1) transfer function estimator.
+
+   Welch's method: input `x` and output `y` are cut into Hann windowed segments
+   overlapping by half, and the auto spectra Sxx, Syy and the cross spectrum Sxy
+   are summed over every segment since the last reset. From those,
+
+     H1        = Sxy/Sxx
+     coherence = |Sxy|^2/(Sxx*Syy)
+
+   H1 is unbiased by noise on the output. Coherence says how much of the output
+   at each bin is explained by the input (1 is all of it, 0 is none), which is
+   the thing to look at before trusting H1 at a bin where the input has little
+   energy.
+
+   Uses two rfft_t, so the same planning caveats apply: create before starting
+   any threads. */
+
+typedef struct xspec xspec_t;
+
+size_t
+xspec_footprint(size_t segment);
+
+size_t
+xspec_align(void);
+
+xspec_t*
+create_xspec(void*  mem,
+             size_t segment,
+             int*   opt_err);
+
+void*
+destroy_xspec(xspec_t* xs);
+
+size_t
+xspec_segment(xspec_t const* xs);
+
+size_t
+xspec_n_bins(xspec_t const* xs);
+
+/* Number of segments accumulated since the last reset, and the frame the first
+   one started at */
+
+size_t
+xspec_n_segments(xspec_t const* xs);
+
+uint64_t
+xspec_first_frame(xspec_t const* xs);
+
+/* Add `n` frames of input and output, the first of which is at `frame`. If
+   `frame` doesn't follow on from the last call, the partial segment collected
+   so far is thrown away, segments never span a gap. */
+
+void
+xspec_add(xspec_t*     xs,
+          uint64_t     frame,
+          float const* x,
+          float const* y,
+          size_t       n);
+
+/* Write H1 (real and imaginary parts) and coherence for bins
+   [first_bin, first_bin+n). Bins where either spectrum is empty read zero. */
+
+void
+xspec_estimate(xspec_t const* xs,
+               size_t         first_bin,
+               size_t         n,
+               float*         h_real,
+               float*         h_imag,
+               float*         coherence);
+
+/* Start a new averaging interval. The partial segment carries over. */
+
+void
+xspec_reset(xspec_t* xs);
@@ -1,49 +1,435 @@
 import struct
 import array
+import glob
+import sys
 import numpy as np
 from matplotlib import pyplot as plt
 
 float_size  = 4
 size_t_size = 8
 
-square    = np.array([], dtype=np.float32)
-pulse     = np.array([], dtype=np.float32)
-lxd_in    = np.array([], dtype=np.float32)
-fft_taken = []
+# record types, see disk.h
+RECORD_SAMPLE_SET = 1
+RECORD_HARMONICS  = 2
+RECORD_LOCKIN     = 3
+RECORD_STRIKE     = 4
+RECORD_STRIKE_FIT = 5
+RECORD_SYNC_AVG   = 6
+RECORD_TRANSFER   = 7
+RECORD_LATENCY    = 8
+RECORD_XRUN       = 9
+RECORD_REDUCED    = 10
+RECORD_GAP        = 11
+RECORD_CHUNK      = 12
+RECORD_FFT        = 13
+RECORD_INDEX      = 14
+
+REDUCED_SQUARE = 1
+REDUCED_PULSE  = 2
+REDUCED_LXD_IN = 4
+
+record_hdr_size = 4 + 4 + 8
+
+# chunk layouts and column encodings, see disk.h
+CHUNK_RAW         = 0
+CHUNK_PACKED      = 1
+COLUMN_FLOAT32    = 0
+COLUMN_XOR_PLANES = 1
+COLUMN_SYNTH      = 2
+COLUMN_INT16      = 3
+COLUMN_INT24      = 4
+column_hdr_fmt    = '=IIQ'
+chunk_fmt         = '=IIQIIIIIIII' # record_hdr, then the chunk's own fields
+CHUNK_SYNC        = 0x4b4e4843
+chunk_size        = struct.calcsize(chunk_fmt)
+chunk_sync_offset = 32
+chunk_crc_offset  = 40
+quant_hdr_fmt     = '=fI'
+
+# file header, see disk.h
+FILE_MAGIC          = 0x3144584c
+FILE_LENGTH_UNKNOWN = 2**64 - 1
+file_hdr_fmt        = '=IIIIQQIQ'
+FILE_META_OFFSET    = 64
+capture_meta_fmt    = '=QQIIIffIII'
+CAPTURE_NAME_SIZE   = 16
+
+# CRC32C a byte at a time, see crc32c.h
+crc32c_table = []
+for b in range(256):
+    c = b
+    for k in range(8):
+        c = (c >> 1) ^ 0x82f63b78 if c & 1 else c >> 1
+    crc32c_table.append(c)
 
-with open('/scratch/data_out', 'rb') as f:
-    i = 0
+def crc32c(crc, buf):
+    crc ^= 0xffffffff
+    for b in buf:
+        crc = crc32c_table[(crc ^ b) & 0xff] ^ (crc >> 8)
+    return crc ^ 0xffffffff
+
+def chunk_ok(data, pos, end):
+    """ a version 3 chunk at pos that fits before end and passes its crc """
+    if end - pos < chunk_size:
+        return False
+    (rtype, size, _, _, _, data_offset, _, sync, _, crc, _) = \
+        struct.unpack_from(chunk_fmt, data, pos)
+    if rtype != RECORD_CHUNK or sync != CHUNK_SYNC or size > end - pos:
+        return False
+    if data_offset < chunk_size or data_offset > size:
+        return False
+    at = pos + chunk_crc_offset
+    return crc32c(crc32c(0, data[pos:at]), data[at + 4:pos + size]) == crc
+
+def resync(data, start, end):
+    """ offset of the first good chunk from start on, end if there is none """
+    sync = struct.pack('=I', CHUNK_SYNC)
     while True:
-        header_bytes = f.read(2*size_t_size)
-        if not header_bytes: break
+        p = data.find(sync, start + chunk_sync_offset, end)
+        if p < 0:
+            return end
+        if chunk_ok(data, p - chunk_sync_offset, end):
+            return p - chunk_sync_offset
+        start = p - chunk_sync_offset + 1
+
+def read_file_hdr(path):
+    with open(path, 'rb') as f:
+        hdr = struct.unpack(file_hdr_fmt, f.read(struct.calcsize(file_hdr_fmt)))
+    if hdr[0] != FILE_MAGIC:
+        raise ValueError('%s is not an lxd data file' % path)
+    return hdr
+
+# bit j of a byte -> bit 8j, for unpacking bit planes
+spread = [sum(((m >> j) & 1) << (8*j) for j in range(8)) for m in range(256)]
+
+def unpack_column(buf, n):
+    """ COLUMN_XOR_PLANES, see column_codec.h """
+    out  = array.array('I')
+    pos  = 0
+    prev = 0
+    for g in range((n + 31)//32):
+        group = bytearray(128)
+        for b in range(4):
+            w = buf[pos]
+            pos += 1
+            plane = 0
+            for k in range(w):
+                for q in range(4):
+                    plane |= spread[buf[pos + q]] << (64*q + k)
+                pos += 4
+            group[b::4] = plane.to_bytes(32, 'little')
+        for x in array.array('I', bytes(group)):
+            prev ^= x
+            out.append(prev)
+    return np.frombuffer(out[0:n].tobytes(), dtype=np.float32)
+
+class Synth(object):
+    """ COLUMN_SYNTH columns, made again by the generators in build/liblxd.so
+        so they come out the same as when they were written, see
+        capture_synth.h. Only loads the library if a file needs it. """
+    def __init__(self, meta_bytes):
+        from lib import libc, lxd # next to this file
+        import ctypes
+        self._ctypes = ctypes
+        self._lxd    = lxd
+        self._free   = libc.free
+        self._mem    = libc.malloc(lxd.capture_synth_footprint())
+        if not self._mem:
+            raise RuntimeError('Failed to allocate memory')
+        self._impl = lxd.create_capture_synth(self._mem, meta_bytes, None)
+        if not self._impl:
+            raise ValueError('the generators in this file can not be run')
+
+    def __del__(self):
+        if getattr(self, '_impl', None):
+            self._lxd.destroy_capture_synth(self._impl)
+        if getattr(self, '_mem', None):
+            self._free(self._mem)
+
+    def column(self, channel, state, n):
+        out = np.empty(n, dtype=np.float32)
+        ret = self._lxd.capture_synth_column(self._impl, channel, bytes(state), len(state), n,
+                                             out.ctypes.data_as(self._ctypes.POINTER(self._ctypes.c_float)))
+        if ret != 0:
+            raise ValueError('bad synthesized column')
+        return out
+
+synth = None
+
+def dequant_column(buf, n, width):
+    """ COLUMN_INT16 and COLUMN_INT24, see column_quant.h """
+    (scale, _) = struct.unpack_from(quant_hdr_fmt, buf)
+    start = struct.calcsize(quant_hdr_fmt)
+    if width == 2:
+        q = np.frombuffer(buf, dtype='<i2', count=n, offset=start).astype(np.int32)
+    else:
+        b = np.frombuffer(buf, dtype=np.uint8, count=3*n, offset=start).reshape(n, 3).astype(np.int32)
+        q = ((b[:, 0] | b[:, 1] << 8 | b[:, 2] << 16) << 8) >> 8
+    return q.astype(np.float32)*np.float32(scale)
+
+def chunk_columns(body, n_frames, n_channels, data_offset, layout):
+    """ each channel's samples from a RECORD_CHUNK body """
+    global synth
+    start = data_offset - record_hdr_size
+    if layout == CHUNK_RAW:
+        floats = np.frombuffer(body, dtype=np.float32, count=n_channels*n_frames, offset=start)
+        return [floats[c*n_frames:(c+1)*n_frames] for c in range(n_channels)]
+
+    hdrs = [struct.unpack_from(column_hdr_fmt, body, start + c*struct.calcsize(column_hdr_fmt))
+            for c in range(n_channels)]
+    pos  = start + n_channels*struct.calcsize(column_hdr_fmt)
+    cols = []
+    for (c, (encoding, nbytes, _)) in enumerate(hdrs):
+        if encoding == COLUMN_FLOAT32:
+            cols.append(np.frombuffer(body, dtype=np.float32, count=n_frames, offset=pos))
+        elif encoding == COLUMN_SYNTH:
+            if synth is None: synth = Synth(read_meta_bytes(paths[0]))
+            cols.append(synth.column(c, body[pos:pos + nbytes], n_frames))
+        elif encoding in (COLUMN_INT16, COLUMN_INT24):
+            width = 2 if encoding == COLUMN_INT16 else 3
+            cols.append(dequant_column(body[pos:pos + nbytes], n_frames, width))
+        else:
+            cols.append(unpack_column(body[pos:pos + nbytes], n_frames))
+        pos += nbytes
+    return cols
+
+def read_meta_bytes(path):
+    """ capture_meta as it is in the file, see disk.h """
+    with open(path, 'rb') as f:
+        f.seek(FILE_META_OFFSET)
+        return f.read(struct.calcsize(capture_meta_fmt) + 8*CAPTURE_NAME_SIZE)
+
+def read_meta(path):
+    """ capture_meta as a dict, see disk.h """
+    raw = read_meta_bytes(path)
+    fields = ('sample_rate_hz', 'strike_period_ns', 'fft_size', 'chunk_frames', 'envelope_type',
+              'envelope_param', 'drive_frequency_hz', 'harmonic_count', 'n_channels', 'reserved')
+    meta = dict(zip(fields, struct.unpack_from(capture_meta_fmt, raw)))
+    names = raw[struct.calcsize(capture_meta_fmt):]
+    meta['channels'] = [names[i*CAPTURE_NAME_SIZE:(i+1)*CAPTURE_NAME_SIZE].rstrip(b'\0').decode()
+                        for i in range(meta['n_channels'])]
+    return meta
+
+def segments(paths):
+    """ Segments of one run in order, the latest run if there are several """
+    hdrs = [(read_file_hdr(p), p) for p in paths]
+    session = max(h[5] for (h, p) in hdrs)
+    run = sorted((h[6], p) for (h, p) in hdrs if h[5] == session)
+    for (i, (segment, p)) in enumerate(run):
+        if segment != i:
+            print('segment %d is missing, data jumps here' % i)
+    return [p for (segment, p) in run]
+
+def records(paths):
+    """ (type, size, frame, body) of every record, across segments.
+
+        Since version 3 a record that can't be right, or a chunk that fails
+        its crc, means the file is damaged there. Nothing after the last good
+        chunk can be trusted, so look from there for the next chunk that
+        checks out and carry on from it. Chunks' sequence numbers say how
+        many were lost. """
+    last_seq = None
+    for path in paths:
+        with open(path, 'rb') as f:
+            data = f.read()
+        (magic, version, hdr_size, flags, length, session, segment, index) = \
+            struct.unpack_from(file_hdr_fmt, data)
+        end = len(data)
+        if length == FILE_LENGTH_UNKNOWN:
+            print('%s was not closed cleanly, reading what is there' % path)
+        elif hdr_size + length <= end:
+            end = hdr_size + length
+
+        pos  = hdr_size
+        good = hdr_size # just past the last good chunk
+        done = hdr_size # just past the last record handed out
+        while pos < end:
+            ok = end - pos >= record_hdr_size
+            if ok:
+                (rtype, size, frame) = struct.unpack_from('=IIQ', data, pos)
+                ok = record_hdr_size <= size <= end - pos
+            if ok and rtype == RECORD_CHUNK and version >= 3:
+                ok = chunk_ok(data, pos, end)
+            if not ok:
+                if version < 3: break # zero padding after the last record, or worse
+                found = resync(data, good, end)
+                if any(data[pos:found]): # more than the zeros after the last record
+                    print('%s is damaged at %d, carrying on from %d' % (path, pos, found))
+                pos = found
+                continue
 
-        (n_samples, fft_bins) = struct.unpack('NN', header_bytes)
-        print( (n_samples, fft_bins) )
+            # a walk from a resync can cover records handed out already, but
+            # not chunks, those move `good` on
+            if pos >= done or rtype == RECORD_CHUNK:
+                if rtype == RECORD_CHUNK and version >= 3:
+                    seq = struct.unpack_from(chunk_fmt, data, pos)[8]
+                    if last_seq is not None and seq != last_seq + 1:
+                        print('chunks %d to %d are missing' % (last_seq + 1, seq - 1))
+                    last_seq = seq
+                yield (rtype, size, frame, data[pos + record_hdr_size:pos + size])
+                done = pos + size
+            pos += size
+            if rtype == RECORD_CHUNK: good = pos
 
-        float_array = array.array('f')
-        float_array.fromfile(f, n_samples)
-        square = np.concatenate( (square, float_array) )
+paths = segments(sys.argv[1:] or glob.glob('/scratch/data_out-*.lxd'))
+print(read_meta(paths[0]))
 
-        float_array = array.array('f')
-        float_array.fromfile(f, n_samples)
-        pulse = np.concatenate( (pulse, float_array) )
+# chunks are written as they fill, after the other records for their frames,
+# so samples are collected as (frame, square, pulse, lxd_in) and sorted after
+pieces    = []
+fft_taken = []
+harmonics = [] # (frame, amplitudes, phases)
+lockin_t  = np.array([], dtype=np.uint64)
+lockin_a  = np.array([], dtype=np.float32)
+lockin_p  = np.array([], dtype=np.float32)
+strikes   = []
+fits      = [] # (strike frame, baseline, amplitude, tau_rise_s, tau_fall_s, rms_residual)
+averages  = {} # first strike frame -> (n_strikes, averaged lxd_in)
+transfers = {} # first frame -> (n_segments, H1, coherence)
+latencies = [] # (strike frame, delay, peak, median)
+xruns     = [] # first frame after each discontinuity
+gaps      = [] # (frame, shed level, records dropped)
+
+for (rtype, size, frame, body) in records(paths):
+    if rtype == RECORD_SAMPLE_SET: # version 1 files
+        (n_samples, fft_bins) = struct.unpack_from('NN', body)
+        print( (frame, n_samples, fft_bins) )
+
+        floats = np.frombuffer(body, dtype=np.float32, offset=2*size_t_size)
+        pieces.append( (frame, floats[0:n_samples], floats[n_samples:2*n_samples],
+                        floats[2*n_samples:3*n_samples]) )
+
+        if fft_bins:
+            fft_taken.append(frame)
+
+    elif rtype == RECORD_CHUNK:
+        (n_frames, n_channels, data_offset, layout) = struct.unpack_from('IIII', body)
+        print( (frame, n_frames, 'chunk') )
+
+        cols = chunk_columns(body, n_frames, n_channels, data_offset, layout)
+        pieces.append( (frame, cols[0], cols[1], cols[2]) )
+
+    elif rtype == RECORD_FFT:
+        fft_taken.append(frame)
+
+    elif rtype == RECORD_HARMONICS:
+        (n_bins, window, fundamental, _) = struct.unpack_from('IIfI', body)
+        floats = np.frombuffer(body, dtype=np.float32, offset=16)
+        harmonics.append( (frame, floats[0:n_bins], floats[n_bins:2*n_bins]) )
+
+    elif rtype == RECORD_LOCKIN:
+        (n_points, decimation) = struct.unpack_from('II', body)
+        floats = np.frombuffer(body, dtype=np.float32, offset=8)
+        frames = frame + decimation*np.arange(n_points, dtype=np.uint64)
+        lockin_t = np.concatenate( (lockin_t, frames) )
+        lockin_a = np.concatenate( (lockin_a, floats[0:n_points]) )
+        lockin_p = np.concatenate( (lockin_p, floats[n_points:2*n_points]) )
+
+    elif rtype == RECORD_STRIKE:
+        strikes.append(frame)
+
+    elif rtype == RECORD_STRIKE_FIT:
+        fit = struct.unpack_from('fffffIII', body)
+        print('strike at %d: tau_rise=%f tau_fall=%f converged=%d' % (frame, fit[2], fit[3], fit[7]))
+        fits.append( (frame,) + fit[0:5] )
 
-        float_array = array.array('f')
-        float_array.fromfile(f, n_samples)
-        lxd_in = np.concatenate( (lxd_in, float_array) )
+    elif rtype == RECORD_SYNC_AVG:
+        (n_strikes, window, offset, n_points) = struct.unpack_from('IIII', body)
+        floats = np.frombuffer(body, dtype=np.float32, offset=16)
+        if frame not in averages:
+            averages[frame] = (n_strikes, np.zeros(window, dtype=np.float32))
+        averages[frame][1][offset:offset+n_points] = floats[0:n_points]
+
+    elif rtype == RECORD_TRANSFER:
+        (n_segments, segment, first_bin, n_bins) = struct.unpack_from('IIII', body)
+        floats = np.frombuffer(body, dtype=np.float32, offset=16)
+        if frame not in transfers:
+            transfers[frame] = (n_segments,
+                                np.zeros(segment//2+1, dtype=np.complex64),
+                                np.zeros(segment//2+1, dtype=np.float32))
+        h = floats[0:n_bins] + 1j*floats[n_bins:2*n_bins]
+        transfers[frame][1][first_bin:first_bin+n_bins] = h
+        transfers[frame][2][first_bin:first_bin+n_bins] = floats[2*n_bins:3*n_bins]
+
+    elif rtype == RECORD_LATENCY:
+        (delay, peak, median, n_median) = struct.unpack_from('fffI', body)
+        print('strike at %d: latency=%f frames (median of %d %f) peak=%f' % (frame, delay, n_median, median, peak))
+        latencies.append( (frame, delay, peak, median) )
+
+    elif rtype == RECORD_XRUN:
+        (time_ns, n_new, n_total) = struct.unpack_from('QII', body)
+        print('xrun before frame %d: %d new, %d total' % (frame, n_new, n_total))
+        xruns.append(frame)
+
+    elif rtype == RECORD_REDUCED:
+        (channels, decimation, n_frames, fft_bins) = struct.unpack_from('IIII', body)
+        n_samples = (n_frames + decimation - 1)//decimation
+        floats = np.frombuffer(body, dtype=np.float32, offset=16)
+
+        # hold each decimated sample for the frames it covers, NaN for missing channels
+        present = 0
+        held    = []
+        for bit in (REDUCED_SQUARE, REDUCED_PULSE, REDUCED_LXD_IN):
+            if channels & bit:
+                held.append(np.repeat(floats[present*n_samples:(present+1)*n_samples], decimation)[0:n_frames])
+                present += 1
+            else:
+                held.append(np.full(n_frames, np.nan, dtype=np.float32))
+        pieces.append( (frame,) + tuple(held) )
 
         if fft_bins:
-            float_array = array.array('f')
-            float_array.fromfile(f, fft_bins)
+            fft_taken.append(frame)
+
+    elif rtype == RECORD_GAP:
+        (level, n_dropped, n_dropped_total) = struct.unpack_from('IIQ', body)
+        print('from frame %d: shed level %d, %d records dropped (%d total)' % (frame, level, n_dropped, n_dropped_total))
+        gaps.append( (frame, level, n_dropped) )
 
-            fft_taken.append(i)
+    # skip anything we don't know about, and the index
 
-        i += n_samples
+pieces.sort(key=lambda p: p[0])
+square = np.concatenate([np.array([], dtype=np.float32)] + [p[1] for p in pieces])
+pulse  = np.concatenate([np.array([], dtype=np.float32)] + [p[2] for p in pieces])
+lxd_in = np.concatenate([np.array([], dtype=np.float32)] + [p[3] for p in pieces])
 
 for loc in fft_taken:
     plt.axvline(loc, color='r')
 
+for loc in strikes:
+    plt.axvline(loc, color='g')
+
+for loc in xruns:
+    plt.axvline(loc, color='k', linestyle='--')
+
+for (loc, level, n_dropped) in gaps:
+    plt.axvline(loc, color='m', linestyle=':')
+
 #plt.plot(square)
 plt.plot(lxd_in)
 plt.plot(pulse)
+plt.plot(lockin_t, lockin_a)
 plt.show()
+
+for (first, (n_strikes, avg)) in sorted(averages.items()):
+    plt.plot(avg, label='%d strikes from %d' % (n_strikes, first))
+if averages:
+    plt.legend()
+    plt.show()
+
+if transfers:
+    (fig, (mag, coh)) = plt.subplots(2, 1, sharex=True)
+    for (first, (n_segments, h, c)) in sorted(transfers.items()):
+        mag.plot(20*np.log10(np.abs(h) + 1e-12))
+        coh.plot(c)
+    mag.set_ylabel('|H1| dB')
+    coh.set_ylabel('coherence')
+    coh.set_xlabel('bin')
+    plt.show()
+
+if latencies:
+    frames = [l[0] for l in latencies]
+    plt.plot(frames, [l[1] for l in latencies], '.', label='per strike')
+    plt.plot(frames, [l[3] for l in latencies], label='rolling median')
+    plt.ylabel('latency (frames)')
+    plt.legend()
+    plt.show()
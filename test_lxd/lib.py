@@ -27,6 +27,12 @@ lxd.destroy_additive_square.restype  = c_void_p
 lxd.additive_square_generate_samples.argtypes = [c_void_p, c_size_t, c_float, POINTER(c_float)]
 lxd.additive_square_generate_samples.restype  = c_int
 
+lxd.additive_square_phase.argtypes = [c_void_p]
+lxd.additive_square_phase.restype  = c_float
+
+lxd.additive_square_set_phase.argtypes = [c_void_p, c_float]
+lxd.additive_square_set_phase.restype  = None
+
 class envelope_setting(Structure):
     # hack alert! all the structs in the union are currently the same, so this
     # will *probably* work
@@ -56,3 +62,22 @@ lxd.envelope_change_setting.restype = c_int
 
 lxd.envelope_generate_samples.argtypes = [c_void_p, c_size_t, POINTER(c_float)]
 lxd.envelope_generate_samples.restype  = c_int
+
+lxd.envelope_position.argtypes = [c_void_p]
+lxd.envelope_position.restype  = c_uint32
+
+lxd.envelope_set_position.argtypes = [c_void_p, c_uint32]
+lxd.envelope_set_position.restype  = c_int
+
+# capture_meta is passed as the bytes read from the file
+lxd.capture_synth_footprint.argtypes = []
+lxd.capture_synth_footprint.restype  = c_size_t
+
+lxd.create_capture_synth.argtypes = [c_void_p, c_char_p, POINTER(c_int)]
+lxd.create_capture_synth.restype  = c_void_p
+
+lxd.destroy_capture_synth.argtypes = [c_void_p]
+lxd.destroy_capture_synth.restype  = c_void_p
+
+lxd.capture_synth_column.argtypes = [c_void_p, c_size_t, c_char_p, c_size_t, c_size_t, POINTER(c_float)]
+lxd.capture_synth_column.restype  = c_int